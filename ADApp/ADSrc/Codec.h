@@ -6,7 +6,8 @@ static std::string codecName[] = {
     "jpeg",
     "blosc",
     "lz4",
-    "bslz4"
+    "bslz4",
+    "zstd"
 };
 
 typedef enum {
@@ -14,7 +15,8 @@ typedef enum {
   NDCODEC_JPEG,
   NDCODEC_BLOSC,
   NDCODEC_LZ4,
-  NDCODEC_BSLZ4
+  NDCODEC_BSLZ4,
+  NDCODEC_ZSTD
 } NDCodecCompressor_t;
 
 typedef struct Codec_t {
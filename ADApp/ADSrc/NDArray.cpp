@@ -26,7 +26,7 @@
 NDArray::NDArray()
   : referenceCount(0), pNDArrayPool(0), pDriver(0),
     uniqueId(0), timeStamp(0.0), ndims(0), dataType(NDInt8),
-    dataSize(0),  pData(0)
+    dataSize(0),  pData(0), pBufferOwner(0)
 {
   this->epicsTS.secPastEpoch = 0;
   this->epicsTS.nsec = 0;
@@ -38,7 +38,7 @@ NDArray::NDArray()
 NDArray::NDArray(int nDims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData)
   : referenceCount(0), pNDArrayPool(0), pDriver(0),
     uniqueId(0), timeStamp(0.0), ndims(nDims), dataType(dataType),
-    dataSize(dataSize),  pData(0)
+    dataSize(dataSize),  pData(0), pBufferOwner(0)
 {
   static const char *functionName = "NDArray::NDArray";
   this->epicsTS.secPastEpoch = 0;
@@ -73,7 +73,8 @@ NDArray::NDArray(int nDims, size_t *dims, NDDataType_t dataType, size_t dataSize
   * Frees the data array, deletes all attributes, frees the attribute list and destroys the mutex. */
 NDArray::~NDArray()
 {
-  if (this->pData) free(this->pData);
+  if (this->pBufferOwner) this->pBufferOwner->releaseBuffer(this->pData);
+  else if (this->pData) free(this->pData);
   delete this->pAttributeList;
 }
 
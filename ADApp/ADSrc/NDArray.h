@@ -88,6 +88,49 @@ typedef struct NDArrayInfo {
     size_t colorStride;     /**< The number of array elements between color values */
 } NDArrayInfo_t;
 
+/** Interface for objects that own the data buffer of an NDArray when that buffer was not allocated by
+  * the NDArrayPool, for example the value buffer of an NTNDArray received over pvAccess.
+  * NDArrayPool::alloc() borrows such a buffer rather than taking ownership of it, and calls releaseBuffer()
+  * instead of free() when the last reference to the NDArray is released.
+  * releaseBuffer() is called with the pool's lock held, so it must not block. */
+class ADCORE_API NDArrayBufferOwner {
+public:
+    virtual ~NDArrayBufferOwner() {}
+    /** Called exactly once when the NDArray no longer references the buffer; the owner may delete itself.
+      * \param[in] pData The buffer that was passed to NDArrayPool::alloc(). */
+    virtual void releaseBuffer(void *pData) = 0;
+};
+
+/** Enumeration of priority classes used by NDArrayPool to decide which consumers give up queued arrays
+  * when it runs out of memory.  Threads that have not declared a class, e.g. detector driver threads,
+  * are NDPriorityCritical. */
+typedef enum {
+    NDPriorityLow,          /**< Consumers whose arrays are expendable, e.g. previews */
+    NDPriorityNormal,       /**< Default for plugins */
+    NDPriorityHigh,         /**< Consumers that must not lose arrays, e.g. file writers; never asked to shed */
+    NDPriorityCritical      /**< The detector driver itself */
+} NDPriorityClass_t;
+
+#define ND_NUM_SHED_PRIORITIES NDPriorityHigh
+
+class NDArrayPool;
+
+/** Interface for consumers that hold NDArrays in a queue and can drop some of them when an NDArrayPool
+  * runs out of memory.  Shedders register with NDArrayPool::addShedder(). */
+class ADCORE_API NDArrayShedder {
+public:
+    virtual ~NDArrayShedder() {}
+    /** Returns the priority class of this consumer (NDPriorityClass_t) */
+    virtual int getPriorityClass() = 0;
+    /** Releases queued arrays that belong to pPool, oldest first, until bytesNeeded bytes have been released.
+      * Called without the pool's lock held.
+      * \param[in] pPool The pool that needs memory.
+      * \param[in] bytesNeeded Number of bytes the pool needs.
+      * \param[out] bytesShed Number of bytes in the arrays that were released.
+      * \return The number of arrays that were released. */
+    virtual int shedArrays(NDArrayPool *pPool, size_t bytesNeeded, size_t *bytesShed) = 0;
+};
+
 /** N-dimensional array class; each array has a set of dimensions, a data type, pointer to data, and optional attributes.
   * An NDArray also has a uniqueId and timeStamp that to identify it. NDArray objects can be allocated
   * by an NDArrayPool object, which maintains a free list of NDArrays for efficient memory management. */
@@ -129,6 +172,7 @@ public:
     NDAttributeList *pAttributeList;  /**< Linked list of attributes */
     Codec_t codec;              /**< Definition of codec used to compress the data. */
     size_t compressedSize;      /**< Size of the compressed data. Should be equal to dataSize if pData is uncompressed. */
+    NDArrayBufferOwner *pBufferOwner; /**< Owner of pData if it is borrowed rather than allocated by the pool, else NULL */
 };
 
 // This class defines the object that is contained in the std::multilist for sorting NDArrays in the freeList_.
@@ -164,11 +208,13 @@ class ADCORE_API NDArrayPool {
 public:
     NDArrayPool  (class asynNDArrayDriver *pDriver, size_t maxMemory);
     virtual ~NDArrayPool() {}
-    NDArray*     alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData);
+    NDArray*     alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                       NDArrayBufferOwner *pBufferOwner=NULL);
     NDArray*     copy(NDArray *pIn, NDArray *pOut, bool copyData, bool copyDimensions=true, bool copyDataType=true);
 
     int          reserve(NDArray *pArray);
     int          release(NDArray *pArray);
+    int          compact(NDArray *pArray);
     int          convert(NDArray *pIn,
                          NDArray **ppOut,
                          NDDataType_t dataTypeOut,
@@ -182,6 +228,20 @@ public:
     size_t       getMemorySize();
     int          getNumFree();
     void         emptyFreeList();
+    size_t       getMemoryHighWater();
+    int          getBuffersHighWater();
+    int          getShedCount(int priorityClass);
+    int          getAllocFailures();
+    int          getCompactCount();
+    double       getCompactBytesSaved();
+    void         resetStatistics();
+    int          setAlignment(size_t alignment);
+    size_t       getAlignment();
+
+    static void  addShedder(NDArrayShedder *pShedder);
+    static void  removeShedder(NDArrayShedder *pShedder);
+    static void  setThreadPriorityClass(int priorityClass);
+    static int   getThreadPriorityClass();
 
 protected:
     /** The following methods should be implemented by a pool class
@@ -199,6 +259,16 @@ private:
     size_t       maxMemory_;     /**< Maximum bytes of memory this object is allowed to allocate; -1=unlimited */
     size_t       memorySize_;    /**< Number of bytes of memory this object has currently allocated */
     class asynNDArrayDriver *pDriver_; /**< The asynNDArrayDriver that created this object */
+    size_t       memoryHighWater_;  /**< Largest value of memorySize_ since the last resetStatistics() */
+    int          buffersHighWater_; /**< Largest value of numBuffers_ since the last resetStatistics() */
+    int          shedCount_[ND_NUM_SHED_PRIORITIES]; /**< Arrays shed by consumers of each priority class */
+    int          allocFailures_;    /**< Allocations that failed because maxMemory was reached */
+    int          compactCount_;     /**< Arrays moved to smaller buffers by compact() */
+    double       compactBytesSaved_; /**< Bytes released by compact() */
+    size_t       alignment_;        /**< Alignment of the data buffers allocated by the pool; 0=malloc() */
+
+    void         freeMemory(size_t dataSize);
+    void         shedMemory(size_t dataSize);
 };
 
 #endif
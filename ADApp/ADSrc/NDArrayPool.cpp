@@ -42,15 +42,48 @@ static const char *driverName = "NDArrayPool";
 volatile int eraseNDAttributes=0;
 extern "C" {epicsExportAddress(int, eraseNDAttributes);}
 
+/* The consumers that can shed arrays when a pool runs out of memory, shared by all pools.
+ * The priority class of each thread is kept in thread private storage, offset by 1 so that
+ * threads that never set it read back NULL and are treated as NDPriorityCritical. */
+static std::set<NDArrayShedder *> *pShedders;
+static epicsMutexId shedderLock;
+static epicsThreadPrivateId priorityClassKey;
+static epicsThreadOnceId shedderOnceId = EPICS_THREAD_ONCE_INIT;
+
+static void shedderInit(void *)
+{
+  pShedders = new std::set<NDArrayShedder *>;
+  shedderLock = epicsMutexMustCreate();
+  priorityClassKey = epicsThreadPrivateCreate();
+}
+
+/* Allocates an array data buffer starting on a multiple of alignment bytes, or with malloc() if alignment
+ * is 0.  The buffer is freed with free(), so on Windows, where that cannot free _aligned_malloc() memory,
+ * and on vxWorks buffers are not aligned. */
+static void *allocData(size_t dataSize, size_t alignment)
+{
+#if !defined(_WIN32) && !defined(vxWorks)
+  if (alignment > 0) {
+    void *pData;
+    if (posix_memalign(&pData, alignment, dataSize) != 0) return NULL;
+    return pData;
+  }
+#endif
+  return malloc(dataSize);
+}
+
 /** NDArrayPool constructor
   * \param[in] pDriver Pointer to the asynNDArrayDriver that created this object.
   * \param[in] maxMemory Maxiumum number of bytes of memory the the pool is allowed to use, summed over
   * all of the NDArray objects; 0=unlimited.
   */
 NDArrayPool::NDArrayPool(class asynNDArrayDriver *pDriver, size_t maxMemory)
-  : numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), pDriver_(pDriver)
+  : numBuffers_(0), maxMemory_(maxMemory), memorySize_(0), pDriver_(pDriver),
+    memoryHighWater_(0), buffersHighWater_(0), allocFailures_(0), compactCount_(0), compactBytesSaved_(0.),
+    alignment_(0)
 {
   listLock_ = epicsMutexCreate();
+  memset(shedCount_, 0, sizeof(shedCount_));
 }
 
 /** Create new NDArray object.
@@ -96,16 +129,24 @@ void NDArrayPool::onReleaseArray(NDArray *pArray)
   * \param[in] pData Pointer to a data buffer; if NULL then alloc will allocate a new
   * array buffer; if not NULL then it is assumed to point to a valid buffer.
   *
+  * \param[in] pBufferOwner If this and pData are not NULL then the buffer is borrowed rather than
+  * owned by the pool; pBufferOwner->releaseBuffer() is called when the last reference to the NDArray is
+  * released, and the buffer does not count towards the memory used by the pool.  The caller must not
+  * write to the array data if the owner's buffer is read-only.
+  *
   * If pData is not NULL then dataSize must contain the actual number of bytes in the existing
   * array, and this array must be large enough to hold the array data.
   * alloc() searches
   * its free list to find a free NDArray buffer. If is cannot find one then it will
   * allocate a new one and add it to the free list. If allocating the memory required for
   * this NDArray would cause the cumulative memory allocated for the pool to exceed
-  * maxMemory then an error will be returned. alloc() sets the reference count for the
-  * returned NDArray to 1.
+  * maxMemory then it first deletes arrays on the free list, and then asks consumers
+  * with a lower priority class than the calling thread (see setThreadPriorityClass())
+  * to shed queued arrays from this pool. If that does not free enough memory then an error will be returned.
+  * alloc() sets the reference count for the returned NDArray to 1.
   */
-NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData)
+NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size_t dataSize, void *pData,
+                            NDArrayBufferOwner *pBufferOwner)
 {
   NDArray *pArray=NULL;
   NDArrayInfo_t arrayInfo;
@@ -167,7 +208,12 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
 
   /* At this point pArray exists, but pArray->pData may be NULL */
   /* If the caller passed a valid buffer use that */
-  if (pData) {
+  if (pData && pBufferOwner) {
+    pArray->pData = pData;
+    pArray->dataSize = dataSize;
+    pArray->compressedSize = dataSize;
+    pArray->pBufferOwner = pBufferOwner;
+  } else if (pData) {
     pArray->pData = pData;
     pArray->dataSize = dataSize;
     memorySize_ += dataSize;
@@ -175,25 +221,23 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
     if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
       // We don't have enough memory to allocate the array
       // See if we can get memory by deleting arrays
-      // Delete the largest arrays first, i.e. work from the end of freeList_
-      NDArray *freeArray;
-      std::multiset<freeListElement>::iterator it;
-      while (!freeList_.empty() && ((memorySize_ + dataSize) > maxMemory_)) {
-        it = freeList_.end();
-        it--;
-        freeArray = it->pArray_;
-        freeList_.erase(it);
-        memorySize_ -= freeArray->dataSize;
-        numBuffers_--;
-        delete freeArray;
-      }
+      freeMemory(dataSize);
+    }
+    if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+      // Ask lower priority consumers to release queued arrays from this pool.
+      // The lock must be released because they release the arrays back to this pool.
+      epicsMutexUnlock(listLock_);
+      shedMemory(dataSize);
+      epicsMutexLock(listLock_);
+      freeMemory(dataSize);
     }
     if ((maxMemory_ > 0) && ((memorySize_ + dataSize) > maxMemory_)) {
+      allocFailures_++;
       asynPrint(pDriver_->pasynUserSelf, ASYN_TRACE_ERROR,
              "%s: error: reached limit of %ld memory (%d buffers)\n",
              functionName, (long)maxMemory_, numBuffers_);
     } else {
-      pArray->pData = malloc(dataSize);
+      pArray->pData = allocData(dataSize, alignment_);
       if (pArray->pData) {
         pArray->dataSize = dataSize;
         pArray->compressedSize = dataSize;
@@ -208,12 +252,193 @@ NDArray* NDArrayPool::alloc(int ndims, size_t *dims, NDDataType_t dataType, size
     pArray = NULL;
   }
 
+  if (memorySize_ > memoryHighWater_) memoryHighWater_ = memorySize_;
+  if (numBuffers_ > buffersHighWater_) buffersHighWater_ = numBuffers_;
+
   // Call allocation hook (for pools that manage objects derived from NDArray class)
   onAllocateArray(pArray);
   epicsMutexUnlock(listLock_);
   return (pArray);
 }
 
+/** Moves the data of a compressed array into a buffer sized to its compressedSize.
+  * \param[in] pArray The array, which must have been allocated from this pool and have a codec.
+  * \return ND_SUCCESS if the data were moved, ND_ERROR if the array was left in its own buffer.
+  *
+  * Compressors allocate their output for the worst case, which is larger than the uncompressed data,
+  * so without this a compressed array holds as much pool memory as the uncompressed one while it waits
+  * in plugin queues.  compact() takes a buffer from the free list that alloc() would reuse for
+  * compressedSize bytes, or allocates a new one, copies the compressed data into it and puts the large
+  * buffer on the free list, where the next compression reuses it.  Arrays whose buffer is not larger
+  * than THRESHOLD_SIZE_RATIO*compressedSize, and borrowed buffers, are left alone.  The array must not be
+  * in use by any other thread, so compressors call this before passing the array to their callbacks.
+  */
+int NDArrayPool::compact(NDArray *pArray)
+{
+  NDArray *pHolder=NULL;
+  void *pData=NULL;
+  size_t oldSize, newSize;
+  std::multiset<freeListElement>::iterator pListElement;
+  const char *functionName = "compact";
+
+  if (pArray->pNDArrayPool != this) {
+    asynPrint(pDriver_->pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s::%s: ERROR, not owner!  owner=%p, should be this=%p\n",
+      driverName, functionName, pArray->pNDArrayPool, this);
+    return(ND_ERROR);
+  }
+  oldSize = pArray->dataSize;
+  newSize = pArray->compressedSize;
+  if (pArray->pBufferOwner || pArray->codec.empty() || (newSize == 0) ||
+      (oldSize <= newSize * THRESHOLD_SIZE_RATIO)) {
+    return(ND_ERROR);
+  }
+
+  epicsMutexLock(listLock_);
+  freeListElement testElement(NULL, newSize);
+  pListElement = freeList_.lower_bound(testElement);
+  if ((pListElement != freeList_.end()) && (pListElement->dataSize_ <= newSize * THRESHOLD_SIZE_RATIO)) {
+    // Swap buffers with an array on the free list, which then holds the large buffer
+    pHolder = pListElement->pArray_;
+    freeList_.erase(pListElement);
+    newSize = pHolder->dataSize;
+    pData = pHolder->pData;
+  } else {
+    if ((maxMemory_ > 0) && ((memorySize_ + newSize) > maxMemory_)) {
+      freeMemory(newSize);
+    }
+    // If there is no room to keep the large buffer as well it is freed below, so the pool is only
+    // over its limit by newSize until the copy is done
+    pData = allocData(newSize, alignment_);
+    if (!pData) {
+      epicsMutexUnlock(listLock_);
+      return(ND_ERROR);
+    }
+    memorySize_ += newSize;
+    if ((maxMemory_ == 0) || (memorySize_ <= maxMemory_)) {
+      numBuffers_++;
+      pHolder = this->createArray();
+      pHolder->pNDArrayPool = this;
+      pHolder->pDriver = pDriver_;
+      pHolder->referenceCount = 0;
+    }
+  }
+  epicsMutexUnlock(listLock_);
+
+  memcpy(pData, pArray->pData, pArray->compressedSize);
+
+  epicsMutexLock(listLock_);
+  if (pHolder) {
+    pHolder->pData = pArray->pData;
+    pHolder->dataSize = oldSize;
+    freeListElement listElement(pHolder, oldSize);
+    freeList_.insert(listElement);
+  } else {
+    free(pArray->pData);
+    memorySize_ -= oldSize;
+  }
+  pArray->pData = pData;
+  pArray->dataSize = newSize;
+  compactCount_++;
+  compactBytesSaved_ += (double)(oldSize - newSize);
+  if (memorySize_ > memoryHighWater_) memoryHighWater_ = memorySize_;
+  if (numBuffers_ > buffersHighWater_) buffersHighWater_ = numBuffers_;
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Deletes arrays on the free list, largest first, until dataSize more bytes can be allocated
+  * without exceeding maxMemory or the free list is empty.  Must be called with the lock held. */
+void NDArrayPool::freeMemory(size_t dataSize)
+{
+  NDArray *freeArray;
+  std::multiset<freeListElement>::iterator it;
+
+  while (!freeList_.empty() && ((memorySize_ + dataSize) > maxMemory_)) {
+    it = freeList_.end();
+    it--;
+    freeArray = it->pArray_;
+    freeList_.erase(it);
+    memorySize_ -= freeArray->dataSize;
+    numBuffers_--;
+    delete freeArray;
+  }
+}
+
+/** Asks the registered shedders with a lower priority class than the calling thread to release queued arrays
+  * from this pool, lowest class first, until dataSize more bytes could be allocated.
+  * NDPriorityHigh consumers are never asked.  Must be called with the lock released. */
+void NDArrayPool::shedMemory(size_t dataSize)
+{
+  int requester = getThreadPriorityClass();
+  int priority, numShed;
+  size_t needed, bytesShed;
+  std::set<NDArrayShedder *>::iterator it;
+  const char *functionName = "shedMemory";
+
+  epicsMutexLock(listLock_);
+  needed = (memorySize_ + dataSize > maxMemory_) ? memorySize_ + dataSize - maxMemory_ : 0;
+  epicsMutexUnlock(listLock_);
+
+  epicsThreadOnce(&shedderOnceId, shedderInit, 0);
+  epicsMutexLock(shedderLock);
+  for (priority=NDPriorityLow; (priority<requester) && (priority<NDPriorityHigh) && (needed>0); priority++) {
+    for (it=pShedders->begin(); (it!=pShedders->end()) && (needed>0); ++it) {
+      if ((*it)->getPriorityClass() != priority) continue;
+      numShed = (*it)->shedArrays(this, needed, &bytesShed);
+      if (numShed == 0) continue;
+      needed = (bytesShed < needed) ? needed - bytesShed : 0;
+      epicsMutexLock(listLock_);
+      shedCount_[priority] += numShed;
+      epicsMutexUnlock(listLock_);
+      asynPrint(pDriver_->pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::%s: shed %d arrays (%ld bytes) from priority class %d consumer\n",
+        driverName, functionName, numShed, (long)bytesShed, priority);
+    }
+  }
+  epicsMutexUnlock(shedderLock);
+}
+
+/** Registers a consumer that can shed queued arrays when any pool runs out of memory.
+  * \param[in] pShedder The consumer, normally a plugin. */
+void NDArrayPool::addShedder(NDArrayShedder *pShedder)
+{
+  epicsThreadOnce(&shedderOnceId, shedderInit, 0);
+  epicsMutexLock(shedderLock);
+  pShedders->insert(pShedder);
+  epicsMutexUnlock(shedderLock);
+}
+
+/** Unregisters a consumer; after this returns shedArrays() will not be called on it.
+  * \param[in] pShedder The consumer passed to addShedder(). */
+void NDArrayPool::removeShedder(NDArrayShedder *pShedder)
+{
+  epicsThreadOnce(&shedderOnceId, shedderInit, 0);
+  epicsMutexLock(shedderLock);
+  pShedders->erase(pShedder);
+  epicsMutexUnlock(shedderLock);
+}
+
+/** Sets the priority class (NDPriorityClass_t) of the calling thread, which alloc() uses to decide which
+  * consumers may be asked to shed arrays.  Plugins call this in their callback threads.
+  * \param[in] priorityClass The priority class. */
+void NDArrayPool::setThreadPriorityClass(int priorityClass)
+{
+  epicsThreadOnce(&shedderOnceId, shedderInit, 0);
+  epicsThreadPrivateSet(priorityClassKey, (void *)(size_t)(priorityClass + 1));
+}
+
+/** Returns the priority class of the calling thread, NDPriorityCritical if it was never set */
+int NDArrayPool::getThreadPriorityClass()
+{
+  void *value;
+
+  epicsThreadOnce(&shedderOnceId, shedderInit, 0);
+  value = epicsThreadPrivateGet(priorityClassKey);
+  if (!value) return NDPriorityCritical;
+  return (int)(size_t)value - 1;
+}
+
 /** This method makes a copy of an NDArray object.
   * \param[in] pIn The input array to be copied.
   * \param[in] pOut The output array that will be copied to; can be NULL or a pointer to an existing NDArray.
@@ -321,6 +546,13 @@ int NDArrayPool::release(NDArray *pArray)
   epicsMutexLock(listLock_);
   pArray->referenceCount--;
   if (pArray->referenceCount == 0) {
+    /* Give a borrowed buffer back to its owner; the array goes on the free list without memory */
+    if (pArray->pBufferOwner) {
+      pArray->pBufferOwner->releaseBuffer(pArray->pData);
+      pArray->pBufferOwner = NULL;
+      pArray->pData = NULL;
+      pArray->dataSize = 0;
+    }
     /* The last user has released this image, add it back to the free list */
     freeListElement listElement(pArray, pArray->dataSize);
     freeList_.insert(listElement);
@@ -715,6 +947,101 @@ size_t NDArrayPool::getMemorySize()
   return memorySize_;
 }
 
+/** Returns the largest number of bytes of memory this object has had allocated since the last resetStatistics() */
+size_t NDArrayPool::getMemoryHighWater()
+{
+  return memoryHighWater_;
+}
+
+/** Returns the largest number of NDArray objects this object has had allocated since the last resetStatistics() */
+int NDArrayPool::getBuffersHighWater()
+{
+  return buffersHighWater_;
+}
+
+/** Returns the number of arrays from this pool that consumers of a priority class have shed
+  * \param[in] priorityClass NDPriorityLow or NDPriorityNormal; other classes never shed. */
+int NDArrayPool::getShedCount(int priorityClass)
+{
+  if ((priorityClass < 0) || (priorityClass >= ND_NUM_SHED_PRIORITIES)) return 0;
+  return shedCount_[priorityClass];
+}
+
+/** Returns the number of allocations that failed because maxMemory was reached */
+int NDArrayPool::getAllocFailures()
+{
+  return allocFailures_;
+}
+
+/** Returns the number of arrays whose data compact() has moved into a smaller buffer */
+int NDArrayPool::getCompactCount()
+{
+  return compactCount_;
+}
+
+/** Returns the number of bytes that compact() has released from the arrays it moved, which is the memory
+  * those arrays did not hold while they were queued */
+double NDArrayPool::getCompactBytesSaved()
+{
+  return compactBytesSaved_;
+}
+
+/** Resets the high water marks to the current usage and the shed, failure and compaction counters to 0 */
+void NDArrayPool::resetStatistics()
+{
+  epicsMutexLock(listLock_);
+  memoryHighWater_ = memorySize_;
+  buffersHighWater_ = numBuffers_;
+  memset(shedCount_, 0, sizeof(shedCount_));
+  allocFailures_ = 0;
+  compactCount_ = 0;
+  compactBytesSaved_ = 0.;
+  epicsMutexUnlock(listLock_);
+}
+
+/** Sets the alignment of the data buffers that the pool allocates from now on.
+  * Arrays on the free list whose data are not aligned are deleted, so that they are not reused.
+  * Used for direct I/O, which transfers data to and from the file without copying them when
+  * the buffers are aligned to the disk blocks.
+  * \param[in] alignment Alignment in bytes, a power of 2; 0 to use malloc().
+  * \return ND_SUCCESS, or ND_ERROR if alignment is not valid or buffers cannot be aligned on this platform.
+  */
+int NDArrayPool::setAlignment(size_t alignment)
+{
+  std::multiset<freeListElement>::iterator it;
+  NDArray *freeArray;
+
+  if ((alignment & (alignment - 1)) != 0) return ND_ERROR;
+#if defined(_WIN32) || defined(vxWorks)
+  /* allocData() does not align buffers on these platforms */
+  if (alignment > 0) return ND_ERROR;
+#endif
+  if ((alignment > 0) && (alignment < sizeof(void *))) alignment = sizeof(void *);
+  epicsMutexLock(listLock_);
+  alignment_ = alignment;
+  if (alignment_ > 0) {
+    for (it = freeList_.begin(); it != freeList_.end();) {
+      freeArray = it->pArray_;
+      if (((uintptr_t)freeArray->pData % alignment_) == 0) {
+        ++it;
+        continue;
+      }
+      freeList_.erase(it++);
+      memorySize_ -= freeArray->dataSize;
+      numBuffers_--;
+      delete freeArray;
+    }
+  }
+  epicsMutexUnlock(listLock_);
+  return ND_SUCCESS;
+}
+
+/** Returns the alignment in bytes of the data buffers that the pool allocates; 0 if they are allocated with malloc() */
+size_t NDArrayPool::getAlignment()
+{
+  return alignment_;
+}
+
 /** Returns number of NDArray objects in the free list */
 int NDArrayPool::getNumFree()
 {
@@ -754,6 +1081,11 @@ int NDArrayPool::report(FILE *fp, int details)
          numBuffers_, this->getNumFree());
   fprintf(fp, "  memorySize=%ld, maxMemory=%ld\n",
         (long)memorySize_, (long)maxMemory_);
+  fprintf(fp, "  memoryHighWater=%ld, buffersHighWater=%d, shed low=%d, shed normal=%d, allocFailures=%d\n",
+        (long)memoryHighWater_, buffersHighWater_, shedCount_[NDPriorityLow], shedCount_[NDPriorityNormal],
+        allocFailures_);
+  fprintf(fp, "  compacted=%d, compactBytesSaved=%.0f\n", compactCount_, compactBytesSaved_);
+  fprintf(fp, "  alignment=%ld\n", (long)alignment_);
   if (details > 5) {
     int i;
     std::multiset<freeListElement>::iterator it;
@@ -94,6 +94,8 @@ bool asynNDArrayDriver::checkPath(std::string &filePath)
   * It sets the value of NDFilePathExists to 0 (does not exist) or 1 (exists).
   * It also adds a trailing '/' character to the path if one is not present.
   * Returns a error status if the directory does not exist.
+  * A directory that was found to exist is not checked again until NDFilePath is written, so that
+  * createFileName does not look at the directory for every file.
   */
 asynStatus asynNDArrayDriver::checkPath()
 {
@@ -103,8 +105,10 @@ asynStatus asynNDArrayDriver::checkPath()
 
     getStringParam(NDFilePath, filePath);
     if (filePath.size() == 0) return asynSuccess;
+    if (filePath == existingPath_) return asynSuccess;
     pathExists = checkPath(filePath);
     status = pathExists ? asynSuccess : asynError;
+    existingPath_ = pathExists ? filePath : "";
     setStringParam(NDFilePath, filePath);
     setIntegerParam(NDFilePathExists, pathExists);
     return status;
@@ -518,6 +522,7 @@ asynStatus asynNDArrayDriver::writeOctet(asynUser *pasynUser, const char *value,
         (function == NDAttributesMacros)) {
         this->readNDAttributesFile();
     } else if (function == NDFilePath) {
+        existingPath_.clear();
         status = this->checkPath();
         if (status == asynError) {
             // If the directory does not exist then try to create it
@@ -673,6 +678,19 @@ asynStatus asynNDArrayDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
 
     if (function == NDPoolEmptyFreeList) {
         this->pNDArrayPool->emptyFreeList();
+    } else if (function == NDPoolResetStats) {
+        this->pNDArrayPool->resetStatistics();
+    } else if (function == NDPoolAlignment) {
+        if ((value < 0) || (this->pNDArrayPool->setAlignment((size_t)value) != ND_SUCCESS)) status = asynError;
+        setIntegerParam(addr, function, (int)this->pNDArrayPool->getAlignment());
+    } else if (function == NDThrottledCount) {
+        creditMutex_->lock();
+        throttledCount_ = value;
+        creditMutex_->unlock();
+    } else if (function == NDWouldDropCount) {
+        creditMutex_->lock();
+        wouldDropCount_ = value;
+        creditMutex_->unlock();
     }
 
     /* Do callbacks so higher layers see any changes */
@@ -704,6 +722,18 @@ asynStatus asynNDArrayDriver::readInt32(asynUser *pasynUser, epicsInt32 *value)
         setIntegerParam(addr, function, this->pNDArrayPool->getNumBuffers());
     } else if (function == NDPoolFreeBuffers) {
         setIntegerParam(addr, function, this->pNDArrayPool->getNumFree());
+    } else if (function == NDPoolBuffersHighWater) {
+        setIntegerParam(addr, function, this->pNDArrayPool->getBuffersHighWater());
+    } else if (function == NDPoolShedLow) {
+        setIntegerParam(addr, function, this->pNDArrayPool->getShedCount(NDPriorityLow));
+    } else if (function == NDPoolShedNormal) {
+        setIntegerParam(addr, function, this->pNDArrayPool->getShedCount(NDPriorityNormal));
+    } else if (function == NDPoolAllocFailures) {
+        setIntegerParam(addr, function, this->pNDArrayPool->getAllocFailures());
+    } else if (function == NDPoolCompactCount) {
+        setIntegerParam(addr, function, this->pNDArrayPool->getCompactCount());
+    } else if (function == NDPoolAlignment) {
+        setIntegerParam(addr, function, (int)this->pNDArrayPool->getAlignment());
     }
 
     // Call base class
@@ -727,6 +757,10 @@ asynStatus asynNDArrayDriver::readFloat64(asynUser *pasynUser, epicsFloat64 *val
         setDoubleParam(addr, function, this->pNDArrayPool->getMaxMemory() / MEGABYTE_DBL);
     } else if (function == NDPoolUsedMemory) {
         setDoubleParam(addr, function, this->pNDArrayPool->getMemorySize() / MEGABYTE_DBL);
+    } else if (function == NDPoolMemoryHighWater) {
+        setDoubleParam(addr, function, this->pNDArrayPool->getMemoryHighWater() / MEGABYTE_DBL);
+    } else if (function == NDPoolCompactSaved) {
+        setDoubleParam(addr, function, this->pNDArrayPool->getCompactBytesSaved() / MEGABYTE_DBL);
     }
 
     // Call base class
@@ -762,6 +796,16 @@ void asynNDArrayDriver::report(FILE *fp, int details)
         fprintf(fp, "%s: pAttributeList report\n", this->portName);
         this->pAttributeList->report(fp, details);
     }
+    if (details > 1) {
+        std::map<void *, int>::iterator it;
+        creditMutex_->lock();
+        fprintf(fp, "%s: %d lossless consumers, credits available=%d, throttled=%d, would drop=%d\n",
+                this->portName, (int)credits_.size(), getCredits(), throttledCount_, wouldDropCount_);
+        for (it=credits_.begin(); it!=credits_.end(); ++it) {
+            fprintf(fp, "  consumer %p credits=%d\n", it->first, it->second);
+        }
+        creditMutex_->unlock();
+    }
 }
 
 static void updateQueuedArrayCountC(void *drvPvt)
@@ -779,8 +823,17 @@ void asynNDArrayDriver::updateQueuedArrayCount()
         if (!queuedArrayUpdateRun_)
             break;
 
+        int credits = getCredits();
+        creditMutex_->lock();
+        int throttledCount = throttledCount_;
+        int wouldDropCount = wouldDropCount_;
+        creditMutex_->unlock();
+
         lock();
         setIntegerParam(NDNumQueuedArrays, getQueuedArrayCount());
+        setIntegerParam(NDCreditsAvailable, credits);
+        setIntegerParam(NDThrottledCount, throttledCount);
+        setIntegerParam(NDWouldDropCount, wouldDropCount);
         callParamCallbacks();
         unlock();
     }
@@ -820,6 +873,135 @@ asynStatus asynNDArrayDriver::decrementQueuedArrayCount()
     return asynSuccess;
 }
 
+/** Sets the number of arrays that a lossless consumer can currently accept from this driver.
+  * Plugins with Lossless=1 call this on their upstream driver every time their free queue space changes.
+  * This method does not take the asynPortDriver lock, so it can be called from any thread.
+  * \param[in] consumer Opaque handle identifying the consumer, normally the plugin's this pointer.
+  * \param[in] credits Number of arrays the consumer can accept; negative values are treated as 0. */
+asynStatus asynNDArrayDriver::setCredits(void *consumer, int credits)
+{
+    int prevCredits, newCredits;
+
+    if (credits < 0) credits = 0;
+    creditMutex_->lock();
+    prevCredits = getCredits();
+    credits_[consumer] = credits;
+    newCredits = getCredits();
+    creditMutex_->unlock();
+    if (newCredits != 0) epicsEventSignal(creditEvent_);
+    epicsEventSignal(queuedArrayEvent_);
+    if (newCredits != prevCredits) creditsChanged();
+    return asynSuccess;
+}
+
+/** Removes a consumer from the set of lossless consumers of this driver.
+  * \param[in] consumer The handle that was passed to setCredits. */
+asynStatus asynNDArrayDriver::removeCredits(void *consumer)
+{
+    int prevCredits, newCredits;
+
+    creditMutex_->lock();
+    prevCredits = getCredits();
+    credits_.erase(consumer);
+    newCredits = getCredits();
+    creditMutex_->unlock();
+    if (newCredits != 0) epicsEventSignal(creditEvent_);
+    epicsEventSignal(queuedArrayEvent_);
+    if (newCredits != prevCredits) creditsChanged();
+    return asynSuccess;
+}
+
+/** Returns the number of arrays that all lossless consumers can accept, i.e. the smallest credit
+  * of any of them, or -1 if there are no lossless consumers.
+  * Drivers that distribute arrays rather than broadcasting them (e.g. NDPluginScatter) override this. */
+int asynNDArrayDriver::getCredits()
+{
+    std::map<void *, int>::iterator it;
+    int credits = -1;
+
+    creditMutex_->lock();
+    for (it=credits_.begin(); it!=credits_.end(); ++it) {
+        if ((credits < 0) || (it->second < credits)) credits = it->second;
+    }
+    creditMutex_->unlock();
+    return credits;
+}
+
+/** Returns the credits last reported by one consumer, or -1 if it is not a lossless consumer.
+  * \param[in] consumer The handle that was passed to setCredits. */
+int asynNDArrayDriver::getCredits(void *consumer)
+{
+    std::map<void *, int>::iterator it;
+    int credits = -1;
+
+    creditMutex_->lock();
+    it = credits_.find(consumer);
+    if (it != credits_.end()) credits = it->second;
+    creditMutex_->unlock();
+    return credits;
+}
+
+/** Waits until the lossless consumers of this driver can accept another array.
+  * Drivers call this before doCallbacksGenericPointer to pace themselves to their lossless plugins
+  * instead of having the plugins drop arrays. It returns immediately if there are no lossless consumers.
+  * Each call that has to wait increments ThrottledCount.
+  * This method must be called with the asynPortDriver lock released.
+  * \param[in] timeout Maximum time to wait in seconds.
+  * \return asynSuccess if an array can be sent, asynTimeout if the consumers were still full after timeout. */
+asynStatus asynNDArrayDriver::waitForCredits(double timeout)
+{
+    epicsTimeStamp tStart, tNow;
+    double remaining;
+
+    if (getCredits() != 0) return asynSuccess;
+
+    creditMutex_->lock();
+    throttledCount_++;
+    creditMutex_->unlock();
+    epicsEventSignal(queuedArrayEvent_);
+
+    epicsTimeGetCurrent(&tStart);
+    while (1) {
+        epicsTimeGetCurrent(&tNow);
+        remaining = timeout - epicsTimeDiffInSeconds(&tNow, &tStart);
+        if (remaining <= 0.) break;
+        epicsEventWaitWithTimeout(creditEvent_, remaining);
+        if (getCredits() != 0) return asynSuccess;
+    }
+    return asynTimeout;
+}
+
+/** Waits for credits using the CreditTimeout parameter as the timeout.
+  * This method must be called with the asynPortDriver lock held; it releases the lock while waiting. */
+asynStatus asynNDArrayDriver::waitForCredits()
+{
+    double timeout;
+    asynStatus status;
+
+    if (getCredits() != 0) return asynSuccess;
+    getDoubleParam(NDCreditTimeout, &timeout);
+    this->unlock();
+    status = waitForCredits(timeout);
+    this->lock();
+    return status;
+}
+
+/** Called by a lossless consumer when it received an array that it would have had to drop,
+  * i.e. this driver sent it without waiting for credits.  Increments WouldDropCount. */
+void asynNDArrayDriver::incrementWouldDropCount()
+{
+    creditMutex_->lock();
+    wouldDropCount_++;
+    creditMutex_->unlock();
+    epicsEventSignal(queuedArrayEvent_);
+}
+
+/** Called without any locks held when the value returned by getCredits() changes.
+  * The base class does nothing; NDPluginDriver overrides it to pass the pressure to its own upstream driver. */
+void asynNDArrayDriver::creditsChanged()
+{
+}
+
 
 /** This is the constructor for the asynNDArrayDriver class.
   * portName, maxAddr, interfaceMask, interruptMask, asynFlags, autoConnect, priority and stackSize
@@ -850,8 +1032,8 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
                      interfaceMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask | asynGenericPointerMask | asynDrvUserMask,
                      interruptMask | asynInt32Mask | asynFloat64Mask | asynOctetMask | asynInt32ArrayMask | asynGenericPointerMask,
                      asynFlags, autoConnect, priority, stackSize),
-      pNDArrayPool(NULL), queuedArrayCountMutex_(NULL), queuedArrayCount_(0),
-      queuedArrayUpdateRun_(true)
+      pNDArrayPool(NULL), creditMutex_(NULL), queuedArrayCountMutex_(NULL), queuedArrayCount_(0),
+      queuedArrayUpdateRun_(true), throttledCount_(0), wouldDropCount_(0)
 {
     char versionString[20];
     static const char *functionName = "asynNDArrayDriver";
@@ -865,6 +1047,8 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     this->pNDArrayPoolPvt_ = new NDArrayPool(this, maxMemory);
     this->pNDArrayPool = this->pNDArrayPoolPvt_;
     this->queuedArrayCountMutex_ = new epicsMutex();
+    this->creditMutex_ = new epicsMutex();
+    this->creditEvent_ = epicsEventCreate(epicsEventEmpty);
 
     /* Allocate pArray pointer array */
     this->pArrays = (NDArray **)calloc(maxAddr, sizeof(NDArray *));
@@ -918,6 +1102,8 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     createParam(NDFileLazyOpenString,         asynParamInt32,           &NDFileLazyOpen);
     createParam(NDFileCreateDirString,        asynParamInt32,           &NDFileCreateDir);
     createParam(NDFileTempSuffixString,       asynParamOctet,           &NDFileTempSuffix);
+    createParam(NDFileRotateString,           asynParamInt32,           &NDFileRotate);
+    createParam(NDFileBoundaryStallString,    asynParamFloat64,         &NDFileBoundaryStall);
     createParam(NDAttributesFileString,       asynParamOctet,           &NDAttributesFile);
     createParam(NDAttributesStatusString,     asynParamInt32,           &NDAttributesStatus);
     createParam(NDAttributesMacrosString,     asynParamOctet,           &NDAttributesMacros);
@@ -929,7 +1115,20 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     createParam(NDPoolMaxMemoryString,        asynParamFloat64,         &NDPoolMaxMemory);
     createParam(NDPoolUsedMemoryString,       asynParamFloat64,         &NDPoolUsedMemory);
     createParam(NDPoolEmptyFreeListString,    asynParamInt32,           &NDPoolEmptyFreeList);
+    createParam(NDPoolMemoryHighWaterString,  asynParamFloat64,         &NDPoolMemoryHighWater);
+    createParam(NDPoolBuffersHighWaterString, asynParamInt32,           &NDPoolBuffersHighWater);
+    createParam(NDPoolShedLowString,          asynParamInt32,           &NDPoolShedLow);
+    createParam(NDPoolShedNormalString,       asynParamInt32,           &NDPoolShedNormal);
+    createParam(NDPoolAllocFailuresString,    asynParamInt32,           &NDPoolAllocFailures);
+    createParam(NDPoolCompactCountString,     asynParamInt32,           &NDPoolCompactCount);
+    createParam(NDPoolCompactSavedString,     asynParamFloat64,         &NDPoolCompactSaved);
+    createParam(NDPoolResetStatsString,       asynParamInt32,           &NDPoolResetStats);
+    createParam(NDPoolAlignmentString,        asynParamInt32,           &NDPoolAlignment);
     createParam(NDNumQueuedArraysString,      asynParamInt32,           &NDNumQueuedArrays);
+    createParam(NDCreditsAvailableString,     asynParamInt32,           &NDCreditsAvailable);
+    createParam(NDCreditTimeoutString,        asynParamFloat64,         &NDCreditTimeout);
+    createParam(NDThrottledCountString,       asynParamInt32,           &NDThrottledCount);
+    createParam(NDWouldDropCountString,       asynParamInt32,           &NDWouldDropCount);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -972,6 +1171,8 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     setIntegerParam(NDFileNumCaptured, 0);
     setIntegerParam(NDFileCreateDir, 0);
     setStringParam (NDFileTempSuffix, "");
+    setIntegerParam(NDFileRotate, 0);
+    setDoubleParam (NDFileBoundaryStall, 0.0);
     setStringParam (NDAttributesFile, "");
     setIntegerParam(NDAttributesStatus, NDAttributesFileNotFound);
     setStringParam (NDAttributesMacros, "");
@@ -980,8 +1181,18 @@ asynNDArrayDriver::asynNDArrayDriver(const char *portName, int maxAddr, int maxB
     setIntegerParam(NDPoolFreeBuffers, this->pNDArrayPool->getNumFree());
     setDoubleParam(NDPoolMaxMemory, 0);
     setDoubleParam(NDPoolUsedMemory, 0);
+    setDoubleParam(NDPoolMemoryHighWater, 0);
+    setIntegerParam(NDPoolBuffersHighWater, 0);
+    setIntegerParam(NDPoolShedLow, 0);
+    setIntegerParam(NDPoolShedNormal, 0);
+    setIntegerParam(NDPoolAllocFailures, 0);
+    setIntegerParam(NDPoolAlignment, 0);
 
     setIntegerParam(NDNumQueuedArrays, 0);
+    setIntegerParam(NDCreditsAvailable, -1);
+    setDoubleParam(NDCreditTimeout, 1.0);
+    setIntegerParam(NDThrottledCount, 0);
+    setIntegerParam(NDWouldDropCount, 0);
 
     queuedArrayEvent_ = epicsEventCreate(epicsEventEmpty);
     queuedArrayUpdateDone_ = epicsEventCreate(epicsEventEmpty);
@@ -1012,5 +1223,7 @@ asynNDArrayDriver::~asynNDArrayDriver()
     free(this->pArrays);
     delete this->pAttributeList;
     delete this->queuedArrayCountMutex_;
+    delete this->creditMutex_;
+    epicsEventDestroy(this->creditEvent_);
 }
 
@@ -1,6 +1,8 @@
 #ifndef asynNDArrayDriver_H
 #define asynNDArrayDriver_H
 
+#include <map>
+
 #include <epicsMutex.h>
 #include <epicsEvent.h>
 
@@ -104,6 +106,8 @@ typedef enum {
 #define NDFileLazyOpenString    "FILE_LAZY_OPEN"    /**< (asynInt32,    r/w) Don't open file until first frame arrives in Stream mode */
 #define NDFileCreateDirString   "CREATE_DIR"        /**< (asynInt32,    r/w) Create the target directory up to this depth */
 #define NDFileTempSuffixString  "FILE_TEMP_SUFFIX"  /**< (asynOctet,    r/w) Temporary filename suffix while writing data to file. The file will be renamed (suffix removed) upon closing the file. */
+#define NDFileRotateString      "FILE_ROTATE"       /**< (asynInt32,    r/w) In Stream mode start the next file after NumCapture arrays rather than stopping */
+#define NDFileBoundaryStallString "FILE_BOUNDARY_STALL" /**< (asynFloat64, r/o) Time the last change to the next file held up the plugin */
 
 #define NDAttributesFileString    "ND_ATTRIBUTES_FILE"   /**< (asynOctet,    r/w) Attributes file name */
 #define NDAttributesStatusString  "ND_ATTRIBUTES_STATUS" /**< (asynInt32,    r/o) Attributes status */
@@ -120,10 +124,25 @@ typedef enum {
 #define NDPoolMaxMemoryString       "POOL_MAX_MEMORY"
 #define NDPoolUsedMemoryString      "POOL_USED_MEMORY"
 #define NDPoolEmptyFreeListString   "POOL_EMPTY_FREELIST"
+#define NDPoolMemoryHighWaterString  "POOL_MEMORY_HIGH_WATER"   /**< (asynFloat64,  r/o) Most memory in use since the statistics were reset (MB) */
+#define NDPoolBuffersHighWaterString "POOL_BUFFERS_HIGH_WATER"  /**< (asynInt32,    r/o) Most buffers allocated since the statistics were reset */
+#define NDPoolShedLowString          "POOL_SHED_LOW"            /**< (asynInt32,    r/o) Arrays shed by Low priority plugins */
+#define NDPoolShedNormalString       "POOL_SHED_NORMAL"         /**< (asynInt32,    r/o) Arrays shed by Normal priority plugins */
+#define NDPoolAllocFailuresString    "POOL_ALLOC_FAILURES"      /**< (asynInt32,    r/o) Allocations that failed because the memory limit was reached */
+#define NDPoolCompactCountString     "POOL_COMPACT_COUNT"       /**< (asynInt32,    r/o) Compressed arrays moved to right-sized buffers */
+#define NDPoolCompactSavedString     "POOL_COMPACT_SAVED"       /**< (asynFloat64,  r/o) Memory released by moving compressed arrays (MB) */
+#define NDPoolResetStatsString       "POOL_RESET_STATS"         /**< (asynInt32,    r/w) Reset the high water marks and counters */
+#define NDPoolAlignmentString        "POOL_ALIGNMENT"           /**< (asynInt32,    r/w) Alignment of the array data buffers in bytes */
 
 /* Queued arrays */
 #define NDNumQueuedArraysString     "NUM_QUEUED_ARRAYS"
 
+/* Credit based backpressure from lossless plugins */
+#define NDCreditsAvailableString    "CREDITS_AVAILABLE"     /**< (asynInt32,    r/o) Arrays the lossless consumers can accept, -1 if there are none */
+#define NDCreditTimeoutString       "CREDIT_TIMEOUT"        /**< (asynFloat64,  r/w) Maximum time a driver waits for credits before sending an array */
+#define NDThrottledCountString      "THROTTLED_COUNT"       /**< (asynInt32,    r/w) Number of times the driver waited for credits */
+#define NDWouldDropCountString      "WOULD_DROP_COUNT"      /**< (asynInt32,    r/w) Number of arrays a lossless consumer would have dropped */
+
 /** This is the class from which NDArray drivers are derived; implements the asynGenericPointer functions
   * for NDArray objects.
   * For areaDetector, both plugins and detector drivers are indirectly derived from this class.
@@ -161,6 +180,14 @@ public:
     int getQueuedArrayCount();
     void updateQueuedArrayCount();
 
+    virtual asynStatus setCredits(void *consumer, int credits);
+    virtual asynStatus removeCredits(void *consumer);
+    virtual int getCredits();
+    int getCredits(void *consumer);
+    virtual asynStatus waitForCredits(double timeout);
+    asynStatus waitForCredits();
+    void incrementWouldDropCount();
+
     class NDArrayPool *pNDArrayPool;     /**< An NDArrayPool pointer that is initialized to pNDArrayPoolPvt_ in the constructor.
                                      * Plugins change this pointer to the one passed in NDArray::pNDArrayPool */
 
@@ -214,6 +241,8 @@ protected:
     int NDFileLazyOpen;
     int NDFileCreateDir;
     int NDFileTempSuffix;
+    int NDFileRotate;
+    int NDFileBoundaryStall;
     int NDAttributesFile;
     int NDAttributesStatus;
     int NDAttributesMacros;
@@ -225,13 +254,30 @@ protected:
     int NDPoolMaxMemory;
     int NDPoolUsedMemory;
     int NDPoolEmptyFreeList;
+    int NDPoolMemoryHighWater;
+    int NDPoolBuffersHighWater;
+    int NDPoolShedLow;
+    int NDPoolShedNormal;
+    int NDPoolAllocFailures;
+    int NDPoolCompactCount;
+    int NDPoolCompactSaved;
+    int NDPoolResetStats;
+    int NDPoolAlignment;
     int NDNumQueuedArrays;
+    int NDCreditsAvailable;
+    int NDCreditTimeout;
+    int NDThrottledCount;
+    int NDWouldDropCount;
 
     class NDArray **pArrays;             /**< An array of NDArray pointers used to store data in the driver */
     class NDAttributeList *pAttributeList;  /**< An NDAttributeList object used to obtain the current values of a set of attributes */
     int threadStackSize_;
     int threadPriority_;
 
+    virtual void creditsChanged();
+    std::map<void *, int> credits_;       /**< Credits reported by each lossless consumer, protected by creditMutex_ */
+    epicsMutex *creditMutex_;
+
 private:
     NDArrayPool *pNDArrayPoolPvt_;
     epicsMutex *queuedArrayCountMutex_;
@@ -241,6 +287,11 @@ private:
     bool queuedArrayUpdateRun_;
     epicsEventId queuedArrayUpdateDone_;
 
+    epicsEventId creditEvent_;
+    int throttledCount_;
+    int wouldDropCount_;
+    std::string existingPath_;     /**< The last NDFilePath that checkPath() found to exist */
+
     friend class NDArrayPool;
 
 };
@@ -44,6 +44,15 @@ struct freeNDArray {
     void operator()(dataType *data) { array->release(); }
 };
 
+// Keeps the value buffer of a received NTNDArray alive while an NDArray references it
+class NTNDArrayBufferOwner : public NDArrayBufferOwner {
+public:
+    NTNDArrayBufferOwner(const shared_vector<const void>& buffer) : m_buffer(buffer) {}
+    void releaseBuffer(void *pData) { delete this; }
+private:
+    shared_vector<const void> m_buffer;
+};
+
 NTNDArrayConverter::NTNDArrayConverter (NTNDArrayPtr array) : m_array(array) {}
 
 ScalarType NTNDArrayConverter::getValueType (void)
@@ -218,6 +227,29 @@ void NTNDArrayConverter::toArray (NDArray *dest)
     dest->uniqueId = uniqueId->get();
 }
 
+/** Returns a new NDArray allocated from pool whose data is the value buffer of the NTNDArray,
+  * rather than a copy of it.  The NDArray holds a reference to the buffer until it is released,
+  * so the NTNDArray may be updated in the meantime.  The buffer belongs to pvData and is read-only;
+  * the caller must not modify the array data.  The caller owns the returned NDArray. */
+NDArray *NTNDArrayConverter::toArrayZeroCopy (NDArrayPool *pool)
+{
+    NDArray *dest = toValueZeroCopy(pool);
+
+    try {
+        toDimensions(dest);
+        toTimeStamp(dest);
+        toDataTimeStamp(dest);
+        toAttributes(dest);
+    } catch (...) {
+        dest->release();
+        throw;
+    }
+
+    PVIntPtr uniqueId(m_array->getPVStructure()->getSubField<PVInt>("uniqueId"));
+    dest->uniqueId = uniqueId->get();
+    return dest;
+}
+
 void NTNDArrayConverter::fromArray (NDArray *src)
 {
     fromValue(src);
@@ -273,6 +305,54 @@ void NTNDArrayConverter::toValue (NDArray *dest)
 
 }
 
+template <typename arrayType>
+NDArray *NTNDArrayConverter::toValueZeroCopy (NDArrayPool *pool)
+{
+    typedef typename arrayType::value_type arrayValType;
+    typedef typename arrayType::const_svector arrayVecType;
+
+    PVUnionPtr src(m_array->getValue());
+    arrayVecType srcVec(src->get<arrayType>()->view());
+    size_t nBytes = srcVec.size()*sizeof(arrayValType);
+
+    NTNDArrayInfo_t info = getInfo();
+    if (info.codec.empty() && (nBytes < info.totalBytes))
+        throw std::runtime_error("value is smaller than dimensions require");
+
+    NTNDArrayBufferOwner *owner = new NTNDArrayBufferOwner(static_shared_vector_cast<const void>(srcVec));
+    NDArray *dest = pool->alloc(info.ndims, info.dims, info.dataType, nBytes,
+            (void *)srcVec.data(), owner);
+    if (!dest) {
+        delete owner;
+        throw std::runtime_error("unable to allocate NDArray");
+    }
+
+    dest->codec.name = info.codec;
+    dest->compressedSize = nBytes;
+    return dest;
+}
+
+NDArray *NTNDArrayConverter::toValueZeroCopy (NDArrayPool *pool)
+{
+    switch(getValueType())
+    {
+    case pvByte:    return toValueZeroCopy<PVByteArray>  (pool);
+    case pvUByte:   return toValueZeroCopy<PVUByteArray> (pool);
+    case pvShort:   return toValueZeroCopy<PVShortArray> (pool);
+    case pvUShort:  return toValueZeroCopy<PVUShortArray>(pool);
+    case pvInt:     return toValueZeroCopy<PVIntArray>   (pool);
+    case pvUInt:    return toValueZeroCopy<PVUIntArray>  (pool);
+    case pvLong:    return toValueZeroCopy<PVLongArray>  (pool);
+    case pvULong:   return toValueZeroCopy<PVULongArray> (pool);
+    case pvFloat:   return toValueZeroCopy<PVFloatArray> (pool);
+    case pvDouble:  return toValueZeroCopy<PVDoubleArray>(pool);
+    case pvBoolean:
+    case pvString:
+    default:
+        throw std::runtime_error("invalid value data type");
+    }
+}
+
 void NTNDArrayConverter::toDimensions (NDArray *dest)
 {
     PVStructureArrayPtr src(m_array->getDimension());
@@ -321,41 +401,46 @@ void NTNDArrayConverter::toDataTimeStamp (NDArray *dest)
     dest->timeStamp = ts.toSeconds() - POSIX_TIME_AT_EPICS_EPOCH;
 }
 
-template <typename pvAttrType, typename valueType>
-void NTNDArrayConverter::toAttribute (NDArray *dest, PVStructurePtr src)
+/* Updates the value of an existing attribute with the same name and type, so that the
+ * attribute list of a reused NDArray is not rebuilt on every frame; otherwise adds a new one. */
+void NTNDArrayConverter::toAttributeValue (NDArray *dest, PVStructurePtr src,
+        NDAttrDataType_t dataType, void *pValue)
 {
-    const char *name          = src->getSubField<PVString>("name")->get().c_str();
+    const string& name = src->getSubField<PVString>("name")->get();
+    NDAttribute *attr = dest->pAttributeList->find(name.c_str());
+
+    if (attr && attr->getDataType() == dataType) {
+        attr->setValue(pValue);
+        return;
+    }
+
     const char *desc          = src->getSubField<PVString>("descriptor")->get().c_str();
     NDAttrSource_t sourceType = (NDAttrSource_t)src->getSubField<PVInt>("sourceType")->get();
     const char *source        = src->getSubField<PVString>("source")->get().c_str();
+
+    attr = new NDAttribute(name.c_str(), desc, sourceType, source, dataType, pValue);
+    dest->pAttributeList->add(attr);
+}
+
+template <typename pvAttrType, typename valueType>
+void NTNDArrayConverter::toAttribute (NDArray *dest, PVStructurePtr src)
+{
     NDAttrDataType_t dataType = scalarToNDAttrDataType[pvAttrType::typeCode];
     valueType value           = src->getSubField<PVUnion>("value")->get<pvAttrType>()->get();
 
-    NDAttribute *attr = new NDAttribute(name, desc, sourceType, source, dataType, (void*)&value);
-    dest->pAttributeList->add(attr);
+    toAttributeValue(dest, src, dataType, (void*)&value);
 }
 
 void NTNDArrayConverter::toStringAttribute (NDArray *dest, PVStructurePtr src)
 {
-    const char *name          = src->getSubField<PVString>("name")->get().c_str();
-    const char *desc          = src->getSubField<PVString>("descriptor")->get().c_str();
-    NDAttrSource_t sourceType = (NDAttrSource_t)src->getSubField<PVInt>("sourceType")->get();
-    const char *source        = src->getSubField<PVString>("source")->get().c_str();
-    const char *value         = src->getSubField<PVUnion>("value")->get<PVString>()->get().c_str();
+    const char *value = src->getSubField<PVUnion>("value")->get<PVString>()->get().c_str();
 
-    NDAttribute *attr = new NDAttribute(name, desc, sourceType, source, NDAttrString, (void*)value);
-    dest->pAttributeList->add(attr);
+    toAttributeValue(dest, src, NDAttrString, (void*)value);
 }
 
 void NTNDArrayConverter::toUndefinedAttribute (NDArray *dest, PVStructurePtr src)
 {
-    const char *name          = src->getSubField<PVString>("name")->get().c_str();
-    const char *desc          = src->getSubField<PVString>("descriptor")->get().c_str();
-    NDAttrSource_t sourceType = (NDAttrSource_t)src->getSubField<PVInt>("sourceType")->get();
-    const char *source        = src->getSubField<PVString>("source")->get().c_str();
-
-    NDAttribute *attr = new NDAttribute(name, desc, sourceType, source, NDAttrUndefined, NULL);
-    dest->pAttributeList->add(attr);
+    toAttributeValue(dest, src, NDAttrUndefined, NULL);
 }
 
 void NTNDArrayConverter::toAttributes (NDArray *dest)
@@ -503,21 +588,20 @@ void NTNDArrayConverter::fromTimeStamp (NDArray *src)
 }
 
 template <typename pvAttrType, typename valueType>
-void NTNDArrayConverter::fromAttribute (PVStructurePtr dest, NDAttribute *src)
+void NTNDArrayConverter::fromAttribute (PVUnionPtr dest, NDAttribute *src)
 {
     valueType value;
     src->getValue(src->getDataType(), (void*)&value);
 
-    PVUnionPtr destUnion(dest->getSubFieldT<PVUnion>("value"));
-    typename pvAttrType::shared_pointer valueFld(destUnion->get<pvAttrType>());
+    typename pvAttrType::shared_pointer valueFld(dest->get<pvAttrType>());
     if(!valueFld) {
         valueFld = PVDC->createPVScalar<pvAttrType>();
-        destUnion->set(valueFld);
+        dest->set(valueFld);
     }
     valueFld->put(value);
 }
 
-void NTNDArrayConverter::fromStringAttribute (PVStructurePtr dest, NDAttribute *src)
+void NTNDArrayConverter::fromStringAttribute (PVUnionPtr dest, NDAttribute *src)
 {
     NDAttrDataType_t attrDataType;
     size_t attrDataSize;
@@ -526,19 +610,18 @@ void NTNDArrayConverter::fromStringAttribute (PVStructurePtr dest, NDAttribute *
     std::vector<char> value(attrDataSize);
     src->getValue(attrDataType, &value[0], attrDataSize);
 
-    PVUnionPtr destUnion(dest->getSubFieldT<PVUnion>("value"));
-    PVStringPtr valueFld(destUnion->get<PVString>());
+    PVStringPtr valueFld(dest->get<PVString>());
     if(!valueFld) {
         valueFld = PVDC->createPVScalar<PVString>();
-        destUnion->set(valueFld);
+        dest->set(valueFld);
     }
     valueFld->put(&value[0]);
 }
 
-void NTNDArrayConverter::fromUndefinedAttribute (PVStructurePtr dest)
+void NTNDArrayConverter::fromUndefinedAttribute (PVUnionPtr dest)
 {
     PVFieldPtr nullPtr;
-    dest->getSubField<PVUnion>("value")->set(nullPtr);
+    dest->set(nullPtr);
 }
 
 void NTNDArrayConverter::fromAttributes (NDArray *src)
@@ -550,6 +633,7 @@ void NTNDArrayConverter::fromAttributes (NDArray *src)
     PVStructureArray::svector destVec(dest->reuse());
 
     destVec.resize(srcList->count());
+    m_attrCache.resize(destVec.size());
 
     size_t i = 0;
     while((attr = srcList->next(attr)))
@@ -558,29 +642,40 @@ void NTNDArrayConverter::fromAttributes (NDArray *src)
             destVec[i] = PVDC->createPVStructure(structure);
 
         PVStructurePtr pvAttr(destVec[i]);
+        CachedAttribute& cached = m_attrCache[i];
 
-        pvAttr->getSubField<PVString>("name")->put(attr->getName());
-        pvAttr->getSubField<PVString>("descriptor")->put(attr->getDescription());
-        pvAttr->getSubField<PVString>("source")->put(attr->getSource());
+        // Only rewrite the strings if this is a new structure or a different attribute
+        if(cached.structure.lock() != pvAttr || cached.name != attr->getName())
+        {
+            cached.structure = pvAttr;
+            cached.name      = attr->getName();
+            cached.value     = pvAttr->getSubField<PVUnion>("value");
+
+            pvAttr->getSubField<PVString>("name")->put(cached.name);
+            pvAttr->getSubField<PVString>("descriptor")->put(attr->getDescription());
+            pvAttr->getSubField<PVString>("source")->put(attr->getSource());
+
+            NDAttrSource_t sourceType;
+            attr->getSourceInfo(&sourceType);
+            pvAttr->getSubField<PVInt>("sourceType")->put(sourceType);
+        }
 
-        NDAttrSource_t sourceType;
-        attr->getSourceInfo(&sourceType);
-        pvAttr->getSubField<PVInt>("sourceType")->put(sourceType);
+        PVUnionPtr value(cached.value);
 
         switch(attr->getDataType())
         {
-        case NDAttrInt8:      fromAttribute <PVByte,   int8_t>  (pvAttr, attr); break;
-        case NDAttrUInt8:     fromAttribute <PVUByte,  uint8_t> (pvAttr, attr); break;
-        case NDAttrInt16:     fromAttribute <PVShort,  int16_t> (pvAttr, attr); break;
-        case NDAttrUInt16:    fromAttribute <PVUShort, uint16_t>(pvAttr, attr); break;
-        case NDAttrInt32:     fromAttribute <PVInt,    int32_t> (pvAttr, attr); break;
-        case NDAttrUInt32:    fromAttribute <PVUInt,   uint32_t>(pvAttr, attr); break;
-        case NDAttrInt64:     fromAttribute <PVLong,   int64_t> (pvAttr, attr); break;
-        case NDAttrUInt64:    fromAttribute <PVULong,  uint64_t>(pvAttr, attr); break;
-        case NDAttrFloat32:   fromAttribute <PVFloat,  float>   (pvAttr, attr); break;
-        case NDAttrFloat64:   fromAttribute <PVDouble, double>  (pvAttr, attr); break;
-        case NDAttrString:    fromStringAttribute(pvAttr, attr); break;
-        case NDAttrUndefined: fromUndefinedAttribute(pvAttr); break;
+        case NDAttrInt8:      fromAttribute <PVByte,   int8_t>  (value, attr); break;
+        case NDAttrUInt8:     fromAttribute <PVUByte,  uint8_t> (value, attr); break;
+        case NDAttrInt16:     fromAttribute <PVShort,  int16_t> (value, attr); break;
+        case NDAttrUInt16:    fromAttribute <PVUShort, uint16_t>(value, attr); break;
+        case NDAttrInt32:     fromAttribute <PVInt,    int32_t> (value, attr); break;
+        case NDAttrUInt32:    fromAttribute <PVUInt,   uint32_t>(value, attr); break;
+        case NDAttrInt64:     fromAttribute <PVLong,   int64_t> (value, attr); break;
+        case NDAttrUInt64:    fromAttribute <PVULong,  uint64_t>(value, attr); break;
+        case NDAttrFloat32:   fromAttribute <PVFloat,  float>   (value, attr); break;
+        case NDAttrFloat64:   fromAttribute <PVDouble, double>  (value, attr); break;
+        case NDAttrString:    fromStringAttribute(value, attr); break;
+        case NDAttrUndefined: fromUndefinedAttribute(value); break;
         default:              throw std::runtime_error("invalid attribute data type");
         }
 
@@ -589,7 +684,3 @@ void NTNDArrayConverter::fromAttributes (NDArray *src)
 
     dest->replace(freeze(destVec));
 }
-
-
-
-
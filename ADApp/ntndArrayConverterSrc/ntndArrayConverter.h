@@ -1,4 +1,5 @@
 #include <math.h>
+#include <vector>
 
 #include <ntndArrayConverterAPI.h>
 #include <NDArray.h>
@@ -28,17 +29,32 @@ public:
 
     NTNDArrayInfo_t getInfo (void);
     void toArray (NDArray *dest);
+    NDArray *toArrayZeroCopy (NDArrayPool *pool);
     void fromArray (NDArray *src);
 
 private:
     epics::nt::NTNDArrayPtr m_array;
 
+    // Fields of the attribute structures written by fromAttributes, cached so that
+    // the name, descriptor and source only need to be written when an attribute changes
+    struct CachedAttribute
+    {
+        // Weak so that the cache does not stop fromAttributes reusing the structure
+        std::tr1::weak_ptr<epics::pvData::PVStructure> structure;
+        std::string name;
+        epics::pvData::PVUnionPtr value;
+    };
+    std::vector<CachedAttribute> m_attrCache;
+
     epics::pvData::ScalarType getValueType (void);
     NDColorMode_t getColorMode (void);
 
     template <typename arrayType>
     void toValue (NDArray *dest);
     void toValue (NDArray *dest);
+    template <typename arrayType>
+    NDArray *toValueZeroCopy (NDArrayPool *pool);
+    NDArray *toValueZeroCopy (NDArrayPool *pool);
 
     void toDimensions (NDArray *dest);
     void toTimeStamp (NDArray *dest);
@@ -48,6 +64,8 @@ private:
     void toAttribute (NDArray *dest, epics::pvData::PVStructurePtr src);
     void toStringAttribute (NDArray *dest, epics::pvData::PVStructurePtr src);
     void toUndefinedAttribute (NDArray *dest, epics::pvData::PVStructurePtr src);
+    void toAttributeValue (NDArray *dest, epics::pvData::PVStructurePtr src,
+            NDAttrDataType_t dataType, void *pValue);
     void toAttributes (NDArray *dest);
 
     template <typename arrayType, typename srcDataType>
@@ -59,9 +77,9 @@ private:
     void fromDataTimeStamp (NDArray *src);
 
     template <typename pvAttrType, typename valueType>
-    void fromAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
-    void fromStringAttribute (epics::pvData::PVStructurePtr dest, NDAttribute *src);
-    void fromUndefinedAttribute (epics::pvData::PVStructurePtr dest);
+    void fromAttribute (epics::pvData::PVUnionPtr dest, NDAttribute *src);
+    void fromStringAttribute (epics::pvData::PVUnionPtr dest, NDAttribute *src);
+    void fromUndefinedAttribute (epics::pvData::PVUnionPtr dest);
     void fromAttributes (NDArray *src);
 };
 
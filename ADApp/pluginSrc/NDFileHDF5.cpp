@@ -40,7 +40,8 @@ enum HDF5Compression_t {HDF5CompressNone=0,
                         HDF5CompressBlosc,
                         HDF5CompressBshuf,
                         HDF5CompressLZ4,
-                        HDF5CompressJPEG};
+                        HDF5CompressJPEG,
+                        HDF5CompressZstd};
 /* Filter ID officially assigned to blosc */
 #define FILTER_BLOSC 32001
 /* Filter ID officially assigned to bitshuffle */
@@ -49,10 +50,17 @@ enum HDF5Compression_t {HDF5CompressNone=0,
 #define FILTER_LZ4 32004
 /* Filter ID officially assigned to jpeg */
 #define FILTER_JPEG 32019
+/* Filter ID officially assigned to zstd */
+#define FILTER_ZSTD 32015
 
 #define DIMSREPORTSIZE 512
 #define DIMNAMESIZE 40
 #define ALIGNMENT_BOUNDARY 1048576
+#define MAX_ATTRIBUTE_WRITE_BLOCK 1024 /* Largest number of frames of attribute values that are buffered */
+#define DIRECT_IO_ALIGN 4096 /* Alignment for direct I/O when ChunkBoundaryAlign is 0 */
+#define DIRECT_IO_BUFFER_SIZE 16777216 /* Size of the buffer that the direct I/O driver copies unaligned data through */
+#define FLUSH_IDLE_WAIT 1.0 /* Seconds flushTask waits for a flush event when no periodic flush is due */
+#define FLUSH_MIN_WAIT 0.001 /* Shortest wait of flushTask before a periodic flush */
 #define INFINITE_FRAMES_CAPTURE 10000 /* Used to calculate istorek (the size of the chunk index binar search tree) when capturing infinite number of frames */
 
 #ifdef HDF5_BTREE_IK_MAX_ENTRIES
@@ -149,6 +157,20 @@ const char *NDFileHDF5::str_NDFileHDF5_posIndex[MAXEXTRADIMS] = {
     "HDF5_posIndexDim8",
     "HDF5_posIndexDim9"
 };
+const char *NDFileHDF5::str_NDFileHDF5_phaseMean[NDFileHDF5NumPhases] = {
+    "HDF5_phaseLockWait",
+    "HDF5_phaseExtend",
+    "HDF5_phaseWrite",
+    "HDF5_phaseAttributes",
+    "HDF5_phaseFlush"
+};
+const char *NDFileHDF5::str_NDFileHDF5_phaseMax[NDFileHDF5NumPhases] = {
+    "HDF5_phaseLockWaitMax",
+    "HDF5_phaseExtendMax",
+    "HDF5_phaseWriteMax",
+    "HDF5_phaseAttributesMax",
+    "HDF5_phaseFlushMax"
+};
 
 /** The task to run the thread for flush commands
  * \param[in] drvPvt Pointer to the NDFileHDF5 object
@@ -159,10 +181,17 @@ static void flushTaskC(void *drvPvt)
     pPlugin->flushTask();
 }
 
+static void writeBehindTaskC(void *drvPvt)
+{
+    NDFileHDF5 *pPlugin = (NDFileHDF5 *)drvPvt;
+    pPlugin->writeBehindTask();
+}
+
 /** Opens a HDF5 file.
  * In write mode if NDFileModeMultiple is set then the first dataspace dimension is set to H5S_UNLIMITED to allow
  * multiple arrays to be written to the same file.
- * NOTE: Does not currently support NDFileModeRead or NDFileModeAppend.
+ * In read mode the file is opened with an NDFileHDF5Reader, which reads the dataset named by HDF5_readDataset.
+ * NOTE: Does not currently support NDFileModeAppend.
  * \param[in] fileName  Absolute path name of the file to open.
  * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite, NDFileModeAppend.
  *           May also have the bit NDFileModeMultiple set if the file is to be opened to write or read multiple
@@ -171,23 +200,116 @@ static void flushTaskC(void *drvPvt)
  *           structure for the file.
  */
 asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
+{
+  int writeBehind;
+  epicsInt32 numCaptured;
+  asynStatus status;
+
+  // A file is read with its own handles, so this does not disturb a file that is open for writing
+  if (openMode & NDFileModeRead) {
+    return this->openReadFile(fileName);
+  }
+  // HDF5 cannot create a file that is still open for reading, and a rewritten file must be read again
+  this->closeReadFile();
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_writeBehind, &writeBehind);
+  getIntegerParam(NDFileNumCaptured, &numCaptured);
+  this->unlock();
+
+  if (this->writeBehindActive){
+    // The next file of a rotation is opened by writeBehindTask after the previous file is closed
+    if (this->rotatingFile && (writeBehind == 1) && !(openMode & (NDFileModeRead | NDFileModeAppend))){
+      return this->queueOpen(fileName, openMode, pArray, numCaptured);
+    }
+    // Write the queued arrays to the file that is open before it is closed
+    this->drainWriteQueue();
+    writeQueueLock.lock();
+    this->writeBehindActive = false;
+    this->writeBehindStatus = asynSuccess;
+    writeQueueLock.unlock();
+  }
+
+  status = this->openNewFile(fileName, openMode, pArray, numCaptured, NULL);
+  if (status != asynSuccess) return status;
+
+  // Arrays for this file are written by writeBehindTask if write-behind is enabled
+  writeQueueLock.lock();
+  this->writeBehindActive = (writeBehind == 1);
+  this->writeBehindStatus = asynSuccess;
+  this->writeBehindStallTime = 0.0;
+  writeQueueLock.unlock();
+  this->setWriteQueueParams();
+
+  return asynSuccess;
+}
+
+/** Creates a new HDF5 file and its layout.
+  * Called by openFile, or by writeBehindTask for the next file of a rotation.
+  * \param[in] fileName Absolute path name of the file to open.
+  * \param[in] openMode Bit mask with the access mode bits, as for openFile.
+  * \param[in] pArray Pointer to the NDArray used to determine the structure of the file.
+  * \param[in] numCaptured The value of NDFileNumCaptured when the file was opened.
+  * \param[in] pAttributes The plugin attributes read when the open was queued, or NULL to read them now.
+  */
+asynStatus NDFileHDF5::openNewFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray,
+                                   epicsInt32 numCaptured, NDAttributeList *pAttributes)
 {
   int storeAttributes, storePerformance;
-  static const char *functionName = "openFile";
+  static const char *functionName = "openNewFile";
   int numCapture;
+  int numShards, shard, extraDims, preSize, perfDetail;
+  std::string dataFileName = fileName;
   asynStatus status = asynSuccess;
+  epicsTimeStamp startTime, endTime;
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Filename: %s\n", driverName, functionName, fileName);
+  epicsTimeGetCurrent(&startTime);
 
   /* These operations are accessing parameter library, must take lock */
   this->lock();
   // Reset flush counter
   setIntegerParam(NDFileHDF5_SWMRCbCounter, 0);
+  getDoubleParam(NDFileHDF5_SWMRFlushPeriod, &this->swmrFlushPeriod);
+  epicsTimeGetCurrent(&this->lastFlushTime);
   getIntegerParam(NDFileNumCapture, &numCapture);
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
+  getIntegerParam(NDFileHDF5_performanceDetail, &perfDetail);
+  getIntegerParam(NDFileHDF5_performanceWindow, &this->phaseWindow);
+  getIntegerParam(NDFileHDF5_shardCount, &numShards);
+  getIntegerParam(NDFileHDF5_shardIndex, &shard);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
+
+  // The phases of writing each frame are timed for the rolling statistics, and stored after the
+  // standard columns of the performance dataset
+  this->perfDetail = (perfDetail == 1);
+  this->performanceColumns = this->perfDetail ? 5 + NDFileHDF5NumPhases : 5;
+  if (this->phaseWindow < 1) this->phaseWindow = 1;
+  this->resetPhaseTimes();
+
+  // Check the shard settings; a sharded file is one long series of frames
+  this->shardCount = (numShards > 1) ? numShards : 1;
+  this->shardIndex = 0;
+  this->shardFrames = 0;
+  if (this->shardCount > 1){
+    if (shard < 0 || shard >= this->shardCount){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s Invalid shard index %d for %d shards\n",
+                driverName, functionName, shard, this->shardCount);
+      status = asynError;
+    }
+    if ((openMode & NDFileModeMultiple) && extraDims > 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s Shard files cannot have extra dimensions\n",
+                driverName, functionName);
+      status = asynError;
+    }
+    this->shardIndex = shard;
+    dataFileName = this->shardFileName(fileName, shard);
+  }
 
-  // We don't support reading yet
+  // Files are read by openReadFile, not through the write path
   if (openMode & NDFileModeRead) {
     setIntegerParam(NDFileCapture, 0);
     setIntegerParam(NDWriteFile, 0);
@@ -229,6 +351,15 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
     this->unlock();
   }
 
+  // The detector datasets can be created at full size if the number of frames is known.
+  // SWMR readers use the size of the datasets to see how many frames have been written.
+  this->lock();
+  getIntegerParam(NDFileHDF5_preSize, &preSize);
+  getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
+  this->unlock();
+  this->preSized = (preSize == 1) && this->multiFrameFile && (extraDims == 0) && (numCapture > 0) &&
+                   !checkForSWMRMode();
+
   epicsTimeGetCurrent(&this->prevts);
   this->opents = this->prevts;
   NDArrayInfo_t info;
@@ -246,7 +377,11 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   this->addDefaultAttributes(pArray);
 
   // Now get the current values of the attributes for this plugin
-  this->getAttributes(this->pFileAttributes);
+  if (pAttributes){
+    pAttributes->copy(this->pFileAttributes);
+  } else {
+    this->getAttributes(this->pFileAttributes);
+  }
 
   // Now append the attributes from the array which are already up to date from the driver and prior plugins
   pArray->pAttributeList->copy(this->pFileAttributes);
@@ -267,13 +402,23 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   }
 
   // Create the new file
-  if (this->createNewFile(fileName)){
+  if (this->createNewFile(dataFileName.c_str())){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s::%s ERROR Failed to create a new output file\n",
               driverName, functionName);
     return asynError;
   }
 
+  // With direct I/O the arrays are written without a copy if their data are aligned to the disk blocks.
+  // The pool belongs to the driver and is shared with other plugins, so it is not changed here
+  setIntegerParam(NDFileHDF5_directIORunning, (this->directIOAlign > 0) ? 1 : 0);
+  if (this->directIOAlign > 0 && pArray->pNDArrayPool &&
+      pArray->pNDArrayPool->getAlignment() < this->directIOAlign){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+              "%s::%s The NDArrayPool alignment is less than %llu bytes, the arrays are copied for direct I/O\n",
+              driverName, functionName, (unsigned long long)this->directIOAlign);
+  }
+
   // Now create the layout within the file
   if (this->createFileLayout(pArray)){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -295,7 +440,7 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
 
   if (storeAttributes == 1){
     this->createAttributeDataset(pArray);
-    this->writeAttributeDataset(hdf5::OnFileOpen, 0, NULL);
+    this->writeAttributeDataset(hdf5::OnFileOpen, 0, NULL, numCaptured);
 
 
     // Store any attributes that have been marked as onOpen
@@ -319,6 +464,16 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
   hdf5::Root *root = this->layout.get_hdftree();
   this->createHardLinks(root);
 
+  // The first shard writes the master file, which has the same datasets as the shard files
+  if (this->shardCount > 1 && this->shardIndex == 0){
+    if (this->createVirtualMaster(fileName, dataFileName.c_str())){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Failed to create the master file %s\n",
+                driverName, functionName, fileName);
+      return asynError;
+    }
+  }
+
   // Check if we are in SWMR mode
   if (checkForSWMRMode()){
     // Call the method to place the file into SWMR
@@ -333,71 +488,215 @@ asynStatus NDFileHDF5::openFile(const char *fileName, NDFileOpenMode_t openMode,
     }
   }
 
+  epicsTimeGetCurrent(&endTime);
+  this->openTime = epicsTimeDiffInSeconds(&endTime, &startTime);
+  this->lock();
+  setDoubleParam(NDFileHDF5_openTime, this->openTime);
+  this->unlock();
+
   return asynSuccess;
 }
 
 /** Thread function for flush now command
- * Waits for flush events, and upon receiving one, flushes all datasets and attributes, ensuring
- * that the unique ID attribute is the last attribute flushed
+ * Waits for flush events, and upon receiving one, flushes the datasets that were written since
+ * the last flush, ensuring that the unique ID attribute is the last attribute flushed.
+ * If SWMRFlushPeriod is set it also flushes them when no frame has caused a flush for that long,
+ * so that SWMR readers see the last frames when frames stop arriving.
  */
 void NDFileHDF5::flushTask()
 {
     const char* functionName = "flushTask";
-    NDAttribute *ndAttr = NULL;
-    NDFileHDF5AttributeDataset *uniqueIDNode = NULL;
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Started flushTask thread\n", driverName, functionName);
     while (1){
-        // Wait for a flush event
-        epicsEventWait(this->flushEventId);
-        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Received flush event\n", driverName, functionName);
-        // Now lock the flushLock
-        flushLock.lock();
-        // Perform the flush
-        if (checkForSWMRMode()){
-            // We are in SWMR mode so flush all datasets
-            std::map<std::string, NDFileHDF5Dataset *>::iterator iter;
-            for (iter = this->detDataMap.begin(); iter != this->detDataMap.end(); ++iter){
-                iter->second->flushDataset();
+        // Wait for a flush event, or until the periodic flush is due
+        if (epicsEventWaitWithTimeout(this->flushEventId, this->flushWaitTime()) == epicsEventWaitOK){
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Received flush event\n", driverName, functionName);
+            this->flushDatasets();
+        } else {
+            this->flushIfDue();
+        }
+    }
+}
+
+/** Returns the time in seconds that flushTask waits for a flush event before it checks if the
+ * periodic flush is due
+ */
+double NDFileHDF5::flushWaitTime()
+{
+    epicsTimeStamp now;
+    double waitTime = FLUSH_IDLE_WAIT;
+
+    flushLock.lock();
+    if (this->file != 0 && this->swmrFlushPeriod > 0.0){
+        epicsTimeGetCurrent(&now);
+        waitTime = this->swmrFlushPeriod - epicsTimeDiffInSeconds(&now, &this->lastFlushTime);
+        if (waitTime < FLUSH_MIN_WAIT) waitTime = FLUSH_MIN_WAIT;
+    }
+    flushLock.unlock();
+    return waitTime;
+}
+
+/** Flushes the datasets written since the last flush if SWMR is running on the open file and
+ * the last flush was at least SWMRFlushPeriod ago
+ */
+void NDFileHDF5::flushIfDue()
+{
+    epicsTimeStamp now;
+    int swmrRunning = 0;
+
+    flushLock.lock();
+    if (this->file != 0 && this->swmrFlushPeriod > 0.0){
+        this->lock();
+        getIntegerParam(NDFileHDF5_SWMRRunning, &swmrRunning);
+        this->unlock();
+        epicsTimeGetCurrent(&now);
+        if (swmrRunning && epicsTimeDiffInSeconds(&now, &this->lastFlushTime) >= this->swmrFlushPeriod){
+            this->flushDirtyDatasets();
+        }
+    }
+    flushLock.unlock();
+}
+
+/** Flushes the datasets written since the last flush, and then clears the SWMRFlushNow parameter.
+ * Called by flushTask, or by writeBehindTask when the flush was queued behind arrays.
+ */
+void NDFileHDF5::flushDatasets()
+{
+    // Now lock the flushLock
+    flushLock.lock();
+    // Perform the flush
+    if (checkForSWMRMode() && this->file != 0){
+        this->flushDirtyDatasets();
+    }
+
+    // Unlock the flushLock
+    flushLock.unlock();
+    // Now take the standard lock
+    this->lock();
+    // Update the flush parameter
+    setIntegerParam(NDFileHDF5_SWMRFlushNow, 0);
+    callParamCallbacks();
+    // Unlock the standard lock
+    this->unlock();
+}
+
+/** Flushes the detector and attribute datasets that were written since the last flush,
+ * ensuring that the unique ID attribute is the last attribute flushed.
+ * The caller must hold flushLock.
+ */
+asynStatus NDFileHDF5::flushDirtyDatasets()
+{
+    const char* functionName = "flushDirtyDatasets";
+    NDFileHDF5AttributeDataset *uniqueIDNode = NULL;
+    asynStatus status = asynSuccess;
+
+    std::map<std::string, NDFileHDF5Dataset *>::iterator iter;
+    for (iter = this->detDataMap.begin(); iter != this->detDataMap.end(); ++iter){
+        if (iter->second->isDirty()){
+            if (iter->second->flushDataset()) status = asynError;
+        }
+    }
+    // Write any buffered attribute values, then flush the attribute datasets that were written
+    if (this->writeAttributeBuffers()) status = asynError;
+    for (std::list<NDFileHDF5AttributeDataset*>::iterator it_node = attrList.begin(); it_node != attrList.end(); ++it_node){
+        NDFileHDF5AttributeDataset *hdfAttrNode = *it_node;
+        // We do not want to flush the unique ID attribute at this stage
+        if (strcmp(uniqueIDName, hdfAttrNode->getName().c_str())){
+            if (!hdfAttrNode->isDirty()) continue;
+            // find the named attribute in the NDAttributeList
+            if (this->pFileAttributes->find(hdfAttrNode->getName().c_str()) == NULL){
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                        "%s::%s WARNING: NDAttribute named \'%s\' not found\n",
+                        driverName, functionName, hdfAttrNode->getName().c_str());
+                continue;
             }
-            // Now flush all attribute datasets
-            for (std::list<NDFileHDF5AttributeDataset*>::iterator it_node = attrList.begin(); it_node != attrList.end(); ++it_node){
-                NDFileHDF5AttributeDataset *hdfAttrNode = *it_node;
-                // find the named attribute in the NDAttributeList
-                // We do not want to flush the unique ID attribute at this stage
-                if (strcmp(uniqueIDName, hdfAttrNode->getName().c_str())){
-                    ndAttr = this->pFileAttributes->find(hdfAttrNode->getName().c_str());
-                    if (ndAttr == NULL){
-                        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
-                                "%s::%s WARNING: NDAttribute named \'%s\' not found\n",
-                                driverName, functionName, hdfAttrNode->getName().c_str());
-                        continue;
-                    }
-                    hdfAttrNode->flushDataset();
-                } else {
-                    // Keep the unique ID node ready to flush it as the last attribute
-                    uniqueIDNode = *it_node;
+            if (hdfAttrNode->flushDataset()) status = asynError;
+        } else {
+            // Keep the unique ID node ready to flush it as the last attribute
+            uniqueIDNode = *it_node;
+        }
+    }
+    // Now locate and flush the unique ID attribute ensuring it is the last attribute flushed
+    if (this->pFileAttributes->find(uniqueIDName) == NULL || uniqueIDNode == NULL){
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+          "%s::%s WARNING: NDAttribute named \'NDArrayUniqueId\' not found\n",
+          driverName, functionName);
+    } else if (uniqueIDNode->isDirty()){
+        if (uniqueIDNode->flushDataset()) status = asynError;
+    }
+    epicsTimeGetCurrent(&this->lastFlushTime);
+    return status;
+}
+
+/** Thread function for write-behind
+ * Writes the queued arrays and does the queued flushes, closes and opens in the order in which
+ * they were queued. A job stays at the front of the queue until it is done, so that drainWriteQueue
+ * waits for it.
+ */
+void NDFileHDF5::writeBehindTask()
+{
+    const char* functionName = "writeBehindTask";
+    NDFileHDF5WriteJob job;
+    asynStatus status;
+    char errorMessage[256];
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Started writeBehindTask thread\n", driverName, functionName);
+    while (1){
+        // Wait for a job to be queued
+        epicsEventWait(this->writeQueueEventId);
+        writeQueueLock.lock();
+        while (!this->writeQueue.empty()){
+            job = this->writeQueue.front();
+            writeQueueLock.unlock();
+            status = asynSuccess;
+            switch (job.type){
+              case NDFileHDF5JobWrite:
+                status = this->writeArray(job.pArray, job.numCaptured, job.pAttributes);
+                epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+                    "Error writing file, status=%d", status);
+                break;
+              case NDFileHDF5JobFlush:
+                this->flushDatasets();
+                break;
+              case NDFileHDF5JobClose:
+                status = this->closeOpenFile(job.numCaptured);
+                epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+                    "Error closing file, status=%d", status);
+                if (this->renameTempFile(job.fileName.c_str(), job.tempSuffix.c_str(),
+                                         errorMessage, sizeof(errorMessage))){
+                    status = asynError;
                 }
+                break;
+              case NDFileHDF5JobOpen:
+                status = this->openNewFile(job.fileName.c_str(), job.openMode, job.pArray, job.numCaptured, job.pAttributes);
+                epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+                    "Error opening file %s, status=%d", job.fileName.c_str(), status);
+                break;
             }
-            // Now locate and flush the unique ID attribute ensuring it is the last attribute flushed
-            ndAttr = this->pFileAttributes->find(uniqueIDName);
-            if (ndAttr == NULL || uniqueIDNode == NULL){
-                asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
-                  "%s::%s WARNING: NDAttribute named \'NDArrayUniqueId\' not found\n",
-                  driverName, functionName);
-            } else {
-                uniqueIDNode->flushDataset();
+            writeQueueLock.lock();
+            this->writeQueue.pop_front();
+            if (job.type == NDFileHDF5JobWrite){
+                this->writeQueueArrays--;
+                this->writeQueueBytes -= job.pArray->dataSize;
             }
+            if (status != asynSuccess) this->writeBehindStatus = status;
+            writeQueueLock.unlock();
+            if (job.pArray) job.pArray->release();
+            delete job.pAttributes;
+            if (job.type == NDFileHDF5JobWrite) this->setWriteQueueParams();
+            if (status != asynSuccess){
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                          "%s::%s %s\n",
+                          driverName, functionName, errorMessage);
+                this->lock();
+                setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+                setStringParam(NDFileWriteMessage, errorMessage);
+                callParamCallbacks();
+                this->unlock();
+            }
+            epicsEventSignal(this->writeDoneEventId);
+            writeQueueLock.lock();
         }
-
-        // Unlock the flushLock
-        flushLock.unlock();
-        // Now take the standard lock
-        this->lock();
-        // Update the flush parameter
-        setIntegerParam(NDFileHDF5_SWMRFlushNow, 0);
-        callParamCallbacks();
-        // Unlock the standard lock
-        this->unlock();
+        writeQueueLock.unlock();
     }
 }
 
@@ -740,7 +1039,6 @@ asynStatus NDFileHDF5::createHardLinks(hdf5::Group* root)
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s error creating hard link from: %s to %s\n",
                   driverName, functionName, targetName.c_str(), linkName.c_str());
       }
-      delete it_hardlinks->second;
     }
 
     hdf5::Group::MapGroups_t::const_iterator it_group;
@@ -1345,23 +1643,262 @@ hid_t NDFileHDF5::createDatasetDetector(hid_t group, hdf5::Dataset *dset)
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
             "%s::%s Creating first empty dataset called \"%s\"\n",
             driverName, functionName, dsetname);
-  dataset = H5Dcreate2(group, dsetname, this->datatype, this->dataspace,
-                       H5P_DEFAULT, this->cparms, dset_access_plist);
+  if (this->preSized){
+    // Create the dataset with room for all of the frames so that it is never extended
+    std::vector<hsize_t> fullsize(this->framesize, this->framesize + this->rank);
+    fullsize[0] = this->maxdims[0];
+    hid_t filespace = H5Screate_simple(this->rank, &fullsize[0], this->maxdims);
+    dataset = H5Dcreate2(group, dsetname, this->datatype, filespace,
+                         H5P_DEFAULT, this->cparms, dset_access_plist);
+    H5Sclose(filespace);
+  } else {
+    dataset = H5Dcreate2(group, dsetname, this->datatype, this->dataspace,
+                         H5P_DEFAULT, this->cparms, dset_access_plist);
+  }
 
   H5Pclose(dset_access_plist);
 
   // Store the dataset into the detector dataset map
   this->detDataMap[dset->get_full_name()] = new NDFileHDF5Dataset(this->pasynUserSelf, dset->get_name(), dataset);
+  this->detDataMap[dset->get_full_name()]->setPreSized(this->preSized);
 
   return dataset;
 }
 
 /** Writes NDArray data to a HDF5 file.
+  * If write-behind was enabled when the file was opened the array is queued for writeBehindTask
+  * and this returns without waiting for the HDF5 calls; an error writing a queued array is
+  * returned by the next call to writeFile or closeFile.
   * \param[in] pArray Pointer to an NDArray to write to the file. This function can be called multiple
   *            times between the call to openFile and closeFile if NDFileModeMultiple was set in
   *            openMode in the call to NDFileHDF5::openFile.
   */
 asynStatus NDFileHDF5::writeFile(NDArray *pArray)
+{
+  epicsInt32 numCaptured;
+
+  this->lock();
+  getIntegerParam(NDFileNumCaptured, &numCaptured);
+  this->unlock();
+
+  if (this->writeBehindActive){
+    return this->queueArray(pArray, numCaptured);
+  }
+  return this->writeArray(pArray, numCaptured, NULL);
+}
+
+/** Queues an NDArray for writeBehindTask.
+  * Waits while the queue is over the WriteBehindMaxMemory or WriteBehindMaxArrays limits,
+  * adding the time to WriteBehindStallTime. The array is always queued if the queue is empty.
+  * \param[in] pArray Pointer to the NDArray; it is reserved until it has been written.
+  * \param[in] numCaptured The value of NDFileNumCaptured for this array.
+  */
+asynStatus NDFileHDF5::queueArray(NDArray *pArray, epicsInt32 numCaptured)
+{
+  asynStatus status;
+  int storeAttributes, maxMemory, maxArrays;
+  size_t maxBytes;
+  bool stalled = false;
+  epicsTimeStamp stallStart, stallEnd;
+  NDFileHDF5WriteJob job;
+  static const char *functionName = "queueArray";
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
+  getIntegerParam(NDFileHDF5_writeBehindMaxMemory, &maxMemory);
+  getIntegerParam(NDFileHDF5_writeBehindMaxArrays, &maxArrays);
+  this->unlock();
+  maxBytes = (size_t)(maxMemory > 0 ? maxMemory : 0) * 1024 * 1024;
+
+  job.type = NDFileHDF5JobWrite;
+  job.pArray = pArray;
+  job.numCaptured = numCaptured;
+  job.pAttributes = NULL;
+  if (storeAttributes == 1){
+    // The plugin attributes must have their values from when the array arrived, not when it is written
+    job.pAttributes = new NDAttributeList;
+    this->getAttributes(job.pAttributes);
+  }
+
+  writeQueueLock.lock();
+  while (this->writeQueueArrays > 0 &&
+         ((maxArrays > 0 && this->writeQueueArrays >= maxArrays) ||
+          (this->writeQueueBytes + pArray->dataSize > maxBytes))){
+    if (!stalled){
+      stalled = true;
+      epicsTimeGetCurrent(&stallStart);
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s::%s queue full (%d arrays, %lu bytes), waiting\n",
+                driverName, functionName, this->writeQueueArrays, (unsigned long)this->writeQueueBytes);
+    }
+    writeQueueLock.unlock();
+    epicsEventWait(this->writeDoneEventId);
+    writeQueueLock.lock();
+  }
+  pArray->reserve();
+  this->writeQueue.push_back(job);
+  this->writeQueueArrays++;
+  this->writeQueueBytes += pArray->dataSize;
+  if (stalled){
+    epicsTimeGetCurrent(&stallEnd);
+    this->writeBehindStallTime += epicsTimeDiffInSeconds(&stallEnd, &stallStart);
+  }
+  status = this->writeBehindStatus;
+  this->writeBehindStatus = asynSuccess;
+  writeQueueLock.unlock();
+  epicsEventSignal(this->writeQueueEventId);
+
+  this->setWriteQueueParams();
+  return status;
+}
+
+/** Queues a flush of the datasets behind the arrays already queued.
+  * \return true if the flush was queued, false if write-behind is not active and the caller must
+  *         signal flushTask instead.
+  */
+bool NDFileHDF5::queueFlush()
+{
+  bool queued = false;
+  NDFileHDF5WriteJob job;
+
+  job.type = NDFileHDF5JobFlush;
+  job.pArray = NULL;
+  job.pAttributes = NULL;
+  job.numCaptured = 0;
+
+  writeQueueLock.lock();
+  if (this->writeBehindActive){
+    this->writeQueue.push_back(job);
+    queued = true;
+  }
+  writeQueueLock.unlock();
+  if (queued) epicsEventSignal(this->writeQueueEventId);
+  return queued;
+}
+
+/** Queues the close of the open file behind the arrays already queued, when NDPluginFile is
+  * rotating to the next file. The file is renamed once it is closed if NDFileTempSuffix is set.
+  * \param[in] numCaptured The value of NDFileNumCaptured for the file.
+  */
+asynStatus NDFileHDF5::queueClose(epicsInt32 numCaptured)
+{
+  asynStatus status;
+  char fullFileName[2*MAX_FILENAME_LEN];
+  char tempSuffix[MAX_FILENAME_LEN];
+  NDFileHDF5WriteJob job;
+
+  this->lock();
+  getStringParam(NDFullFileName, sizeof(fullFileName), fullFileName);
+  getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
+  this->unlock();
+
+  job.type = NDFileHDF5JobClose;
+  job.pArray = NULL;
+  job.pAttributes = NULL;
+  job.numCaptured = numCaptured;
+  job.fileName = fullFileName;
+  job.tempSuffix = tempSuffix;
+  // Only the first shard has a master file to rename
+  if (this->shardCount > 1 && this->shardIndex != 0) job.tempSuffix = "";
+  // NDPluginFile must not rename the file before writeBehindTask has closed it
+  this->closeDeferred = true;
+
+  writeQueueLock.lock();
+  this->writeQueue.push_back(job);
+  status = this->writeBehindStatus;
+  this->writeBehindStatus = asynSuccess;
+  writeQueueLock.unlock();
+  epicsEventSignal(this->writeQueueEventId);
+  return status;
+}
+
+/** Queues the open of the next file behind the close of the previous one, when NDPluginFile is
+  * rotating to the next file. The arrays for the next file are queued behind it.
+  * \param[in] fileName Absolute path name of the file to open.
+  * \param[in] openMode Bit mask with the access mode bits, as for openFile.
+  * \param[in] pArray Pointer to the NDArray used to determine the structure of the file;
+  *            it is reserved until the file has been opened.
+  * \param[in] numCaptured The value of NDFileNumCaptured when the file was opened.
+  */
+asynStatus NDFileHDF5::queueOpen(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray, epicsInt32 numCaptured)
+{
+  NDFileHDF5WriteJob job;
+
+  job.type = NDFileHDF5JobOpen;
+  job.pArray = pArray;
+  job.numCaptured = numCaptured;
+  job.fileName = fileName;
+  job.openMode = openMode;
+  // The plugin attributes must have their values from when the file was opened
+  job.pAttributes = new NDAttributeList;
+  this->getAttributes(job.pAttributes);
+
+  pArray->reserve();
+  writeQueueLock.lock();
+  this->writeQueue.push_back(job);
+  this->writeBehindStallTime = 0.0;
+  writeQueueLock.unlock();
+  epicsEventSignal(this->writeQueueEventId);
+
+  this->setWriteQueueParams();
+  return asynSuccess;
+}
+
+/** Waits until writeBehindTask has written all of the queued arrays and done any queued flush.
+  */
+void NDFileHDF5::drainWriteQueue()
+{
+  writeQueueLock.lock();
+  while (!this->writeQueue.empty()){
+    writeQueueLock.unlock();
+    epicsEventWait(this->writeDoneEventId);
+    writeQueueLock.lock();
+  }
+  writeQueueLock.unlock();
+}
+
+/** Updates the write-behind queue size, memory and stall time parameters.
+  */
+void NDFileHDF5::setWriteQueueParams()
+{
+  int arrays;
+  double megabytes, stallTime;
+
+  writeQueueLock.lock();
+  arrays = this->writeQueueArrays;
+  megabytes = this->writeQueueBytes / (1024.0 * 1024.0);
+  stallTime = this->writeBehindStallTime;
+  writeQueueLock.unlock();
+
+  this->lock();
+  setIntegerParam(NDFileHDF5_writeBehindQueueSize, arrays);
+  setDoubleParam(NDFileHDF5_writeBehindMemory, megabytes);
+  setDoubleParam(NDFileHDF5_writeBehindStallTime, stallTime);
+  callParamCallbacks();
+  this->unlock();
+}
+
+/** Returns the time in seconds since *pStart, and sets *pStart to the current time
+  * so that the next phase is timed from the end of this one.
+  */
+static double phaseElapsed(epicsTimeStamp *pStart)
+{
+  epicsTimeStamp now;
+  double elapsed;
+
+  epicsTimeGetCurrent(&now);
+  elapsed = epicsTimeDiffInSeconds(&now, pStart);
+  *pStart = now;
+  return elapsed;
+}
+
+/** Writes an NDArray to the open file.
+  * Called by writeFile, or by writeBehindTask for queued arrays.
+  * \param[in] pArray Pointer to the NDArray to write.
+  * \param[in] numCaptured The value of NDFileNumCaptured for this array.
+  * \param[in] pAttributes The plugin attributes read when the array was queued, or NULL to read them now.
+  */
+asynStatus NDFileHDF5::writeArray(NDArray *pArray, epicsInt32 numCaptured, NDAttributeList *pAttributes)
 {
   herr_t hdfstatus = 0;
   asynStatus status = asynSuccess;
@@ -1369,16 +1906,21 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   int dimAttDataset = 0;
   int posRunning = 0;
   char posName[MAXEXTRADIMS][MAX_STRING_SIZE];
-  epicsTimeStamp startts, endts;
-  epicsInt32 numCaptured;
+  epicsTimeStamp startts, endts, now;
   double dt=0.0, period=0.0, runtime = 0.0;
   int extradims = 0;
   hsize_t offsets[MAXEXTRADIMS] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-  static const char *functionName = "writeFile";
+  bool shardOrderError = false;
+  double phaseTimes[NDFileHDF5NumPhases] = {0.0, 0.0, 0.0, 0.0, 0.0};
+  double extendTime = 0.0;
+  epicsTimeStamp phaseStart;
+  static const char *functionName = "writeArray";
 
   // Take the flushing lock here, we do not let a manual flush occur
   // from a different thread during execution of this method.
+  if (this->perfDetail) epicsTimeGetCurrent(&phaseStart);
   flushLock.lock();
+  if (this->perfDetail) phaseTimes[NDFileHDF5PhaseLockWait] = phaseElapsed(&phaseStart);
 
   if (this->file == 0) {
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -1388,9 +1930,23 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     return asynError;
   }
 
+  // The master file assumes that each shard gets every shardCount'th frame. The frame is still
+  // written if it is out of order, but it will be in the wrong place in the master file.
+  if (this->shardCount > 1){
+    if (this->shardFrames == 0){
+      this->shardFirstUniqueId = pArray->uniqueId;
+    } else if (pArray->uniqueId != this->shardFirstUniqueId + this->shardFrames * this->shardCount){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: shard %d frame %d has unique ID %d, expected %d\n",
+                driverName, functionName, this->shardIndex, this->shardFrames, pArray->uniqueId,
+                this->shardFirstUniqueId + this->shardFrames * this->shardCount);
+      shardOrderError = true;
+    }
+    this->shardFrames++;
+  }
+
   this->lock();
   getIntegerParam(NDFileHDF5_dimAttDatasets, &dimAttDataset);
-  getIntegerParam(NDFileNumCaptured, &numCaptured);
   getIntegerParam(NDFileHDF5_storeAttributes, &storeAttributes);
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
   getIntegerParam(NDFileHDF5_flushNthFrame, &flush);
@@ -1417,7 +1973,11 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
               "%s::%s getting attribute list\n",
               driverName, functionName);
-    status = (asynStatus)this->getAttributes(this->pFileAttributes);
+    if (pAttributes){
+      status = (asynStatus)pAttributes->copy(this->pFileAttributes);
+    } else {
+      status = (asynStatus)this->getAttributes(this->pFileAttributes);
+    }
     if (status != asynSuccess){
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s::%s ERROR: could not update the attribute list\n",
@@ -1475,6 +2035,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
 
   // Get the current time to calculate performance times
   epicsTimeGetCurrent(&startts);
+  phaseStart = startts;
 
   // Check to see if we are positional placement mode
   if (posRunning == 1){
@@ -1515,8 +2076,16 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
     }
   }
 
+  if (this->perfDetail) phaseTimes[NDFileHDF5PhaseExtend] = phaseElapsed(&phaseStart);
+
   if (status == asynSuccess){
     status = this->detDataMap[destination]->writeFile(pArray, this->datatype, this->dataspace, this->framesize);
+    // The dataset is extended in the file by writeFile, so that time is moved from Write to Extend
+    extendTime = this->detDataMap[destination]->getExtendTime();
+  }
+  if (this->perfDetail) {
+    phaseTimes[NDFileHDF5PhaseWrite] = phaseElapsed(&phaseStart) - extendTime;
+    phaseTimes[NDFileHDF5PhaseExtend] += extendTime;
   }
   if (status != asynSuccess){
     // If dataset creation fails then close file and abort as all following writes will fail as well
@@ -1561,12 +2130,12 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
       // If attribute datasets are following dimensions of the main dataset
       // check to ensure this NDArray is destined for the default dataset
       if (destination == this->defDsetName){
-        status = this->writeAttributeDataset(hdf5::OnFrame, posRunning, offsets);
+        status = this->writeAttributeDataset(hdf5::OnFrame, posRunning, offsets, numCaptured);
       }
     } else {
       // Normal attribute datasets required (linear 1D)
       // so save on every occasion
-      status = this->writeAttributeDataset(hdf5::OnFrame, 0, offsets);
+      status = this->writeAttributeDataset(hdf5::OnFrame, 0, offsets, numCaptured);
     }
     if (status != asynSuccess){
       flushLock.unlock();
@@ -1575,6 +2144,7 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
       return status;
     }
   }
+  if (this->perfDetail) phaseTimes[NDFileHDF5PhaseAttributes] = phaseElapsed(&phaseStart);
   if (storePerformance == 1 && numCaptured <= this->numPerformancePoints){
     epicsTimeGetCurrent(&endts);
     dt = epicsTimeDiffInSeconds(&endts, &startts);
@@ -1594,10 +2164,18 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   }
 
   if (checkForSWMRMode()){
-    if ((numCaptured+1) % flush == 0) {
+    if (this->swmrFlushPeriod > 0.0) {
+      // We are in SWMR mode with a flush period so flush the datasets written since the
+      // last flush when that flush is at least one period old
+      epicsTimeGetCurrent(&now);
+      if (epicsTimeDiffInSeconds(&now, &this->lastFlushTime) >= this->swmrFlushPeriod) {
+        status = this->flushDirtyDatasets();
+      }
+    } else if ((numCaptured+1) % flush == 0) {
       // We are in SWMR mode so flush the dataset on every <flush> frames
       status = this->detDataMap[destination]->flushDataset();
     }
+    if (this->perfDetail) phaseTimes[NDFileHDF5PhaseFlush] = phaseElapsed(&phaseStart);
   }
 
   if (status != asynSuccess){
@@ -1620,6 +2198,10 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
               driverName, functionName, dt, period);
 
     this->nextRecord++;
+    if (this->perfDetail){
+      this->recordPhaseTimes(phaseTimes, storePerformance == 1 && numCaptured <= this->numPerformancePoints);
+    }
+    if (shardOrderError) status = asynError;
   }
 
   // Release the flushing lock here to allow a manual flush
@@ -1628,29 +2210,180 @@ asynStatus NDFileHDF5::writeFile(NDArray *pArray)
   return status;
 }
 
-/** Read NDArray data from a HDF5 file; NOTE: not implemented yet.
+/** Opens a HDF5 file for reading with an NDFileHDF5Reader.
+  * The detector dataset is HDF5_readDataset, or the first detector dataset in the file if that is empty.
+  * HDF5_readNumFrames is set to the number of frames in the dataset, and HDF5_readFrame is reset to 0
+  * if it is past the last frame.
+  * The reader is kept open after closeFile, so that stepping through the frames of a file does not open it
+  * and read its NDAttributes again for every frame. It is reopened if the file name, the dataset or the
+  * modification time or size of the file have changed.
+  * \param[in] fileName Absolute path name of the file to open.
+  */
+asynStatus NDFileHDF5::openReadFile(const char *fileName)
+{
+  char datasetName[MAX_STRING_SIZE];
+  struct stat buffer;
+  int frame;
+  asynStatus status = asynSuccess;
+
+  this->lock();
+  getStringParam(NDFileHDF5_readDataset, sizeof(datasetName), datasetName);
+  this->unlock();
+
+  if (stat(fileName, &buffer) != 0) {
+    buffer.st_mtime = 0;
+    buffer.st_size = 0;
+  }
+  if (this->pReader == NULL || this->readFileName != fileName || this->readDatasetRequest != datasetName ||
+      this->readFileModTime != buffer.st_mtime || this->readFileSize != buffer.st_size) {
+    this->closeReadFile();
+    this->pReader = new NDFileHDF5Reader(this->pasynUserSelf);
+    status = this->pReader->open(fileName, datasetName);
+    this->readFileName = fileName;
+    this->readDatasetRequest = datasetName;
+    this->readFileModTime = buffer.st_mtime;
+    this->readFileSize = buffer.st_size;
+  }
+
+  this->lock();
+  if (status == asynSuccess) {
+    setIntegerParam(NDFileHDF5_readNumFrames, this->pReader->getNumFrames());
+    getIntegerParam(NDFileHDF5_readFrame, &frame);
+    if (frame < 0 || frame >= this->pReader->getNumFrames()) {
+      setIntegerParam(NDFileHDF5_readFrame, 0);
+    }
+  } else {
+    setIntegerParam(NDFileHDF5_readNumFrames, 0);
+  }
+  this->unlock();
+  if (status == asynSuccess) {
+    this->readFileOpen = true;
+  } else {
+    this->closeReadFile();
+  }
+  return status;
+}
+
+/** Closes the file kept open by the reader of openReadFile. */
+void NDFileHDF5::closeReadFile()
+{
+  delete this->pReader;
+  this->pReader = NULL;
+  this->readFileOpen = false;
+  this->readFileName.clear();
+}
+
+/** Read NDArray data from a HDF5 file.
+  * Reads frame HDF5_readFrame of the file opened with NDFileModeRead, and advances HDF5_readFrame
+  * to the next frame so that repeated reads step through the file.
   * \param[in] pArray Pointer to the address of an NDArray to read the data into.  */
 asynStatus NDFileHDF5::readFile(NDArray **pArray)
 {
-  //static const char *functionName = "readFile";
-  return asynError;
+  int frame;
+  asynStatus status;
+  static const char *functionName = "readFile";
+
+  if (!this->readFileOpen) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s ERROR no file is open for reading\n",
+              driverName, functionName);
+    return asynError;
+  }
+
+  this->lock();
+  getIntegerParam(NDFileHDF5_readFrame, &frame);
+  this->unlock();
+
+  status = this->pReader->readFrame(frame, this->pNDArrayPool, pArray);
+
+  if (status == asynSuccess) {
+    this->lock();
+    setIntegerParam(NDFileHDF5_readFrame, (frame + 1) % this->pReader->getNumFrames());
+    this->unlock();
+  }
+  return status;
 }
 
 /** Closes the HDF5 file opened with NDFileHDF5::openFile
+ * When NDPluginFile is rotating to the next file and write-behind is active the close is queued
+ * behind the arrays for the file, and an error closing it is returned by the next writeFile or closeFile.
  */
 asynStatus NDFileHDF5::closeFile()
+{
+  epicsInt32 numCaptured;
+  asynStatus status = asynSuccess;
+
+  // A file opened for reading stays open in pReader for the next read
+  if (this->readFileOpen) {
+    this->readFileOpen = false;
+    return asynSuccess;
+  }
+
+  this->lock();
+  getIntegerParam(NDFileNumCaptured, &numCaptured);
+  this->unlock();
+
+  if (this->writeBehindActive){
+    if (this->rotatingFile){
+      return this->queueClose(numCaptured);
+    }
+    // Write the queued arrays before anything is closed
+    this->drainWriteQueue();
+    writeQueueLock.lock();
+    this->writeBehindActive = false;
+    status = this->writeBehindStatus;
+    this->writeBehindStatus = asynSuccess;
+    writeQueueLock.unlock();
+  }
+
+  if (this->closeOpenFile(numCaptured) != asynSuccess){
+    status = asynError;
+  }
+  // Only the first shard has a master file for NDPluginFile to rename
+  if (this->shardCount > 1 && this->shardIndex != 0){
+    this->closeDeferred = true;
+  }
+  return status;
+}
+
+/** Closes the open HDF5 file.
+  * Called by closeFile, or by writeBehindTask when the close was queued.
+  * \param[in] numCaptured The value of NDFileNumCaptured for the file.
+  */
+asynStatus NDFileHDF5::closeOpenFile(epicsInt32 numCaptured)
 {
   int storeAttributes, storePerformance;
-  epicsTimeStamp now;
+  epicsTimeStamp startTime, now;
   double runtime = 0.0, writespeed = 0.0;
-  epicsInt32 numCaptured;
-  static const char *functionName = "closeFile";
+  asynStatus status = asynSuccess;
+  static const char *functionName = "closeOpenFile";
+
+  // Take the flushing lock so that a periodic flush from the flush task cannot
+  // use the datasets while they are closed
+  flushLock.lock();
 
   if (this->file == 0){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
               "%s::%s file was not open! Ignoring close command.\n",
               driverName, functionName);
-    return asynSuccess;
+    flushLock.unlock();
+    return status;
+  }
+  epicsTimeGetCurrent(&startTime);
+
+  // Write the frames of any chunks that are still being assembled, and shrink the pre-sized
+  // datasets to the frames that were written
+  std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
+  for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
+    if (it_dset->second->writeAssembledChunk() != asynSuccess){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s ERROR: could not write the last chunk of dataset %s\n",
+                driverName, functionName, it_dset->first.c_str());
+      status = asynError;
+    }
+    if (it_dset->second->trimDataset() != asynSuccess){
+      status = asynError;
+    }
   }
 
   this->lock();
@@ -1658,7 +2391,7 @@ asynStatus NDFileHDF5::closeFile()
   getIntegerParam(NDFileHDF5_storePerformance, &storePerformance);
   this->unlock();
   if (storeAttributes == 1) {
-     this->writeAttributeDataset(hdf5::OnFileClose, 0, NULL);
+     this->writeAttributeDataset(hdf5::OnFileClose, 0, NULL, numCaptured);
      this->storeOnCloseAttributes();
      this->closeAttributeDataset();
   }
@@ -1687,7 +2420,6 @@ asynStatus NDFileHDF5::closeFile()
             driverName, functionName);
 
   // Iterate over the stored detector data sets and close them
-  std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
     H5Dclose(it_dset->second->getHandle());
   }
@@ -1730,9 +2462,9 @@ asynStatus NDFileHDF5::closeFile()
   // At this point we can clear the SWMR active flag, whether we were running
   // in SWMR mode or not
   setIntegerParam(NDFileHDF5_SWMRRunning, 0);
+  setIntegerParam(NDFileHDF5_directIORunning, 0);
 
-  // Unload the XML layout
-  this->layout.unload_xml();
+  // The XML layout is not unloaded, it is kept for the next file by loadLayout
 
   // Reset the default data set and clear out the maps of handles to stale datasets
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
@@ -1741,21 +2473,22 @@ asynStatus NDFileHDF5::closeFile()
   detDataMap.clear();
   constDsetMap.clear();
   defDsetName = "";
+  flushLock.unlock();
 
   epicsTimeGetCurrent(&now);
   runtime = epicsTimeDiffInSeconds(&now, &this->opents);
   this->lock();
-  getIntegerParam(NDFileNumCaptured, &numCaptured);
   writespeed = (numCaptured * this->frameSize)/runtime;
   setDoubleParam(NDFileHDF5_totalIoSpeed, writespeed);
   setDoubleParam(NDFileHDF5_totalRuntime, runtime);
+  setDoubleParam(NDFileHDF5_closeTime, epicsTimeDiffInSeconds(&now, &startTime));
   this->unlock();
 
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
             "%s::%s file closed! runtime=%.3f s overall acquisition performance=%.2f Mbit/s\n",
             driverName, functionName, runtime, writespeed);
 
-  return asynSuccess;
+  return status;
 }
 
 /** Perform any actions required when an int32 parameter is updated.
@@ -1906,11 +2639,17 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
         setIntegerParam(function, oldvalue);
       }
   } else if (function == NDFileHDF5_storeAttributes ||
-         function == NDFileHDF5_storePerformance) {
+         function == NDFileHDF5_storePerformance ||
+         function == NDFileHDF5_performanceDetail) {
     if (this->file != 0) {
       status = asynError;
       setIntegerParam(function, oldvalue);
     }
+  } else if (function == NDFileHDF5_performanceWindow) {
+    if (value < 1) {
+      status = asynError;
+      setIntegerParam(function, oldvalue);
+    }
   } else if (function == NDFileHDF5_compressionType) {
     if (this->file != 0)
     {
@@ -1945,6 +2684,9 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
       case HDF5CompressJPEG:
         filterId = FILTER_JPEG;
         break;
+      case HDF5CompressZstd:
+        filterId = FILTER_ZSTD;
+        break;
       default:
         filterId = H5Z_FILTER_NONE;
         status = asynError;
@@ -2039,8 +2781,11 @@ asynStatus NDFileHDF5::writeInt32(asynUser *pasynUser, epicsInt32 value)
           // Set the parameter
           setIntegerParam(NDFileHDF5_SWMRFlushNow, 1);
           callParamCallbacks();
-          // Now send the event to the flush task
-          epicsEventSignal(this->flushEventId);
+          // With write-behind the flush is done after the arrays already queued,
+          // otherwise send the event to the flush task
+          if (!this->queueFlush()){
+              epicsEventSignal(this->flushEventId);
+          }
       } else {
           // We cannot flush if we are not saving to file
           status = asynError;
@@ -2161,8 +2906,12 @@ int NDFileHDF5::verifyLayoutXMLFile()
     }
   }
 
+  // A layout that has been parsed for a file and not changed since is valid. Others are parsed by
+  // a separate LayoutXML, so that the layout of an open file is not affected.
   std::string strFileName = std::string(fileName);
-  if (this->layout.verify_xml(strFileName)){
+  time_t modTime;
+  hdf5::LayoutXML verifier;
+  if (!this->layoutUnchanged(fileName, &modTime) && verifier.verify_xml(strFileName)){
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s::%s XML description file parser error.\n",
               driverName, functionName);
@@ -2278,6 +3027,7 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_chunkBoundaryAlign, asynParamInt32,&NDFileHDF5_chunkBoundaryAlign);
   this->createParam(str_NDFileHDF5_chunkBoundaryThreshold, asynParamInt32,&NDFileHDF5_chunkBoundaryThreshold);
   this->createParam(str_NDFileHDF5_NDAttributeChunk,asynParamInt32,   &NDFileHDF5_NDAttributeChunk);
+  this->createParam(str_NDFileHDF5_NDAttributeWritePeriod, asynParamFloat64, &NDFileHDF5_NDAttributeWritePeriod);
   this->createParam(str_NDFileHDF5_nExtraDims,      asynParamInt32,   &NDFileHDF5_nExtraDims);
   this->createParam(str_NDFileHDF5_extraDimOffsetX, asynParamInt32,   &NDFileHDF5_extraDimOffsetX);
   this->createParam(str_NDFileHDF5_extraDimOffsetY, asynParamInt32,   &NDFileHDF5_extraDimOffsetY);
@@ -2290,6 +3040,14 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_storePerformance,asynParamInt32,   &NDFileHDF5_storePerformance);
   this->createParam(str_NDFileHDF5_totalRuntime,    asynParamFloat64, &NDFileHDF5_totalRuntime);
   this->createParam(str_NDFileHDF5_totalIoSpeed,    asynParamFloat64, &NDFileHDF5_totalIoSpeed);
+  this->createParam(str_NDFileHDF5_openTime,        asynParamFloat64, &NDFileHDF5_openTime);
+  this->createParam(str_NDFileHDF5_closeTime,       asynParamFloat64, &NDFileHDF5_closeTime);
+  this->createParam(str_NDFileHDF5_performanceDetail, asynParamInt32, &NDFileHDF5_performanceDetail);
+  this->createParam(str_NDFileHDF5_performanceWindow, asynParamInt32, &NDFileHDF5_performanceWindow);
+  for (int phase = 0; phase < NDFileHDF5NumPhases; phase++){
+    this->createParam(str_NDFileHDF5_phaseMean[phase], asynParamFloat64, &NDFileHDF5_phaseMean[phase]);
+    this->createParam(str_NDFileHDF5_phaseMax[phase],  asynParamFloat64, &NDFileHDF5_phaseMax[phase]);
+  }
   this->createParam(str_NDFileHDF5_flushNthFrame,   asynParamInt32,   &NDFileHDF5_flushNthFrame);
   this->createParam(str_NDFileHDF5_compressionType, asynParamInt32,   &NDFileHDF5_compressionType);
   this->createParam(str_NDFileHDF5_nbitsPrecision,  asynParamInt32,   &NDFileHDF5_nbitsPrecision);
@@ -2300,10 +3058,13 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_bloscCompressor,    asynParamInt32,   &NDFileHDF5_bloscCompressor);
   this->createParam(str_NDFileHDF5_bloscCompressLevel, asynParamInt32,   &NDFileHDF5_bloscCompressLevel);
   this->createParam(str_NDFileHDF5_jpegQuality,     asynParamInt32,   &NDFileHDF5_jpegQuality);
+  this->createParam(str_NDFileHDF5_zstdLevel,       asynParamInt32,   &NDFileHDF5_zstdLevel);
+  this->createParam(str_NDFileHDF5_compressionNumThreads, asynParamInt32, &NDFileHDF5_compressionNumThreads);
   this->createParam(str_NDFileHDF5_dimAttDatasets,  asynParamInt32,   &NDFileHDF5_dimAttDatasets);
   this->createParam(str_NDFileHDF5_layoutErrorMsg,  asynParamOctet,   &NDFileHDF5_layoutErrorMsg);
   this->createParam(str_NDFileHDF5_layoutValid,     asynParamInt32,   &NDFileHDF5_layoutValid);
   this->createParam(str_NDFileHDF5_layoutFilename,  asynParamOctet,   &NDFileHDF5_layoutFilename);
+  this->createParam(str_NDFileHDF5_layoutCached,    asynParamInt32,   &NDFileHDF5_layoutCached);
   this->createParam(str_NDFileHDF5_posRunning,      asynParamInt32,   &NDFileHDF5_posRunning);
   for (int extraDimIndex = 0; extraDimIndex < MAXEXTRADIMS; extraDimIndex++){
     this->createParam(str_NDFileHDF5_posName[extraDimIndex],    asynParamOctet,   &NDFileHDF5_posName[extraDimIndex]);
@@ -2315,6 +3076,21 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->createParam(str_NDFileHDF5_SWMRSupported,   asynParamInt32,   &NDFileHDF5_SWMRSupported);
   this->createParam(str_NDFileHDF5_SWMRMode,        asynParamInt32,   &NDFileHDF5_SWMRMode);
   this->createParam(str_NDFileHDF5_SWMRRunning,     asynParamInt32,   &NDFileHDF5_SWMRRunning);
+  this->createParam(str_NDFileHDF5_SWMRFlushPeriod, asynParamFloat64, &NDFileHDF5_SWMRFlushPeriod);
+  this->createParam(str_NDFileHDF5_writeBehind,     asynParamInt32,   &NDFileHDF5_writeBehind);
+  this->createParam(str_NDFileHDF5_writeBehindMaxMemory, asynParamInt32, &NDFileHDF5_writeBehindMaxMemory);
+  this->createParam(str_NDFileHDF5_writeBehindMaxArrays, asynParamInt32, &NDFileHDF5_writeBehindMaxArrays);
+  this->createParam(str_NDFileHDF5_writeBehindQueueSize, asynParamInt32, &NDFileHDF5_writeBehindQueueSize);
+  this->createParam(str_NDFileHDF5_writeBehindMemory,    asynParamFloat64, &NDFileHDF5_writeBehindMemory);
+  this->createParam(str_NDFileHDF5_writeBehindStallTime, asynParamFloat64, &NDFileHDF5_writeBehindStallTime);
+  this->createParam(str_NDFileHDF5_shardCount,      asynParamInt32,   &NDFileHDF5_shardCount);
+  this->createParam(str_NDFileHDF5_shardIndex,      asynParamInt32,   &NDFileHDF5_shardIndex);
+  this->createParam(str_NDFileHDF5_preSize,         asynParamInt32,   &NDFileHDF5_preSize);
+  this->createParam(str_NDFileHDF5_directIO,        asynParamInt32,   &NDFileHDF5_directIO);
+  this->createParam(str_NDFileHDF5_directIORunning, asynParamInt32,   &NDFileHDF5_directIORunning);
+  this->createParam(str_NDFileHDF5_readDataset,     asynParamOctet,   &NDFileHDF5_readDataset);
+  this->createParam(str_NDFileHDF5_readFrame,       asynParamInt32,   &NDFileHDF5_readFrame);
+  this->createParam(str_NDFileHDF5_readNumFrames,   asynParamInt32,   &NDFileHDF5_readNumFrames);
 
   setIntegerParam(NDFileHDF5_chunkSizeAuto, 1);
   for (int chunkIndex = 0; chunkIndex < MAX_CHUNK_DIMS; chunkIndex++){
@@ -2322,6 +3098,7 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   }
   setIntegerParam(NDFileHDF5_nFramesChunks,   0);
   setIntegerParam(NDFileHDF5_NDAttributeChunk,0);
+  setDoubleParam (NDFileHDF5_NDAttributeWritePeriod, 1.0);
   setIntegerParam(NDFileHDF5_chunkBoundaryAlign, 0);
   setIntegerParam(NDFileHDF5_chunkBoundaryThreshold, 65536);
   setIntegerParam(NDFileHDF5_nExtraDims,      0);
@@ -2335,6 +3112,14 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_storePerformance,1);
   setDoubleParam (NDFileHDF5_totalRuntime,    0.0);
   setDoubleParam (NDFileHDF5_totalIoSpeed,    0.0);
+  setDoubleParam (NDFileHDF5_openTime,        0.0);
+  setDoubleParam (NDFileHDF5_closeTime,       0.0);
+  setIntegerParam(NDFileHDF5_performanceDetail, 0);
+  setIntegerParam(NDFileHDF5_performanceWindow, 100);
+  for (int phase = 0; phase < NDFileHDF5NumPhases; phase++){
+    setDoubleParam(NDFileHDF5_phaseMean[phase], 0.0);
+    setDoubleParam(NDFileHDF5_phaseMax[phase],  0.0);
+  }
   setIntegerParam(NDFileHDF5_flushNthFrame,   0);
   setIntegerParam(NDFileHDF5_compressionType, HDF5CompressNone);
   setIntegerParam(NDFileHDF5_nbitsPrecision,  8);
@@ -2346,9 +3131,12 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_bloscCompressLevel, 5);
   setIntegerParam(NDFileHDF5_dimAttDatasets,  0);
   setIntegerParam(NDFileHDF5_jpegQuality,     90);
+  setIntegerParam(NDFileHDF5_zstdLevel,       3);
+  setIntegerParam(NDFileHDF5_compressionNumThreads, 0);
   setStringParam (NDFileHDF5_layoutErrorMsg,  "");
   setIntegerParam(NDFileHDF5_layoutValid,     1);
   setStringParam (NDFileHDF5_layoutFilename,  "");
+  setIntegerParam(NDFileHDF5_layoutCached,    0);
   setIntegerParam(NDFileHDF5_posRunning,      0);
   for (int extraDimIndex = 0; extraDimIndex < MAXEXTRADIMS; extraDimIndex++){
     setStringParam(NDFileHDF5_posName[extraDimIndex],   "");
@@ -2359,6 +3147,21 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   setIntegerParam(NDFileHDF5_SWMRCbCounter,   0);
   setIntegerParam(NDFileHDF5_SWMRMode,        0);
   setIntegerParam(NDFileHDF5_SWMRRunning,     0);
+  setDoubleParam (NDFileHDF5_SWMRFlushPeriod, 0.0);
+  setIntegerParam(NDFileHDF5_writeBehind,     0);
+  setIntegerParam(NDFileHDF5_writeBehindMaxMemory, 256);
+  setIntegerParam(NDFileHDF5_writeBehindMaxArrays, 0);
+  setIntegerParam(NDFileHDF5_writeBehindQueueSize, 0);
+  setDoubleParam (NDFileHDF5_writeBehindMemory,    0.0);
+  setDoubleParam (NDFileHDF5_writeBehindStallTime, 0.0);
+  setIntegerParam(NDFileHDF5_shardCount,      1);
+  setIntegerParam(NDFileHDF5_shardIndex,      0);
+  setIntegerParam(NDFileHDF5_preSize,         0);
+  setIntegerParam(NDFileHDF5_directIO,        0);
+  setIntegerParam(NDFileHDF5_directIORunning, 0);
+  setStringParam (NDFileHDF5_readDataset,     "");
+  setIntegerParam(NDFileHDF5_readFrame,       0);
+  setIntegerParam(NDFileHDF5_readNumFrames,   0);
   if (checkForSWMRSupported()){
     setIntegerParam(NDFileHDF5_SWMRSupported, 1);
   } else {
@@ -2402,11 +3205,42 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
   this->virtualdims  = NULL;
   this->rank         = 0;
   this->file         = 0;
+  this->compressionNumThreads = 0;
+  this->preSized = false;
+  this->directIOAlign = 0;
+  this->pReader = NULL;
+  this->readFileOpen = false;
+  this->readFileModTime = 0;
+  this->readFileSize = 0;
+  this->layoutLoaded = false;
+  this->layoutModTime = 0;
+  this->attrWriteBlock       = 1;
+  this->attrChunking         = 1;
+  this->attrFrames           = 0;
+  this->attrBufferedFrames   = 0;
+  this->attrWritePeriod      = 0.0;
+  this->swmrFlushPeriod      = 0.0;
+  epicsTimeGetCurrent(&this->lastFlushTime);
+  this->writeBehindActive = false;
+  this->writeQueueArrays  = 0;
+  this->writeQueueBytes   = 0;
+  this->writeBehindStatus = asynSuccess;
+  this->writeBehindStallTime = 0.0;
+  this->shardCount = 1;
+  this->shardIndex = 0;
+  this->shardFrames = 0;
+  this->shardFirstUniqueId = 0;
   this->ptrFillValue = (void*)calloc(8, sizeof(char));
   this->dimsreport   = (char*)calloc(DIMSREPORTSIZE, sizeof(char));
   this->performanceBuf       = NULL;
   this->performancePtr       = NULL;
   this->numPerformancePoints = 0;
+  this->performanceColumns   = 5;
+  this->performanceBufSize   = 0;
+  this->openTime             = 0.0;
+  this->perfDetail           = false;
+  this->phaseWindow          = 1;
+  this->resetPhaseTimes();
 
   this->hostname = (char*)calloc(MAXHOSTNAMELEN, sizeof(char));
   gethostname(this->hostname, MAXHOSTNAMELEN);
@@ -2427,6 +3261,25 @@ NDFileHDF5::NDFileHDF5(const char *portName, int queueSize, int blockingCallback
       printf("%s:%s epicsThreadCreate failure for flushing task\n", driverName, functionName);
       return;
   }
+
+  this->writeQueueEventId = epicsEventCreate(epicsEventEmpty);
+  this->writeDoneEventId = epicsEventCreate(epicsEventEmpty);
+  if (!this->writeQueueEventId || !this->writeDoneEventId){
+      printf("%s:%s epicsEventCreate failure for write-behind events\n", driverName, functionName);
+      return;
+  }
+
+  // Create the thread that writes the arrays queued when write-behind is enabled.
+  // It makes the same HDF5 calls as the plugin thread so it gets the same stack size.
+  status = (epicsThreadCreate("HDF5WriteBehindTask",
+                              epicsThreadPriorityMedium,
+                              stackSize > 0 ? stackSize : epicsThreadGetStackSize(epicsThreadStackBig),
+                              (EPICSTHREADFUNC)writeBehindTaskC,
+                              this) == NULL);
+  if (status){
+      printf("%s:%s epicsThreadCreate failure for write-behind task\n", driverName, functionName);
+      return;
+  }
 }
 
 /** Calculate the total number of frames that the current configured dimensions can contain.
@@ -2575,13 +3428,14 @@ asynStatus NDFileHDF5::configurePerformanceDataset()
     numCaptureFrames = 1000000;
   }
 
-  // only allocate new memory if we need more points than we've used before
-  if (numCaptureFrames > this->numPerformancePoints)
+  // only allocate new memory if we need more values than we've used before
+  this->numPerformancePoints = numCaptureFrames;
+  if ((size_t)numCaptureFrames * this->performanceColumns > this->performanceBufSize)
   {
-    this->numPerformancePoints = numCaptureFrames;
+    this->performanceBufSize = (size_t)numCaptureFrames * this->performanceColumns;
     if (this->performanceBuf != NULL) {free(this->performanceBuf); this->performanceBuf = NULL;}
     if (this->performanceBuf == NULL)
-      this->performanceBuf = (epicsFloat64*)  calloc(5 * this->numPerformancePoints, sizeof(double));
+      this->performanceBuf = (epicsFloat64*)  calloc(this->performanceBufSize, sizeof(double));
   }
   this->performancePtr  = this->performanceBuf;
 
@@ -2617,7 +3471,7 @@ asynStatus NDFileHDF5::createPerformanceDataset()
       }
     }
     dims[0] = 1;
-    dims[1] = 5;
+    dims[1] = this->performanceColumns;
 
     if(perf_group == NULL)
     {
@@ -2642,7 +3496,7 @@ asynStatus NDFileHDF5::createPerformanceDataset()
     // Check the chunking value
     calculateAttributeChunking(&chunking, mdchunking);
     hid_t hdfcparm   = H5Pcreate(H5P_DATASET_CREATE);
-    hsize_t chunk[2] = {(hsize_t)chunking, 5};
+    hsize_t chunk[2] = {(hsize_t)chunking, (hsize_t)this->performanceColumns};
     int hdfrank  = 2;
     H5Pset_chunk(hdfcparm, hdfrank, chunk);
 
@@ -2664,6 +3518,12 @@ asynStatus NDFileHDF5::createPerformanceDataset()
     if(perf_group != NULL){
       H5Gclose(group_performance);
     }
+    if (this->perfDetail){
+      // Name the columns, since the phase times follow the standard ones
+      this->writeStringAttribute(this->perf_dataset_id, "columns",
+                                 "dt,period,runtime,frame_speed,total_speed,"
+                                 "lock_wait,extend,write,attributes,flush");
+    }
   } else {
     return asynError;
   }
@@ -2680,7 +3540,7 @@ asynStatus NDFileHDF5::writePerformanceDataset()
   this->lock();
   getIntegerParam(NDFileNumCaptured, &numCaptured);
   this->unlock();
-  dims[1] = 5;
+  dims[1] = this->performanceColumns;
   if (numCaptured < this->numPerformancePoints) dims[0] = numCaptured;
   else dims[0] = this->numPerformancePoints;
 
@@ -2693,12 +3553,77 @@ asynStatus NDFileHDF5::writePerformanceDataset()
              H5S_ALL, H5S_ALL,
              H5P_DEFAULT, this->performanceBuf);
 
+    if (this->perfDetail){
+      // The time taken to open the file is known only after the dataset was created
+      std::ostringstream openTime;
+      openTime << this->openTime;
+      this->writeH5attrFloat64(this->perf_dataset_id, "open_time", openTime.str());
+    }
+
     /* Close the second dataset */
     H5Dclose(this->perf_dataset_id);
   }
   return asynSuccess;
 }
 
+/** Clears the rolling statistics of the phase times, for a window of phaseWindow frames
+ */
+void NDFileHDF5::resetPhaseTimes()
+{
+  this->phaseHistory.assign((size_t)this->phaseWindow * NDFileHDF5NumPhases, 0.0);
+  this->phaseFrames = 0;
+  this->phaseNext = 0;
+  this->lock();
+  for (int phase = 0; phase < NDFileHDF5NumPhases; phase++){
+    this->phaseSum[phase] = 0.0;
+    this->phaseMax[phase] = 0.0;
+    setDoubleParam(NDFileHDF5_phaseMean[phase], 0.0);
+    setDoubleParam(NDFileHDF5_phaseMax[phase],  0.0);
+  }
+  this->unlock();
+}
+
+/** Adds the phase times of a frame to the rolling statistics, replacing the times of the oldest
+ * frame when there are phaseWindow frames, and stores them in the performance dataset.
+ * \param[in] phaseTimes The time in seconds of each phase of writing the frame.
+ * \param[in] store Whether to store the times after the standard columns of the performance dataset.
+ */
+void NDFileHDF5::recordPhaseTimes(const double *phaseTimes, bool store)
+{
+  double *pFrame = &this->phaseHistory[(size_t)this->phaseNext * NDFileHDF5NumPhases];
+  bool full = (this->phaseFrames == this->phaseWindow);
+
+  for (int phase = 0; phase < NDFileHDF5NumPhases; phase++){
+    double oldTime = pFrame[phase];
+    pFrame[phase] = phaseTimes[phase];
+    if (full) this->phaseSum[phase] -= oldTime;
+    this->phaseSum[phase] += phaseTimes[phase];
+    if (phaseTimes[phase] >= this->phaseMax[phase]){
+      this->phaseMax[phase] = phaseTimes[phase];
+    } else if (full && oldTime >= this->phaseMax[phase]){
+      // The largest time has left the window, so find the new largest
+      this->phaseMax[phase] = 0.0;
+      for (int frame = 0; frame < this->phaseWindow; frame++){
+        double time = this->phaseHistory[(size_t)frame * NDFileHDF5NumPhases + phase];
+        if (time > this->phaseMax[phase]) this->phaseMax[phase] = time;
+      }
+    }
+    if (store){
+      *this->performancePtr = phaseTimes[phase];
+      this->performancePtr++;
+    }
+  }
+  this->phaseNext = (this->phaseNext + 1) % this->phaseWindow;
+  if (!full) this->phaseFrames++;
+
+  this->lock();
+  for (int phase = 0; phase < NDFileHDF5NumPhases; phase++){
+    setDoubleParam(NDFileHDF5_phaseMean[phase], this->phaseSum[phase] / this->phaseFrames);
+    setDoubleParam(NDFileHDF5_phaseMax[phase],  this->phaseMax[phase]);
+  }
+  this->unlock();
+}
+
 /** Create the group of datasets to hold the NDArray attributes
  *
  */
@@ -2711,6 +3636,7 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
   //int fileWriteMode = 0;
   int dimAttDataset = 0;
   int posRunning = 0;
+  double writePeriod = 0.0;
   hid_t groupDefault = -1;
   const char *attrNames[5] = {"NDAttrName", "NDAttrDescription", "NDAttrSourceType", "NDAttrSource", NULL};
   const char *attrStrings[5] = {NULL,NULL,NULL,NULL,NULL};
@@ -2723,6 +3649,7 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
   getIntegerParam(NDFileHDF5_dimAttDatasets, &dimAttDataset);
   getIntegerParam(NDFileHDF5_nExtraDims, &extraDims);
   getIntegerParam(NDFileHDF5_posRunning, &posRunning);
+  getDoubleParam(NDFileHDF5_NDAttributeWritePeriod, &writePeriod);
 
   if (this->multiFrameFile){
     struct extradimdefs_t {
@@ -2757,6 +3684,17 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
   }
   calculateAttributeChunking(&chunking, user_chunking);
 
+  // One dimensional attribute datasets buffer their values and write them in blocks of up to
+  // a chunk, unless the write period is 0
+  this->attrWriteBlock = 1;
+  if (writePeriod > 0.0 && dimAttDataset == 0){
+    this->attrWriteBlock = (chunking < MAX_ATTRIBUTE_WRITE_BLOCK) ? chunking : MAX_ATTRIBUTE_WRITE_BLOCK;
+  }
+  this->attrChunking = (chunking > 0) ? chunking : 1;
+  this->attrWritePeriod = writePeriod;
+  this->attrFrames = 0;
+  this->attrBufferedFrames = 0;
+
   asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Creating attribute datasets. extradims=%d attribute count=%d\n",
             driverName, functionName, extraDims, this->pFileAttributes->count());
 
@@ -2788,8 +3726,16 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
     attrStrings[3] = ndAttr->getSource();
 
     hdf5::Dataset *dset = NULL;
-    // Search for the dataset of the NDAttribute.  If it exists then we use it
-    if (root->find_dset_ndattr(ndAttr->getName(), &dset) == 0){
+    // Search for the dataset of the NDAttribute.  If it exists then we use it.
+    // The result is kept with the layout, so the search is done once for each layout.
+    std::map<std::string, hdf5::Dataset*>::iterator it_plan = this->attrDsetPlan.find(ndAttr->getName());
+    if (it_plan != this->attrDsetPlan.end()){
+      dset = it_plan->second;
+    } else {
+      if (root->find_dset_ndattr(ndAttr->getName(), &dset) != 0) dset = NULL;
+      this->attrDsetPlan[ndAttr->getName()] = dset;
+    }
+    if (dset != NULL){
       // In here we need to open the dataset for writing
 
       hdf5::DataSource dsource = dset->data_source();
@@ -2808,6 +3754,7 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
         }
       } else {
         attDset->createDataset(chunking);
+        attDset->setWriteBlock(this->attrWriteBlock);
       }
 
       //save xml tags attributes
@@ -2841,6 +3788,7 @@ asynStatus NDFileHDF5::createAttributeDataset(NDArray *pArray)
           }
         } else {
           attDset->createDataset(chunking);
+          attDset->setWriteBlock(this->attrWriteBlock);
         }
 
         // Write some description of the NDAttribute as a HDF attribute to the dataset
@@ -2920,22 +3868,23 @@ asynStatus NDFileHDF5::calculateAttributeChunking(int *chunking, int *mdim_chunk
 }
 
 /** Write the NDArray attributes to the file
- *
+ * One dimensional attribute datasets buffer the values of each frame. The buffers of all datasets
+ * are written together when attrWriteBlock frames have been buffered, at the end of each chunk and
+ * when the oldest values are NDAttributeWritePeriod old.
+ * \param[in] numCaptured The value of NDFileNumCaptured for the frame, which decides the SWMR flushes.
  */
-asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets)
+asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets, epicsInt32 numCaptured)
 {
   asynStatus status = asynSuccess;
   NDAttribute *ndAttr = NULL;
   int flush = 0;
   NDFileHDF5AttributeDataset *uniqueIDNode = NULL;
+  epicsTimeStamp now;
   static const char *functionName = "writeAttributeDataset";
 
-  // Check if we need to force a flush of the datasets
-  if (checkForSWMRMode()){
-    int numCaptured = 0;
-    this->lock();
-    getIntegerParam(NDFileNumCaptured, &numCaptured);
-    this->unlock();
+  // Check if we need to force a flush of the datasets, unless they are flushed by
+  // writeArray every SWMRFlushPeriod
+  if (checkForSWMRMode() && this->swmrFlushPeriod <= 0.0){
     int chunking = 0;
     int mdchunking[MAXEXTRADIMS];
     for (int index = 0; index < MAXEXTRADIMS; index++){
@@ -2990,6 +3939,46 @@ asynStatus NDFileHDF5::writeAttributeDataset(hdf5::When_t whenToSave, int positi
     }
   }
 
+  if (whenToSave == hdf5::OnFrame && this->attrWriteBlock > 1){
+    this->attrFrames++;
+    if (flush == 1){
+      // The datasets wrote their buffers before flushing
+      this->attrBufferedFrames = 0;
+    } else {
+      epicsTimeGetCurrent(&now);
+      if (this->attrBufferedFrames == 0) this->attrWriteTime = now;
+      this->attrBufferedFrames++;
+      if (this->attrBufferedFrames >= this->attrWriteBlock ||
+          this->attrFrames % this->attrChunking == 0 ||
+          epicsTimeDiffInSeconds(&now, &this->attrWriteTime) >= this->attrWritePeriod){
+        status = this->writeAttributeBuffers();
+      }
+    }
+  }
+
+  return status;
+}
+
+/** Write the buffered values of all attribute datasets, ensuring that the unique ID attribute
+ * is the last attribute written
+ */
+asynStatus NDFileHDF5::writeAttributeBuffers()
+{
+  asynStatus status = asynSuccess;
+  NDFileHDF5AttributeDataset *uniqueIDNode = NULL;
+
+  for (std::list<NDFileHDF5AttributeDataset*>::iterator it_node = attrList.begin(); it_node != attrList.end(); ++it_node){
+    if (strcmp(uniqueIDName, (*it_node)->getName().c_str())){
+      if ((*it_node)->writeBuffer() != asynSuccess) status = asynError;
+    } else {
+      uniqueIDNode = *it_node;
+    }
+  }
+  if (uniqueIDNode != NULL){
+    if (uniqueIDNode->writeBuffer() != asynSuccess) status = asynError;
+  }
+  this->attrBufferedFrames = 0;
+
   return status;
 }
 
@@ -3001,6 +3990,7 @@ asynStatus NDFileHDF5::closeAttributeDataset()
   NDFileHDF5AttributeDataset *dsetPtr;
   static const char *functionName = "closeAttributeDataset";
 
+  this->writeAttributeBuffers();
   while (attrList.size() > 0){
     dsetPtr = attrList.front();
     attrList.pop_front();
@@ -3308,6 +4298,8 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
   int bloscCompressor = 0;
   int bloscLevel = 0;
   int jpegQuality = 0;
+  int zstdLevel = 0;
+  int numThreads = 0;
   static const char * functionName = "configureCompression";
 
   this->lock();
@@ -3327,6 +4319,9 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
       setIntegerParam(NDFileHDF5_compressionType, HDF5CompressLZ4);
     } else if (pArray->codec.name == codecName[NDCODEC_JPEG]) {
       setIntegerParam(NDFileHDF5_compressionType, HDF5CompressJPEG);
+    } else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+      setIntegerParam(NDFileHDF5_compressionType, HDF5CompressZstd);
+      setIntegerParam(NDFileHDF5_zstdLevel, pArray->codec.level);
     }
   }
   getIntegerParam(NDFileHDF5_compressionType, &compressionScheme);
@@ -3338,7 +4333,10 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
   getIntegerParam(NDFileHDF5_bloscCompressor, &bloscCompressor);
   getIntegerParam(NDFileHDF5_bloscCompressLevel, &bloscLevel);
   getIntegerParam(NDFileHDF5_jpegQuality, &jpegQuality);
+  getIntegerParam(NDFileHDF5_zstdLevel, &zstdLevel);
+  getIntegerParam(NDFileHDF5_compressionNumThreads, &numThreads);
   this->unlock();
+  this->compressionNumThreads = (numThreads > 0) ? numThreads : 0;
 
   // Clear the codec to (possibly) configure a new one
   this->codec.clear();
@@ -3378,6 +4376,7 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
                 driverName, functionName, zLevel);
       H5Pset_deflate(this->cparms, zLevel);
       this->codec.name = "zlib";
+      this->codec.level = zLevel;
       break;
     case HDF5CompressBlosc: {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -3451,6 +4450,21 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
         this->codec.name = codecName[NDCODEC_JPEG];
       }
       break;
+    case HDF5CompressZstd: {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+                  "%s::%s Setting zstd compression filter level=%d\n",
+                  driverName, functionName, zstdLevel);
+        unsigned int cds[1];
+        cds[0] = (unsigned int)zstdLevel; /* The filter reads this back as a signed level */
+        int h5status = H5Pset_filter(this->cparms, FILTER_ZSTD, H5Z_FLAG_MANDATORY, 1, cds);
+        if (h5status) {
+          asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, "Failed to set h5 zstd filter\n");
+          break;
+        }
+        this->codec.name = codecName[NDCODEC_ZSTD];
+        this->codec.level = zstdLevel;
+      }
+      break;
   }
   return status;
 }
@@ -3461,14 +4475,15 @@ asynStatus NDFileHDF5::configureCompression(NDArray *pArray)
  *  To enable compression via the HDF5 pipeline, it is sufficient to call this method
  *  with just a name. This will cause the chunking verification to fail so that direct chunk write
  *  is not used. To configure the dataset to direct chunk write pre-compressed data, the full codec
- *  definition must be provided and match the NDArrays passed in.
+ *  definition must be provided and match the NDArrays passed in. If compressionNumThreads is
+ *  non-zero the datasets compress the chunks of uncompressed NDArrays themselves and write them directly.
  */
 asynStatus NDFileHDF5::configureDatasetCompression()
 {
   // Iterate over the stored detector data sets and store the compression settings
   std::map<std::string, NDFileHDF5Dataset*>::iterator it_dset;
   for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
-    it_dset->second->configureCompression(this->codec);
+    it_dset->second->configureCompression(this->codec, this->compressionNumThreads);
   }
   return asynSuccess;
 }
@@ -3581,6 +4596,10 @@ char* NDFileHDF5::getDimsReport()
 void NDFileHDF5::report(FILE *fp, int details)
 {
   fprintf(fp, "Dimension report: %s\n", this->getDimsReport());
+  writeQueueLock.lock();
+  fprintf(fp, "Write-behind queue: %d arrays, %lu bytes\n",
+          this->writeQueueArrays, (unsigned long)this->writeQueueBytes);
+  writeQueueLock.unlock();
   // Call the base class report
   NDPluginFile::report(fp, details);
 }
@@ -3608,7 +4627,11 @@ void NDFileHDF5::checkForOpenFile()
     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s::%s file is already open. Closing it and opening new one.\n",
               driverName, functionName);
-    this->closeFile();
+    epicsInt32 numCaptured;
+    this->lock();
+    getIntegerParam(NDFileNumCaptured, &numCaptured);
+    this->unlock();
+    this->closeOpenFile(numCaptured);
   }
 }
 
@@ -3746,6 +4769,7 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   int tempAlign = 0;
   int tempThreshold = 0;
   int SWMRMode = 0;
+  int directIO = 0;
   static const char *functionName = "createNewFile";
 
   this->lock();
@@ -3753,8 +4777,28 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   getIntegerParam(NDFileHDF5_chunkBoundaryThreshold, (int*)&tempThreshold);
   // Check if we are in SWMR mode
   getIntegerParam(NDFileHDF5_SWMRMode, &SWMRMode);
+  getIntegerParam(NDFileHDF5_directIO, &directIO);
   this->unlock();
 
+  // Direct I/O needs the objects in the file aligned to the disk blocks
+  this->directIOAlign = 0;
+  if (directIO == 1){
+    if (SWMRMode == 1){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s Direct I/O cannot be used in SWMR mode, writing through the page cache\n",
+                driverName, functionName);
+    } else {
+#ifdef H5_HAVE_DIRECT
+      if (tempAlign <= 0) tempAlign = DIRECT_IO_ALIGN;
+      this->directIOAlign = tempAlign;
+#else
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s The HDF5 library was built without the direct I/O driver, writing through the page cache\n",
+                driverName, functionName);
+#endif
+    }
+  }
+
   /* File access property list: set the alignment boundary to a user defined block size
    * which ideally matches disk boundaries.
    * If user sets size to 0 we do not set alignment at all. */
@@ -3781,6 +4825,20 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
     }
   }
 
+#ifdef H5_HAVE_DIRECT
+  // The direct driver reads and writes whole blocks with O_DIRECT, copying through a buffer
+  // the data that are not aligned in memory or in the file
+  if (this->directIOAlign > 0){
+    hdfstatus = H5Pset_fapl_direct(access_plist, this->directIOAlign, this->directIOAlign, DIRECT_IO_BUFFER_SIZE);
+    if (hdfstatus < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s Warning: failed to set the direct I/O driver with alignment=%llu bytes\n",
+                driverName, functionName, (unsigned long long)this->directIOAlign);
+      this->directIOAlign = 0;
+    }
+  }
+#endif
+
   /* File creation property list: set the i-storek according to HDF group recommendations */
   H5Pset_fclose_degree(access_plist, H5F_CLOSE_STRONG);
 
@@ -3797,6 +4855,11 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
 
   #endif
 
+  // The latest format indexes the chunks of a dataset with a fixed maximum size in a fixed array
+  if (this->preSized){
+    H5Pset_libver_bounds(access_plist, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+  }
+
   hid_t create_plist = H5Pcreate(H5P_FILE_CREATE);
 
   // We only need to calculate an istorek value if we are not in SWMR mode
@@ -3845,6 +4908,150 @@ asynStatus NDFileHDF5::createNewFile(const char *fileName)
   return asynSuccess;
 }
 
+/** Returns the name of a shard file: the file name without NDFileTempSuffix, with _shard<index>
+  * inserted before the extension.
+  * \param[in] fileName The name of the file passed to openFile, which is the name of the master file.
+  * \param[in] index The index of the shard.
+  */
+std::string NDFileHDF5::shardFileName(const char *fileName, int index)
+{
+  char tempSuffix[MAX_FILENAME_LEN];
+  char shard[32];
+  std::string name = fileName;
+
+  this->lock();
+  getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
+  this->unlock();
+
+  // The shard files are not renamed when they are closed
+  size_t suffixLen = strlen(tempSuffix);
+  if (suffixLen > 0 && name.size() > suffixLen &&
+      name.compare(name.size() - suffixLen, suffixLen, tempSuffix) == 0){
+    name.erase(name.size() - suffixLen);
+  }
+  epicsSnprintf(shard, sizeof(shard), "_shard%d", index);
+  size_t dot = name.find_last_of('.');
+  size_t slash = name.find_last_of("/\\");
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)){
+    dot = name.size();
+  }
+  name.insert(dot, shard);
+  return name;
+}
+
+/** Creates the master file of a set of shard files. For every dataset in the open file that is extended
+  * by one for each frame, the master file has a virtual dataset at the same path that maps frame n of
+  * shard i to frame n*shardCount+i, so the frames of all the shards read back as one dataset in order.
+  * The shard files are referred to by name relative to the master file, which is closed again at once.
+  * \param[in] masterFileName The name of the master file.
+  * \param[in] fileName The name of the open shard file.
+  */
+asynStatus NDFileHDF5::createVirtualMaster(const char *masterFileName, const char *fileName)
+{
+  static const char *functionName = "createVirtualMaster";
+
+  #if H5_VERSION_GE(1,10,0)
+  asynStatus status = asynSuccess;
+  std::vector<std::string> shardNames;
+  std::vector<hid_t> datasets;
+  size_t numDetDatasets;
+  hsize_t dims[H5S_MAX_RANK], maxdims[H5S_MAX_RANK];
+  hsize_t start[H5S_MAX_RANK], stride[H5S_MAX_RANK], count[H5S_MAX_RANK], block[H5S_MAX_RANK];
+  char path[MAX_FILENAME_LEN];
+
+  for (int i = 0; i < this->shardCount; i++){
+    std::string name = this->shardFileName(fileName, i);
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos) name.erase(0, slash + 1);
+    shardNames.push_back(name);
+  }
+
+  // The detector and NDAttribute datasets
+  std::map<std::string, NDFileHDF5Dataset *>::iterator it_dset;
+  for (it_dset = this->detDataMap.begin(); it_dset != this->detDataMap.end(); ++it_dset){
+    datasets.push_back(it_dset->second->getHandle());
+  }
+  numDetDatasets = datasets.size();
+  std::list<NDFileHDF5AttributeDataset*>::iterator it_attr;
+  for (it_attr = this->attrList.begin(); it_attr != this->attrList.end(); ++it_attr){
+    datasets.push_back((*it_attr)->getHandle());
+  }
+
+  hid_t master = H5Fcreate(masterFileName, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+  if (master < 0){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s Unable to create HDF5 file: %s\n",
+              driverName, functionName, masterFileName);
+    return asynError;
+  }
+  hid_t lcpl = H5Pcreate(H5P_LINK_CREATE);
+  H5Pset_create_intermediate_group(lcpl, 1);
+
+  for (size_t d = 0; d < datasets.size(); d++){
+    if (datasets[d] <= 0) continue;
+    hid_t space = H5Dget_space(datasets[d]);
+    int rank = H5Sget_simple_extent_dims(space, dims, maxdims);
+    H5Sclose(space);
+    // Only the datasets that grow with the frames are split between the shards. The frame dimension
+    // of the detector datasets has a fixed maximum when NumCapture is set.
+    if (rank < 1 || (d >= numDetDatasets && maxdims[0] != H5S_UNLIMITED)) continue;
+    if (H5Iget_name(datasets[d], path, sizeof(path)) <= 0) continue;
+
+    dims[0] = 0;
+    maxdims[0] = H5S_UNLIMITED;
+    for (int j = 0; j < rank; j++){
+      start[j] = 0;
+      stride[j] = 1;
+      count[j] = 1;
+      block[j] = dims[j];
+    }
+    count[0] = H5S_UNLIMITED;
+    block[0] = 1;
+
+    hid_t vspace = H5Screate_simple(rank, dims, maxdims);
+    hid_t sspace = H5Screate_simple(rank, dims, maxdims);
+    H5Sselect_hyperslab(sspace, H5S_SELECT_SET, start, NULL, count, block);
+    hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+    for (int i = 0; i < this->shardCount; i++){
+      start[0] = i;
+      stride[0] = this->shardCount;
+      H5Sselect_hyperslab(vspace, H5S_SELECT_SET, start, stride, count, block);
+      if (H5Pset_virtual(dcpl, vspace, shardNames[i].c_str(), path, sspace) < 0){
+        status = asynError;
+      }
+    }
+    hid_t datatype = H5Dget_type(datasets[d]);
+    hid_t vds = -1;
+    if (status == asynSuccess){
+      vds = H5Dcreate2(master, path, datatype, vspace, lcpl, dcpl, H5P_DEFAULT);
+    }
+    if (vds < 0){
+      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s Unable to create virtual dataset %s\n",
+                driverName, functionName, path);
+      status = asynError;
+    } else {
+      H5Dclose(vds);
+    }
+    H5Tclose(datatype);
+    H5Pclose(dcpl);
+    H5Sclose(sspace);
+    H5Sclose(vspace);
+    if (status != asynSuccess) break;
+  }
+
+  H5Pclose(lcpl);
+  H5Fclose(master);
+  return status;
+
+  #else
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s Shard files need virtual datasets, which the library compiled against doesn't support.\n",
+            driverName, functionName);
+  return asynError;
+  #endif
+}
+
 /** Create the output file layout as specified by the XML layout.
  */
 asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
@@ -3893,6 +5100,49 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
     delete [] layoutFile;
     return asynError;
   }
+  asynStatus ret = this->loadLayout(layoutFile, pArray);
+  delete [] layoutFile;
+  if (ret != asynSuccess){
+    return ret;
+  }
+
+  ret = this->createXMLFileLayout();
+  return ret;
+}
+
+/** Loads the XML layout for a new file, or keeps the layout parsed for the previous file if the
+ * layout file and the NDArray dimensions written into it as attributes have not changed.
+ * \param[in] layoutFile The layout file name or XML string, empty for the default layout.
+ * \param[in] pArray The first NDArray of the file.
+ */
+asynStatus NDFileHDF5::loadLayout(const char *layoutFile, NDArray *pArray)
+{
+  int status = 0;
+  time_t modTime = 0;
+  std::ostringstream shape;
+  static const char *functionName = "loadLayout";
+
+  shape << pArray->ndims << ":";
+  for (int i = 0; i < pArray->ndims; i++){
+    shape << pArray->dims[i].offset << "," << pArray->dims[i].binning << "," << pArray->dims[i].reverse << ";";
+  }
+  if (this->layoutUnchanged(layoutFile, &modTime) && this->layoutArrayShape == shape.str()){
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Using the layout parsed for the previous file\n",
+              driverName, functionName);
+    this->lock();
+    setIntegerParam(NDFileHDF5_layoutCached, 1);
+    this->unlock();
+    return asynSuccess;
+  }
+
+  // Parse the layout again, and forget the NDAttribute datasets found in the old one
+  this->lock();
+  this->layoutLoaded = false;
+  setIntegerParam(NDFileHDF5_layoutCached, 0);
+  this->unlock();
+  this->attrDsetPlan.clear();
+  this->layout.unload_xml();
+
   // Test here for invalid filename or empty filename.
   // If empty use default layout
   // If invalid raise an error but still use the default layout
@@ -3901,11 +5151,10 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
     status = this->layout.load_xml();
     if (status == -1){
       this->layout.unload_xml();
-      delete [] layoutFile;
       return asynError;
     }
   } else {
-    if (strstr(layoutFile, "<?xml") != NULL || this->fileExists(layoutFile)){
+    if (strstr(layoutFile, "<?xml") != NULL || this->fileExists((char *)layoutFile)){
       // File specified and exists, use the file
       asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s Layout file exists, using the file: %s\n",
                 driverName, functionName, layoutFile);
@@ -3913,7 +5162,6 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
       status = this->layout.load_xml(strLayoutFile);
       if (status == -1){
         this->layout.unload_xml();
-        delete[] layoutFile;
         return asynError;
       }
     } else {
@@ -3922,11 +5170,9 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
       asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s%s Warning: specified XML file does not exist\n",
                 driverName, functionName);
-      delete[] layoutFile;
       return asynError;
     }
   }
-  delete [] layoutFile;
 
   // Append the default NDArray attributes to the detector datasets
   if (this->writeDefaultDatasetAttributes(pArray)) {
@@ -3936,8 +5182,31 @@ asynStatus NDFileHDF5::createFileLayout(NDArray *pArray)
       return asynError;
   }
 
-  asynStatus ret = this->createXMLFileLayout();
-  return ret;
+  // Keep the layout for the next file
+  this->lock();
+  this->layoutSource = layoutFile;
+  this->layoutModTime = modTime;
+  this->layoutArrayShape = shape.str();
+  this->layoutLoaded = true;
+  this->unlock();
+  return asynSuccess;
+}
+
+/** Returns whether the parsed layout was loaded from layoutFile, and the file has not been
+ * modified since.
+ * \param[in] layoutFile The layout file name or XML string, empty for the default layout.
+ * \param[out] modTime The modification time of the layout file, 0 for the default layout or an XML string.
+ */
+bool NDFileHDF5::layoutUnchanged(const char *layoutFile, time_t *modTime)
+{
+  struct stat buffer;
+
+  *modTime = 0;
+  if (strlen(layoutFile) > 0 && strstr(layoutFile, "<?xml") == NULL){
+    if (stat(layoutFile, &buffer) != 0) return false;
+    *modTime = buffer.st_mtime;
+  }
+  return this->layoutLoaded && this->layoutSource == layoutFile && this->layoutModTime == *modTime;
 }
 
 int NDFileHDF5::isAttributeIndex(const std::string& attName)
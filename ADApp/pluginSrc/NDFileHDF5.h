@@ -8,6 +8,9 @@
 #define NDFileHDF5_H
 
 #include <list>
+#include <deque>
+#include <vector>
+#include <string>
 #include <string.h>
 #include <hdf5.h>
 #include <NDPluginFile.h>
@@ -17,6 +20,7 @@
 #include "NDFileHDF5LayoutXML.h"
 #include "NDFileHDF5AttributeDataset.h"
 #include "NDFileHDF5VersionCheck.h"
+#include "NDFileHDF5Reader.h"
 #include "Codec.h"
 
 #define MAXEXTRADIMS 10
@@ -27,6 +31,7 @@
 #define str_NDFileHDF5_chunkBoundaryAlign "HDF5_chunkBoundaryAlign"
 #define str_NDFileHDF5_chunkBoundaryThreshold "HDF5_chunkBoundaryThreshold"
 #define str_NDFileHDF5_NDAttributeChunk  "HDF5_NDAttributeChunk"
+#define str_NDFileHDF5_NDAttributeWritePeriod "HDF5_NDAttributeWritePeriod"
 #define str_NDFileHDF5_nExtraDims        "HDF5_nExtraDims"
 #define str_NDFileHDF5_extraDimOffsetX   "HDF5_extraDimOffsetX"
 #define str_NDFileHDF5_extraDimOffsetY   "HDF5_extraDimOffsetY"
@@ -34,6 +39,10 @@
 #define str_NDFileHDF5_storePerformance  "HDF5_storePerformance"
 #define str_NDFileHDF5_totalRuntime      "HDF5_totalRuntime"
 #define str_NDFileHDF5_totalIoSpeed      "HDF5_totalIoSpeed"
+#define str_NDFileHDF5_openTime          "HDF5_openTime"
+#define str_NDFileHDF5_closeTime         "HDF5_closeTime"
+#define str_NDFileHDF5_performanceDetail "HDF5_performanceDetail"
+#define str_NDFileHDF5_performanceWindow "HDF5_performanceWindow"
 #define str_NDFileHDF5_flushNthFrame     "HDF5_flushNthFrame"
 #define str_NDFileHDF5_compressionType   "HDF5_compressionType"
 #define str_NDFileHDF5_nbitsPrecision    "HDF5_nbitsPrecision"
@@ -44,10 +53,13 @@
 #define str_NDFileHDF5_bloscCompressor   "HDF5_bloscCompressor"
 #define str_NDFileHDF5_bloscCompressLevel "HDF5_bloscCompressLevel"
 #define str_NDFileHDF5_jpegQuality       "HDF5_jpegQuality"
+#define str_NDFileHDF5_zstdLevel         "HDF5_zstdLevel"
+#define str_NDFileHDF5_compressionNumThreads "HDF5_compressionNumThreads"
 #define str_NDFileHDF5_dimAttDatasets    "HDF5_dimAttDatasets"
 #define str_NDFileHDF5_layoutErrorMsg    "HDF5_layoutErrorMsg"
 #define str_NDFileHDF5_layoutValid       "HDF5_layoutValid"
 #define str_NDFileHDF5_layoutFilename    "HDF5_layoutFilename"
+#define str_NDFileHDF5_layoutCached      "HDF5_layoutCached"
 #define str_NDFileHDF5_posRunning        "HDF5_posRunning"
 #define str_NDFileHDF5_posNameDimN       "HDF5_posNameDimN"
 #define str_NDFileHDF5_posNameDimX       "HDF5_posNameDimX"
@@ -61,6 +73,52 @@
 #define str_NDFileHDF5_SWMRSupported     "HDF5_SWMRSupported"
 #define str_NDFileHDF5_SWMRMode          "HDF5_SWMRMode"
 #define str_NDFileHDF5_SWMRRunning       "HDF5_SWMRRunning"
+#define str_NDFileHDF5_SWMRFlushPeriod   "HDF5_SWMRFlushPeriod"
+#define str_NDFileHDF5_writeBehind       "HDF5_writeBehind"
+#define str_NDFileHDF5_writeBehindMaxMemory "HDF5_writeBehindMaxMemory"
+#define str_NDFileHDF5_writeBehindMaxArrays "HDF5_writeBehindMaxArrays"
+#define str_NDFileHDF5_writeBehindQueueSize "HDF5_writeBehindQueueSize"
+#define str_NDFileHDF5_writeBehindMemory "HDF5_writeBehindMemory"
+#define str_NDFileHDF5_writeBehindStallTime "HDF5_writeBehindStallTime"
+#define str_NDFileHDF5_shardCount        "HDF5_shardCount"
+#define str_NDFileHDF5_shardIndex        "HDF5_shardIndex"
+#define str_NDFileHDF5_preSize           "HDF5_preSize"
+#define str_NDFileHDF5_directIO          "HDF5_directIO"
+#define str_NDFileHDF5_directIORunning   "HDF5_directIORunning"
+#define str_NDFileHDF5_readDataset       "HDF5_readDataset"
+#define str_NDFileHDF5_readFrame         "HDF5_readFrame"
+#define str_NDFileHDF5_readNumFrames     "HDF5_readNumFrames"
+
+/** The phases of writing a frame that are timed when PerformanceDetail is enabled */
+typedef enum {
+  NDFileHDF5PhaseLockWait,    /** < Waiting for the flush lock */
+  NDFileHDF5PhaseExtend,      /** < Extending the detector dataset */
+  NDFileHDF5PhaseWrite,       /** < Writing the frame to the detector dataset */
+  NDFileHDF5PhaseAttributes,  /** < Writing the NDAttribute datasets */
+  NDFileHDF5PhaseFlush,       /** < SWMR flushes */
+  NDFileHDF5NumPhases
+} NDFileHDF5Phase_t;
+
+/** The operations done by the write-behind thread of NDFileHDF5 */
+typedef enum {
+  NDFileHDF5JobWrite,   /** < Write pArray to the open file */
+  NDFileHDF5JobFlush,   /** < Flush the datasets of the open file */
+  NDFileHDF5JobClose,   /** < Close the open file and remove tempSuffix from its name */
+  NDFileHDF5JobOpen     /** < Open fileName for arrays like pArray */
+} NDFileHDF5JobType_t;
+
+/** An NDArray waiting to be written by the write-behind thread of NDFileHDF5,
+  * or an operation on the file that must be done in order with the queued arrays.
+  */
+typedef struct NDFileHDF5WriteJob {
+  NDFileHDF5JobType_t type;
+  NDArray *pArray;
+  NDAttributeList *pAttributes;  /** < Values of the plugin attributes when the array was queued, or NULL */
+  epicsInt32 numCaptured;        /** < NDFileNumCaptured when the job was queued */
+  std::string fileName;          /** < Full name of the file to open or close */
+  std::string tempSuffix;        /** < NDFileTempSuffix of the file to close */
+  NDFileOpenMode_t openMode;     /** < Mode of the file to open */
+} NDFileHDF5WriteJob;
 
 /** Writes NDArrays in the HDF5 file format; an XML file can control the structure of the HDF5 file.
   */
@@ -73,6 +131,8 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     static const char *str_NDFileHDF5_extraDimChunk[MAXEXTRADIMS];
     static const char *str_NDFileHDF5_posName[MAXEXTRADIMS];
     static const char *str_NDFileHDF5_posIndex[MAXEXTRADIMS];
+    static const char *str_NDFileHDF5_phaseMean[NDFileHDF5NumPhases];
+    static const char *str_NDFileHDF5_phaseMax[NDFileHDF5NumPhases];
 
     NDFileHDF5(const char *portName, int queueSize, int blockingCallbacks,
                const char *NDArrayPort, int NDArrayAddr,
@@ -88,6 +148,7 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     virtual asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
 
     void flushTask();
+    void writeBehindTask();
     asynStatus startSWMR();
     asynStatus flushCallback();
     asynStatus createXMLFileLayout();
@@ -138,6 +199,7 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_chunkBoundaryAlign;
     int NDFileHDF5_chunkBoundaryThreshold;
     int NDFileHDF5_NDAttributeChunk;
+    int NDFileHDF5_NDAttributeWritePeriod;
     int NDFileHDF5_nExtraDims;
     int NDFileHDF5_extraDimOffsetX;
     int NDFileHDF5_extraDimOffsetY;
@@ -148,6 +210,12 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_storePerformance;
     int NDFileHDF5_totalRuntime;
     int NDFileHDF5_totalIoSpeed;
+    int NDFileHDF5_openTime;
+    int NDFileHDF5_closeTime;
+    int NDFileHDF5_performanceDetail;
+    int NDFileHDF5_performanceWindow;
+    int NDFileHDF5_phaseMean[NDFileHDF5NumPhases];
+    int NDFileHDF5_phaseMax[NDFileHDF5NumPhases];
     int NDFileHDF5_flushNthFrame;
     int NDFileHDF5_compressionType;
     int NDFileHDF5_nbitsPrecision;
@@ -158,10 +226,13 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_bloscCompressLevel;
     int NDFileHDF5_bloscShuffleType;
     int NDFileHDF5_jpegQuality;
+    int NDFileHDF5_zstdLevel;
+    int NDFileHDF5_compressionNumThreads;
     int NDFileHDF5_dimAttDatasets;
     int NDFileHDF5_layoutErrorMsg;
     int NDFileHDF5_layoutValid;
     int NDFileHDF5_layoutFilename;
+    int NDFileHDF5_layoutCached;
     int NDFileHDF5_posRunning;
     int NDFileHDF5_posName[MAXEXTRADIMS];
     int NDFileHDF5_posIndex[MAXEXTRADIMS];
@@ -171,6 +242,21 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     int NDFileHDF5_SWMRSupported;
     int NDFileHDF5_SWMRMode;
     int NDFileHDF5_SWMRRunning;
+    int NDFileHDF5_SWMRFlushPeriod;
+    int NDFileHDF5_writeBehind;
+    int NDFileHDF5_writeBehindMaxMemory;
+    int NDFileHDF5_writeBehindMaxArrays;
+    int NDFileHDF5_writeBehindQueueSize;
+    int NDFileHDF5_writeBehindMemory;
+    int NDFileHDF5_writeBehindStallTime;
+    int NDFileHDF5_shardCount;
+    int NDFileHDF5_shardIndex;
+    int NDFileHDF5_preSize;
+    int NDFileHDF5_directIO;
+    int NDFileHDF5_directIORunning;
+    int NDFileHDF5_readDataset;
+    int NDFileHDF5_readFrame;
+    int NDFileHDF5_readNumFrames;
 
     asynStatus configureDims(NDArray *pArray);
     void calcNumFrames();
@@ -199,11 +285,14 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     char* getDimsReport();
     asynStatus writeStringAttribute(hid_t element, const char* attrName, const char* attrStrValue);
     asynStatus calculateAttributeChunking(int *chunking, int *mdim_chunking);
-    asynStatus writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets);
+    asynStatus writeAttributeDataset(hdf5::When_t whenToSave, int positionMode, hsize_t *offsets, epicsInt32 numCaptured);
+    asynStatus writeAttributeBuffers();
     asynStatus closeAttributeDataset();
     asynStatus configurePerformanceDataset();
     asynStatus createPerformanceDataset();
     asynStatus writePerformanceDataset();
+    void resetPhaseTimes();
+    void recordPhaseTimes(const double *phaseTimes, bool store);
     unsigned int calcIstorek();
     hsize_t calcChunkCacheBytes();
     hsize_t calcChunkCacheSlots();
@@ -215,12 +304,39 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     asynStatus writeDefaultDatasetAttributes(NDArray *pArray);
     asynStatus createNewFile(const char *fileName);
     asynStatus createFileLayout(NDArray *pArray);
+    asynStatus loadLayout(const char *layoutFile, NDArray *pArray);
+    bool layoutUnchanged(const char *layoutFile, time_t *modTime);
     asynStatus createAttributeDataset(NDArray *pArray);
     int isAttributeIndex(const std::string& attName);
     epicsInt32 findPositionIndex(NDArray *pArray, char *posName);
+    asynStatus writeArray(NDArray *pArray, epicsInt32 numCaptured, NDAttributeList *pAttributes);
+    asynStatus openNewFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray,
+                           epicsInt32 numCaptured, NDAttributeList *pAttributes);
+    asynStatus closeOpenFile(epicsInt32 numCaptured);
+    asynStatus openReadFile(const char *fileName);
+    void closeReadFile();
+    asynStatus queueArray(NDArray *pArray, epicsInt32 numCaptured);
+    bool queueFlush();
+    asynStatus queueOpen(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray, epicsInt32 numCaptured);
+    asynStatus queueClose(epicsInt32 numCaptured);
+    void drainWriteQueue();
+    std::string shardFileName(const char *fileName, int index);
+    asynStatus createVirtualMaster(const char *masterFileName, const char *fileName);
+    void setWriteQueueParams();
+    void flushDatasets();
+    asynStatus flushDirtyDatasets();
+    void flushIfDue();
+    double flushWaitTime();
 
 
     hdf5::LayoutXML layout;
+    /* The parsed layout is kept for the next file while the layout file and the NDArray dimensions
+     * written into it are unchanged, so that opening a file does not parse the XML again. */
+    bool layoutLoaded;                /** < layout holds a parsed layout that can be used for the next file */
+    std::string layoutSource;         /** < Layout file name or XML string of the parsed layout, empty for the default layout */
+    time_t layoutModTime;             /** < Modification time of the parsed layout file */
+    std::string layoutArrayShape;     /** < NDArray dimensions written into the parsed layout as attributes */
+    std::map<std::string, hdf5::Dataset*> attrDsetPlan; /** < Layout dataset of each NDAttribute, NULL for the default group */
 
     int nextRecord;
     int *pAttributeId;
@@ -237,19 +353,65 @@ class NDPLUGIN_API NDFileHDF5 : public NDPluginFile
     epicsTimeStamp opents;
     epicsTimeStamp firstFrame;
     double frameSize;  /** < frame size in megabits. For performance measurement. */
+    int performanceColumns;           /** < Values stored in the performance dataset for each frame */
+    size_t performanceBufSize;        /** < Values allocated in performanceBuf */
+    double openTime;                  /** < Time in seconds taken to open the file */
+    bool perfDetail;                  /** < The phases of writing each frame are timed */
+    int phaseWindow;                  /** < Frames in the rolling statistics of the phase times */
+    int phaseFrames;                  /** < Frames in phaseHistory, up to phaseWindow */
+    int phaseNext;                    /** < Frame in phaseHistory that is replaced next */
+    std::vector<double> phaseHistory; /** < Phase times of the last phaseWindow frames */
+    double phaseSum[NDFileHDF5NumPhases];  /** < Sum of each phase time in phaseHistory */
+    double phaseMax[NDFileHDF5NumPhases];  /** < Largest of each phase time in phaseHistory */
     int bytesPerElement;
     char *hostname;
 
     epicsEventId flushEventId;
     epicsMutex flushLock;
 
+    /* Write-behind queue. writeQueue and the counters are protected by writeQueueLock;
+     * the job at the front of the queue is the one being written by writeBehindTask. */
+    std::deque<NDFileHDF5WriteJob> writeQueue;
+    epicsMutex writeQueueLock;
+    epicsEventId writeQueueEventId;   /** < Signalled when a job is queued */
+    epicsEventId writeDoneEventId;    /** < Signalled when a job has been done */
+    bool writeBehindActive;           /** < Arrays for the open file are queued for writeBehindTask */
+    int writeQueueArrays;             /** < Arrays queued or being written */
+    size_t writeQueueBytes;           /** < Memory of the arrays queued or being written */
+    asynStatus writeBehindStatus;     /** < Error from a queued array, reported by the next writeFile or closeFile */
+    double writeBehindStallTime;      /** < Time writeFile has waited for room in the queue since the file was opened */
+
+    /* Sharding: the file holds every shardCount'th frame and the master file of shard 0 presents
+     * the frames of all the shards in order through virtual datasets. */
+    int shardCount;                   /** < Number of shard files, 1 when not sharding */
+    int shardIndex;                   /** < Index of the shard written by this plugin */
+    int shardFrames;                  /** < Frames written to the shard file */
+    int shardFirstUniqueId;           /** < Unique ID of the first frame in the shard file */
+
     std::list<NDFileHDF5AttributeDataset*> attrList;
+    int attrWriteBlock;               /** < Frames of attribute values buffered before they are written, 1 for no buffering */
+    int attrChunking;                 /** < Chunk size of the one dimensional attribute datasets */
+    int attrFrames;                   /** < Frames of attribute values written or buffered */
+    int attrBufferedFrames;           /** < Frames of attribute values buffered */
+    double attrWritePeriod;           /** < Longest time in seconds that attribute values are buffered */
+    epicsTimeStamp attrWriteTime;     /** < Time of the oldest buffered attribute values */
+    double swmrFlushPeriod;           /** < Time in seconds between SWMR flushes, 0 to flush every flushNthFrame frames */
+    epicsTimeStamp lastFlushTime;     /** < Time of the last SWMR flush, or of opening the file */
 
     /* HDF5 handles and references */
     hid_t file;
     hid_t dataspace;
     hid_t datatype;
     hid_t cparms;
+    int compressionNumThreads;  /** < Threads that compress the chunks of uncompressed NDArrays, 0 to use the HDF5 filter */
+    bool preSized;              /** < The detector datasets are created with room for NumCapture frames */
+    hsize_t directIOAlign;      /** < Block size of direct I/O to the open file, 0 if it is written through the page cache */
+    NDFileHDF5Reader *pReader;  /** < Reader of the last file opened with NDFileModeRead, kept open for the next read */
+    bool readFileOpen;          /** < A file is open for reading between openFile and closeFile */
+    std::string readFileName;   /** < Name of the file that pReader has open */
+    std::string readDatasetRequest; /** < HDF5_readDataset when pReader opened the file */
+    time_t readFileModTime;     /** < Modification time of the file when pReader opened it */
+    off_t readFileSize;         /** < Size of the file when pReader opened it */
     void *ptrFillValue;
     hid_t perf_dataset_id;
 
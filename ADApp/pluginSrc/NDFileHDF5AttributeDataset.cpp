@@ -38,7 +38,12 @@ NDFileHDF5AttributeDataset::NDFileHDF5AttributeDataset(hid_t file, const std::st
   rank_(0),
   nextRecord_(0),
   extraDimensions_(0),
-  whenToSave_(hdf5::OnFrame)
+  whenToSave_(hdf5::OnFrame),
+  writeBlock_(1),
+  bufferStart_(0),
+  bufferCount_(0),
+  valueSize_(0),
+  dirty_(false)
 {
   //printf("Constructor called for %s\n", name.c_str());
   // Allocate enough memory for the fill value to accept any data type
@@ -72,6 +77,55 @@ void NDFileHDF5AttributeDataset::setParentGroupName(const std::string& group)
   groupName_ = group;
 }
 
+/** Buffer the values of a one dimensional dataset and write them numFrames at a time,
+ * instead of with one H5Dwrite for every frame. The buffer is also written before a flush
+ * and by writeBuffer(), which the owner calls to write all datasets at the same point.
+ * Must be called after createDataset; datasets with several extra dimensions are not buffered.
+ */
+void NDFileHDF5AttributeDataset::setWriteBlock(int numFrames)
+{
+  writeBuffer();
+  writeBlock_ = 1;
+  if (numFrames > 1 && rank_ == 1 && extraDimensions_ <= 1){
+    writeBlock_ = numFrames;
+    valueSize_ = H5Tget_size(datatype_);
+    buffer_.resize(writeBlock_ * valueSize_);
+  }
+}
+
+/** Write the buffered values to the dataset.
+ */
+asynStatus NDFileHDF5AttributeDataset::writeBuffer()
+{
+  asynStatus status = asynSuccess;
+  hsize_t count[2] = {0, 1};
+  hid_t memspace;
+
+  if (bufferCount_ == 0) return status;
+
+  // The dimensions were extended for every buffered value
+  H5Dset_extent(dataset_, dims_);
+  filespace_ = H5Dget_space(dataset_);
+
+  // Select the hyperslab of all the buffered values
+  count[0] = bufferCount_;
+  H5Sselect_hyperslab(filespace_, H5S_SELECT_SET, &bufferStart_, NULL, count, NULL);
+
+  // Write the data to the hyperslab if data is defined
+  if (!isUndefined_) {
+    memspace = H5Screate_simple(rank_, count, NULL);
+    if (H5Dwrite(dataset_, datatype_, memspace, filespace_, H5P_DEFAULT, &buffer_[0]) < 0){
+      status = asynError;
+    }
+    H5Sclose(memspace);
+  }
+
+  H5Sclose(filespace_);
+  bufferCount_ = 0;
+  dirty_ = true;
+  return status;
+}
+
 asynStatus NDFileHDF5AttributeDataset::createDataset(int user_chunking)
 {
   asynStatus status = asynSuccess;
@@ -144,6 +198,31 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
     // Extend the dataset as required to store the data
     extendDataSet();
 
+    if (writeBlock_ > 1){
+      // Append the value to the buffer, which must hold consecutive elements
+      if (bufferCount_ == writeBlock_ || (bufferCount_ > 0 && bufferStart_ + bufferCount_ != offset_[0])){
+        status = writeBuffer();
+      }
+      if (bufferCount_ == 0){
+        bufferStart_ = offset_[0];
+      }
+      // The attribute type may differ from the dataset type, so read the value as it is
+      // written unbuffered and copy the size of one element
+      ret = ndAttr->getValue(ndAttr->getDataType(), pDatavalue, MAX_ATTRIBUTE_STRING_SIZE);
+      if (ret == ND_ERROR) {
+        memset(pDatavalue, 0, MAX_ATTRIBUTE_STRING_SIZE);
+      }
+      memcpy(&buffer_[bufferCount_ * valueSize_], pDatavalue, valueSize_);
+      bufferCount_++;
+      // Check if we are being asked to flush
+      if (flush == 1){
+        status = writeBuffer();
+        if (status == asynSuccess) status = this->flushDataset();
+      }
+      nextRecord_++;
+      return status;
+    }
+
     // find the data based on datatype
     ret = ndAttr->getValue(ndAttr->getDataType(), pDatavalue, MAX_ATTRIBUTE_STRING_SIZE);
     if (ret == ND_ERROR) {
@@ -160,6 +239,7 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
     if (!isUndefined_) {
        H5Dwrite(dataset_, datatype_, memspace_, filespace_, H5P_DEFAULT, pDatavalue);
     }
+    dirty_ = true;
 
     // Check if we are being asked to flush
     if (flush == 1){
@@ -181,6 +261,8 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
   int ret;
   //check if the attribute is meant to be saved at this time
   if (whenToSave_ == whenToSave) {
+    // Values written by position are not buffered, so write any that are
+    writeBuffer();
     // Extend the dataset as required to store the data
     if (indexed == -1){
       extendDataSet(offsets);
@@ -201,6 +283,7 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
 
     // Write the data to the hyperslab.
     H5Dwrite(dataset_, datatype_, memspace_, filespace_, H5P_DEFAULT, pDatavalue);
+    dirty_ = true;
 
 
     // Check if we are being asked to flush
@@ -218,6 +301,7 @@ asynStatus NDFileHDF5AttributeDataset::writeAttributeDataset(hdf5::When_t whenTo
 asynStatus NDFileHDF5AttributeDataset::closeAttributeDataset()
 {
   //printf("close called for %s\n", name_.c_str());
+  writeBuffer();
   H5Dclose(dataset_);
   H5Sclose(memspace_);
   H5Sclose(dataspace_);
@@ -465,9 +549,18 @@ asynStatus NDFileHDF5AttributeDataset::flushDataset()
 
   // Flush the dataset
   H5Dflush(dataset_);
+  dirty_ = false;
   #else
   status = asynError;
   #endif
 
   return status;
 }
+
+/** Returns whether values have been written, or are waiting in the buffer, since the dataset
+ * was last flushed
+ */
+bool NDFileHDF5AttributeDataset::isDirty()
+{
+  return dirty_ || bufferCount_ > 0;
+}
@@ -9,6 +9,7 @@
 #define ADAPP_PLUGINSRC_NDFILEHDF5ATTRIBUTEDATASET_H_
 
 #include <string>
+#include <vector>
 #include <hdf5.h>
 #include <asynDriver.h>
 #include <NDAttribute.h>
@@ -30,6 +31,9 @@ public:
   asynStatus writeAttributeDataset(hdf5::When_t whenToSave, hsize_t *offsets, NDAttribute *ndAttr, int flush, int indexed);
   asynStatus closeAttributeDataset();
   asynStatus flushDataset();
+  bool isDirty();
+  void setWriteBlock(int numFrames);
+  asynStatus writeBuffer();
   std::string getName();
   hid_t getHandle();
 
@@ -65,6 +69,12 @@ private:
   int              nextRecord_;
   int              extraDimensions_;
   hdf5::When_t     whenToSave_;
+  int              writeBlock_;      // Number of values buffered before they are written, 1 for no buffering
+  std::vector<char> buffer_;         // Values not yet written, for consecutive elements from bufferStart_
+  hsize_t          bufferStart_;
+  int              bufferCount_;
+  size_t           valueSize_;       // Size of one value in buffer_
+  bool             dirty_;           // Whether values were written since the dataset was last flushed
 
 };
 
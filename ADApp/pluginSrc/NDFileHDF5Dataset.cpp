@@ -1,4 +1,6 @@
 #include <iostream>
+#include <vector>
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,20 +9,184 @@
 #include <hdf5_hl.h>
 
 #include "NDFileHDF5Dataset.h"
+#include "NDPluginCodec.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #ifndef htonll
 #define htonll(x) ( ( (uint64_t)(htonl( (uint32_t)(((uint64_t)x << 32) >> 32)))<< 32) | htonl( ((uint32_t)((uint64_t)x >> 32)) ))
 #endif
 
+/* The chunks of a frame are compressed in batches of this many chunks per thread, and each
+ * batch is written before the next one is compressed */
+#define CHUNKS_PER_THREAD 4
+
 static const char *fileName = "NDFileHDF5Dataset";
 
+#ifdef HAVE_ZLIB
+/* Compresses an array in the format of the HDF5 deflate filter */
+static NDArray *compressZlib(NDArray *input, int level, NDCodecStatus_t *status, char *errorMessage)
+{
+  NDArrayInfo_t info;
+  size_t dims[ND_ARRAY_MAX_DIMS];
+
+  input->getInfo(&info);
+  for (int i = 0; i < input->ndims; i++) {
+    dims[i] = input->dims[i].size;
+  }
+  uLongf compSize = compressBound((uLong)info.totalBytes);
+  NDArray *output = input->pNDArrayPool->alloc(input->ndims, dims, input->dataType, compSize, NULL);
+  if (!output) {
+    sprintf(errorMessage, "Failed to allocate zlib output array");
+    *status = NDCODEC_ERROR;
+    return NULL;
+  }
+  if (compress2((Bytef *)output->pData, &compSize, (const Bytef *)input->pData, (uLong)info.totalBytes, level) != Z_OK) {
+    output->release();
+    sprintf(errorMessage, "Internal zlib error");
+    *status = NDCODEC_ERROR;
+    return NULL;
+  }
+  output->codec.name = "zlib";
+  output->codec.level = level;
+  output->compressedSize = compSize;
+  return output;
+}
+#endif
+
+/* Returns true if compressChunk() can compress with the named codec in this build */
+static bool chunkCodecAvailable(const std::string& name)
+{
+#ifdef HAVE_BLOSC
+  if (name == codecName[NDCODEC_BLOSC]) return true;
+#endif
+#ifdef HAVE_BITSHUFFLE
+  if (name == codecName[NDCODEC_BSLZ4] || name == codecName[NDCODEC_LZ4]) return true;
+#endif
+#ifdef HAVE_ZSTD
+  if (name == codecName[NDCODEC_ZSTD]) return true;
+#endif
+#ifdef HAVE_ZLIB
+  if (name == "zlib") return true;
+#endif
+  return false;
+}
+
+/* Compresses an array with the codec of a dataset, as its HDF5 filter would */
+static NDArray *compressChunk(NDArray *input, const Codec_t& codec, int numThreads,
+                              NDCodecStatus_t *status, char *errorMessage)
+{
+  if (codec.name == codecName[NDCODEC_BLOSC]) {
+    return compressBlosc(input, codec.level, codec.shuffle, (NDCodecBloscComp_t)codec.compressor,
+                         numThreads, status, errorMessage);
+  } else if (codec.name == codecName[NDCODEC_BSLZ4]) {
+    return compressBSLZ4(input, numThreads, status, errorMessage);
+  } else if (codec.name == codecName[NDCODEC_LZ4]) {
+    return compressLZ4(input, status, errorMessage);
+  } else if (codec.name == codecName[NDCODEC_ZSTD]) {
+    return compressZstd(input, codec.level, numThreads, NULL, status, errorMessage);
+  }
+#ifdef HAVE_ZLIB
+  if (codec.name == "zlib") {
+    return compressZlib(input, codec.level, status, errorMessage);
+  }
+#endif
+  sprintf(errorMessage, "Unsupported codec '%s'", codec.name.c_str());
+  *status = NDCODEC_ERROR;
+  return NULL;
+}
+
+/* A batch of the chunks of one frame, compressed in parallel by the codec worker pool */
+typedef struct ChunkBatch {
+  NDArray *pArray;
+  const Codec_t *pCodec;
+  int ndims;
+  size_t chunk[ND_ARRAY_MAX_DIMS];     /* Chunk size in each NDArray dimension */
+  size_t nChunks[ND_ARRAY_MAX_DIMS];   /* Number of chunks in each NDArray dimension */
+  size_t first;                        /* Index of the first chunk in the batch */
+  std::vector<NDArray *> output;       /* Compressed chunks, NULL if compression failed */
+  std::vector<std::string> error;
+} ChunkBatch;
+
+/* Finds the first element of a chunk in each NDArray dimension. Chunks are numbered in the
+ * order they are stored in the dataset, with dimension 0 changing fastest. */
+static void chunkStart(const ChunkBatch *pBatch, size_t index, size_t *start)
+{
+  for (int i = 0; i < pBatch->ndims; i++) {
+    start[i] = (index % pBatch->nChunks[i]) * pBatch->chunk[i];
+    index /= pBatch->nChunks[i];
+  }
+}
+
+/* Copies one chunk of a frame into a contiguous array. Chunks at the upper edges of the frame
+ * are padded with zeros, because a direct chunk write always stores a whole chunk. */
+static void copyChunk(NDArray *pArray, NDArray *pChunk, const size_t *chunk, const size_t *start)
+{
+  NDArrayInfo_t info;
+  size_t rows = 1;
+  bool partial = false;
+
+  pArray->getInfo(&info);
+  for (int i = 0; i < pArray->ndims; i++) {
+    if (start[i] + chunk[i] > pArray->dims[i].size) partial = true;
+    if (i > 0) rows *= chunk[i];
+  }
+  size_t rowBytes = std::min(chunk[0], pArray->dims[0].size - start[0]) * info.bytesPerElement;
+  if (partial) {
+    memset(pChunk->pData, 0, rows * chunk[0] * info.bytesPerElement);
+  }
+
+  const char *pIn = (const char *)pArray->pData;
+  char *pOut = (char *)pChunk->pData;
+  for (size_t row = 0; row < rows; row++) {
+    size_t r = row, element = start[0], stride = pArray->dims[0].size;
+    bool inside = true;
+    for (int i = 1; i < pArray->ndims && inside; i++) {
+      size_t index = start[i] + r % chunk[i];
+      r /= chunk[i];
+      inside = index < pArray->dims[i].size;
+      element += index * stride;
+      stride *= pArray->dims[i].size;
+    }
+    if (inside) {
+      memcpy(pOut + row * chunk[0] * info.bytesPerElement, pIn + element * info.bytesPerElement, rowBytes);
+    }
+  }
+}
+
+static void compressChunkTask(void *arg, int i)
+{
+  ChunkBatch *pBatch = (ChunkBatch *)arg;
+  size_t start[ND_ARRAY_MAX_DIMS];
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+  NDArray *pChunk = pBatch->pArray->pNDArrayPool->alloc(pBatch->ndims, pBatch->chunk, pBatch->pArray->dataType, 0, NULL);
+  if (!pChunk) {
+    pBatch->error[i] = "Failed to allocate chunk array";
+    return;
+  }
+  chunkStart(pBatch, pBatch->first + i, start);
+  copyChunk(pBatch->pArray, pChunk, pBatch->chunk, start);
+  pBatch->output[i] = compressChunk(pChunk, *pBatch->pCodec, 1, &status, errorMessage);
+  if (!pBatch->output[i]) {
+    pBatch->error[i] = errorMessage;
+  }
+  pChunk->release();
+}
+
 /** Constructor.
  * \param[in] pAsynUser - asynUser that is used to control debugging output
  * \param[in] name - String name of the dataset.
  * \param[in] dataset - HDF5 handle to the dataset.
  */
 NDFileHDF5Dataset::NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& name, hid_t dataset) :
-                                     pAsynUser_(pAsynUser), name_(name), dataset_(dataset), nextRecord_(0)
+                                     pAsynUser_(pAsynUser), name_(name), dataset_(dataset), nextRecord_(0),
+                                     numCompressThreads_(0), positional_(false), pChunkBuffer_(NULL),
+                                     chunkBufferStart_(0), chunkBufferFrames_(0), chunkBufferDirty_(false),
+                                     preSized_(false), fileSpace_(-1), dirty_(false), extendTime_(0.0)
 {
   this->maxdims_     = NULL;
   this->dims_        = NULL;
@@ -32,6 +198,8 @@ NDFileHDF5Dataset::NDFileHDF5Dataset(asynUser *pAsynUser, const std::string& nam
 
 NDFileHDF5Dataset::~NDFileHDF5Dataset()
 {
+  if (this->pChunkBuffer_ != NULL) this->pChunkBuffer_->release();
+  if (this->fileSpace_ >= 0) H5Sclose(this->fileSpace_);
   if (this->chunkdims_   != NULL) free(this->chunkdims_);
   if (this->maxdims_     != NULL) free(this->maxdims_);
   if (this->dims_        != NULL) free(this->dims_);
@@ -164,6 +332,7 @@ asynStatus NDFileHDF5Dataset::extendDataSet(int extradims, hsize_t *offsets)
   static const char *functionName = "extendDataSet";
 
   // If this method has been called then we are being asked to extend to a particular index
+  this->positional_ = true;
   for (int index = 0; index <= extradims; index++){
     // Check the requested offset is not outside the dimension maximum
     if (offsets[index] < this->virtualdims_[index]){
@@ -232,13 +401,188 @@ asynStatus NDFileHDF5Dataset::verifyChunking(NDArray *pArray)
   return asynSuccess;
 }
 
+/**
+ * Check if an uncompressed NDArray can be assembled with the frames that follow it into a chunk that
+ * spans several frames, which is then written with one direct chunk write. This needs frames written
+ * in order along a single frame dimension, each frame a single chunk in its own dimensions, and a
+ * dataset that is either uncompressed or compressed by the plugin with a codec it can compress with.
+ * \param[in] pArray - The NDArray to write.
+ */
+bool NDFileHDF5Dataset::canAssembleChunks(NDArray *pArray)
+{
+  if (!this->multiFrame_ || this->positional_ || this->extra_rank_ != 1) {
+    return false;
+  }
+  if (this->chunkdims_[pArray->ndims] <= 1 || pArray->ndims >= ND_ARRAY_MAX_DIMS) {
+    return false;
+  }
+  if (!pArray->codec.empty() || !pArray->pNDArrayPool) {
+    return false;
+  }
+  if (!this->codec.empty() && (this->numCompressThreads_ < 1 || !chunkCodecAvailable(this->codec.name))) {
+    return false;
+  }
+  for (int index = 0; index < pArray->ndims; index++) {
+    if (pArray->dims[index].size != this->chunkdims_[index]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/** assembleChunk.
+ * Copy a frame into the chunk buffer at its position in the chunk, and write the chunk once it is full.
+ * A chunk is only started with the first frame of the chunk; the frames of a chunk that was started
+ * some other way are written by the HDF5 library.
+ * \param[in] pArray - The NDArray containing the data to write.
+ * Returns asynDisabled if the frame was not assembled, in which case it should be written with H5Dwrite.
+ */
+asynStatus NDFileHDF5Dataset::assembleChunk(NDArray *pArray)
+{
+  NDArrayInfo_t info;
+  size_t dims[ND_ARRAY_MAX_DIMS];
+  hsize_t chunkFrames = this->chunkdims_[pArray->ndims];
+  hsize_t frame = this->offset_[0];
+  hsize_t start = frame - frame % chunkFrames;
+  asynStatus status = asynSuccess;
+
+  // Write the buffered frames if this frame does not follow them
+  if (this->chunkBufferFrames_ > 0 &&
+      (start != this->chunkBufferStart_ || frame != start + this->chunkBufferFrames_)) {
+    status = this->writeAssembledChunk();
+    this->chunkBufferFrames_ = 0;
+    if (status != asynSuccess) return status;
+  }
+  if (this->chunkBufferFrames_ == 0 && frame != start) {
+    return asynDisabled;
+  }
+
+  pArray->getInfo(&info);
+  if (this->pChunkBuffer_ == NULL) {
+    for (int i = 0; i < pArray->ndims; i++) {
+      dims[i] = pArray->dims[i].size;
+    }
+    dims[pArray->ndims] = (size_t)chunkFrames;
+    this->pChunkBuffer_ = pArray->pNDArrayPool->alloc(pArray->ndims + 1, dims, pArray->dataType, 0, NULL);
+    if (this->pChunkBuffer_ == NULL) {
+      return asynDisabled;
+    }
+  }
+  memcpy((char *)this->pChunkBuffer_->pData + this->chunkBufferFrames_ * info.totalBytes,
+         pArray->pData, info.totalBytes);
+  this->chunkBufferStart_ = start;
+  this->chunkBufferFrames_++;
+  this->chunkBufferDirty_ = true;
+
+  if ((hsize_t)this->chunkBufferFrames_ == chunkFrames) {
+    status = this->writeAssembledChunk();
+    this->chunkBufferFrames_ = 0;
+  }
+  return status;
+}
+
+/** writeAssembledChunk.
+ * Write the frames in the chunk buffer with a direct chunk write, compressing the chunk first if the
+ * dataset is compressed. A chunk that is not full is padded with zeros; its frames are kept so that
+ * the chunk is written again when the rest of its frames arrive. Called when the chunk is full, on a
+ * flush and before the dataset is closed.
+ */
+asynStatus NDFileHDF5Dataset::writeAssembledChunk()
+{
+  NDArrayInfo_t info;
+  herr_t hdfstatus = 0;
+  static const char *functionName = "writeAssembledChunk";
+
+  if (this->pChunkBuffer_ == NULL || this->chunkBufferFrames_ == 0 || !this->chunkBufferDirty_) {
+    return asynSuccess;
+  }
+  int frameDim = this->pChunkBuffer_->ndims - 1;
+  size_t chunkFrames = this->pChunkBuffer_->dims[frameDim].size;
+  this->pChunkBuffer_->getInfo(&info);
+  size_t frameBytes = info.totalBytes / chunkFrames;
+  if ((size_t)this->chunkBufferFrames_ < chunkFrames) {
+    memset((char *)this->pChunkBuffer_->pData + this->chunkBufferFrames_ * frameBytes, 0,
+           (chunkFrames - this->chunkBufferFrames_) * frameBytes);
+  }
+  std::vector<hsize_t> offset(this->rank_, 0);
+  offset[0] = this->chunkBufferStart_;
+
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+            "%s::%s Writing %d frames from frame %d as one chunk. Using direct chunk write\n",
+            fileName, functionName, this->chunkBufferFrames_, (int)this->chunkBufferStart_);
+  if (this->codec.empty()) {
+    hdfstatus = this->writeChunk(this->pChunkBuffer_, &offset[0]);
+  } else {
+    char errorMessage[256];
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    NDArray *pChunk = compressChunk(this->pChunkBuffer_, this->codec, this->numCompressThreads_, &codecStatus, errorMessage);
+    if (pChunk) {
+      hdfstatus = this->writeChunk(pChunk, &offset[0]);
+      pChunk->release();
+    } else {
+      // Leave the compression to the HDF5 filter pipeline
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR compressing chunk: %s. Using standard write\n",
+                fileName, functionName, errorMessage);
+      std::vector<hsize_t> count(this->dims_, this->dims_ + this->rank_);
+      count[0] = this->chunkBufferFrames_;
+      hid_t fspace = H5Dget_space(this->dataset_);
+      hid_t mspace = H5Screate_simple(this->rank_, &count[0], NULL);
+      hid_t datatype = H5Dget_type(this->dataset_);
+      hdfstatus = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset[0], NULL, &count[0], NULL);
+      if (!hdfstatus) {
+        hdfstatus = H5Dwrite(this->dataset_, datatype, mspace, fspace, H5P_DEFAULT, this->pChunkBuffer_->pData);
+      }
+      H5Tclose(datatype);
+      H5Sclose(mspace);
+      H5Sclose(fspace);
+    }
+  }
+  if (hdfstatus){
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to write the chunk at frame %d of dataset [%s]\n",
+              fileName, functionName, (int)this->chunkBufferStart_, this->name_.c_str());
+    return asynError;
+  }
+  this->chunkBufferDirty_ = false;
+  return asynSuccess;
+}
+
+/**
+ * Check if the chunks of an uncompressed NDArray can be compressed by the plugin and written with
+ * direct chunk writes. This needs a codec that the plugin can compress with and the same chunk layout
+ * as the direct chunk write of pre-compressed NDArrays, except that a frame may span several chunks.
+ * \param[in] pArray - The NDArray to write.
+ */
+bool NDFileHDF5Dataset::canCompressChunks(NDArray *pArray)
+{
+  if (this->numCompressThreads_ < 1 || !pArray->codec.empty() || !pArray->pNDArrayPool) {
+    return false;
+  }
+  if (!chunkCodecAvailable(this->codec.name)) {
+    return false;
+  }
+  if (this->multiFrame_ && this->chunkdims_[pArray->ndims] != 1) {
+    return false;
+  }
+  for (int index = 0; index < this->extra_rank_; index++) {
+    if (this->virtualchunkdims_[index] > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
 /**
  * Store codec definition
  * \param[in] codec - Codec definition.
+ * \param[in] numThreads - Number of threads used to compress the chunks of uncompressed NDArrays
+ * before writing them directly. 0 to compress them with the HDF5 filter pipeline.
  */
-void NDFileHDF5Dataset::configureCompression(Codec_t codec)
+void NDFileHDF5Dataset::configureCompression(Codec_t codec, int numThreads)
 {
   this->codec = codec;
+  this->numCompressThreads_ = numThreads;
 }
 
 /** writeFile.
@@ -251,22 +595,35 @@ void NDFileHDF5Dataset::configureCompression(Codec_t codec)
 asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize)
 {
   herr_t hdfstatus;
+  hid_t fspace;
+  epicsTimeStamp extendStart, extendEnd;
   static const char *functionName = "writeFile";
 
-  // Increase the size of the dataset
-  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
-            "%s::%s: set_extent dims={%d,%d,%d}\n",
-            fileName, functionName, (int)this->dims_[0], (int)this->dims_[1], (int)this->dims_[2]);
+  this->dirty_ = true;
+  this->extendTime_ = 0.0;
+  if (this->preSized_) {
+    // The dataset already has room for every frame, so there is no metadata to update
+    if (this->fileSpace_ < 0) this->fileSpace_ = H5Dget_space(this->dataset_);
+    fspace = this->fileSpace_;
+  } else {
+    // Increase the size of the dataset
+    asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+              "%s::%s: set_extent dims={%d,%d,%d}\n",
+              fileName, functionName, (int)this->dims_[0], (int)this->dims_[1], (int)this->dims_[2]);
 
-  hdfstatus = H5Dset_extent(this->dataset_, this->dims_);
-  if (hdfstatus){
-    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
-              "%s::%s ERROR Increasing the size of the dataset [%s] failed\n",
-              fileName, functionName, this->name_.c_str());
-    return asynError;
+    epicsTimeGetCurrent(&extendStart);
+    hdfstatus = H5Dset_extent(this->dataset_, this->dims_);
+    if (hdfstatus){
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Increasing the size of the dataset [%s] failed\n",
+                fileName, functionName, this->name_.c_str());
+      return asynError;
+    }
+    // Select a hyperslab.
+    fspace = H5Dget_space(this->dataset_);
+    epicsTimeGetCurrent(&extendEnd);
+    this->extendTime_ = epicsTimeDiffInSeconds(&extendEnd, &extendStart);
   }
-  // Select a hyperslab.
-  hid_t fspace = H5Dget_space(this->dataset_);
   if (fspace < 0){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
               "%s::%s ERROR Unable to get a copy of the dataspace for dataset [%s]\n",
@@ -278,65 +635,44 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
               "%s::%s ERROR Unable to select hyperslab\n",
               fileName, functionName);
-    H5Sclose(fspace);
+    if (!this->preSized_) H5Sclose(fspace);
     return asynError;
   }
 
   // Write the data to the hyperslab.
-  if (H5_VERSION_GE(1, 8, 11) && verifyChunking(pArray) == asynSuccess) {
+  asynStatus chunkStatus = asynDisabled;
+  asynStatus pendingStatus = asynSuccess;
+  bool assemble = H5_VERSION_GE(1, 8, 11) && canAssembleChunks(pArray);
+  if (!assemble && this->chunkBufferFrames_ > 0) {
+    // Write the frames assembled so far before this frame is written some other way.
+    // If they cannot be written this frame is still written, and the error is returned afterwards.
+    pendingStatus = this->writeAssembledChunk();
+    if (pendingStatus != asynSuccess) {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR %d assembled frames from frame %d of dataset [%s] were lost, writing frame %d\n",
+                fileName, functionName, this->chunkBufferFrames_, (int)this->chunkBufferStart_,
+                this->name_.c_str(), this->nextRecord_);
+      this->chunkBufferDirty_ = false;
+    }
+    this->chunkBufferFrames_ = 0;
+  }
+  if (assemble) {
+    chunkStatus = this->assembleChunk(pArray);
+  }
+  if (chunkStatus == asynDisabled && H5_VERSION_GE(1, 8, 11) && canCompressChunks(pArray)) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+              "%s::%s Compressing chunks with %d threads. Using direct chunk write\n",
+              fileName, functionName, this->numCompressThreads_);
+    chunkStatus = this->writeCompressedChunks(pArray);
+  }
+  if (chunkStatus != asynDisabled) {
+    hdfstatus = (chunkStatus == asynSuccess) ? 0 : -1;
+  } else if (H5_VERSION_GE(1, 8, 11) && verifyChunking(pArray) == asynSuccess) {
     // The chunking and compression settings match - use direct chunk write
     asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
               "%s::%s NDArray correctly chunked. Using direct chunk write\n",
               fileName, functionName);
-    size_t size = pArray->compressedSize;
-    void *pData = pArray->pData;
-    char *temp=0;
-    NDArrayInfo_t info;
-    pArray->getInfo(&info);
-    if (pArray->codec.empty()) {
-        size = info.totalBytes;
-    }
-    else if (pArray->codec.name == codecName[NDCODEC_LZ4]) {
-        // We need to add a 16-byte header to the lz4 compressed data
-        temp = (char *)malloc(16 + size);
-        // First 8 bytes is the uncompressed array size
-        unsigned long long ui64 = htonll(info.totalBytes);
-        memcpy(temp, &ui64, 8);
-        // Next 4 bytes is the block size = uncompressed size as long as < 1GB which we assume here
-        epicsUInt32 ui32 = htonl((int)info.totalBytes);
-        memcpy(temp+8, &ui32, 4);
-        // Next 4 bytes is the compressed size
-        ui32 = htonl((int)size);
-        memcpy(temp+12, &ui32, 4);
-        // Now copy the data
-        memcpy(temp+16, pArray->pData, size);
-        pData = temp;
-        size += 16;
-    }
-    else if (pArray->codec.name == codecName[NDCODEC_BSLZ4]) {
-        // We need to add a 12-byte header to the bs/lz4 compressed data
-        temp = (char *)malloc(12 + size);
-        // First 8 bytes is the uncompressed array size
-        unsigned long long ui64 = htonll(info.totalBytes);
-        memcpy(temp, &ui64, 8);
-        // Next 4 bytes is the block size * elem_size;  8192 is the default in bitshuffle
-        epicsUInt32 ui32 = htonl(8192);
-        memcpy(temp+8, &ui32, 4);
-        // Now copy the data
-        memcpy(temp+12, pArray->pData, size);
-        pData = temp;
-        size += 12;
-    }
-    #if H5_VERSION_GE(1, 10, 3)
-    hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
-                               this->offset_, size, pData);
-    #else  // Use deprecated method
-    hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
-                                this->offset_, size, pData);
-    #endif
-    if (temp) {
-        free(temp);
-    }
+    hdfstatus = this->writeChunk(pArray, this->offset_);
   } else {
     // Either direct chunk write is not available, or we need to use the HDF5 pipeline for
     // compression / chunk buffering - use standard write method
@@ -345,7 +681,7 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
       asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
                 "%s::%s ERROR Unable to write pre-compressed data - mismatched chunk definition\n",
                 fileName, functionName);
-      H5Sclose(fspace);
+      if (!this->preSized_) H5Sclose(fspace);
       return asynError;
     }
     asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
@@ -358,11 +694,11 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
               "%s::%s ERROR Unable to write data to hyperslab\n",
               fileName, functionName);
-    H5Sclose(fspace);
+    if (!this->preSized_) H5Sclose(fspace);
     return asynError;
   }
 
-  hdfstatus = H5Sclose(fspace);
+  hdfstatus = this->preSized_ ? 0 : H5Sclose(fspace);
   if (hdfstatus){
     asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
               "%s::%s ERROR Unable to close the dataspace\n",
@@ -372,7 +708,156 @@ asynStatus NDFileHDF5Dataset::writeFile(NDArray *pArray, hid_t datatype, hid_t d
 
   this->nextRecord_++;
 
-  return asynSuccess;
+  return pendingStatus;
+}
+
+/** getExtendTime.
+ * Return the time in seconds that the last call to writeFile spent extending the dataset
+ * in the file, which is 0 for a pre-sized dataset.
+ */
+double NDFileHDF5Dataset::getExtendTime()
+{
+  return this->extendTime_;
+}
+
+/** writeChunk.
+ * Write one chunk of data with a direct chunk write, adding the header that the HDF5 filter
+ * of the codec expects.
+ * \param[in] pChunk - NDArray holding the whole chunk, uncompressed or compressed with the dataset codec.
+ * \param[in] offset - The offset of the chunk in the dataset.
+ */
+herr_t NDFileHDF5Dataset::writeChunk(NDArray *pChunk, const hsize_t *offset)
+{
+  herr_t hdfstatus;
+  size_t size = pChunk->compressedSize;
+  void *pData = pChunk->pData;
+  char *temp=0;
+  NDArrayInfo_t info;
+  pChunk->getInfo(&info);
+  if (pChunk->codec.empty()) {
+      size = info.totalBytes;
+  }
+  else if (pChunk->codec.name == codecName[NDCODEC_LZ4]) {
+      // We need to add a 16-byte header to the lz4 compressed data
+      temp = (char *)malloc(16 + size);
+      // First 8 bytes is the uncompressed array size
+      unsigned long long ui64 = htonll(info.totalBytes);
+      memcpy(temp, &ui64, 8);
+      // Next 4 bytes is the block size = uncompressed size as long as < 1GB which we assume here
+      epicsUInt32 ui32 = htonl((int)info.totalBytes);
+      memcpy(temp+8, &ui32, 4);
+      // Next 4 bytes is the compressed size
+      ui32 = htonl((int)size);
+      memcpy(temp+12, &ui32, 4);
+      // Now copy the data
+      memcpy(temp+16, pChunk->pData, size);
+      pData = temp;
+      size += 16;
+  }
+  else if (pChunk->codec.name == codecName[NDCODEC_BSLZ4]) {
+      // We need to add a 12-byte header to the bs/lz4 compressed data
+      temp = (char *)malloc(12 + size);
+      // First 8 bytes is the uncompressed array size
+      unsigned long long ui64 = htonll(info.totalBytes);
+      memcpy(temp, &ui64, 8);
+      // Next 4 bytes is the block size * elem_size;  8192 is the default in bitshuffle
+      epicsUInt32 ui32 = htonl(8192);
+      memcpy(temp+8, &ui32, 4);
+      // Now copy the data
+      memcpy(temp+12, pChunk->pData, size);
+      pData = temp;
+      size += 12;
+  }
+  #if H5_VERSION_GE(1, 10, 3)
+  hdfstatus = H5Dwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
+                             offset, size, pData);
+  #else  // Use deprecated method
+  hdfstatus = H5DOwrite_chunk(this->dataset_, H5P_DEFAULT, 0x0,
+                              offset, size, pData);
+  #endif
+  if (temp) {
+      free(temp);
+  }
+  return hdfstatus;
+}
+
+/** writeCompressedChunks.
+ * Compress an uncompressed NDArray chunk by chunk with the dataset codec and write the chunks in
+ * order with direct chunk writes, rather than leaving the compression to the HDF5 filter pipeline
+ * in this thread. The chunks are compressed in batches by numCompressThreads_ threads of the
+ * codec worker pool. A frame that is a single chunk is compressed with the threads of the codec.
+ * \param[in] pArray - The NDArray containing the data to write.
+ * Returns asynDisabled if the data could not be compressed, in which case the frame should be
+ * written through the HDF5 filter pipeline instead.
+ */
+asynStatus NDFileHDF5Dataset::writeCompressedChunks(NDArray *pArray)
+{
+  ChunkBatch batch;
+  size_t totalChunks = 1;
+  size_t start[ND_ARRAY_MAX_DIMS];
+  std::vector<hsize_t> offset(this->offset_, this->offset_ + this->rank_);
+  asynStatus status = asynSuccess;
+  static const char *functionName = "writeCompressedChunks";
+
+  batch.pArray = pArray;
+  batch.pCodec = &this->codec;
+  batch.ndims = pArray->ndims;
+  for (int i = 0; i < pArray->ndims; i++) {
+    batch.chunk[i] = (size_t)this->chunkdims_[i];
+    if (batch.chunk[i] < 1 || batch.chunk[i] > pArray->dims[i].size) {
+      batch.chunk[i] = pArray->dims[i].size;
+    }
+    batch.nChunks[i] = (pArray->dims[i].size + batch.chunk[i] - 1) / batch.chunk[i];
+    totalChunks *= batch.nChunks[i];
+  }
+
+  if (totalChunks == 1) {
+    char errorMessage[256];
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    NDArray *pChunk = compressChunk(pArray, this->codec, this->numCompressThreads_, &codecStatus, errorMessage);
+    if (!pChunk) {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR compressing chunk: %s\n",
+                fileName, functionName, errorMessage);
+      return asynDisabled;
+    }
+    if (this->writeChunk(pChunk, this->offset_)) {
+      status = asynError;
+    }
+    pChunk->release();
+    return status;
+  }
+
+  size_t batchSize = (size_t)this->numCompressThreads_ * CHUNKS_PER_THREAD;
+  for (batch.first = 0; batch.first < totalChunks && status == asynSuccess; batch.first += batchSize) {
+    int nChunks = (int)std::min(batchSize, totalChunks - batch.first);
+    batch.output.assign(nChunks, (NDArray *)NULL);
+    batch.error.assign(nChunks, std::string());
+    NDCodecWorkerPool::run(compressChunkTask, &batch, nChunks, this->numCompressThreads_);
+
+    for (int i = 0; i < nChunks; i++) {
+      if (status == asynSuccess) {
+        if (!batch.output[i]) {
+          asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                    "%s::%s ERROR compressing chunk: %s\n",
+                    fileName, functionName, batch.error[i].c_str());
+          status = asynDisabled;
+        } else {
+          chunkStart(&batch, batch.first + i, start);
+          for (int j = 0; j < pArray->ndims; j++) {
+            offset[this->extra_rank_ + pArray->ndims - 1 - j] = start[j];
+          }
+          if (this->writeChunk(batch.output[i], &offset[0])) {
+            status = asynError;
+          }
+        }
+      }
+      if (batch.output[i]) {
+        batch.output[i]->release();
+      }
+    }
+  }
+  return status;
 }
 
 /** getHandle.
@@ -386,6 +871,10 @@ hid_t NDFileHDF5Dataset::getHandle()
 asynStatus NDFileHDF5Dataset::flushDataset()
 {
   static const char *functionName = "flushDataset";
+  // Frames waiting in a chunk that is not yet full are written so that readers can see them
+  if (this->writeAssembledChunk() != asynSuccess) {
+    return asynError;
+  }
   // flushDataset is a no-op if the HDF version doesn't support it
   #if H5_VERSION_GE(1,9,178)
 
@@ -399,6 +888,7 @@ asynStatus NDFileHDF5Dataset::flushDataset()
               fileName, functionName, this->name_.c_str());
     return asynError;
   }
+  this->dirty_ = false;
   #else
   // If this is called when we do not support SWMR then someone has done something
   // bad, so return an asynError
@@ -411,6 +901,58 @@ asynStatus NDFileHDF5Dataset::flushDataset()
   return asynSuccess;
 }
 
+/** isDirty.
+ * \return Whether frames have been written, or are waiting in an assembled chunk, since the dataset
+ * was last flushed.
+ */
+bool NDFileHDF5Dataset::isDirty()
+{
+  return this->dirty_ || this->chunkBufferDirty_;
+}
+
+/** setPreSized.
+ * Mark the dataset as created with room for all of its frames, in which case writeFile does not
+ * extend it for each frame and trimDataset shrinks it to the frames written before it is closed.
+ * \param[in] preSized - Whether the dataset was created at its maximum size.
+ */
+void NDFileHDF5Dataset::setPreSized(bool preSized)
+{
+  this->preSized_ = preSized;
+}
+
+/** trimDataset.
+ * Shrink a pre-sized dataset to the frames that have been written, when fewer frames were
+ * written than it was created for.
+ */
+asynStatus NDFileHDF5Dataset::trimDataset()
+{
+  hsize_t fileDims[H5S_MAX_RANK];
+  static const char *functionName = "trimDataset";
+
+  if (!this->preSized_ || this->dims_ == NULL) {
+    return asynSuccess;
+  }
+  if (this->fileSpace_ >= 0) {
+    H5Sclose(this->fileSpace_);
+    this->fileSpace_ = -1;
+  }
+  hid_t space = H5Dget_space(this->dataset_);
+  H5Sget_simple_extent_dims(space, fileDims, NULL);
+  H5Sclose(space);
+  if (this->dims_[0] < fileDims[0]) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+              "%s::%s Trimming dataset [%s] from %d to %d frames\n",
+              fileName, functionName, this->name_.c_str(), (int)fileDims[0], (int)this->dims_[0]);
+    if (H5Dset_extent(this->dataset_, this->dims_)) {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Reducing the size of the dataset [%s] failed\n",
+                fileName, functionName, this->name_.c_str());
+      return asynError;
+    }
+  }
+  return asynSuccess;
+}
+
 /** Return the requested dimension size.
   * \param[in] index of dimension
   * \return size of the dimension
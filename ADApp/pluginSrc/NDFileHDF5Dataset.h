@@ -18,16 +18,26 @@ class NDFileHDF5Dataset
     asynStatus extendDataSet(int extradims);
     asynStatus extendDataSet(int extradims, hsize_t *offsets);
     asynStatus verifyChunking(NDArray *pArray);
-    void configureCompression(Codec_t codec);
+    void configureCompression(Codec_t codec, int numThreads = 0);
     asynStatus writeFile(NDArray *pArray, hid_t datatype, hid_t dataspace, hsize_t *framesize);
+    double getExtendTime();
     hid_t getHandle();
     asynStatus flushDataset();
+    bool isDirty();
+    asynStatus writeAssembledChunk();
+    void setPreSized(bool preSized);
+    asynStatus trimDataset();
     hsize_t getDim(int index);
     hsize_t getMaxDim(int index);
     hsize_t getOffset(int index);
     hsize_t getVirtualDim(int index);
 
   private:
+    bool canAssembleChunks(NDArray *pArray);
+    asynStatus assembleChunk(NDArray *pArray);
+    bool canCompressChunks(NDArray *pArray);
+    asynStatus writeCompressedChunks(NDArray *pArray);
+    herr_t writeChunk(NDArray *pChunk, const hsize_t *offset);
 
     asynUser    *pAsynUser_;   // Pointer to the asynUser structure
     std::string name_;         // Name of this dataset
@@ -44,6 +54,16 @@ class NDFileHDF5Dataset
     hsize_t     *virtualdims_; // The desired sizes of the extra (virtual) dimensions: {Y, X, n}
     hsize_t     *virtualchunkdims_;   // The chunk sizes of the extra (virtual) dimensions: {Y, X, n}
     Codec_t codec;             // Definition of codec used to compress the data.
+    int         numCompressThreads_; // Threads used to compress chunks before direct chunk write, 0 to use the HDF5 filter
+    bool        positional_;   // Whether frames are placed at positions given by the NDArrays
+    NDArray     *pChunkBuffer_;      // Frames assembled into a chunk that spans several frames
+    hsize_t     chunkBufferStart_;   // Frame number of the first frame in pChunkBuffer_
+    int         chunkBufferFrames_;  // Number of frames in pChunkBuffer_
+    bool        chunkBufferDirty_;   // Whether pChunkBuffer_ has frames that have not been written
+    bool        preSized_;     // Whether the dataset was created at its maximum size, so it is not extended
+    hid_t       fileSpace_;    // Dataspace of a pre-sized dataset, kept for all of the frames
+    bool        dirty_;        // Whether frames were written since the dataset was last flushed
+    double      extendTime_;   // Time in seconds the last writeFile spent extending the dataset in the file
 };
 
 
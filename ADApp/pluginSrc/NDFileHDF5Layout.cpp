@@ -311,9 +311,7 @@ namespace hdf5
   {
     for_each(this->datasets.begin(), this->datasets.end(), _delete_obj<Dataset>);
     for_each(this->groups.begin(), this->groups.end(), _delete_obj<Group>);
-    // HK verify should this be done? Causes segfault..
-    // for_each(this->hardlinks.begin(), this->hardlinks.end(), _delete_obj<HardLink>);
-    // HK verify should this be done?
+    for_each(this->hardlinks.begin(), this->hardlinks.end(), _delete_obj<HardLink>);
   }
 
   Group& Group::operator=(const Group& src)
@@ -0,0 +1,502 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "NDFileHDF5Reader.h"
+
+/* Filter IDs of the codecs whose chunks are read without decompressing them,
+ * as written by NDFileHDF5 */
+#define FILTER_BLOSC 32001
+#define FILTER_LZ4 32004
+#define FILTER_BSHUF 32008
+#define FILTER_ZSTD 32015
+#define FILTER_JPEG 32019
+/* Compression setting of the bitshuffle filter for lz4 */
+#define BSHUF_LZ4 2
+#define MAX_FILTER_VALUES 16
+
+static const char *fileName = "NDFileHDF5Reader";
+
+/* Finds the NDArray data type of an HDF5 native datatype; returns false if there is none */
+static bool hdfToNDType(hid_t datatype, NDDataType_t *pDataType)
+{
+  size_t size = H5Tget_size(datatype);
+  switch (H5Tget_class(datatype)) {
+    case H5T_INTEGER: {
+      bool isSigned = (H5Tget_sign(datatype) == H5T_SGN_2);
+      switch (size) {
+        case 1: *pDataType = isSigned ? NDInt8  : NDUInt8;  return true;
+        case 2: *pDataType = isSigned ? NDInt16 : NDUInt16; return true;
+        case 4: *pDataType = isSigned ? NDInt32 : NDUInt32; return true;
+        case 8: *pDataType = isSigned ? NDInt64 : NDUInt64; return true;
+        default: return false;
+      }
+    }
+    case H5T_FLOAT:
+      if (size == 4) {*pDataType = NDFloat32; return true;}
+      if (size == 8) {*pDataType = NDFloat64; return true;}
+      return false;
+    default:
+      return false;
+  }
+}
+
+/** Constructor.
+ * \param[in] pAsynUser - The asynUser used for trace messages.
+ */
+NDFileHDF5Reader::NDFileHDF5Reader(asynUser *pAsynUser) :
+  pAsynUser_(pAsynUser),
+  file_(-1),
+  dataset_(-1),
+  datatype_(-1),
+  rank_(0),
+  frameRank_(0),
+  ndims_(0),
+  dataType_(NDUInt8),
+  numFrames_(0),
+  directRead_(false),
+  headerSize_(0)
+{
+}
+
+NDFileHDF5Reader::~NDFileHDF5Reader()
+{
+  this->close();
+}
+
+/** open.
+ * Open a file written by NDFileHDF5 and find the detector dataset and the NDAttribute datasets.
+ * The values of the NDAttributes are read into memory.
+ * \param[in] fileName - Full name of the file.
+ * \param[in] datasetName - Full name of the detector dataset, or an empty string to read the first
+ * dataset that has the NDArrayNumDims attribute that NDFileHDF5 writes on its detector datasets.
+ */
+asynStatus NDFileHDF5Reader::open(const char *fileName, const char *datasetName)
+{
+  hid_t dataspace, dcpl, filetype;
+  int numDims = 0;
+  static const char *functionName = "open";
+
+  this->close();
+  this->file_ = H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (this->file_ < 0) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to open HDF5 file: %s\n",
+              ::fileName, functionName, fileName);
+    return asynError;
+  }
+
+  // Visit every dataset to find the detector datasets and the NDAttribute datasets
+  this->detectorNames_.clear();
+  this->attributeNames_.clear();
+  H5Lvisit(this->file_, H5_INDEX_NAME, H5_ITER_INC, visitObject, this);
+  if (datasetName && strlen(datasetName) > 0) {
+    this->datasetName_ = datasetName;
+  } else if (!this->detectorNames_.empty()) {
+    this->datasetName_ = this->detectorNames_[0];
+  } else {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR No detector dataset found in file: %s\n",
+              ::fileName, functionName, fileName);
+    this->close();
+    return asynError;
+  }
+  if (this->findDataset() != asynSuccess) {
+    this->close();
+    return asynError;
+  }
+
+  filetype = H5Dget_type(this->dataset_);
+  this->datatype_ = H5Tget_native_type(filetype, H5T_DIR_ASCEND);
+  H5Tclose(filetype);
+  if (!hdfToNDType(this->datatype_, &this->dataType_)) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unsupported datatype of dataset [%s]\n",
+              ::fileName, functionName, this->datasetName_.c_str());
+    this->close();
+    return asynError;
+  }
+
+  // The leading dimensions of the dataset count the frames, the others are the NDArray dimensions
+  dataspace = H5Dget_space(this->dataset_);
+  this->rank_ = H5Sget_simple_extent_dims(dataspace, this->dims_, NULL);
+  H5Sclose(dataspace);
+  if (H5Aexists(this->dataset_, "NDArrayNumDims") > 0) {
+    hid_t attr = H5Aopen(this->dataset_, "NDArrayNumDims", H5P_DEFAULT);
+    H5Aread(attr, H5T_NATIVE_INT, &numDims);
+    H5Aclose(attr);
+  } else {
+    numDims = (this->rank_ > 1) ? this->rank_ - 1 : this->rank_;
+  }
+  if (numDims < 1 || numDims > ND_ARRAY_MAX_DIMS || numDims > this->rank_) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Dataset [%s] of rank %d cannot hold %d dimensional NDArrays\n",
+              ::fileName, functionName, this->datasetName_.c_str(), this->rank_, numDims);
+    this->close();
+    return asynError;
+  }
+  this->ndims_ = numDims;
+  this->frameRank_ = this->rank_ - numDims;
+  for (int i = 0; i < this->ndims_; i++) {
+    this->arrayDims_[i] = (size_t)this->dims_[this->rank_ - 1 - i];
+  }
+  this->numFrames_ = 1;
+  for (int i = 0; i < this->frameRank_; i++) {
+    this->numFrames_ *= (int)this->dims_[i];
+  }
+
+  dcpl = H5Dget_create_plist(this->dataset_);
+  this->configureDirectRead(dcpl);
+  H5Pclose(dcpl);
+
+  this->readAttributes();
+
+  asynPrint(this->pAsynUser_, ASYN_TRACE_FLOW,
+            "%s::%s Opened %s: dataset [%s] has %d frames, %d NDAttributes, direct chunk read %s\n",
+            ::fileName, functionName, fileName, this->datasetName_.c_str(), this->numFrames_,
+            (int)this->attributes_.size(), this->directRead_ ? this->codec_.name.c_str() : "off");
+  return asynSuccess;
+}
+
+/** close.
+ * Close the file if it is open.
+ */
+void NDFileHDF5Reader::close()
+{
+  if (this->datatype_ >= 0) H5Tclose(this->datatype_);
+  if (this->dataset_ >= 0) H5Dclose(this->dataset_);
+  if (this->file_ >= 0) H5Fclose(this->file_);
+  this->datatype_ = -1;
+  this->dataset_ = -1;
+  this->file_ = -1;
+  this->numFrames_ = 0;
+  this->directRead_ = false;
+  this->codec_.clear();
+  this->attributes_.clear();
+}
+
+/** getNumFrames.
+ * \return The number of frames in the detector dataset of the open file.
+ */
+int NDFileHDF5Reader::getNumFrames()
+{
+  return this->numFrames_;
+}
+
+/** getDatasetName.
+ * \return The full name of the detector dataset that is read.
+ */
+std::string NDFileHDF5Reader::getDatasetName()
+{
+  return this->datasetName_;
+}
+
+/** readFrame.
+ * Read one frame into an NDArray allocated from a pool, with the NDAttributes stored for the frame.
+ * The uniqueId and time stamps of the NDArray are restored from the NDArrayUniqueId, NDArrayTimeStamp,
+ * NDArrayEpicsTSSec and NDArrayEpicsTSnSec datasets. If the chunks of the dataset are single frames
+ * compressed with a codec that NDPluginCodec can decompress, the compressed data are read with a direct
+ * chunk read and the codec of the NDArray is set.
+ * \param[in] frame - Index of the frame, counting in the order the frames were written.
+ * \param[in] pNDArrayPool - The pool to allocate the NDArray from.
+ * \param[out] ppArray - The NDArray that was read.
+ */
+asynStatus NDFileHDF5Reader::readFrame(int frame, NDArrayPool *pNDArrayPool, NDArray **ppArray)
+{
+  hsize_t offset[H5S_MAX_RANK];
+  hsize_t count[H5S_MAX_RANK];
+  NDArray *pArray = NULL;
+  herr_t hdfstatus;
+  static const char *functionName = "readFrame";
+
+  *ppArray = NULL;
+  if (this->dataset_ < 0 || frame < 0 || frame >= this->numFrames_) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Frame %d is not in the file, which has %d frames\n",
+              ::fileName, functionName, frame, this->numFrames_);
+    return asynError;
+  }
+
+  // The last of the leading dimensions changes fastest as the frames are written
+  int index = frame;
+  for (int i = this->frameRank_ - 1; i >= 0; i--) {
+    offset[i] = index % this->dims_[i];
+    index = (int)(index / this->dims_[i]);
+    count[i] = 1;
+  }
+  for (int i = this->frameRank_; i < this->rank_; i++) {
+    offset[i] = 0;
+    count[i] = this->dims_[i];
+  }
+
+#if H5_VERSION_GE(1, 10, 3)
+  if (this->directRead_) {
+    hsize_t chunkSize = 0;
+    uint32_t filterMask = 0;
+    hdfstatus = H5Dget_chunk_storage_size(this->dataset_, offset, &chunkSize);
+    if (!hdfstatus && chunkSize > this->headerSize_) {
+      pArray = pNDArrayPool->alloc(this->ndims_, this->arrayDims_, this->dataType_, (size_t)chunkSize, NULL);
+      if (pArray == NULL) {
+        asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR Unable to allocate an NDArray for frame %d\n",
+                  ::fileName, functionName, frame);
+        return asynError;
+      }
+      hdfstatus = H5Dread_chunk(this->dataset_, H5P_DEFAULT, offset, &filterMask, pArray->pData);
+      if (hdfstatus) {
+        asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                  "%s::%s ERROR Unable to read the chunk of frame %d\n",
+                  ::fileName, functionName, frame);
+        pArray->release();
+        return asynError;
+      }
+      if (filterMask == 0) {
+        // Remove the header that the HDF5 filter adds in front of the compressed data
+        if (this->headerSize_ > 0) {
+          memmove(pArray->pData, (char *)pArray->pData + this->headerSize_, (size_t)chunkSize - this->headerSize_);
+        }
+        pArray->codec = this->codec_;
+        pArray->compressedSize = (size_t)chunkSize - this->headerSize_;
+      } else {
+        // The filter was skipped when this chunk was written, so it holds the uncompressed data
+        pArray->compressedSize = pArray->dataSize;
+      }
+    }
+  }
+#endif
+
+  if (pArray == NULL) {
+    pArray = pNDArrayPool->alloc(this->ndims_, this->arrayDims_, this->dataType_, 0, NULL);
+    if (pArray == NULL) {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Unable to allocate an NDArray for frame %d\n",
+                ::fileName, functionName, frame);
+      return asynError;
+    }
+    hid_t fspace = H5Dget_space(this->dataset_);
+    hid_t mspace = H5Screate_simple(this->rank_, count, NULL);
+    hdfstatus = H5Sselect_hyperslab(fspace, H5S_SELECT_SET, offset, NULL, count, NULL);
+    if (!hdfstatus) {
+      hdfstatus = H5Dread(this->dataset_, this->datatype_, mspace, fspace, H5P_DEFAULT, pArray->pData);
+    }
+    H5Sclose(mspace);
+    H5Sclose(fspace);
+    if (hdfstatus) {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Unable to read frame %d of dataset [%s]\n",
+                ::fileName, functionName, frame, this->datasetName_.c_str());
+      pArray->release();
+      return asynError;
+    }
+  }
+
+  // Restore the NDArray fields from the default attributes and add the others to the attribute list
+  pArray->pAttributeList->clear();
+  for (size_t i = 0; i < this->attributes_.size(); i++) {
+    AttributeDataset &attr = this->attributes_[i];
+    if (attr.values.size() < (size_t)(frame + 1) * attr.size) continue;
+    void *pValue = &attr.values[frame * attr.size];
+    if (attr.name == "NDArrayUniqueId") {
+      epicsInt32 uniqueId;
+      memcpy(&uniqueId, pValue, sizeof(uniqueId));
+      pArray->uniqueId = uniqueId;
+    } else if (attr.name == "NDArrayTimeStamp") {
+      memcpy(&pArray->timeStamp, pValue, sizeof(pArray->timeStamp));
+    } else if (attr.name == "NDArrayEpicsTSSec") {
+      memcpy(&pArray->epicsTS.secPastEpoch, pValue, sizeof(pArray->epicsTS.secPastEpoch));
+    } else if (attr.name == "NDArrayEpicsTSnSec") {
+      memcpy(&pArray->epicsTS.nsec, pValue, sizeof(pArray->epicsTS.nsec));
+    } else {
+      pArray->pAttributeList->add(attr.name.c_str(), attr.description.c_str(), attr.dataType, pValue);
+    }
+  }
+
+  *ppArray = pArray;
+  return asynSuccess;
+}
+
+/** findDataset.
+ * Open the detector dataset named by datasetName_.
+ */
+asynStatus NDFileHDF5Reader::findDataset()
+{
+  static const char *functionName = "findDataset";
+
+  if (H5Lexists(this->file_, this->datasetName_.c_str(), H5P_DEFAULT) > 0) {
+    this->dataset_ = H5Dopen2(this->file_, this->datasetName_.c_str(), H5P_DEFAULT);
+  }
+  if (this->dataset_ < 0) {
+    asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+              "%s::%s ERROR Unable to open dataset [%s]\n",
+              ::fileName, functionName, this->datasetName_.c_str());
+    return asynError;
+  }
+  return asynSuccess;
+}
+
+/** configureDirectRead.
+ * Check if the compressed chunks of the dataset can be passed on as compressed NDArrays. This needs
+ * chunks of one frame and a single filter for a codec that NDPluginCodec supports.
+ * \param[in] dcpl - The creation property list of the dataset.
+ */
+asynStatus NDFileHDF5Reader::configureDirectRead(hid_t dcpl)
+{
+  hsize_t chunkdims[H5S_MAX_RANK];
+  unsigned int flags;
+  size_t nelmts = MAX_FILTER_VALUES;
+  unsigned int values[MAX_FILTER_VALUES];
+  char name[64];
+
+  this->directRead_ = false;
+  this->codec_.clear();
+  this->headerSize_ = 0;
+  if (!H5_VERSION_GE(1, 10, 3) || H5Pget_layout(dcpl) != H5D_CHUNKED || H5Pget_nfilters(dcpl) != 1) {
+    return asynDisabled;
+  }
+  if (H5Pget_chunk(dcpl, this->rank_, chunkdims) != this->rank_) {
+    return asynDisabled;
+  }
+  for (int i = 0; i < this->rank_; i++) {
+    if (chunkdims[i] != ((i < this->frameRank_) ? 1 : this->dims_[i])) return asynDisabled;
+  }
+  memset(values, 0, sizeof(values));
+  H5Z_filter_t filter = H5Pget_filter2(dcpl, 0, &flags, &nelmts, values, sizeof(name), name, NULL);
+  switch (filter) {
+    case FILTER_BLOSC:
+      this->codec_.name = codecName[NDCODEC_BLOSC];
+      this->codec_.level = values[4];
+      this->codec_.shuffle = values[5];
+      this->codec_.compressor = values[6];
+      break;
+    case FILTER_LZ4:
+      this->codec_.name = codecName[NDCODEC_LZ4];
+      this->headerSize_ = 16;
+      break;
+    case FILTER_BSHUF:
+      // The filter stores the compression after its version, element size and block size
+      if (!((nelmts >= 5 && values[4] == BSHUF_LZ4) || (nelmts == 2 && values[1] == BSHUF_LZ4))) {
+        return asynDisabled;
+      }
+      this->codec_.name = codecName[NDCODEC_BSLZ4];
+      this->headerSize_ = 12;
+      break;
+    case FILTER_JPEG:
+      this->codec_.name = codecName[NDCODEC_JPEG];
+      break;
+    case FILTER_ZSTD:
+      this->codec_.name = codecName[NDCODEC_ZSTD];
+      this->codec_.level = (int)values[0];
+      break;
+    default:
+      return asynDisabled;
+  }
+  this->directRead_ = true;
+  return asynSuccess;
+}
+
+/** readAttributes.
+ * Read the values of the NDAttribute datasets that have a value for each frame.
+ * The datasets are recognised by the NDAttrName attribute that NDFileHDF5 writes on them.
+ */
+asynStatus NDFileHDF5Reader::readAttributes()
+{
+  std::vector<std::string> &names = this->attributeNames_;
+  static const char *functionName = "readAttributes";
+
+  this->attributes_.clear();
+  for (size_t i = 0; i < names.size(); i++) {
+    AttributeDataset attr;
+    hsize_t dims[H5S_MAX_RANK];
+    hid_t dataset = H5Dopen2(this->file_, names[i].c_str(), H5P_DEFAULT);
+    if (dataset < 0) continue;
+    attr.name = this->readStringAttribute(dataset, "NDAttrName");
+    attr.description = this->readStringAttribute(dataset, "NDAttrDescription");
+    bool duplicate = false;
+    for (size_t j = 0; j < this->attributes_.size(); j++) {
+      if (this->attributes_[j].name == attr.name) duplicate = true;
+    }
+    hid_t dataspace = H5Dget_space(dataset);
+    int rank = H5Sget_simple_extent_dims(dataspace, dims, NULL);
+    H5Sclose(dataspace);
+    if (duplicate || rank != 1 || dims[0] < (hsize_t)this->numFrames_) {
+      H5Dclose(dataset);
+      continue;
+    }
+    hid_t filetype = H5Dget_type(dataset);
+    hid_t memtype = -1;
+    if (H5Tget_class(filetype) == H5T_STRING) {
+      // Read the fixed length strings with room for a terminating null
+      memtype = H5Tcopy(H5T_C_S1);
+      H5Tset_size(memtype, H5Tget_size(filetype) + 1);
+      H5Tset_strpad(memtype, H5T_STR_NULLTERM);
+      attr.dataType = NDAttrString;
+    } else {
+      NDDataType_t dataType;
+      memtype = H5Tget_native_type(filetype, H5T_DIR_ASCEND);
+      if (!hdfToNDType(memtype, &dataType)) {
+        H5Tclose(memtype);
+        H5Tclose(filetype);
+        H5Dclose(dataset);
+        continue;
+      }
+      attr.dataType = (NDAttrDataType_t)dataType;
+    }
+    attr.size = H5Tget_size(memtype);
+    attr.values.resize((size_t)dims[0] * attr.size);
+    if (H5Dread(dataset, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, &attr.values[0]) >= 0) {
+      this->attributes_.push_back(attr);
+    } else {
+      asynPrint(this->pAsynUser_, ASYN_TRACE_ERROR,
+                "%s::%s ERROR Unable to read NDAttribute dataset [%s]\n",
+                ::fileName, functionName, names[i].c_str());
+    }
+    H5Tclose(memtype);
+    H5Tclose(filetype);
+    H5Dclose(dataset);
+  }
+  return asynSuccess;
+}
+
+/** visitObject.
+ * Callback of H5Lvisit that collects the names of the detector datasets, which have the NDArrayNumDims
+ * attribute, and of the NDAttribute datasets, which have the NDAttrName attribute.
+ */
+herr_t NDFileHDF5Reader::visitObject(hid_t group, const char *name, const H5L_info_t *info, void *pReader)
+{
+  NDFileHDF5Reader *pThis = (NDFileHDF5Reader *)pReader;
+
+  if (info->type != H5L_TYPE_HARD) return 0;
+  hid_t object = H5Oopen(group, name, H5P_DEFAULT);
+  if (object < 0) return 0;
+  if (H5Iget_type(object) == H5I_DATASET) {
+    std::string fullName = std::string("/") + name;
+    if (H5Aexists(object, "NDArrayNumDims") > 0) {
+      pThis->detectorNames_.push_back(fullName);
+    } else if (H5Aexists(object, "NDAttrName") > 0) {
+      pThis->attributeNames_.push_back(fullName);
+    }
+  }
+  H5Oclose(object);
+  return 0;
+}
+
+/** readStringAttribute.
+ * \return The value of a string attribute of an object, or an empty string if it does not have one.
+ */
+std::string NDFileHDF5Reader::readStringAttribute(hid_t object, const char *attrName)
+{
+  std::string value;
+  if (H5Aexists(object, attrName) <= 0) return value;
+  hid_t attr = H5Aopen(object, attrName, H5P_DEFAULT);
+  hid_t filetype = H5Aget_type(attr);
+  if (H5Tget_class(filetype) == H5T_STRING && !H5Tis_variable_str(filetype)) {
+    std::vector<char> buffer(H5Tget_size(filetype) + 1, 0);
+    hid_t memtype = H5Tcopy(H5T_C_S1);
+    H5Tset_size(memtype, buffer.size());
+    H5Tset_strpad(memtype, H5T_STR_NULLTERM);
+    if (H5Aread(attr, memtype, &buffer[0]) >= 0) value = &buffer[0];
+    H5Tclose(memtype);
+  }
+  H5Tclose(filetype);
+  H5Aclose(attr);
+  return value;
+}
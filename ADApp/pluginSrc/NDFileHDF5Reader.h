@@ -0,0 +1,61 @@
+#ifndef NDFILEHDF5READER_H_
+#define NDFILEHDF5READER_H_
+
+#include <string>
+#include <vector>
+#include <hdf5.h>
+#include "NDPluginFile.h"
+#include "NDFileHDF5VersionCheck.h"
+
+/** Class used for reading the frames of a detector dataset, and the NDAttributes stored with them,
+  * from a file written by the NDFileHDF5 plugin.
+  */
+class NDPLUGIN_API NDFileHDF5Reader
+{
+  public:
+    NDFileHDF5Reader(asynUser *pAsynUser);
+    virtual ~NDFileHDF5Reader();
+
+    asynStatus open(const char *fileName, const char *datasetName);
+    void close();
+    asynStatus readFrame(int frame, NDArrayPool *pNDArrayPool, NDArray **ppArray);
+    int getNumFrames();
+    std::string getDatasetName();
+
+  private:
+    /** An NDAttribute dataset with one value for each frame; the values are read when the file is opened */
+    struct AttributeDataset {
+      std::string name;
+      std::string description;
+      NDAttrDataType_t dataType;
+      size_t size;                /** < Bytes per value */
+      std::vector<char> values;
+    };
+
+    asynStatus findDataset();
+    asynStatus configureDirectRead(hid_t dcpl);
+    asynStatus readAttributes();
+    static herr_t visitObject(hid_t group, const char *name, const H5L_info_t *info, void *pReader);
+    std::string readStringAttribute(hid_t object, const char *attrName);
+
+    asynUser    *pAsynUser_;   // Pointer to the asynUser structure
+    hid_t       file_;         // File handle
+    hid_t       dataset_;      // Handle of the detector dataset
+    hid_t       datatype_;     // Native datatype of the detector dataset
+    std::string datasetName_;  // Full name of the detector dataset
+    std::vector<std::string> detectorNames_;  // Datasets with the attributes of a detector dataset
+    std::vector<std::string> attributeNames_; // Datasets with the attributes of an NDAttribute dataset
+    int         rank_;         // Number of dimensions of the detector dataset
+    int         frameRank_;    // Number of leading dimensions that count the frames
+    hsize_t     dims_[H5S_MAX_RANK];  // Dimensions of the detector dataset
+    int         ndims_;        // Number of dimensions of the NDArrays
+    size_t      arrayDims_[ND_ARRAY_MAX_DIMS]; // Dimensions of the NDArrays, fastest changing first
+    NDDataType_t dataType_;    // Data type of the NDArrays
+    int         numFrames_;    // Number of frames in the dataset
+    bool        directRead_;   // Whether the compressed chunks are read without decompressing them
+    Codec_t     codec_;        // Codec of the chunks that are read directly
+    size_t      headerSize_;   // Bytes of filter header before the compressed data of a chunk
+    std::vector<AttributeDataset> attributes_;
+};
+
+#endif
@@ -0,0 +1,384 @@
+/* NDFileHDF5Replay.cpp
+ * Replays the frames of a file written by NDFileHDF5 to plugins.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <iocsh.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+
+#include "NDFileHDF5Replay.h"
+
+#include <epicsExport.h>
+
+#define DEFAULT_PREFETCH 16
+/* Seconds between checks of stopRequested_ while the prefetch queue is full */
+#define PREFETCH_SEND_TIMEOUT 0.1
+/* Seconds over which the achieved rate is averaged */
+#define ACHIEVED_RATE_PERIOD 0.5
+
+static const char *driverName = "NDFileHDF5Replay";
+
+static void replayTaskC(void *drvPvt)
+{
+  NDFileHDF5Replay *pDriver = (NDFileHDF5Replay *)drvPvt;
+  pDriver->replayTask();
+}
+
+static void prefetchTaskC(void *drvPvt)
+{
+  NDFileHDF5Replay *pDriver = (NDFileHDF5Replay *)drvPvt;
+  pDriver->prefetchTask();
+}
+
+/** Constructor for NDFileHDF5Replay.
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDFileHDF5Replay::NDFileHDF5Replay(const char *portName, int maxBuffers, size_t maxMemory,
+                                   int priority, int stackSize)
+  : asynNDArrayDriver(portName, 1, maxBuffers, maxMemory, 0, 0, ASYN_CANBLOCK, 1, priority, stackSize),
+    reader_(pasynUserSelf), pFrameQueue_(NULL), numLoops_(1), stopRequested_(false), running_(false)
+{
+  static const char *functionName = "NDFileHDF5Replay";
+
+  fullFileName_[0] = 0;
+  datasetName_[0] = 0;
+
+  createParam(str_NDFileHDF5Replay_dataset,      asynParamOctet,   &NDFileHDF5Replay_dataset);
+  createParam(str_NDFileHDF5Replay_rate,         asynParamFloat64, &NDFileHDF5Replay_rate);
+  createParam(str_NDFileHDF5Replay_numLoops,     asynParamInt32,   &NDFileHDF5Replay_numLoops);
+  createParam(str_NDFileHDF5Replay_prefetch,     asynParamInt32,   &NDFileHDF5Replay_prefetch);
+  createParam(str_NDFileHDF5Replay_framesInFile, asynParamInt32,   &NDFileHDF5Replay_framesInFile);
+  createParam(str_NDFileHDF5Replay_frame,        asynParamInt32,   &NDFileHDF5Replay_frame);
+  createParam(str_NDFileHDF5Replay_loop,         asynParamInt32,   &NDFileHDF5Replay_loop);
+  createParam(str_NDFileHDF5Replay_achievedRate, asynParamFloat64, &NDFileHDF5Replay_achievedRate);
+  createParam(str_NDFileHDF5Replay_readStalls,   asynParamInt32,   &NDFileHDF5Replay_readStalls);
+
+  setStringParam (ADManufacturer, "areaDetector");
+  setStringParam (ADModel, "HDF5 replay");
+  setStringParam (NDFileHDF5Replay_dataset,      "");
+  setDoubleParam (NDFileHDF5Replay_rate,         0.0);
+  setIntegerParam(NDFileHDF5Replay_numLoops,     1);
+  setIntegerParam(NDFileHDF5Replay_prefetch,     DEFAULT_PREFETCH);
+  setIntegerParam(NDFileHDF5Replay_framesInFile, 0);
+  setIntegerParam(NDFileHDF5Replay_frame,        0);
+  setIntegerParam(NDFileHDF5Replay_loop,         0);
+  setDoubleParam (NDFileHDF5Replay_achievedRate, 0.0);
+  setIntegerParam(NDFileHDF5Replay_readStalls,   0);
+  setIntegerParam(ADAcquire, 0);
+
+  this->startEvent_ = epicsEventCreate(epicsEventEmpty);
+  this->prefetchEvent_ = epicsEventCreate(epicsEventEmpty);
+  this->stopEvent_ = epicsEventCreate(epicsEventEmpty);
+  if (!this->startEvent_ || !this->prefetchEvent_ || !this->stopEvent_) {
+    printf("%s:%s epicsEventCreate failure\n", driverName, functionName);
+    return;
+  }
+
+  // The replay thread sends the frames to the plugins, the prefetch thread reads them from the file
+  if (epicsThreadCreate("HDF5ReplayTask",
+                        epicsThreadPriorityMedium,
+                        epicsThreadGetStackSize(epicsThreadStackMedium),
+                        (EPICSTHREADFUNC)replayTaskC,
+                        this) == NULL) {
+    printf("%s:%s epicsThreadCreate failure for replay task\n", driverName, functionName);
+    return;
+  }
+  if (epicsThreadCreate("HDF5PrefetchTask",
+                        epicsThreadPriorityMedium,
+                        stackSize > 0 ? stackSize : epicsThreadGetStackSize(epicsThreadStackBig),
+                        (EPICSTHREADFUNC)prefetchTaskC,
+                        this) == NULL) {
+    printf("%s:%s epicsThreadCreate failure for prefetch task\n", driverName, functionName);
+    return;
+  }
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * Setting Acquire to 1 starts a replay of the file, setting it to 0 stops it; Acquire returns to 0
+  * when the last frame has been sent.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDFileHDF5Replay::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+  int function = pasynUser->reason;
+
+  if (function == ADAcquire) {
+    if (value && !this->running_) {
+      this->running_ = true;
+      this->stopRequested_ = false;
+      epicsEventTryWait(this->stopEvent_);
+      epicsEventSignal(this->startEvent_);
+    } else if (!value && this->running_) {
+      this->stopRequested_ = true;
+      epicsEventSignal(this->stopEvent_);
+    }
+  } else if (function == NDFileHDF5Replay_prefetch) {
+    if (value < 1) value = 1;
+  }
+  return asynNDArrayDriver::writeInt32(pasynUser, value);
+}
+
+/** Sends a frame to the replay thread, waiting while the prefetch queue is full.
+  * \return asynError if the replay was stopped before the frame was queued. */
+asynStatus NDFileHDF5Replay::sendFrame(NDFileHDF5ReplayFrame *pFrame)
+{
+  while (!this->stopRequested_) {
+    if (this->pFrameQueue_->send(pFrame, sizeof(*pFrame), PREFETCH_SEND_TIMEOUT) == 0) {
+      return asynSuccess;
+    }
+  }
+  return asynError;
+}
+
+/** Reports an error opening or reading the file with the WriteStatus and WriteMessage parameters. */
+void NDFileHDF5Replay::setReplayError(const char *message)
+{
+  static const char *functionName = "setReplayError";
+
+  asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s ERROR %s\n",
+            driverName, functionName, message);
+  this->lock();
+  setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+  setStringParam(NDFileWriteMessage, message);
+  callParamCallbacks();
+  this->unlock();
+}
+
+/** Thread that reads the frames of the file into NDArrays ahead of the replay thread.
+  * The arrays are passed to the replay thread in pFrameQueue_, followed by a frame with a NULL
+  * array when the last loop is done, the replay is stopped or the file cannot be read. */
+void NDFileHDF5Replay::prefetchTask()
+{
+  NDFileHDF5ReplayFrame msg;
+  char message[MAX_FILENAME_LEN + 64];
+
+  while (1) {
+    epicsEventMustWait(this->prefetchEvent_);
+
+    if (this->reader_.open(this->fullFileName_, this->datasetName_) != asynSuccess) {
+      epicsSnprintf(message, sizeof(message), "Unable to open %s", this->fullFileName_);
+      this->setReplayError(message);
+    } else if (this->reader_.getNumFrames() == 0) {
+      epicsSnprintf(message, sizeof(message), "No frames in %s", this->fullFileName_);
+      this->setReplayError(message);
+    } else {
+      int numFrames = this->reader_.getNumFrames();
+      this->lock();
+      setIntegerParam(NDFileHDF5Replay_framesInFile, numFrames);
+      callParamCallbacks();
+      this->unlock();
+      for (int loop = 0; (this->numLoops_ <= 0 || loop < this->numLoops_) && !this->stopRequested_; loop++) {
+        for (int frame = 0; frame < numFrames && !this->stopRequested_; frame++) {
+          if (this->reader_.readFrame(frame, this->pNDArrayPool, &msg.pArray) != asynSuccess) {
+            epicsSnprintf(message, sizeof(message), "Unable to read frame %d of %s", frame, this->fullFileName_);
+            this->setReplayError(message);
+            this->stopRequested_ = true;
+            break;
+          }
+          msg.frame = frame;
+          msg.loop = loop;
+          if (this->sendFrame(&msg) != asynSuccess) {
+            msg.pArray->release();
+          }
+        }
+      }
+    }
+    this->reader_.close();
+
+    // The replay thread receives until this frame, so the queue always has room for it
+    msg.pArray = NULL;
+    this->pFrameQueue_->send(&msg, sizeof(msg));
+  }
+}
+
+/** Thread that sends the prefetched frames to the plugins at the rate set by REPLAY_RATE. */
+void NDFileHDF5Replay::replayTask()
+{
+  NDFileHDF5ReplayFrame msg;
+  NDArrayInfo_t arrayInfo;
+  epicsTimeStamp tNext, tNow, tRate;
+  int prefetch, arrayCallbacks, arrayCounter, numFrames;
+  int numSent, rateCount, readStalls;
+  double rate, elapsed;
+
+  this->lock();
+  while (1) {
+    this->unlock();
+    epicsEventMustWait(this->startEvent_);
+    this->lock();
+
+    getIntegerParam(NDFileHDF5Replay_prefetch, &prefetch);
+    if (prefetch < 1) prefetch = 1;
+    getIntegerParam(NDFileHDF5Replay_numLoops, &this->numLoops_);
+    getStringParam(NDFileHDF5Replay_dataset, sizeof(this->datasetName_), this->datasetName_);
+    this->createFileName(sizeof(this->fullFileName_), this->fullFileName_);
+    setStringParam(NDFullFileName, this->fullFileName_);
+    setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
+    setStringParam(NDFileWriteMessage, "");
+    setIntegerParam(NDFileHDF5Replay_framesInFile, 0);
+    setIntegerParam(NDFileHDF5Replay_readStalls, 0);
+    setDoubleParam(NDFileHDF5Replay_achievedRate, 0.0);
+    callParamCallbacks();
+
+    this->pFrameQueue_ = new epicsMessageQueue(prefetch, sizeof(NDFileHDF5ReplayFrame));
+    epicsEventSignal(this->prefetchEvent_);
+
+    numSent = 0;
+    rateCount = 0;
+    readStalls = 0;
+    epicsTimeGetCurrent(&tNext);
+    tRate = tNext;
+    while (1) {
+      // The frame is late if the prefetch thread has not read it yet
+      bool stalled = (numSent > 0) && (this->pFrameQueue_->pending() == 0);
+      this->unlock();
+      this->pFrameQueue_->receive(&msg, sizeof(msg));
+      this->lock();
+      if (msg.pArray == NULL) break;
+      if (this->stopRequested_) {
+        msg.pArray->release();
+        continue;
+      }
+      if (stalled) setIntegerParam(NDFileHDF5Replay_readStalls, ++readStalls);
+
+      // Wait until the time of this frame; if the replay fell behind it is not sped up to catch up
+      getDoubleParam(NDFileHDF5Replay_rate, &rate);
+      if (rate > 0) {
+        epicsTimeGetCurrent(&tNow);
+        double delay = epicsTimeDiffInSeconds(&tNext, &tNow);
+        if (delay > 0) {
+          this->unlock();
+          epicsEventWaitWithTimeout(this->stopEvent_, delay);
+          this->lock();
+          if (this->stopRequested_) {
+            msg.pArray->release();
+            continue;
+          }
+        } else if (delay < -1.0/rate) {
+          tNext = tNow;
+        }
+        epicsTimeAddSeconds(&tNext, 1.0/rate);
+      }
+
+      NDArray *pArray = msg.pArray;
+      // Keep the uniqueIds increasing when the file is replayed more than once
+      getIntegerParam(NDFileHDF5Replay_framesInFile, &numFrames);
+      pArray->uniqueId += msg.loop * numFrames;
+      updateTimeStamp(&pArray->epicsTS);
+
+      getIntegerParam(NDArrayCounter, &arrayCounter);
+      setIntegerParam(NDArrayCounter, ++arrayCounter);
+      setIntegerParam(NDUniqueId, pArray->uniqueId);
+      setDoubleParam(NDTimeStamp, pArray->timeStamp);
+      setIntegerParam(NDEpicsTSSec, pArray->epicsTS.secPastEpoch);
+      setIntegerParam(NDEpicsTSNsec, pArray->epicsTS.nsec);
+      pArray->getInfo(&arrayInfo);
+      setIntegerParam(NDNDimensions, pArray->ndims);
+      setIntegerParam(NDArraySizeX, (int)arrayInfo.xSize);
+      setIntegerParam(NDArraySizeY, (int)arrayInfo.ySize);
+      setIntegerParam(NDArraySizeZ, (int)arrayInfo.colorSize);
+      setIntegerParam(NDArraySize, (int)arrayInfo.totalBytes);
+      setIntegerParam(NDDataType, pArray->dataType);
+      setIntegerParam(NDColorMode, arrayInfo.colorMode);
+      setStringParam(NDCodec, pArray->codec.name.c_str());
+      setIntegerParam(NDCompressedSize, (int)pArray->compressedSize);
+      setIntegerParam(NDFileHDF5Replay_frame, msg.frame);
+      setIntegerParam(NDFileHDF5Replay_loop, msg.loop);
+
+      // Add the attributes of this driver to the ones read from the file
+      this->getAttributes(pArray->pAttributeList);
+
+      if (this->pArrays[0]) this->pArrays[0]->release();
+      this->pArrays[0] = pArray;
+      getIntegerParam(NDArrayCallbacks, &arrayCallbacks);
+      if (arrayCallbacks) {
+        this->waitForCredits();
+        this->unlock();
+        doCallbacksGenericPointer(pArray, NDArrayData, 0);
+        this->lock();
+      }
+      numSent++;
+
+      rateCount++;
+      epicsTimeGetCurrent(&tNow);
+      elapsed = epicsTimeDiffInSeconds(&tNow, &tRate);
+      if (elapsed >= ACHIEVED_RATE_PERIOD) {
+        setDoubleParam(NDFileHDF5Replay_achievedRate, rateCount / elapsed);
+        rateCount = 0;
+        tRate = tNow;
+      }
+      callParamCallbacks();
+    }
+
+    delete this->pFrameQueue_;
+    this->pFrameQueue_ = NULL;
+    this->running_ = false;
+    setIntegerParam(ADAcquire, 0);
+    callParamCallbacks();
+  }
+}
+
+/** Report status of the driver.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then driver details are printed.
+  */
+void NDFileHDF5Replay::report(FILE *fp, int details)
+{
+  int framesInFile, frame, loop;
+
+  getIntegerParam(NDFileHDF5Replay_framesInFile, &framesInFile);
+  getIntegerParam(NDFileHDF5Replay_frame, &frame);
+  getIntegerParam(NDFileHDF5Replay_loop, &loop);
+  fprintf(fp, "HDF5 replay driver %s\n", this->portName);
+  fprintf(fp, "  File: %s\n", this->fullFileName_);
+  fprintf(fp, "  Running: %s, frame %d of %d, loop %d\n",
+          this->running_ ? "yes" : "no", frame, framesInFile, loop);
+  asynNDArrayDriver::report(fp, details);
+}
+
+/** Configuration command, called directly or from iocsh */
+extern "C" int NDFileHDF5ReplayConfigure(const char *portName, int maxBuffers, size_t maxMemory,
+                                         int priority, int stackSize)
+{
+  new NDFileHDF5Replay(portName, maxBuffers, maxMemory, priority, stackSize);
+  return(asynSuccess);
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg2 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg3 = { "priority",iocshArgInt};
+static const iocshArg initArg4 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4};
+static const iocshFuncDef initFuncDef = {"NDFileHDF5ReplayConfigure",5,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+  NDFileHDF5ReplayConfigure(args[0].sval, args[1].ival, args[2].ival,
+                            args[3].ival, args[4].ival);
+}
+
+extern "C" void NDFileHDF5ReplayRegister(void)
+{
+  iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDFileHDF5ReplayRegister);
+}
@@ -0,0 +1,71 @@
+#ifndef NDFILEHDF5REPLAY_H_
+#define NDFILEHDF5REPLAY_H_
+
+#include <epicsEvent.h>
+#include <epicsMessageQueue.h>
+#include <asynNDArrayDriver.h>
+#include "NDFileHDF5Reader.h"
+
+#define str_NDFileHDF5Replay_dataset      "REPLAY_DATASET"        /* (asynOctet,   r/w) Detector dataset to replay, empty for the first one */
+#define str_NDFileHDF5Replay_rate         "REPLAY_RATE"           /* (asynFloat64, r/w) Frames per second, 0 for as fast as possible */
+#define str_NDFileHDF5Replay_numLoops     "REPLAY_NUM_LOOPS"      /* (asynInt32,   r/w) Times to replay the file, 0 to repeat until stopped */
+#define str_NDFileHDF5Replay_prefetch     "REPLAY_PREFETCH"       /* (asynInt32,   r/w) Frames read ahead by the prefetch thread */
+#define str_NDFileHDF5Replay_framesInFile "REPLAY_FRAMES_IN_FILE" /* (asynInt32,   r/o) Frames in the dataset that is replayed */
+#define str_NDFileHDF5Replay_frame        "REPLAY_FRAME"          /* (asynInt32,   r/o) Index in the file of the last frame sent */
+#define str_NDFileHDF5Replay_loop         "REPLAY_LOOP"           /* (asynInt32,   r/o) Number of the loop that is replayed */
+#define str_NDFileHDF5Replay_achievedRate "REPLAY_ACHIEVED_RATE"  /* (asynFloat64, r/o) Frames per second that were sent */
+#define str_NDFileHDF5Replay_readStalls   "REPLAY_READ_STALLS"    /* (asynInt32,   r/o) Frames that were late because the prefetch queue was empty */
+
+/** A frame passed from the prefetch thread to the replay thread; pArray is NULL after the last frame */
+typedef struct {
+  NDArray *pArray;
+  int frame;
+  int loop;
+} NDFileHDF5ReplayFrame;
+
+/** Driver that replays the frames of a file written by NDFileHDF5 to plugins, as if they came from a detector.
+  * The file is named by the FilePath, FileName, FileNumber and FileTemplate parameters, and replay is started
+  * and stopped with Acquire. The frames are read ahead by a prefetch thread, so a slow read of one frame does
+  * not delay the frames before it.
+  */
+class NDPLUGIN_API NDFileHDF5Replay : public asynNDArrayDriver {
+public:
+    NDFileHDF5Replay(const char *portName, int maxBuffers, size_t maxMemory,
+                     int priority, int stackSize);
+
+    /* These are the methods that we override from asynNDArrayDriver */
+    virtual asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    virtual void report(FILE *fp, int details);
+
+    void replayTask();
+    void prefetchTask();
+
+protected:
+    int NDFileHDF5Replay_dataset;
+    #define FIRST_NDFILE_HDF5_REPLAY_PARAM NDFileHDF5Replay_dataset
+    int NDFileHDF5Replay_rate;
+    int NDFileHDF5Replay_numLoops;
+    int NDFileHDF5Replay_prefetch;
+    int NDFileHDF5Replay_framesInFile;
+    int NDFileHDF5Replay_frame;
+    int NDFileHDF5Replay_loop;
+    int NDFileHDF5Replay_achievedRate;
+    int NDFileHDF5Replay_readStalls;
+
+private:
+    asynStatus sendFrame(NDFileHDF5ReplayFrame *pFrame);
+    void setReplayError(const char *message);
+
+    NDFileHDF5Reader reader_;        // Used only by the prefetch thread while a file is replayed
+    epicsEventId startEvent_;        // Signalled by writeInt32 to start a replay
+    epicsEventId prefetchEvent_;     // Signalled by the replay thread when the file name and queue are ready
+    epicsEventId stopEvent_;         // Signalled by writeInt32 to end the wait between frames
+    epicsMessageQueue *pFrameQueue_; // Frames read by the prefetch thread, created for each replay
+    char fullFileName_[MAX_FILENAME_LEN];
+    char datasetName_[MAX_FILENAME_LEN];
+    int numLoops_;
+    volatile bool stopRequested_;
+    bool running_;
+};
+
+#endif
@@ -8,16 +8,97 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 
 #include <iocsh.h>
 #include "NDPluginFile.h"
 #include "NDFileJPEG.h"
+#include "NDPluginCodec.h"
 
 #include <epicsExport.h>
 
 static const char *driverName = "NDFileJPEG";
 
-/** Opens a JPEG file.
+/* The frames of an MJPEG file are encoded in batches of this many frames per thread, and each
+ * batch is written before the next one is encoded */
+#define FRAMES_PER_THREAD 2
+
+/* Layout of the header of an MJPEG AVI file: RIFF, hdrl list with avih, strl list with strh and strf, movi list */
+#define AVI_HDRL_SIZE   192  /* Size of the hdrl list, including its fourcc */
+#define AVI_MOVI_OFFSET 220  /* Offset of the movi fourcc, which the offsets in the index are relative to */
+#define AVI_HEADER_SIZE 224  /* Offset of the first frame chunk */
+#define AVIF_HASINDEX   0x10
+#define AVIIF_KEYFRAME  0x10
+
+/* Appends little-endian values to the header of an AVI file */
+static void putFourCC(std::vector<char> &header, const char *fourCC)
+{
+    header.insert(header.end(), fourCC, fourCC + 4);
+}
+
+static void put32(std::vector<char> &header, epicsUInt32 value)
+{
+    for (int i=0; i<4; i++) header.push_back((char)((value >> (8*i)) & 0xff));
+}
+
+static void put16(std::vector<char> &header, epicsUInt16 value)
+{
+    for (int i=0; i<2; i++) header.push_back((char)((value >> (8*i)) & 0xff));
+}
+
+/* Note: we don't use the built-in stdio routines, because this does not work when using
+ * the prebuilt library and either VC++ or g++ on Windows.  The FILE pointers are wrong
+ * when doing that.  Rather we implement our own jpeg_destination_mgr structure, which encodes
+ * each frame into a buffer in memory that is written to the file with a single fwrite.
+ * The buffer keeps its allocation, so it grows only for the first frames. */
+static void init_destination(j_compress_ptr cinfo)
+{
+    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
+    std::vector<JOCTET> *pBuffer = pdest->pBuffer;
+
+    pBuffer->resize(std::max(pBuffer->capacity(), (size_t)JPEG_BUF_SIZE));
+    pdest->pub.next_output_byte = &(*pBuffer)[0];
+    pdest->pub.free_in_buffer = pBuffer->size();
+}
+
+static boolean empty_output_buffer(j_compress_ptr cinfo)
+{
+    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
+    std::vector<JOCTET> *pBuffer = pdest->pBuffer;
+    size_t used = pBuffer->size();
+
+    /* The buffer is full, double its size */
+    pBuffer->resize(2*used);
+    pdest->pub.next_output_byte = &(*pBuffer)[used];
+    pdest->pub.free_in_buffer = pBuffer->size() - used;
+    return TRUE;
+}
+
+static void term_destination(j_compress_ptr cinfo)
+{
+    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
+
+    pdest->pBuffer->resize(pdest->pBuffer->size() - pdest->pub.free_in_buffer);
+}
+
+/* A batch of the frames of an MJPEG file that are encoded in parallel by the codec worker pool */
+typedef struct {
+    NDFileJPEG *pPlugin;
+    const NDFileJPEGImage_t *pImage;
+    NDArray **ppArrays;
+    std::vector<std::vector<JOCTET> > jpeg;
+    std::vector<asynStatus> status;
+} FrameBatch;
+
+/* Encodes one frame of a batch.  Called by the codec worker pool */
+static void encodeFrameTask(void *arg, int frame)
+{
+    FrameBatch *pBatch = (FrameBatch *)arg;
+
+    pBatch->status[frame] = pBatch->pPlugin->encodeFrame(pBatch->pImage, pBatch->ppArrays[frame], &pBatch->jpeg[frame]);
+}
+
+/** Opens a JPEG file, or an MJPEG file if openMode includes NDFileModeMultiple.
   * \param[in] fileName The name of the file to open.
   * \param[in] openMode Mask defining how the file should be opened; bits are
   *            NDFileModeRead, NDFileModeWrite, NDFileModeAppend, NDFileModeMultiple
@@ -26,9 +107,6 @@ static const char *driverName = "NDFileJPEG";
 asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray)
 {
     static const char *functionName = "openFile";
-    int colorMode = NDColorModeMono;
-    NDAttribute *pAttribute;
-    int quality;
 
     /* We don't support reading yet */
     if (openMode & NDFileModeRead) return(asynError);
@@ -36,6 +114,44 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
     /* We don't support opening an existing file for appending yet */
     if (openMode & NDFileModeAppend) return(asynError);
 
+    if (this->getImage(pArray, &this->image)) return(asynError);
+
+    /* Must lock when accessing parameter library */
+    this->lock();
+    getIntegerParam(NDFileJPEGQuality, &this->image.quality);
+    getIntegerParam(NDFileJPEGEncodeThreads, &this->encodeThreads);
+    this->unlock();
+
+   /* Create the file. */
+    if ((this->outFile = fopen(fileName, "wb")) == NULL ) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+        "%s:%s error opening file %s\n",
+        driverName, functionName, fileName);
+        return(asynError);
+    }
+
+    this->multiFrame = (openMode & NDFileModeMultiple) != 0;
+    if (!this->multiFrame) return(asynSuccess);
+
+    /* The header is written again with the number of frames and the sizes when the file is closed */
+    this->frameIndex.clear();
+    this->moviSize = 4;
+    this->maxFrameSize = 0;
+    this->firstTimeStamp = 0.;
+    this->lastTimeStamp = 0.;
+    return this->writeAVIHeader(AVI_HEADER_SIZE - 8);
+}
+
+/** Gets the size and color of the image of an NDArray.
+  * \param[in] pArray Pointer to the NDArray.
+  * \param[out] pImage The image, apart from the quality.
+  */
+asynStatus NDFileJPEG::getImage(NDArray *pArray, NDFileJPEGImage_t *pImage)
+{
+    static const char *functionName = "getImage";
+    int colorMode = NDColorModeMono;
+    NDAttribute *pAttribute;
+
     switch (pArray->dataType) {
         case NDInt8:
         case NDUInt8:
@@ -53,88 +169,136 @@ asynStatus NDFileJPEG::openFile(const char *fileName, NDFileOpenMode_t openMode,
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
 
     if (pArray->ndims == 2) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[0].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[1].size;
-        this->jpegInfo.input_components = 1;
-        this->jpegInfo.in_color_space = JCS_GRAYSCALE;
-        this->colorMode = NDColorModeMono;
+        pImage->width  = (JDIMENSION)pArray->dims[0].size;
+        pImage->height = (JDIMENSION)pArray->dims[1].size;
+        pImage->components = 1;
+        pImage->colorSpace = JCS_GRAYSCALE;
+        pImage->colorMode = NDColorModeMono;
     } else if ((pArray->ndims == 3) && (pArray->dims[0].size == 3) && (colorMode == NDColorModeRGB1)) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[1].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[2].size;
-        this->jpegInfo.input_components = 3;
-        this->jpegInfo.in_color_space = JCS_RGB;
-        this->colorMode = NDColorModeRGB1;
+        pImage->width  = (JDIMENSION)pArray->dims[1].size;
+        pImage->height = (JDIMENSION)pArray->dims[2].size;
+        pImage->components = 3;
+        pImage->colorSpace = JCS_RGB;
+        pImage->colorMode = NDColorModeRGB1;
     } else if ((pArray->ndims == 3) && (pArray->dims[1].size == 3) && (colorMode == NDColorModeRGB2)) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[0].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[2].size;
-        this->jpegInfo.input_components = 3;
-        this->jpegInfo.in_color_space = JCS_RGB;
-        this->colorMode = NDColorModeRGB2;
+        pImage->width  = (JDIMENSION)pArray->dims[0].size;
+        pImage->height = (JDIMENSION)pArray->dims[2].size;
+        pImage->components = 3;
+        pImage->colorSpace = JCS_RGB;
+        pImage->colorMode = NDColorModeRGB2;
     } else if ((pArray->ndims == 3) && (pArray->dims[2].size == 3) && (colorMode == NDColorModeRGB3)) {
-        this->jpegInfo.image_width  = (JDIMENSION)pArray->dims[0].size;
-        this->jpegInfo.image_height = (JDIMENSION)pArray->dims[1].size;
-        this->jpegInfo.input_components = 3;
-        this->jpegInfo.in_color_space = JCS_RGB;
-        this->colorMode = NDColorModeRGB3;
+        pImage->width  = (JDIMENSION)pArray->dims[0].size;
+        pImage->height = (JDIMENSION)pArray->dims[1].size;
+        pImage->components = 3;
+        pImage->colorSpace = JCS_RGB;
+        pImage->colorMode = NDColorModeRGB3;
     } else {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s: unsupported array structure\n",
             driverName, functionName);
         return(asynError);
     }
+    return(asynSuccess);
+}
 
-   /* Create the file. */
-    if ((this->outFile = fopen(fileName, "wb")) == NULL ) {
+/** Writes single NDArray to the JPEG file, or appends it as a frame of the MJPEG file.
+  * With more than 1 encode thread the frames of an MJPEG file are reserved, and encoded and written
+  * in batches, so an error encoding or writing a frame is returned for a later frame or by closeFile.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+asynStatus NDFileJPEG::writeFile(NDArray *pArray)
+{
+    NDFileJPEGImage_t arrayImage;
+    asynStatus status;
+    static const char *functionName = "writeFile";
+
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
+              "%s:%s: %lu, %lu\n",
+              driverName, functionName, (unsigned long)pArray->dims[0].size, (unsigned long)pArray->dims[1].size);
+
+    if (this->outFile == NULL) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-        "%s:%s error opening file %s\n",
-        driverName, functionName, fileName);
+            "%s:%s: file is not open\n",
+            driverName, functionName);
+        return(asynError);
+    }
+    if (this->getImage(pArray, &arrayImage)) return(asynError);
+    if ((arrayImage.width != this->image.width) || (arrayImage.height != this->image.height) ||
+        (arrayImage.colorMode != this->image.colorMode)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: array size or color mode is different from the file\n",
+            driverName, functionName);
         return(asynError);
     }
 
-    jpeg_set_defaults(&this->jpegInfo);
+    if (this->multiFrame && (this->encodeThreads > 1)) {
+        pArray->reserve();
+        this->pending.push_back(pArray);
+        if (this->pending.size() < (size_t)this->encodeThreads * FRAMES_PER_THREAD) return(asynSuccess);
+        return this->writePendingFrames();
+    }
 
-    /* Set the file quality */
-    /* Must lock when accessing parameter library */
-    this->lock();
-    getIntegerParam(NDFileJPEGQuality, &quality);
-    this->unlock();
-    jpeg_set_quality(&this->jpegInfo, quality, TRUE);
+    status = this->encodeFrame(&this->image, pArray, &this->jpegBuffer);
+    if (status) return status;
+    if (this->multiFrame) return this->writeFrame(this->jpegBuffer, pArray->timeStamp);
 
-    jpeg_start_compress(&this->jpegInfo, TRUE);
+    if (fwrite(&this->jpegBuffer[0], 1, this->jpegBuffer.size(), this->outFile) != this->jpegBuffer.size()) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error writing data to file\n",
+            driverName, functionName);
+        return(asynError);
+    }
     return(asynSuccess);
 }
 
-/** Writes single NDArray to the JPEG file.
-  * \param[in] pArray Pointer to the NDArray to be written
+/** Encodes an NDArray into a JPEG image in memory.
+  * This uses only local libjpeg structures, so it can be called by several threads at once.
+  * \param[in] pImage The size, color and quality of the image, from getImage.
+  * \param[in] pArray Pointer to the NDArray to be encoded
+  * \param[out] pBuffer The buffer that receives the JPEG data.
   */
-asynStatus NDFileJPEG::writeFile(NDArray *pArray)
+asynStatus NDFileJPEG::encodeFrame(const NDFileJPEGImage_t *pImage, NDArray *pArray, std::vector<JOCTET> *pBuffer)
 {
+    struct jpeg_compress_struct jpegInfo;
+    struct jpeg_error_mgr jpegErr;
+    jpegDestMgr destMgr;
     JSAMPROW row_pointer[1];
     int nwrite=0;
-    unsigned char *pRed=NULL, *pGreen=NULL, *pBlue=NULL, *pData=NULL, *pOut, *buffer=NULL;
-    int sizeX = (int)this->jpegInfo.image_width;
-    int sizeY = (int)this->jpegInfo.image_height;
+    unsigned char *pRed=NULL, *pGreen=NULL, *pBlue=NULL, *pData=NULL, *pOut;
+    int sizeX = (int)pImage->width;
+    int sizeY = (int)pImage->height;
     int stepSize=0, i;
-    static const char *functionName = "writeFile";
-
-    asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
-              "%s:%s: %lu, %lu\n",
-              driverName, functionName, (unsigned long)pArray->dims[0].size, (unsigned long)pArray->dims[1].size);
-
-    switch (this->colorMode) {
+    std::vector<unsigned char> buffer;
+    static const char *functionName = "encodeFrame";
+
+    jpegInfo.err = jpeg_std_error(&jpegErr);
+    jpeg_create_compress(&jpegInfo);
+    destMgr.pub.init_destination = init_destination;
+    destMgr.pub.empty_output_buffer = empty_output_buffer;
+    destMgr.pub.term_destination = term_destination;
+    destMgr.pBuffer = pBuffer;
+    jpegInfo.dest = (jpeg_destination_mgr *) &destMgr;
+    jpegInfo.image_width = pImage->width;
+    jpegInfo.image_height = pImage->height;
+    jpegInfo.input_components = pImage->components;
+    jpegInfo.in_color_space = pImage->colorSpace;
+    jpeg_set_defaults(&jpegInfo);
+    jpeg_set_quality(&jpegInfo, pImage->quality, TRUE);
+
+    switch (pImage->colorMode) {
         case NDColorModeMono:
         case NDColorModeRGB1:
             pData = (unsigned char *)pArray->pData;
             break;
         case NDColorModeRGB2:
-            buffer = (unsigned char *)malloc(sizeX * sizeY * 3);
+            buffer.resize(sizeX * 3);
             stepSize = sizeX * 3;
             pRed = (unsigned char *)pArray->pData;
             pGreen = pRed + sizeX;
             pBlue = pGreen + sizeX;
             break;
         case NDColorModeRGB3:
-            buffer = (unsigned char *)malloc(sizeX * sizeY * 3);
+            buffer.resize(sizeX * 3);
             stepSize = sizeX;
             pRed = (unsigned char *)pArray->pData;
             pGreen = pRed + sizeX * sizeY;
@@ -143,138 +307,267 @@ asynStatus NDFileJPEG::writeFile(NDArray *pArray)
         default:
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s:%s: unknown color mode %d\n",
-                driverName, functionName, this->colorMode);
+                driverName, functionName, pImage->colorMode);
+            jpeg_destroy_compress(&jpegInfo);
             return(asynError);
             break;
     }
-    while ((int)this->jpegInfo.next_scanline < sizeY) {
-        switch (this->colorMode) {
-            case NDColorModeMono:
-            case NDColorModeRGB1:
-                row_pointer[0] = pData;
-                nwrite = jpeg_write_scanlines(&this->jpegInfo, row_pointer, 1);
-                pData += sizeX * this->jpegInfo.input_components;
-                break;
+    jpeg_start_compress(&jpegInfo, TRUE);
+    while ((int)jpegInfo.next_scanline < sizeY) {
+        switch (pImage->colorMode) {
             case NDColorModeRGB2:
             case NDColorModeRGB3:
-                row_pointer[0] = buffer;
-                pOut = buffer;
+                row_pointer[0] = &buffer[0];
+                pOut = &buffer[0];
                 for (i=0; i<sizeX; i++) {
                     *pOut++ = pRed[i];
                     *pOut++ = pGreen[i];
                     *pOut++ = pBlue[i];
                 }
-                nwrite = jpeg_write_scanlines(&this->jpegInfo, row_pointer, 1);
+                nwrite = jpeg_write_scanlines(&jpegInfo, row_pointer, 1);
                 pRed += stepSize;
                 pBlue += stepSize;
                 pGreen += stepSize;
                 break;
             default:
-                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s:%s: unknown color mode %d\n",
-                    driverName, functionName, this->colorMode);
-                return(asynError);
+                row_pointer[0] = pData;
+                nwrite = jpeg_write_scanlines(&jpegInfo, row_pointer, 1);
+                pData += sizeX * pImage->components;
                 break;
         }
         if (nwrite != 1) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s: error writing data to file\n",
+                "%s:%s: error encoding data\n",
                 driverName, functionName);
+            jpeg_destroy_compress(&jpegInfo);
             return(asynError);
         }
     }
-    if (buffer) free(buffer);
+    jpeg_finish_compress(&jpegInfo);
+    jpeg_destroy_compress(&jpegInfo);
 
     return(asynSuccess);
 }
 
-/** Reads single NDArray from a JPEG file; NOT CURRENTLY IMPLEMENTED.
-  * \param[in] pArray Pointer to the NDArray to be read
-  */
-asynStatus NDFileJPEG::readFile(NDArray **pArray)
-{
-    //static const char *functionName = "readFile";
-
-    return asynError;
-}
-
-
-/** Closes the JPEG file. */
-asynStatus NDFileJPEG::closeFile()
+/** Encodes the reserved arrays of an MJPEG file with the codec worker pool, and writes them in order.
+  * The arrays are released. */
+asynStatus NDFileJPEG::writePendingFrames()
 {
-    //static const char *functionName = "closeFile";
-
-    jpeg_finish_compress(&this->jpegInfo);
-    fclose(this->outFile);
-
-    return asynSuccess;
+    FrameBatch batch;
+    asynStatus status = asynSuccess;
+    int numFrames = (int)this->pending.size();
+    int i;
+
+    if (numFrames == 0) return(asynSuccess);
+    batch.pPlugin = this;
+    batch.pImage = &this->image;
+    batch.ppArrays = &this->pending[0];
+    batch.jpeg.resize(numFrames);
+    batch.status.assign(numFrames, asynSuccess);
+    NDCodecWorkerPool::run(encodeFrameTask, &batch, numFrames, this->encodeThreads);
+
+    for (i=0; i<numFrames; i++) {
+        if (status == asynSuccess) {
+            status = batch.status[i];
+            if (status == asynSuccess) status = this->writeFrame(batch.jpeg[i], this->pending[i]->timeStamp);
+        }
+        this->pending[i]->release();
+    }
+    this->pending.clear();
+    return status;
 }
 
-static void init_destination(j_compress_ptr cinfo)
+/** Appends a frame chunk to the movi list of the MJPEG file, and adds it to the index.
+  * \param[in] jpeg The JPEG data of the frame.
+  * \param[in] timeStamp The timeStamp of the NDArray, which is used for the frame rate of the file.
+  */
+asynStatus NDFileJPEG::writeFrame(const std::vector<JOCTET> &jpeg, double timeStamp)
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
-    pdest->pNDFileJPEG->initDestination();
-}
+    NDFileJPEGIndex_t entry;
+    std::vector<char> header;
+    size_t padding = jpeg.size() & 1;
+    epicsUInt64 fileSize;
+    static const char *functionName = "writeFrame";
+
+    /* The file with the new frame and the index must fit in the sizes of the RIFF file, which many readers
+     * treat as signed, and in the long offsets of fseek */
+    fileSize = (epicsUInt64)AVI_MOVI_OFFSET + this->moviSize + 8 + jpeg.size() + padding +
+               8 + 16*(epicsUInt64)(this->frameIndex.size() + 1);
+    if (fileSize > 0x7fffffffULL) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: MJPEG file would be larger than 2 GB\n",
+            driverName, functionName);
+        return(asynError);
+    }
 
-/** Initializes the destination file; should be private but called from C so must be public */
-void NDFileJPEG::initDestination()
-{
-    jpegDestMgr *pdest = (jpegDestMgr*) this->jpegInfo.dest;
+    putFourCC(header, "00dc");
+    put32(header, (epicsUInt32)jpeg.size());
+    if ((fwrite(&header[0], 1, header.size(), this->outFile) != header.size()) ||
+        (fwrite(&jpeg[0], 1, jpeg.size(), this->outFile) != jpeg.size()) ||
+        (padding && (fputc(0, this->outFile) == EOF))) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error writing data to file\n",
+            driverName, functionName);
+        return(asynError);
+    }
 
-    pdest->pub.next_output_byte = this->jpegBuffer;
-    pdest->pub.free_in_buffer = JPEG_BUF_SIZE;
+    entry.offset = this->moviSize;
+    entry.size = (epicsUInt32)jpeg.size();
+    this->frameIndex.push_back(entry);
+    this->moviSize += (epicsUInt32)(8 + jpeg.size() + padding);
+    this->maxFrameSize = std::max(this->maxFrameSize, jpeg.size());
+    if (this->frameIndex.size() == 1) this->firstTimeStamp = timeStamp;
+    this->lastTimeStamp = timeStamp;
+    return(asynSuccess);
 }
 
-static boolean empty_output_buffer(j_compress_ptr cinfo)
+/** Writes the header of the MJPEG file at the start of the file.
+  * The frame rate is computed from the timeStamps of the first and last frames.
+  * \param[in] riffSize The size of the RIFF chunk.
+  */
+asynStatus NDFileJPEG::writeAVIHeader(epicsUInt32 riffSize)
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
-    return pdest->pNDFileJPEG->emptyOutputBuffer();
+    std::vector<char> header;
+    epicsUInt32 numFrames = (epicsUInt32)this->frameIndex.size();
+    epicsUInt32 microSecPerFrame = 100000;
+    double bytesPerSec;
+    static const char *functionName = "writeAVIHeader";
+
+    if ((numFrames > 1) && (this->lastTimeStamp > this->firstTimeStamp)) {
+        microSecPerFrame = (epicsUInt32)((this->lastTimeStamp - this->firstTimeStamp) / (numFrames - 1) * 1e6 + 0.5);
+        if (microSecPerFrame < 1) microSecPerFrame = 1;
+    }
+    bytesPerSec = std::min(this->maxFrameSize * 1e6 / microSecPerFrame, 4294967295.);
+
+    putFourCC(header, "RIFF");
+    put32(header, riffSize);
+    putFourCC(header, "AVI ");
+    putFourCC(header, "LIST");
+    put32(header, AVI_HDRL_SIZE);
+    putFourCC(header, "hdrl");
+
+    putFourCC(header, "avih");
+    put32(header, 56);
+    put32(header, microSecPerFrame);
+    put32(header, (epicsUInt32)bytesPerSec);
+    put32(header, 0);                        /* padding granularity */
+    put32(header, AVIF_HASINDEX);
+    put32(header, numFrames);
+    put32(header, 0);                        /* initial frames */
+    put32(header, 1);                        /* streams */
+    put32(header, (epicsUInt32)this->maxFrameSize);
+    put32(header, this->image.width);
+    put32(header, this->image.height);
+    for (int i=0; i<4; i++) put32(header, 0);
+
+    putFourCC(header, "LIST");
+    put32(header, 116);
+    putFourCC(header, "strl");
+    putFourCC(header, "strh");
+    put32(header, 56);
+    putFourCC(header, "vids");
+    putFourCC(header, "MJPG");
+    put32(header, 0);                        /* flags */
+    put16(header, 0);                        /* priority */
+    put16(header, 0);                        /* language */
+    put32(header, 0);                        /* initial frames */
+    put32(header, microSecPerFrame);         /* scale */
+    put32(header, 1000000);                  /* rate, so frames per second is rate/scale */
+    put32(header, 0);                        /* start */
+    put32(header, numFrames);
+    put32(header, (epicsUInt32)this->maxFrameSize);
+    put32(header, 0xffffffff);               /* quality */
+    put32(header, 0);                        /* sample size */
+    put16(header, 0);
+    put16(header, 0);
+    put16(header, (epicsUInt16)this->image.width);
+    put16(header, (epicsUInt16)this->image.height);
+
+    putFourCC(header, "strf");
+    put32(header, 40);
+    put32(header, 40);                       /* BITMAPINFOHEADER size */
+    put32(header, this->image.width);
+    put32(header, this->image.height);
+    put16(header, 1);                        /* planes */
+    put16(header, (epicsUInt16)(8 * this->image.components));
+    putFourCC(header, "MJPG");
+    put32(header, this->image.width * this->image.height * this->image.components);
+    for (int i=0; i<4; i++) put32(header, 0);
+
+    putFourCC(header, "LIST");
+    put32(header, this->moviSize);
+    putFourCC(header, "movi");
+
+    if ((fseek(this->outFile, 0, SEEK_SET) != 0) ||
+        (fwrite(&header[0], 1, header.size(), this->outFile) != header.size())) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error writing header to file\n",
+            driverName, functionName);
+        return(asynError);
+    }
+    return(asynSuccess);
 }
 
-/** Empties the output buffer; should be private but called from C so must be public */
-boolean NDFileJPEG::emptyOutputBuffer()
+/** Writes the index at the end of the MJPEG file, and writes the header again with the number of frames and the sizes. */
+asynStatus NDFileJPEG::finishAVI()
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) this->jpegInfo.dest;
-    static const char *functionName = "emptyOutputBuffer";
-
-    if (fwrite(this->jpegBuffer, 1, JPEG_BUF_SIZE, this->outFile) !=
-      (size_t) JPEG_BUF_SIZE) {
+    std::vector<char> index;
+    long fileSize;
+    static const char *functionName = "finishAVI";
+
+    putFourCC(index, "idx1");
+    put32(index, (epicsUInt32)(16 * this->frameIndex.size()));
+    for (size_t i=0; i<this->frameIndex.size(); i++) {
+        putFourCC(index, "00dc");
+        put32(index, AVIIF_KEYFRAME);
+        put32(index, this->frameIndex[i].offset);
+        put32(index, this->frameIndex[i].size);
+    }
+    if ((fseek(this->outFile, AVI_MOVI_OFFSET + this->moviSize, SEEK_SET) != 0) ||
+        (fwrite(&index[0], 1, index.size(), this->outFile) != index.size()) ||
+        ((fileSize = ftell(this->outFile)) < 0)) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s error writing JPEG file\n",
+            "%s:%s: error writing index to file\n",
             driverName, functionName);
-        return FALSE;
+        return(asynError);
     }
-    pdest->pub.next_output_byte = this->jpegBuffer;
-    pdest->pub.free_in_buffer = JPEG_BUF_SIZE;
-    return TRUE;
+    return this->writeAVIHeader((epicsUInt32)(fileSize - 8));
 }
 
-static void term_destination (j_compress_ptr cinfo)
+/** Reads single NDArray from a JPEG file; NOT CURRENTLY IMPLEMENTED.
+  * \param[in] pArray Pointer to the NDArray to be read
+  */
+asynStatus NDFileJPEG::readFile(NDArray **pArray)
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) cinfo->dest;
-    pdest->pNDFileJPEG->termDestination();
+    //static const char *functionName = "readFile";
+
+    return asynError;
 }
 
-/** Terminates the destination file; should be private but called from C so must be public */
-void NDFileJPEG::termDestination()
+
+/** Closes the JPEG file.  The frames of an MJPEG file that are still reserved are encoded and written first. */
+asynStatus NDFileJPEG::closeFile()
 {
-    jpegDestMgr *pdest = (jpegDestMgr*) this->jpegInfo.dest;
-    size_t datacount = JPEG_BUF_SIZE - pdest->pub.free_in_buffer;
-    static const char *functionName = "termDestination";
+    asynStatus status = asynSuccess;
+    static const char *functionName = "closeFile";
 
-    /* Write any data remaining in the buffer */
-    if (datacount > 0) {
-        if (fwrite(this->jpegBuffer, 1, datacount, this->outFile) != datacount)
-            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s:%s error writing JPEG file\n",
-                driverName, functionName);
+    if (this->outFile == NULL) return(asynError);
+
+    if (this->multiFrame) {
+        status = this->writePendingFrames();
+        /* The index is written even if a frame failed, so the frames before it can be read */
+        if (this->finishAVI()) status = asynError;
     }
-    fflush(this->outFile);
-    /* Make sure we wrote the output file OK */
-    if (ferror(this->outFile))
+    if ((fflush(this->outFile) != 0) || ferror(this->outFile)) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s error flushing JPEG file\n",
             driverName, functionName);
+        status = asynError;
+    }
+    fclose(this->outFile);
+    this->outFile = NULL;
+
+    return status;
 }
 
 
@@ -306,25 +599,21 @@ NDFileJPEG::NDFileJPEG(const char *portName, int queueSize, int blockingCallback
     //static const char *functionName = "NDFileJPEG";
 
     createParam(NDFileJPEGQualityString, asynParamInt32, &NDFileJPEGQuality);
+    createParam(NDFileJPEGEncodeThreadsString, asynParamInt32, &NDFileJPEGEncodeThreads);
 
-    jpeg_create_compress(&this->jpegInfo);
-    this->jpegInfo.err = jpeg_std_error(&this->jpegErr);
-
-    /* Note: we don't use the built-in stdio routines, because this does not work when using
-     * the prebuilt library and either VC++ or g++ on Windows.  The FILE pointers are wrong
-     * when doing that.  Rather we implement our own jpeg_destination_mgr structure and handle
-     * the I/O ourselves.  The code we use is almost a direct copy from jdatadst.c in the standard
-     * package. */
-    this->destMgr.pub.init_destination = init_destination;
-    this->destMgr.pub.empty_output_buffer = empty_output_buffer;
-    this->destMgr.pub.term_destination = term_destination;
-    this->destMgr.pNDFileJPEG = this;
-    this->jpegInfo.dest = (jpeg_destination_mgr *) &this->destMgr;
+    this->outFile = NULL;
+    this->multiFrame = false;
+    this->encodeThreads = 0;
+    this->moviSize = 0;
+    this->maxFrameSize = 0;
+    this->firstTimeStamp = 0.;
+    this->lastTimeStamp = 0.;
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDFileJPEG");
-    this->supportsMultipleArrays = 0;
+    this->supportsMultipleArrays = 1;
     setIntegerParam(NDFileJPEGQuality, 50);
+    setIntegerParam(NDFileJPEGEncodeThreads, 0);
 }
 
 /* Configuration routine.  Called directly, or from the iocsh  */
@@ -8,6 +8,8 @@
 #ifndef DRV_NDFileJPEG_H
 #define DRV_NDFileJPEG_H
 
+#include <vector>
+
 #include "NDPluginFile.h"
 
 #ifdef __cplusplus
@@ -19,18 +21,37 @@ extern "C" {
 }
 #endif
 
-#define JPEG_BUF_SIZE 4096 /* choose an efficiently fwrite'able size */
+#define JPEG_BUF_SIZE 65536 /* Initial size of the buffer that a frame is encoded into */
 
-/** Expanded data destination object for JPEG output */
+/** Expanded data destination object for JPEG output, which encodes a frame into a buffer in memory */
 typedef struct {
   struct jpeg_destination_mgr pub; /* public fields */
-  class NDFileJPEG *pNDFileJPEG;   /* Pointer to ourselves */
+  std::vector<JOCTET> *pBuffer;    /* Buffer that grows to hold the JPEG data */
 } jpegDestMgr;
 
-#define NDFileJPEGQualityString  "JPEG_QUALITY"  /* (asynInt32, r/w) File quality */
+/** Size and color of the images in a file, which are the same for every frame */
+typedef struct {
+  JDIMENSION width;
+  JDIMENSION height;
+  int components;
+  J_COLOR_SPACE colorSpace;
+  NDColorMode_t colorMode;
+  int quality;
+} NDFileJPEGImage_t;
+
+/** Location of a frame in the movi list of an MJPEG file */
+typedef struct {
+  epicsUInt32 offset;   /* Offset of the chunk from the movi fourcc */
+  epicsUInt32 size;     /* Size of the JPEG data in the chunk */
+} NDFileJPEGIndex_t;
+
+#define NDFileJPEGQualityString        "JPEG_QUALITY"        /* (asynInt32, r/w) File quality */
+#define NDFileJPEGEncodeThreadsString  "JPEG_ENCODE_THREADS" /* (asynInt32, r/w) Threads that encode the frames of an MJPEG file */
 
 /** Writes NDArrays in the JPEG file format, which is a lossy compression format.
   * This plugin was developed using the libjpeg library to write the file.
+  * Single mode writes one JPEG file per array.  Capture and Stream mode write all of the arrays
+  * to one Motion-JPEG AVI file, with an index of the frames; the frames can be encoded by several threads.
   */
 class NDPLUGIN_API NDFileJPEG : public NDPluginFile {
 public:
@@ -43,22 +64,32 @@ public:
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
-    /* These should be private, but are called from C, must be public */
-    void initDestination();
-    boolean emptyOutputBuffer();
-    void termDestination();
+    /* Called from the codec worker threads, so it must be public */
+    asynStatus encodeFrame(const NDFileJPEGImage_t *pImage, NDArray *pArray, std::vector<JOCTET> *pBuffer);
 
 protected:
     int NDFileJPEGQuality;
     #define FIRST_NDFILE_JPEG_PARAM NDFileJPEGQuality
+    int NDFileJPEGEncodeThreads;
 
 private:
-    struct jpeg_compress_struct jpegInfo;
-    struct jpeg_error_mgr jpegErr;
-    NDColorMode_t colorMode;
+    asynStatus getImage(NDArray *pArray, NDFileJPEGImage_t *pImage);
+    asynStatus writeFrame(const std::vector<JOCTET> &jpeg, double timeStamp);
+    asynStatus writePendingFrames();
+    asynStatus writeAVIHeader(epicsUInt32 riffSize);
+    asynStatus finishAVI();
+
     FILE *outFile;
-    JOCTET jpegBuffer[JPEG_BUF_SIZE];
-    jpegDestMgr destMgr;
+    NDFileJPEGImage_t image;          /* Images of the open file */
+    bool multiFrame;                  /* The open file is an MJPEG file with one frame per array */
+    int encodeThreads;                /* Threads that encode the frames of the open MJPEG file */
+    std::vector<NDArray *> pending;   /* Reserved arrays that are waiting to be encoded */
+    std::vector<JOCTET> jpegBuffer;   /* Buffer for frames that are encoded by the writing thread */
+    std::vector<NDFileJPEGIndex_t> frameIndex;
+    epicsUInt32 moviSize;             /* Bytes in the movi list, including its fourcc */
+    size_t maxFrameSize;
+    double firstTimeStamp;
+    double lastTimeStamp;
 };
 
 #endif
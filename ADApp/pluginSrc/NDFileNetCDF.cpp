@@ -21,6 +21,25 @@
 
 static const char *driverName = "NDFileNetCDF";
 
+/* Returns the number of bytes in a value of a netCDF type */
+static size_t ncTypeSize(nc_type ncType)
+{
+    switch (ncType) {
+        case NC_SHORT:  return sizeof(short);
+        case NC_INT:    return sizeof(int);
+        case NC_FLOAT:  return sizeof(float);
+        case NC_DOUBLE: return sizeof(double);
+        default:        return 1;
+    }
+}
+
+/* Appends the value of one array to a buffer */
+static void appendValue(NDFileNetCDFBuffer_t *pBuffer, const void *pValue)
+{
+    const char *pBytes = (const char *)pValue;
+    pBuffer->values.insert(pBuffer->values.end(), pBytes, pBytes + pBuffer->valueSize);
+}
+
 /* Handle errors by printing an error message and exiting with a
  * non-zero status. */
 #define ERR(e) {asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR, \
@@ -31,6 +50,8 @@ static const char *driverName = "NDFileNetCDF";
 /** Opens a netCDF file.
   * In write mode if NDFileModeMultiple is set then the first dimension is set to NC_UNLIMITED to allow
   * multiple arrays to be written to the same file.
+  * If NDFileFormat is NDFileNetCDFFormatNetCDF4 the file is a netCDF-4 file, with one array per chunk
+  * of the array data, which is compressed with deflate if NDFileNetCDFDeflateLevel is greater than 0.
   * NOTE: Does not currently support NDFileModeRead or NDFileModeAppend.
   * \param[in] fileName  Absolute path name of the file to open.
   * \param[in] openMode Bit mask with one of the access mode bits NDFileModeRead, NDFileModeWrite, NDFileModeAppend.
@@ -56,8 +77,10 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     const char *dataTypeString=NULL;
     NDAttrDataType_t attrDataType;
     size_t attrSize;
-    int numAttributes, attrCount;
+    int attrId;
     double fileVersion;
+    int fileFormat, deflateLevel, shuffle, cmode;
+    size_t chunks[ND_ARRAY_MAX_DIMS+1];
     static const char *functionName = "openFile";
 
     /* We don't support reading yet */
@@ -79,9 +102,26 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     /* Set the next record in the file to 0 */
     this->nextRecord = 0;
 
+    /* Must lock when accessing parameter library */
+    this->lock();
+    getIntegerParam(NDFileFormat, &fileFormat);
+    getIntegerParam(NDFileNetCDFDeflateLevel, &deflateLevel);
+    getIntegerParam(NDFileNetCDFShuffle, &shuffle);
+    getIntegerParam(NDFileNetCDFBufferFrames, &this->bufferFrames);
+    this->unlock();
+    this->netCDF4 = (fileFormat == NDFileNetCDFFormatNetCDF4);
+    if (!(openMode & NDFileModeMultiple) || (this->bufferFrames < 1)) this->bufferFrames = 1;
+    /* The chunks of the variables with one value per array hold the arrays that are written at once.
+     * A chunk cannot be larger than a fixed numArrays dimension */
+    this->chunkFrames = (openMode & NDFileModeMultiple) ? this->bufferFrames : 1;
+    this->numBuffered = 0;
+    this->buffers.clear();
+
     /* Create the file. The NC_CLOBBER parameter tells netCDF to
      * overwrite this file, if it already exists.*/
-    if ((retval = nc_create(fileName, NC_CLOBBER, &this->ncId)))
+    cmode = NC_CLOBBER;
+    if (this->netCDF4) cmode |= NC_NETCDF4;
+    if ((retval = nc_create(fileName, cmode, &this->ncId)))
         ERR(retval);
 
     /* Create global attribute for the data type because netCDF does not
@@ -183,31 +223,46 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     if ((retval = nc_def_var(this->ncId, "uniqueId", NC_INT, 1,
                  &dimIds[0], &this->uniqueIdId)))
         ERR(retval);
+    if (this->addBuffer(this->uniqueIdId, NC_INT, sizeof(int))) return asynError;
 
     /* Define the timestamp data variable. */
     if ((retval = nc_def_var(this->ncId, "timeStamp", NC_DOUBLE, 1,
                  &dimIds[0], &this->timeStampId)))
         ERR(retval);
+    if (this->addBuffer(this->timeStampId, NC_DOUBLE, sizeof(double))) return asynError;
 
     /* Define the EPICS timestamp data variables. */
     if ((retval = nc_def_var(this->ncId, "epicsTSSec", NC_INT, 1,
                  &dimIds[0], &this->epicsTSSecId)))
         ERR(retval);
+    if (this->addBuffer(this->epicsTSSecId, NC_INT, sizeof(int))) return asynError;
 
     if ((retval = nc_def_var(this->ncId, "epicsTSNsec", NC_INT, 1,
                  &dimIds[0], &this->epicsTSNsecId)))
         ERR(retval);
+    if (this->addBuffer(this->epicsTSNsecId, NC_INT, sizeof(int))) return asynError;
 
     /* Define the array data variable. */
     if ((retval = nc_def_var(this->ncId, "array_data", ncType, pArray->ndims+1,
                  dimIds, &this->arrayDataId)))
         ERR(retval);
 
+    /* In netCDF-4 files each array is a chunk, which is compressed if deflateLevel is greater than 0 */
+    if (this->netCDF4) {
+        chunks[0] = 1;
+        for (i=0; i<pArray->ndims; i++) {
+            chunks[i+1] = pArray->dims[pArray->ndims - i - 1].size;
+        }
+        if ((retval = nc_def_var_chunking(this->ncId, this->arrayDataId, NC_CHUNKED, chunks)))
+            ERR(retval);
+        if ((deflateLevel > 0) || shuffle) {
+            if ((retval = nc_def_var_deflate(this->ncId, this->arrayDataId, shuffle ? 1 : 0,
+                                             (deflateLevel > 0) ? 1 : 0, deflateLevel)))
+                ERR(retval);
+        }
+    }
+
     /* Create a variable for each attribute in the array */
-    free(this->pAttributeId);
-    numAttributes = this->pFileAttributes->count();
-    attrCount = 0;
-    this->pAttributeId = (int *)calloc(numAttributes, sizeof(int));
     pAttribute = this->pFileAttributes->next(NULL);
     while (pAttribute) {
         const char *attributeName = pAttribute->getName();
@@ -315,12 +370,14 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
         epicsSnprintf(tempString, sizeof(tempString), "Attr_%s", pAttribute->getName());
         if (attrDataType == NDAttrString) {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 2,
-                    stringDimIds, &this->pAttributeId[attrCount++])))
+                    stringDimIds, &attrId)))
                     ERR(retval);
+            if (this->addBuffer(attrId, ncType, MAX_ATTRIBUTE_STRING_SIZE)) return asynError;
         } else {
             if ((retval = nc_def_var(this->ncId, tempString, ncType, 1,
-                    &dimIds[0], &this->pAttributeId[attrCount++])))
+                    &dimIds[0], &attrId)))
                     ERR(retval);
+            if (this->addBuffer(attrId, ncType, ncTypeSize(ncType))) return asynError;
         }
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
@@ -332,18 +389,89 @@ asynStatus NDFileNetCDF::openFile(const char *fileName, NDFileOpenMode_t openMod
     return(asynSuccess);
 }
 
+/** Adds the buffer of a variable with one value per array.
+  * In netCDF-4 files the variable is chunked so that each write of the buffers is one chunk.
+  * \param[in] varId The netCDF variable.
+  * \param[in] ncType The netCDF type of the variable.
+  * \param[in] valueSize The number of bytes written for each array. */
+asynStatus NDFileNetCDF::addBuffer(int varId, int ncType, size_t valueSize)
+{
+    NDFileNetCDFBuffer_t buffer;
+    size_t chunks[2];
+    int retval;
+    static const char *functionName = "addBuffer";
+
+    if (this->netCDF4) {
+        chunks[0] = this->chunkFrames;
+        chunks[1] = MAX_ATTRIBUTE_STRING_SIZE;
+        if ((retval = nc_def_var_chunking(this->ncId, varId, NC_CHUNKED, chunks)))
+            ERR(retval);
+    }
+    buffer.varId = varId;
+    buffer.ncType = ncType;
+    buffer.valueSize = valueSize;
+    buffer.values.reserve(valueSize * this->bufferFrames);
+    this->buffers.push_back(buffer);
+    return asynSuccess;
+}
+
+/** Writes the values of the buffered arrays, with one call for each variable. */
+asynStatus NDFileNetCDF::flushBuffers()
+{
+    size_t start[2], count[2];
+    int retval = NC_NOERR;
+    size_t i;
+    static const char *functionName = "flushBuffers";
+
+    if (this->numBuffered == 0) return asynSuccess;
+    start[0] = this->nextRecord - this->numBuffered;
+    start[1] = 0;
+    count[0] = this->numBuffered;
+    count[1] = MAX_ATTRIBUTE_STRING_SIZE;
+    for (i=0; (i<this->buffers.size()) && (retval == NC_NOERR); i++) {
+        NDFileNetCDFBuffer_t *pBuffer = &this->buffers[i];
+        const void *pValues = &pBuffer->values[0];
+        switch (pBuffer->ncType) {
+            case NC_BYTE:
+                retval = nc_put_vara_schar(this->ncId, pBuffer->varId, start, count, (const signed char *)pValues);
+                break;
+            case NC_SHORT:
+                retval = nc_put_vara_short(this->ncId, pBuffer->varId, start, count, (const short *)pValues);
+                break;
+            case NC_INT:
+                retval = nc_put_vara_int(this->ncId, pBuffer->varId, start, count, (const int *)pValues);
+                break;
+            case NC_FLOAT:
+                retval = nc_put_vara_float(this->ncId, pBuffer->varId, start, count, (const float *)pValues);
+                break;
+            case NC_DOUBLE:
+                retval = nc_put_vara_double(this->ncId, pBuffer->varId, start, count, (const double *)pValues);
+                break;
+            case NC_CHAR:
+                retval = nc_put_vara_text(this->ncId, pBuffer->varId, start, count, (const char *)pValues);
+                break;
+        }
+    }
+    /* The values are discarded even if they could not be written, so the next arrays start with empty buffers */
+    for (i=0; i<this->buffers.size(); i++) this->buffers[i].values.clear();
+    this->numBuffered = 0;
+    if (retval) ERR(retval);
+    return asynSuccess;
+}
+
 
 /** Writes NDArray data to a netCDF file.
+  * The uniqueId, timestamps and attributes are added to the buffers, which are written when they hold
+  * NDFileNetCDFBufferFrames arrays and when the file is closed.
   * \param[in] pArray Pointer to an NDArray to write to the file. This function can be called multiple
   *           times between the call to openFile and closeFile if
   *           NDFileModeMultiple was set in openMode in the call to NDFileNetCDF::openFile. */
 asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
 {
     int retval;
-    size_t stringCount[2];
     size_t start[ND_ARRAY_MAX_DIMS+1], count[ND_ARRAY_MAX_DIMS+1];
-    int attrId;
     NDAttrValue attrVal;
+    const void *pValue;
     int i, j;
     NDAttribute *pAttribute;
     NDAttrDataType_t attrDataType;
@@ -369,16 +497,13 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
         start[i+1] = 0;
     }
 
-    /* Write the data to the file. */
-    if ((retval = nc_put_vara_int(this->ncId, this->uniqueIdId, start, count, &pArray->uniqueId)))
-                ERR(retval);
-    if ((retval = nc_put_vara_double(this->ncId, this->timeStampId, start, count, &pArray->timeStamp)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSSecId, start, count, (int *)&pArray->epicsTS.secPastEpoch)))
-                ERR(retval);
-    if ((retval = nc_put_vara_int(this->ncId, this->epicsTSNsecId, start, count, (int *)&pArray->epicsTS.nsec)))
-                ERR(retval);
+    /* Add the uniqueId and timestamps to the buffers, in the order they were added in openFile */
+    appendValue(&this->buffers[0], &pArray->uniqueId);
+    appendValue(&this->buffers[1], &pArray->timeStamp);
+    appendValue(&this->buffers[2], &pArray->epicsTS.secPastEpoch);
+    appendValue(&this->buffers[3], &pArray->epicsTS.nsec);
 
+    /* Write the data to the file. */
     switch (pArray->dataType) {
         case NDInt8:
             if ((retval = nc_put_vara_schar(this->ncId, this->arrayDataId, start, count, (signed char*)pArray->pData)))
@@ -415,63 +540,46 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
             return asynError;
             break;
     }
-    /* Write the attributes.  Loop through the list of attributes.  These must not have changed since define time! */
+    /* Add the attributes to the buffers.  Loop through the list of attributes.  These must not have changed since define time! */
     pAttribute = this->pFileAttributes->next(NULL);
     attrCount = 0;
-    while (pAttribute) {
+    while (pAttribute && (4 + attrCount < (int)this->buffers.size())) {
         pAttribute->getValueInfo(&attrDataType, &attrSize);
-        attrId = this->pAttributeId[attrCount++];
+        pValue = &attrVal;
         switch (attrDataType) {
             case NDAttrInt8:
             case NDAttrUInt8:
                 pAttribute->getValue(attrDataType, &attrVal.i8);
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
                 break;
             case NDAttrInt16:
             case NDAttrUInt16:
                 pAttribute->getValue(attrDataType, &attrVal.i16);
-                if ((retval = nc_put_vara_short(this->ncId, attrId, start, count, (short *)&attrVal.i16)))
-                    ERR(retval);
                 break;
             case NDAttrInt32:
             case NDAttrUInt32:
                 pAttribute->getValue(attrDataType, &attrVal.i32);
-                if ((retval = nc_put_vara_int(this->ncId, attrId, start, count, (int *)&attrVal.i32)))
-                    ERR(retval);
                 break;
             case NDAttrFloat32:
                 pAttribute->getValue(attrDataType, &attrVal.f32);
-                if ((retval = nc_put_vara_float(this->ncId, attrId, start, count, (float *)&attrVal.f32)))
-                    ERR(retval);
                 break;
             case NDAttrInt64:
                 pAttribute->getValue(attrDataType, &attrVal.i64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.i64)))
-                    ERR(retval);
                 break;
             case NDAttrUInt64:
                 pAttribute->getValue(attrDataType, &attrVal.ui64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.ui64)))
-                    ERR(retval);
                 break;
             case NDAttrFloat64:
                 pAttribute->getValue(attrDataType, &attrVal.f64);
-                if ((retval = nc_put_vara_double(this->ncId, attrId, start, count, (double *)&attrVal.f64)))
-                    ERR(retval);
                 break;
             case NDAttrString:
+                /* The rest of the string is filled with 0, which is the netCDF fill value for text */
+                memset(attrString, 0, sizeof(attrString));
                 pAttribute->getValue(attrDataType, attrString, sizeof(attrString));
-                stringCount[0] = 1;
-                stringCount[1] = strlen(attrString);
-                if ((retval = nc_put_vara_text(this->ncId, attrId, start, stringCount, attrString)))
-                    ERR(retval);
+                pValue = attrString;
                 break;
             case NDAttrUndefined:
                 /* netCDF does not have a way of storing NaN, etc. We just use 0 byte */
                 attrVal.i8 = 0;
-                if ((retval = nc_put_vara_schar(this->ncId, attrId, start, count, (signed char*)&attrVal.i8)))
-                    ERR(retval);
                 break;
             default:
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -480,9 +588,16 @@ asynStatus NDFileNetCDF::writeFile(NDArray *pArray)
                 return asynError;
                 break;
         }
+        appendValue(&this->buffers[4 + attrCount++], pValue);
         pAttribute = this->pFileAttributes->next(pAttribute);
     }
+    /* Attributes that this array does not have are written as 0 */
+    for (i=4+attrCount; i<(int)this->buffers.size(); i++) {
+        this->buffers[i].values.resize(this->buffers[i].values.size() + this->buffers[i].valueSize, 0);
+    }
     this->nextRecord++;
+    this->numBuffered++;
+    if (this->numBuffered >= this->bufferFrames) return this->flushBuffers();
     return(asynSuccess);
 }
 
@@ -496,17 +611,20 @@ asynStatus NDFileNetCDF::readFile(NDArray **pArray)
 }
 
 
-/** Closes the netCDF file opened with NDFileNetCDF::openFile */
+/** Closes the netCDF file opened with NDFileNetCDF::openFile, after writing the buffered values */
 asynStatus NDFileNetCDF::closeFile()
 {
     int retval;
+    asynStatus status;
     static const char *functionName = "closeFile";
 
     if (this->ncId == 0) return asynSuccess;
-    if ((retval = nc_close(this->ncId)))
-        ERR(retval);
+    status = this->flushBuffers();
+    retval = nc_close(this->ncId);
     this->ncId = 0;
-    return asynSuccess;
+    if (retval)
+        ERR(retval);
+    return status;
 }
 
 
@@ -530,11 +648,22 @@ NDFileNetCDF::NDFileNetCDF(const char *portName, int queueSize, int blockingCall
 {
     //static const char *functionName = "NDFileNetCDF";
 
+    createParam(NDFileNetCDFDeflateLevelString, asynParamInt32, &NDFileNetCDFDeflateLevel);
+    createParam(NDFileNetCDFShuffleString,      asynParamInt32, &NDFileNetCDFShuffle);
+    createParam(NDFileNetCDFBufferFramesString, asynParamInt32, &NDFileNetCDFBufferFrames);
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDFileNetCDF");
+    setIntegerParam(NDFileFormat, NDFileNetCDFFormatClassic);
+    setIntegerParam(NDFileNetCDFDeflateLevel, 0);
+    setIntegerParam(NDFileNetCDFShuffle, 0);
+    setIntegerParam(NDFileNetCDFBufferFrames, 1);
     this->supportsMultipleArrays = 1;
-    this->pAttributeId = NULL;
     this->ncId = 0;
+    this->netCDF4 = false;
+    this->chunkFrames = 1;
+    this->bufferFrames = 1;
+    this->numBuffered = 0;
     this->pFileAttributes = new NDAttributeList;
 }
 
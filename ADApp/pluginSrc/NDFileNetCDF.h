@@ -8,6 +8,8 @@
 #ifndef DRV_NDFileNetCDF_H
 #define DRV_NDFileNetCDF_H
 
+#include <vector>
+
 #include "NDPluginFile.h"
 
 /** This version number is an attribute in the netCDF file to allow readers
@@ -18,12 +20,33 @@
  * which changed the datatypes of NDFloat32 and NDFloat64 from 6-7 to 8-9.*/
 #define NDNetCDFFileVersion 3.1
 
+/** Formats of the files, selected with NDFileFormat */
+typedef enum {
+    NDFileNetCDFFormatClassic,
+    NDFileNetCDFFormatNetCDF4
+} NDFileNetCDFFormat_t;
+
+#define NDFileNetCDFDeflateLevelString "NETCDF_DEFLATE_LEVEL" /* (asynInt32, r/w) Deflate level of the array data in netCDF-4 files, 0 for none */
+#define NDFileNetCDFShuffleString      "NETCDF_SHUFFLE"       /* (asynInt32, r/w) Shuffle the array data before deflate in netCDF-4 files */
+#define NDFileNetCDFBufferFramesString "NETCDF_BUFFER_FRAMES" /* (asynInt32, r/w) Arrays whose uniqueId, timestamps and attributes are written at once */
+
+/** Values of a variable with one value per array, e.g. uniqueId or an attribute, that have not been written yet */
+typedef struct {
+    int varId;
+    int ncType;
+    size_t valueSize;          /* Bytes per array */
+    std::vector<char> values;
+} NDFileNetCDFBuffer_t;
+
 /** Writes NDArrays to files in the netCDF file format.
   * netCDF is an open-source, portable, self-describing binary format supported by Unidata at UCAR
   * (http://www.unidata.ucar.edu/software/netcdf).
   * The netCDF format supports arrays of any dimension and all of the data types supported by NDArray.
   * It can store multiple NDArrays in a single file, so it sets NDPluginFile::supportsMultipleArrays to 1.
   * If also can store all of the attributes associated with an NDArray.
+  * Files are written in the classic format, or in the netCDF-4 format with chunked and optionally
+  * compressed array data.  The uniqueId, timestamps and attributes of several arrays can be buffered
+  * and written with one call per variable.
   * This class implements the 4 pure virtual functions from
   * NDPluginFile: openFile, readFile, writeFile and closeFile. */
 class NDPLUGIN_API NDFileNetCDF : public NDPluginFile {
@@ -38,7 +61,16 @@ public:
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
 
+protected:
+    int NDFileNetCDFDeflateLevel;
+    #define FIRST_NDFILE_NETCDF_PARAM NDFileNetCDFDeflateLevel
+    int NDFileNetCDFShuffle;
+    int NDFileNetCDFBufferFrames;
+
 private:
+    asynStatus addBuffer(int varId, int ncType, size_t valueSize);
+    asynStatus flushBuffers();
+
     int ncId;
     int arrayDataId;
     int uniqueIdId;
@@ -46,8 +78,12 @@ private:
     int epicsTSSecId;
     int epicsTSNsecId;
     int nextRecord;
-    int *pAttributeId;
     NDAttributeList *pFileAttributes;
+    bool netCDF4;                               /* The open file is a netCDF-4 file */
+    size_t chunkFrames;                         /* Arrays per chunk of the variables with one value per array */
+    int bufferFrames;                           /* Arrays that are buffered before the buffers are written */
+    int numBuffered;                            /* Arrays in the buffers */
+    std::vector<NDFileNetCDFBuffer_t> buffers;  /* uniqueId, timeStamp, epicsTSSec, epicsTSNsec, then the attributes */
 };
 
 #endif
@@ -22,16 +22,31 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+#include <algorithm>
 
 #include <iocsh.h>
+#include <epicsString.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 
 #include "tiffio.h"
 #include "NDFileTIFF.h"
+#include "NDPluginCodec.h"
 
 #include <epicsExport.h>
 
 #define STRING_BUFFER_SIZE 2048
 
+/* The strips of an image are compressed in batches of this many strips per thread, and each
+ * batch is written before the next one is compressed */
+#define STRIPS_PER_THREAD 4
+
 static const char *driverName = "NDFileTIFF";
 
 
@@ -59,9 +74,95 @@ static void registerCustomTIFFTags(TIFF *tif)
 
 static void augmentLibTiffWithCustomTags() {
     static bool first_time = true;
+    char tagName[STRING_BUFFER_SIZE] = {0};
+    TIFFFieldInfo fieldInfo = {0, 1, 1, TIFF_ASCII, FIELD_CUSTOM, 1, 0, tagName};
+    int i;
+
     if (!first_time) return;
     first_time = false;
+    for (i=TIFFTAG_FIRST_ATTRIBUTE; i<=TIFFTAG_LAST_ATTRIBUTE; i++) {
+        sprintf(tagName, "Attribute_%d", i-TIFFTAG_FIRST_ATTRIBUTE+1);
+        fieldInfo.field_name = epicsStrDup(tagName);
+        fieldInfo.field_tag = i;
+        tiffFieldInfo[4+i-TIFFTAG_FIRST_ATTRIBUTE] = fieldInfo;
+    }
     TIFFSetTagExtender(registerCustomTIFFTags);
+
+    /* Suppress error and warning messages from the TIFF library */
+    TIFFSetErrorHandler(NULL);
+    TIFFSetWarningHandler(NULL);
+}
+
+
+/* libtiff compression schemes, indexed by NDFileTIFFCompression_t.
+ * COMPRESSION_ZSTD only exists in libtiff 4.0.10 and later, -1 marks a scheme this libtiff cannot write. */
+#ifdef COMPRESSION_ZSTD
+#define NDTIFF_COMPRESSION_ZSTD COMPRESSION_ZSTD
+#else
+#define NDTIFF_COMPRESSION_ZSTD -1
+#endif
+static const int tiffCompression[] = {COMPRESSION_NONE, COMPRESSION_ADOBE_DEFLATE, COMPRESSION_LZW, NDTIFF_COMPRESSION_ZSTD};
+static const char *compressionNames[] = {"None", "Deflate", "LZW", "Zstd"};
+#define NUM_COMPRESSIONS ((int)(sizeof(tiffCompression)/sizeof(tiffCompression[0])))
+
+/* Returns true if the strips are compressed by the worker threads and written raw, rather than compressed by libtiff */
+static bool compressStripsInThreads(const NDFileTIFFSettings_t *pSettings)
+{
+    if (pSettings->compressThreads < 1) return false;
+#ifdef HAVE_ZLIB
+    if (pSettings->compression == NDFileTIFFCompressionDeflate) return true;
+#endif
+#ifdef HAVE_ZSTD
+    if (pSettings->compression == NDFileTIFFCompressionZstd) return true;
+#endif
+    return false;
+}
+
+/* A batch of the strips of an image that are compressed in parallel by the codec worker pool */
+typedef struct {
+    int compression;
+    int compressLevel;
+    const char **pData;      /* Uncompressed data of all the strips of the image */
+    const size_t *pSize;     /* Uncompressed size of all the strips of the image */
+    size_t first;            /* Index of the first strip of the batch */
+    std::vector<std::vector<char> > output; /* Compressed strips of the batch, empty if compression failed */
+} StripBatch;
+
+/* Compresses one strip of a batch into the format that libtiff expects for the compression scheme.
+ * Called by the codec worker pool */
+static void compressStripTask(void *arg, int strip)
+{
+    StripBatch *pBatch = (StripBatch *)arg;
+    std::vector<char> &out = pBatch->output[strip];
+
+    out.clear();
+#ifdef HAVE_ZLIB
+    if (pBatch->compression == NDFileTIFFCompressionDeflate) {
+        const char *pIn = pBatch->pData[pBatch->first + strip];
+        size_t inSize = pBatch->pSize[pBatch->first + strip];
+        uLongf outSize = compressBound((uLong)inSize);
+        int level = (pBatch->compressLevel > 0) ? pBatch->compressLevel : Z_DEFAULT_COMPRESSION;
+        out.resize(outSize);
+        if (compress2((Bytef *)&out[0], &outSize, (const Bytef *)pIn, (uLong)inSize, level) == Z_OK)
+            out.resize(outSize);
+        else
+            out.clear();
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (pBatch->compression == NDFileTIFFCompressionZstd) {
+        const char *pIn = pBatch->pData[pBatch->first + strip];
+        size_t inSize = pBatch->pSize[pBatch->first + strip];
+        size_t outSize = ZSTD_compressBound(inSize);
+        int level = (pBatch->compressLevel > 0) ? pBatch->compressLevel : ZSTD_CLEVEL_DEFAULT;
+        out.resize(outSize);
+        outSize = ZSTD_compress(&out[0], outSize, pIn, inSize, level);
+        if (ZSTD_isError(outSize))
+            out.clear();
+        else
+            out.resize(outSize);
+    }
+#endif
 }
 
 
@@ -76,28 +177,9 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     /* When we create TIFF variables and dimensions, we get back an
      * ID for each one. */
     static const char *functionName = "openFile";
-    size_t sizeX, sizeY, rowsPerStrip;
-    int bitsPerSample=8, sampleFormat=SAMPLEFORMAT_INT, samplesPerPixel, photoMetric, planarConfig;
-    int colorMode=NDColorModeMono;
-    NDAttribute *pAttribute = NULL;
-    char tagString[STRING_BUFFER_SIZE] = {0};
-    char attrString[STRING_BUFFER_SIZE] = {0};
-    char tagName[STRING_BUFFER_SIZE] = {0};
-    int i;
-    TIFFFieldInfo fieldInfo = {0, 1, 1, TIFF_ASCII, FIELD_CUSTOM, 1, 0, tagName};
-
-    for (i=TIFFTAG_FIRST_ATTRIBUTE; i<=TIFFTAG_LAST_ATTRIBUTE; i++) {
-        sprintf(tagName, "Attribute_%d", i-TIFFTAG_FIRST_ATTRIBUTE+1);
-        fieldInfo.field_tag = i;
-        tiffFieldInfo[4+i-TIFFTAG_FIRST_ATTRIBUTE] = fieldInfo;
-    }
 
     augmentLibTiffWithCustomTags();
 
-    /* Suppress error and warning messages from the TIFF library */
-    TIFFSetErrorHandler(NULL);
-    TIFFSetWarningHandler(NULL);
-
     /* We don't support opening an existing file for appending yet */
     if (openMode & NDFileModeAppend) return(asynError);
 
@@ -115,9 +197,11 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
             driverName, functionName, fileName);
     }
 
-    /* Open file for writing */
+    /* Open file for writing.  Files with multiple arrays are BigTIFF files, so they can be larger than 4 GB */
     else if (openMode & NDFileModeWrite) {
-        if ((this->tiff = TIFFOpen(fileName, "w")) == NULL ) {
+        this->multiPage = (openMode & NDFileModeMultiple) != 0;
+        this->numPages = 0;
+        if ((this->tiff = TIFFOpen(fileName, this->multiPage ? "w8" : "w")) == NULL ) {
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s error opening file %s\n",
             driverName, functionName, fileName);
@@ -131,6 +215,48 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
     // If the file is open for reading we are done
     if (openMode & NDFileModeRead) return asynSuccess;
 
+    this->readSettings(&this->settings);
+
+    // The tags of each page of a multi-page file are set when its array is written
+    if (this->multiPage) return asynSuccess;
+
+    return this->setTags(this->tiff, &this->settings, pArray, this->pFileAttributes, &this->colorMode);
+}
+
+/** Reads the compression and strip parameters.  Called without the asyn lock held.
+  * \param[out] pSettings The settings that are read.
+  */
+void NDFileTIFF::readSettings(NDFileTIFFSettings_t *pSettings)
+{
+    /* Must lock when accessing parameter library */
+    this->lock();
+    getIntegerParam(NDFileTIFFCompression,     &pSettings->compression);
+    getIntegerParam(NDFileTIFFCompressLevel,   &pSettings->compressLevel);
+    getIntegerParam(NDFileTIFFCompressThreads, &pSettings->compressThreads);
+    getIntegerParam(NDFileTIFFStripSize,       &pSettings->stripSize);
+    this->unlock();
+}
+
+/** Sets the TIFF tags of a file that is open for writing, or of the next page of a multi-page file.
+  * \param[in] tiff The TIFF file.
+  * \param[in] pSettings The compression and strip settings.
+  * \param[in] pArray A pointer to an NDArray; this is used to determine the array and attribute properties.
+  * \param[out] pFileAttributes The list that the attributes of this plugin and of pArray are copied to.
+  * \param[out] pColorMode The color mode that the array is written in.
+  * Called without the asyn lock held.
+  */
+asynStatus NDFileTIFF::setTags(TIFF *tiff, const NDFileTIFFSettings_t *pSettings, NDArray *pArray,
+                               NDAttributeList *pFileAttributes, NDColorMode_t *pColorMode)
+{
+    static const char *functionName = "setTags";
+    size_t sizeX, sizeY, rowsPerStrip;
+    int bitsPerSample=8, sampleFormat=SAMPLEFORMAT_INT, samplesPerPixel, photoMetric, planarConfig;
+    int colorMode=NDColorModeMono;
+    NDAttribute *pAttribute = NULL;
+    char tagString[STRING_BUFFER_SIZE] = {0};
+    char attrString[STRING_BUFFER_SIZE] = {0};
+    int numAttributes;
+
     /* We do some special treatment based on colorMode */
     pAttribute = pArray->pAttributeList->find("ColorMode");
     if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
@@ -184,7 +310,7 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         samplesPerPixel = 1;
         photoMetric = PHOTOMETRIC_MINISBLACK;
         planarConfig = PLANARCONFIG_CONTIG;
-        this->colorMode = NDColorModeMono;
+        *pColorMode = NDColorModeMono;
     } else if (pArray->ndims == 2) {
         sizeX = pArray->dims[0].size;
         sizeY = pArray->dims[1].size;
@@ -192,7 +318,7 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         samplesPerPixel = 1;
         photoMetric = PHOTOMETRIC_MINISBLACK;
         planarConfig = PLANARCONFIG_CONTIG;
-        this->colorMode = NDColorModeMono;
+        *pColorMode = NDColorModeMono;
     } else if ((pArray->ndims == 3) && (pArray->dims[0].size == 3) && (colorMode == NDColorModeRGB1)) {
         sizeX = pArray->dims[1].size;
         sizeY = pArray->dims[2].size;
@@ -200,7 +326,7 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         samplesPerPixel = 3;
         photoMetric = PHOTOMETRIC_RGB;
         planarConfig = PLANARCONFIG_CONTIG;
-        this->colorMode = NDColorModeRGB1;
+        *pColorMode = NDColorModeRGB1;
     } else if ((pArray->ndims == 3) && (pArray->dims[1].size == 3) && (colorMode == NDColorModeRGB2)) {
         sizeX = pArray->dims[0].size;
         sizeY = pArray->dims[2].size;
@@ -208,7 +334,7 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         samplesPerPixel = 3;
         photoMetric = PHOTOMETRIC_RGB;
         planarConfig = PLANARCONFIG_SEPARATE;
-        this->colorMode = NDColorModeRGB2;
+        *pColorMode = NDColorModeRGB2;
     } else if ((pArray->ndims == 3) && (pArray->dims[2].size == 3) && (colorMode == NDColorModeRGB3)) {
         sizeX = pArray->dims[0].size;
         sizeY = pArray->dims[1].size;
@@ -216,7 +342,7 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         samplesPerPixel = 3;
         photoMetric = PHOTOMETRIC_RGB;
         planarConfig = PLANARCONFIG_SEPARATE;
-        this->colorMode = NDColorModeRGB3;
+        *pColorMode = NDColorModeRGB3;
     } else {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
             "%s:%s: unsupported array structure\n",
@@ -224,61 +350,102 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
         return(asynError);
     }
 
-    TIFFSetField(this->tiff, TIFFTAG_NDTIMESTAMP, pArray->timeStamp);
-    TIFFSetField(this->tiff, TIFFTAG_UNIQUEID, pArray->uniqueId);
-    TIFFSetField(this->tiff, TIFFTAG_EPICSTSSEC, pArray->epicsTS.secPastEpoch);
-    TIFFSetField(this->tiff, TIFFTAG_EPICSTSNSEC, pArray->epicsTS.nsec);
-    TIFFSetField(this->tiff, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
-    TIFFSetField(this->tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat);
-    TIFFSetField(this->tiff, TIFFTAG_SAMPLESPERPIXEL, samplesPerPixel);
-    TIFFSetField(this->tiff, TIFFTAG_PHOTOMETRIC, photoMetric);
-    TIFFSetField(this->tiff, TIFFTAG_PLANARCONFIG, planarConfig);
-    TIFFSetField(this->tiff, TIFFTAG_IMAGEWIDTH, (epicsUInt32)sizeX);
-    TIFFSetField(this->tiff, TIFFTAG_IMAGELENGTH, (epicsUInt32)sizeY);
-    TIFFSetField(this->tiff, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);
-
-    this->pFileAttributes->clear();
-    this->getAttributes(this->pFileAttributes);
-    pArray->pAttributeList->copy(this->pFileAttributes);
-
-    pAttribute = this->pFileAttributes->find("Model");
+    if ((pSettings->compression < 0) || (pSettings->compression >= NUM_COMPRESSIONS)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: unknown compression %d\n",
+            driverName, functionName, pSettings->compression);
+        return(asynError);
+    }
+    if (tiffCompression[pSettings->compression] < 0) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: %s compression is not supported by this version of libtiff\n",
+            driverName, functionName, compressionNames[pSettings->compression]);
+        return(asynError);
+    }
+    if (!compressStripsInThreads(pSettings) && !TIFFIsCODECConfigured((epicsUInt16)tiffCompression[pSettings->compression])) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: %s compression is not supported by libtiff\n",
+            driverName, functionName, compressionNames[pSettings->compression]);
+        return(asynError);
+    }
+
+    /* Split the image into strips of about stripSize bytes, so that each strip can be compressed by a different thread.
+     * NDColorModeRGB2 is always written with one row per strip, because the rows of each color are not contiguous */
+    size_t rowSize = sizeX * (bitsPerSample/8) * ((planarConfig == PLANARCONFIG_CONTIG) ? samplesPerPixel : 1);
+    if ((*pColorMode != NDColorModeRGB2) && (pSettings->stripSize > 0) && (rowSize > 0)) {
+        rowsPerStrip = std::max((size_t)pSettings->stripSize / rowSize, (size_t)1);
+        rowsPerStrip = std::min(rowsPerStrip, sizeY);
+    }
+
+    TIFFSetField(tiff, TIFFTAG_NDTIMESTAMP, pArray->timeStamp);
+    TIFFSetField(tiff, TIFFTAG_UNIQUEID, pArray->uniqueId);
+    TIFFSetField(tiff, TIFFTAG_EPICSTSSEC, pArray->epicsTS.secPastEpoch);
+    TIFFSetField(tiff, TIFFTAG_EPICSTSNSEC, pArray->epicsTS.nsec);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, bitsPerSample);
+    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, sampleFormat);
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, samplesPerPixel);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, photoMetric);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, planarConfig);
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, (epicsUInt32)sizeX);
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, (epicsUInt32)sizeY);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, (epicsUInt32)rowsPerStrip);
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, tiffCompression[pSettings->compression]);
+    /* The level is only needed when libtiff compresses the strips, and these pseudo-tags only exist for their scheme */
+    if ((pSettings->compressLevel > 0) && !compressStripsInThreads(pSettings)) {
+        if (pSettings->compression == NDFileTIFFCompressionDeflate)
+            TIFFSetField(tiff, TIFFTAG_ZIPQUALITY, pSettings->compressLevel);
+#ifdef COMPRESSION_ZSTD
+        else if (pSettings->compression == NDFileTIFFCompressionZstd)
+            TIFFSetField(tiff, TIFFTAG_ZSTD_LEVEL, pSettings->compressLevel);
+#endif
+    }
+
+    /* Called without the asyn lock held, possibly from several threads at once, and getAttributes
+     * updates the attribute list of the plugin */
+    pFileAttributes->clear();
+    this->lock();
+    this->getAttributes(pFileAttributes);
+    this->unlock();
+    pArray->pAttributeList->copy(pFileAttributes);
+
+    pAttribute = pFileAttributes->find("Model");
     if (pAttribute) {
         pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
-        TIFFSetField(this->tiff, TIFFTAG_MODEL, tagString);
+        TIFFSetField(tiff, TIFFTAG_MODEL, tagString);
     } else {
-        TIFFSetField(this->tiff, TIFFTAG_MODEL, "Unknown");
+        TIFFSetField(tiff, TIFFTAG_MODEL, "Unknown");
     }
 
-    pAttribute = this->pFileAttributes->find("Manufacturer");
+    pAttribute = pFileAttributes->find("Manufacturer");
     if (pAttribute) {
         pAttribute->getValue(NDAttrString, tagString);
-        TIFFSetField(this->tiff, TIFFTAG_MAKE, tagString, sizeof(tagString)-1);
+        TIFFSetField(tiff, TIFFTAG_MAKE, tagString, sizeof(tagString)-1);
     } else {
-        TIFFSetField(this->tiff, TIFFTAG_MAKE, "Unknown");
+        TIFFSetField(tiff, TIFFTAG_MAKE, "Unknown");
     }
 
-    TIFFSetField(this->tiff, TIFFTAG_SOFTWARE, "EPICS areaDetector");
+    TIFFSetField(tiff, TIFFTAG_SOFTWARE, "EPICS areaDetector");
 
     // If the attribute TIFFImageDescription exists use it to set the TIFFTAG_IMAGEDESCRIPTION
-    pAttribute = this->pFileAttributes->find("TIFFImageDescription");
+    pAttribute = pFileAttributes->find("TIFFImageDescription");
     if (pAttribute) {
         pAttribute->getValue(NDAttrString, tagString, sizeof(tagString)-1);
-        TIFFSetField(this->tiff, TIFFTAG_IMAGEDESCRIPTION, tagString);
+        TIFFSetField(tiff, TIFFTAG_IMAGEDESCRIPTION, tagString);
     }
 
     int count = 0;
     int tagId = TIFFTAG_FIRST_ATTRIBUTE;
 
-    numAttributes_ = this->pFileAttributes->count();
+    numAttributes = pFileAttributes->count();
     asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
-        "%s:%s this->pFileAttributes->count(): %d\n",
-        driverName, functionName, numAttributes_);
+        "%s:%s pFileAttributes->count(): %d\n",
+        driverName, functionName, numAttributes);
 
     asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
         "%s:%s Looping over attributes...\n",
         driverName, functionName);
 
-    pAttribute = this->pFileAttributes->next(NULL);
+    pAttribute = pFileAttributes->next(NULL);
     while (pAttribute) {
         const char *attributeName = pAttribute->getName();
         //const char *attributeDescription = pAttribute->getDescription();
@@ -337,17 +504,17 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
             asynPrint(this->pasynUserSelf, ASYN_TRACEIO_DRIVER,
                 "%s:%s : tagId: %d, tagString: %s\n",
                   driverName, functionName, tagId, tagString);
-            TIFFSetField(this->tiff, tagId, tagString);
+            TIFFSetField(tiff, tagId, tagString);
             ++count;
             ++tagId;
-            if ((tagId > TIFFTAG_LAST_ATTRIBUTE) || (count > numAttributes_)) {
+            if ((tagId > TIFFTAG_LAST_ATTRIBUTE) || (count > numAttributes)) {
                 asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                     "%s:%s error, Too many tags/attributes for file. tagId: %d, count: %d\n",
                     driverName, functionName, tagId, count);
                 break;
             }
         }
-        pAttribute = this->pFileAttributes->next(pAttribute);
+        pAttribute = pFileAttributes->next(pAttribute);
     }
 
     return(asynSuccess);
@@ -358,10 +525,6 @@ asynStatus NDFileTIFF::openFile(const char *fileName, NDFileOpenMode_t openMode,
   */
 asynStatus NDFileTIFF::writeFile(NDArray *pArray)
 {
-    unsigned long stripSize;
-    tsize_t nwrite=0;
-    int strip, sizeY;
-    unsigned char *pRed, *pGreen, *pBlue;
     static const char *functionName = "writeFile";
 
     asynPrint(this->pasynUserSelf, ASYN_TRACE_FLOW,
@@ -375,45 +538,157 @@ asynStatus NDFileTIFF::writeFile(NDArray *pArray)
         return(asynError);
     }
 
-    stripSize = (unsigned long)TIFFStripSize(this->tiff);
-    TIFFGetField(this->tiff, TIFFTAG_IMAGELENGTH, &sizeY);
+    if (!this->multiPage) {
+        return this->writeStrips(this->tiff, &this->settings, this->colorMode, pArray);
+    }
+
+    /* Each array is a page of a multi-page file, with its own tags and attributes */
+    asynStatus status = this->setTags(this->tiff, &this->settings, pArray, this->pFileAttributes, &this->colorMode);
+    if (status != asynSuccess) return status;
+    TIFFSetField(this->tiff, TIFFTAG_SUBFILETYPE, FILETYPE_PAGE);
+    status = this->writeStrips(this->tiff, &this->settings, this->colorMode, pArray);
+    if (status != asynSuccess) return status;
+    if (!TIFFWriteDirectory(this->tiff)) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s:%s: error writing page %d\n",
+            driverName, functionName, this->numPages);
+        return(asynError);
+    }
+    this->numPages++;
+    return asynSuccess;
+}
 
-    switch (this->colorMode) {
+/** Writes the data of an NDArray to a TIFF file whose tags have been set with setTags.
+  * If the strips are compressed by threads they are compressed in batches by the codec worker pool,
+  * and written in order with TIFFWriteRawStrip.  Otherwise libtiff compresses them one at a time.
+  * \param[in] tiff The TIFF file.
+  * \param[in] pSettings The compression and strip settings passed to setTags.
+  * \param[in] colorMode The color mode returned by setTags.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+asynStatus NDFileTIFF::writeStrips(TIFF *tiff, const NDFileTIFFSettings_t *pSettings, NDColorMode_t colorMode, NDArray *pArray)
+{
+    size_t rowSize;
+    epicsUInt32 sizeY=0, rowsPerStrip=0, stripsPerPlane, strip, row;
+    int plane, numPlanes=1;
+    std::vector<epicsUInt32> stripIndex;
+    std::vector<const char *> stripData;
+    std::vector<size_t> stripSize;
+    const char *pData = (const char *)pArray->pData;
+    static const char *functionName = "writeStrips";
+
+    rowSize = (size_t)TIFFScanlineSize(tiff);
+    TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &sizeY);
+    TIFFGetField(tiff, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+    stripsPerPlane = (sizeY + rowsPerStrip - 1) / rowsPerStrip;
+
+    switch (colorMode) {
         case NDColorModeMono:
         case NDColorModeRGB1:
-            nwrite = TIFFWriteEncodedStrip(this->tiff, 0, pArray->pData, stripSize);
+            numPlanes = 1;
+            break;
+        case NDColorModeRGB3:
+            numPlanes = 3;
             break;
         case NDColorModeRGB2:
             /* TIFF readers don't support row interleave, put all the red strips first, then all the blue, then green. */
-            for (strip=0; strip<sizeY; strip++) {
-                pRed   = (unsigned char *)pArray->pData + 3*strip*stripSize;
-                pGreen = pRed + stripSize;
-                pBlue  = pRed + 2*stripSize;
-                nwrite = TIFFWriteEncodedStrip(this->tiff, strip, pRed, stripSize);
-                nwrite = TIFFWriteEncodedStrip(this->tiff, sizeY+strip, pGreen, stripSize);
-                nwrite = TIFFWriteEncodedStrip(this->tiff, 2*sizeY+strip, pBlue, stripSize);
-            }
-            break;
-        case NDColorModeRGB3:
-            for (strip=0; strip<3; strip++) {
-                nwrite = TIFFWriteEncodedStrip(this->tiff, strip, (unsigned char *)pArray->pData+stripSize*strip, stripSize);
+            numPlanes = 0;
+            for (row=0; row<sizeY; row++) {
+                for (plane=0; plane<3; plane++) {
+                    stripIndex.push_back(plane*sizeY + row);
+                    stripData.push_back(pData + (3*row + plane)*rowSize);
+                    stripSize.push_back(rowSize);
+                }
             }
             break;
         default:
             asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
                 "%s:%s: unknown color mode %d\n",
-                driverName, functionName, this->colorMode);
+                driverName, functionName, colorMode);
             return(asynError);
             break;
     }
-    if (nwrite <= 0) {
+    for (plane=0; plane<numPlanes; plane++) {
+        for (strip=0; strip<stripsPerPlane; strip++) {
+            row = strip * rowsPerStrip;
+            stripIndex.push_back(plane*stripsPerPlane + strip);
+            stripData.push_back(pData + ((size_t)plane*sizeY + row)*rowSize);
+            stripSize.push_back(std::min(rowsPerStrip, sizeY - row) * rowSize);
+        }
+    }
+
+    if (!compressStripsInThreads(pSettings)) {
+        for (size_t i=0; i<stripIndex.size(); i++) {
+            if (TIFFWriteEncodedStrip(tiff, stripIndex[i], (void *)stripData[i], stripSize[i]) <= 0) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: error writing data to file\n",
+                    driverName, functionName);
+                return(asynError);
+            }
+        }
+        return(asynSuccess);
+    }
+
+    StripBatch batch;
+    batch.compression = pSettings->compression;
+    batch.compressLevel = pSettings->compressLevel;
+    batch.pData = &stripData[0];
+    batch.pSize = &stripSize[0];
+    size_t batchSize = (size_t)pSettings->compressThreads * STRIPS_PER_THREAD;
+    for (batch.first = 0; batch.first < stripIndex.size(); batch.first += batchSize) {
+        int numStrips = (int)std::min(batchSize, stripIndex.size() - batch.first);
+        batch.output.resize(numStrips);
+        NDCodecWorkerPool::run(compressStripTask, &batch, numStrips, pSettings->compressThreads);
+        for (int i=0; i<numStrips; i++) {
+            std::vector<char> &out = batch.output[i];
+            if (out.empty()) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: error compressing strip %u\n",
+                    driverName, functionName, stripIndex[batch.first + i]);
+                return(asynError);
+            }
+            if (TIFFWriteRawStrip(tiff, stripIndex[batch.first + i], &out[0], out.size()) <= 0) {
+                asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                    "%s:%s: error writing data to file\n",
+                    driverName, functionName);
+                return(asynError);
+            }
+        }
+    }
+
+    return(asynSuccess);
+}
+
+/** Writes single NDArray to its own TIFF file.
+  * This keeps the TIFF file, color mode and attributes in local variables rather than in the class,
+  * so it can be called by several threads at once.
+  * \param[in] fileName The name of the file to write.
+  * \param[in] pArray Pointer to the NDArray to be written
+  */
+asynStatus NDFileTIFF::writeSingleFile(const char *fileName, NDArray *pArray)
+{
+    TIFF *tiff;
+    NDColorMode_t colorMode = NDColorModeMono;
+    NDAttributeList fileAttributes;
+    NDFileTIFFSettings_t settings;
+    asynStatus status;
+    static const char *functionName = "writeSingleFile";
+
+    this->readSettings(&settings);
+
+    if ((tiff = TIFFOpen(fileName, "w")) == NULL ) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-            "%s:%s: error writing data to file\n",
-            driverName, functionName);
+        "%s:%s error opening file %s\n",
+        driverName, functionName, fileName);
         return(asynError);
     }
+    status = this->setTags(tiff, &settings, pArray, &fileAttributes, &colorMode);
+    if (status == asynSuccess) {
+        status = this->writeStrips(tiff, &settings, colorMode, pArray);
+    }
+    TIFFClose(tiff);
 
-    return(asynSuccess);
+    return status;
 }
 
 /** Reads single NDArray from a TIFF file;
@@ -580,6 +855,7 @@ asynStatus NDFileTIFF::closeFile()
         "%s::%s closing file\n",
         driverName, functionName);
     TIFFClose(this->tiff);
+    this->tiff = NULL;
 
     return asynSuccess;
 }
@@ -597,10 +873,12 @@ asynStatus NDFileTIFF::closeFile()
   * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
   * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
   * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] maxThreads The maximum number of threads this driver is allowed to use. If 0 then 1 will be used.
+  *            More than 1 thread writes files in parallel in single mode with AutoSave.
   */
 NDFileTIFF::NDFileTIFF(const char *portName, int queueSize, int blockingCallbacks,
                        const char *NDArrayPort, int NDArrayAddr,
-                       int priority, int stackSize)
+                       int priority, int stackSize, int maxThreads)
     /* Invoke the base class constructor.
      * We allocate 2 NDArrays of unlimited size in the NDArray pool.
      * This driver can block (because writing a file can be slow), and it is not multi-device.
@@ -608,15 +886,29 @@ NDFileTIFF::NDFileTIFF(const char *portName, int queueSize, int blockingCallback
     : NDPluginFile(portName, queueSize, blockingCallbacks,
                    NDArrayPort, NDArrayAddr, 1,
                    2, 0, asynGenericPointerMask, asynGenericPointerMask,
-                   ASYN_CANBLOCK, 1, priority, stackSize, 1),
-    numAttributes_(0)
+                   ASYN_CANBLOCK, 1, priority, stackSize, maxThreads)
 {
     //static const char *functionName = "NDFileTIFF";
 
+    createParam(NDFileTIFFCompressionString,     asynParamInt32, &NDFileTIFFCompression);
+    createParam(NDFileTIFFCompressLevelString,   asynParamInt32, &NDFileTIFFCompressLevel);
+    createParam(NDFileTIFFCompressThreadsString, asynParamInt32, &NDFileTIFFCompressThreads);
+    createParam(NDFileTIFFStripSizeString,       asynParamInt32, &NDFileTIFFStripSize);
+
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDFileTIFF");
-    this->supportsMultipleArrays = 0;
+    setIntegerParam(NDFileTIFFCompression, NDFileTIFFCompressionNone);
+    setIntegerParam(NDFileTIFFCompressLevel, 0);
+    setIntegerParam(NDFileTIFFCompressThreads, 0);
+    setIntegerParam(NDFileTIFFStripSize, 65536);
+    this->supportsMultipleArrays = 1;
+    this->supportsConcurrentWrites = 1;
+
+    augmentLibTiffWithCustomTags();
 
+    this->tiff = NULL;
+    this->multiPage = false;
+    this->numPages = 0;
     this->pAttributeId = NULL;
     this->pFileAttributes = new NDAttributeList;
 }
@@ -625,14 +917,14 @@ NDFileTIFF::NDFileTIFF(const char *portName, int queueSize, int blockingCallback
 
 extern "C" int NDFileTIFFConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                    const char *NDArrayPort, int NDArrayAddr,
-                                   int priority, int stackSize)
+                                   int priority, int stackSize, int maxThreads)
 {
     // Stack size must be a minimum of 40000 on vxWorks because of automatic variables in NDFileTIFF::openFile()
     #ifdef vxWorks
         if (stackSize < 40000) stackSize = 40000;
     #endif
     NDFileTIFF *pPlugin = new NDFileTIFF(portName, queueSize, blockingCallbacks, NDArrayPort, NDArrayAddr,
-                                         priority, stackSize);
+                                         priority, stackSize, maxThreads);
     return pPlugin->start();
 }
 
@@ -646,17 +938,20 @@ static const iocshArg initArg3 = { "NDArray Port",iocshArgString};
 static const iocshArg initArg4 = { "NDArray Addr",iocshArgInt};
 static const iocshArg initArg5 = { "priority",iocshArgInt};
 static const iocshArg initArg6 = { "stack size",iocshArgInt};
+static const iocshArg initArg7 = { "maxThreads",iocshArgInt};
 static const iocshArg * const initArgs[] = {&initArg0,
                                             &initArg1,
                                             &initArg2,
                                             &initArg3,
                                             &initArg4,
                                             &initArg5,
-                                            &initArg6};
-static const iocshFuncDef initFuncDef = {"NDFileTIFFConfigure",7,initArgs};
+                                            &initArg6,
+                                            &initArg7};
+static const iocshFuncDef initFuncDef = {"NDFileTIFFConfigure",8,initArgs};
 static void initCallFunc(const iocshArgBuf *args)
 {
-    NDFileTIFFConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].sval, args[4].ival, args[5].ival, args[6].ival);
+    NDFileTIFFConfigure(args[0].sval, args[1].ival, args[2].ival, args[3].sval, args[4].ival, args[5].ival, args[6].ival,
+                        args[7].ival);
 }
 
 extern "C" void NDFileTIFFRegister(void)
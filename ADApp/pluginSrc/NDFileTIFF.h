@@ -18,27 +18,64 @@
 /** Writes NDArrays in the TIFF file format.
     Tagged Image File Format is a file format for storing images.  The format was originally created by Aldus corporation and is
     currently developed by Adobe Systems Incorporated.  This plugin was developed using the libtiff library to write the file.
-    The current version is only capable of writing 2-D images with one image per file.
+    Single mode writes one image per file. Capture and Stream modes write each image as a page of a BigTIFF file.
+    The strips can be compressed with deflate, LZW or zstd; deflate and zstd strips can be compressed by a pool of threads.
     */
 
+/** Compression of the strips of the TIFF files */
+typedef enum {
+    NDFileTIFFCompressionNone,
+    NDFileTIFFCompressionDeflate,
+    NDFileTIFFCompressionLZW,
+    NDFileTIFFCompressionZstd
+} NDFileTIFFCompression_t;
+
+#define NDFileTIFFCompressionString     "TIFF_COMPRESSION"      /* (asynInt32, r/w) NDFileTIFFCompression_t */
+#define NDFileTIFFCompressLevelString   "TIFF_COMPRESS_LEVEL"   /* (asynInt32, r/w) Deflate or zstd level, 0 for the default */
+#define NDFileTIFFCompressThreadsString "TIFF_COMPRESS_THREADS" /* (asynInt32, r/w) Threads that compress the strips, 0 for libtiff */
+#define NDFileTIFFStripSizeString       "TIFF_STRIP_SIZE"       /* (asynInt32, r/w) Target bytes per strip, 0 for one strip per image */
+
+/** Settings that are read from the parameters when a file is opened, and used for every page of the file */
+typedef struct {
+    int compression;
+    int compressLevel;
+    int compressThreads;
+    int stripSize;
+} NDFileTIFFSettings_t;
+
 class NDPLUGIN_API NDFileTIFF : public NDPluginFile {
 public:
     NDFileTIFF(const char *portName, int queueSize, int blockingCallbacks,
                  const char *NDArrayPort, int NDArrayAddr,
-                 int priority, int stackSize);
+                 int priority, int stackSize, int maxThreads=1);
 
     /* The methods that this class implements */
     virtual asynStatus openFile(const char *fileName, NDFileOpenMode_t openMode, NDArray *pArray);
     virtual asynStatus readFile(NDArray **pArray);
     virtual asynStatus writeFile(NDArray *pArray);
     virtual asynStatus closeFile();
+    virtual asynStatus writeSingleFile(const char *fileName, NDArray *pArray);
+
+protected:
+    int NDFileTIFFCompression;
+    #define FIRST_NDFILE_TIFF_PARAM NDFileTIFFCompression
+    int NDFileTIFFCompressLevel;
+    int NDFileTIFFCompressThreads;
+    int NDFileTIFFStripSize;
 
 private:
+    void readSettings(NDFileTIFFSettings_t *pSettings);
+    asynStatus setTags(TIFF *tiff, const NDFileTIFFSettings_t *pSettings, NDArray *pArray,
+                       NDAttributeList *pFileAttributes, NDColorMode_t *pColorMode);
+    asynStatus writeStrips(TIFF *tiff, const NDFileTIFFSettings_t *pSettings, NDColorMode_t colorMode, NDArray *pArray);
+
     TIFF *tiff;
     NDColorMode_t colorMode;
     int *pAttributeId;
     NDAttributeList *pFileAttributes;
-    int numAttributes_;
+    NDFileTIFFSettings_t settings;  /* Settings of the file opened by openFile */
+    bool multiPage;                 /* The file opened by openFile is a BigTIFF with one page per array */
+    int numPages;
 
 };
 
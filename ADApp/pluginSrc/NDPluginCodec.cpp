@@ -37,6 +37,9 @@
  */
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
 
 #include <stdlib.h>
 #include <string.h>
@@ -44,6 +47,10 @@
 #include <math.h>
 
 #include <iocsh.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsStdio.h>
 
 #include "Codec.h"
 #include "NDPluginCodec.h"
@@ -53,6 +60,14 @@
 #define JPEG_MIN_QUALITY 1
 #define JPEG_MAX_QUALITY 100
 
+/* Arrays collected for zstd dictionary training are cut into samples of this size */
+#define ZSTD_TRAIN_SAMPLE_SIZE (128*1024)
+/* Maximum size of a trained zstd dictionary, the same as the zstd command line tool */
+#define ZSTD_DICT_CAPACITY (110*1024)
+/* Limits of the samples kept for training. zstd recommends about 100 times the dictionary size */
+#define ZSTD_TRAIN_MAX_BYTES (100*ZSTD_DICT_CAPACITY)
+#define ZSTD_TRAIN_MAX_SAMPLES 10000
+
 using std::string;
 
 static const char *driverName="NDPluginCodec";
@@ -84,6 +99,107 @@ static NDArray *allocArray(NDArray *input, int dataType = -1, size_t dataSize=0,
 
 }
 
+epicsThreadOnceId NDCodecWorkerPool::onceId_ = EPICS_THREAD_ONCE_INIT;
+epicsMutexId NDCodecWorkerPool::mutex_;
+epicsEventId NDCodecWorkerPool::workEvent_;
+std::deque<NDCodecJob *> NDCodecWorkerPool::jobs_;
+int NDCodecWorkerPool::numWorkers_ = 0;
+
+void NDCodecWorkerPool::init(void *)
+{
+    mutex_ = epicsMutexMustCreate();
+    workEvent_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+void NDCodecWorkerPool::workerTask(void *)
+{
+    for (;;) {
+        if (!runNext(NULL))
+            epicsEventMustWait(workEvent_);
+    }
+}
+
+/* Runs one chunk of pJob, or of the oldest queued job if pJob is NULL.
+ * Returns false if there was nothing left to hand out. */
+bool NDCodecWorkerPool::runNext(NDCodecJob *pJob)
+{
+    epicsMutexMustLock(mutex_);
+    if (!pJob && !jobs_.empty())
+        pJob = jobs_.front();
+    if (!pJob || pJob->next >= pJob->nChunks) {
+        epicsMutexUnlock(mutex_);
+        return false;
+    }
+    int chunk = pJob->next++;
+    if (pJob->next == pJob->nChunks)
+        jobs_.erase(std::find(jobs_.begin(), jobs_.end(), pJob));
+    bool moreWork = !jobs_.empty();
+    epicsMutexUnlock(mutex_);
+
+    // Wake up another worker to help; each worker passes the signal on while there is work left
+    if (moreWork)
+        epicsEventSignal(workEvent_);
+
+    pJob->func(pJob->arg, chunk);
+
+    epicsMutexMustLock(mutex_);
+    if (++pJob->done == pJob->nChunks)
+        epicsEventSignal(pJob->doneEvent);
+    epicsMutexUnlock(mutex_);
+    return true;
+}
+
+/* Calls func for every chunk using up to numThreads threads, including the calling thread,
+ * and returns when all of the chunks have completed. */
+void NDCodecWorkerPool::run(void (*func)(void *arg, int chunk), void *arg, int nChunks, int numThreads)
+{
+    if (numThreads > nChunks)
+        numThreads = nChunks;
+
+    if (numThreads <= 1) {
+        for (int i = 0; i < nChunks; ++i)
+            func(arg, i);
+        return;
+    }
+
+    epicsThreadOnce(&onceId_, init, NULL);
+
+    NDCodecJob job;
+    job.func = func;
+    job.arg = arg;
+    job.nChunks = nChunks;
+    job.next = 0;
+    job.done = 0;
+    job.doneEvent = epicsEventMustCreate(epicsEventEmpty);
+
+    epicsMutexMustLock(mutex_);
+    while (numWorkers_ < numThreads - 1) {
+        char name[32];
+        epicsSnprintf(name, sizeof(name), "NDCodecWorker%d", numWorkers_);
+        if (!epicsThreadCreate(name, epicsThreadGetPrioritySelf(),
+                               epicsThreadGetStackSize(epicsThreadStackMedium),
+                               workerTask, NULL))
+            break;
+        numWorkers_++;
+    }
+    jobs_.push_back(&job);
+    epicsMutexUnlock(mutex_);
+    epicsEventSignal(workEvent_);
+
+    // The calling thread works on its own job while the workers help
+    while (runNext(&job)) {
+    }
+
+    epicsMutexMustLock(mutex_);
+    while (job.done < job.nChunks) {
+        epicsMutexUnlock(mutex_);
+        epicsEventMustWait(job.doneEvent);
+        epicsMutexMustLock(mutex_);
+    }
+    epicsMutexUnlock(mutex_);
+    epicsEventDestroy(job.doneEvent);
+}
+
 static int jpeg_clamp_quality(int quality)
 {
     if (quality < JPEG_MIN_QUALITY)
@@ -528,7 +644,88 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
 }
 
 
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+/* Bitshuffle/LZ4 compresses each block of bshuf_default_block_size() elements independently and
+ * writes it as a 4-byte big-endian compressed size followed by the LZ4 data; any elements that do
+ * not fill a multiple of 8 are copied uncompressed at the end. The frame is therefore split into
+ * chunks of whole blocks that are [de]compressed in parallel, and the concatenated chunks are
+ * byte-for-byte the stream that a single bshuf_compress_lz4() call on the whole frame produces,
+ * which is what the HDF5 bitshuffle filter expects after its 12-byte header. */
+#define BSLZ4_CHUNKS_PER_THREAD 4
+
+typedef struct BSLZ4Chunks {
+    const char *pIn;
+    char *pOut;
+    size_t elemSize;
+    size_t blockSize;
+    std::vector<size_t> start;    /* First element of each chunk, start[nChunks] is nElements */
+    std::vector<size_t> offset;   /* Offset of each chunk in the compressed stream */
+    std::vector<int64_t> result;  /* Bytes written (compress) or consumed (decompress), <0 on error */
+} BSLZ4Chunks;
+
+static int splitBSLZ4(BSLZ4Chunks *pChunks, size_t nElements, size_t elemSize, int numThreads)
+{
+    size_t blockSize = bshuf_default_block_size(elemSize);
+    size_t nBlocks = (nElements + blockSize - 1) / blockSize;
+    size_t nChunks = numThreads > 1 ? (size_t)numThreads * BSLZ4_CHUNKS_PER_THREAD : 1;
+
+    if (nChunks > nBlocks)
+        nChunks = nBlocks ? nBlocks : 1;
+    size_t blocksPerChunk = (nBlocks + nChunks - 1) / nChunks;
+    if (blocksPerChunk == 0)
+        blocksPerChunk = 1;
+    nChunks = (nBlocks + blocksPerChunk - 1) / blocksPerChunk;
+    if (nChunks == 0)
+        nChunks = 1;
+
+    pChunks->elemSize = elemSize;
+    pChunks->blockSize = blockSize;
+    pChunks->start.resize(nChunks + 1);
+    pChunks->offset.resize(nChunks + 1);
+    pChunks->result.assign(nChunks, -1);
+    for (size_t i = 0; i < nChunks; ++i)
+        pChunks->start[i] = std::min(i * blocksPerChunk * blockSize, nElements);
+    pChunks->start[nChunks] = nElements;
+
+    return (int)nChunks;
+}
+
+/* Advances *pPos past the compressed data of nElements elements that start at a block boundary,
+ * by walking the block size headers. Returns false if the stream is shorter than size. */
+static bool skipBSLZ4(const unsigned char *pIn, size_t size, size_t *pPos,
+                      size_t nElements, size_t elemSize, size_t blockSize)
+{
+    size_t lastBlock = nElements % blockSize;
+    size_t nBlocks = nElements / blockSize + ((lastBlock - lastBlock % 8) ? 1 : 0);
+    size_t pos = *pPos;
+    size_t j;
+
+    for (j = 0; j < nBlocks && pos + 4 <= size; ++j) {
+        pos += 4 + (((size_t)pIn[pos] << 24) | ((size_t)pIn[pos+1] << 16) |
+                    ((size_t)pIn[pos+2] << 8) | (size_t)pIn[pos+3]);
+    }
+    pos += (nElements % 8) * elemSize;
+    *pPos = pos;
+
+    return j == nBlocks && pos <= size;
+}
+
+static void compressBSLZ4Chunk(void *arg, int chunk)
+{
+    BSLZ4Chunks *p = (BSLZ4Chunks *)arg;
+
+    p->result[chunk] = bshuf_compress_lz4(p->pIn + p->start[chunk]*p->elemSize, p->pOut + p->offset[chunk],
+                                          p->start[chunk+1] - p->start[chunk], p->elemSize, p->blockSize);
+}
+
+static void decompressBSLZ4Chunk(void *arg, int chunk)
+{
+    BSLZ4Chunks *p = (BSLZ4Chunks *)arg;
+
+    p->result[chunk] = bshuf_decompress_lz4(p->pIn + p->offset[chunk], p->pOut + p->start[chunk]*p->elemSize,
+                                            p->start[chunk+1] - p->start[chunk], p->elemSize, p->blockSize);
+}
+
+NDArray *compressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
 {
     if (!input->codec.empty()) {
         sprintf(errorMessage, "Array is already compressed");
@@ -539,34 +736,51 @@ NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
     NDArrayInfo_t info;
     input->getInfo(&info);
 
-    NDArray *output = allocArray(input, -1, info.totalBytes);
+    BSLZ4Chunks chunks;
+    int nChunks = splitBSLZ4(&chunks, info.nElements, info.bytesPerElement, numThreads);
+
+    // Each chunk compresses into its own worst case sized region, the regions are packed afterwards
+    size_t outputSize = 0;
+    for (int i = 0; i < nChunks; ++i) {
+        chunks.offset[i] = outputSize;
+        outputSize += bshuf_compress_lz4_bound(chunks.start[i+1] - chunks.start[i],
+                                               chunks.elemSize, chunks.blockSize);
+    }
+    chunks.offset[nChunks] = outputSize;
+
+    NDArray *output = allocArray(input, -1, outputSize);
 
     if (!output) {
-        sprintf(errorMessage, "Failed to allocate BZLZ4 output array");
+        sprintf(errorMessage, "Failed to allocate BSLZ4 output array");
         *status = NDCODEC_ERROR;
         return NULL;
     }
 
-    size_t blockSize = 0;
-
-    int64_t compSize = bshuf_compress_lz4(input->pData, output->pData, info.nElements,
-                                          info.bytesPerElement, blockSize);
+    chunks.pIn = (const char *)input->pData;
+    chunks.pOut = (char *)output->pData;
+    NDCodecWorkerPool::run(compressBSLZ4Chunk, &chunks, nChunks, numThreads);
 
-    if (compSize < 0) {
-        output->release();
-        sprintf(errorMessage, "Internal BSLZ4 error");
-        *status = NDCODEC_ERROR;
-        return NULL;
+    size_t compSize = 0;
+    for (int i = 0; i < nChunks; ++i) {
+        if (chunks.result[i] < 0) {
+            output->release();
+            sprintf(errorMessage, "Internal BSLZ4 error");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+        if (compSize != chunks.offset[i])
+            memmove(chunks.pOut + compSize, chunks.pOut + chunks.offset[i], (size_t)chunks.result[i]);
+        compSize += (size_t)chunks.result[i];
     }
 
     output->codec.name = codecName[NDCODEC_BSLZ4];
-    output->compressedSize = (size_t)compSize;
+    output->compressedSize = compSize;
 
     return output;
 }
 
 
-NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+NDArray *decompressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
 {
     // Sanity check
     if (input->codec.name != codecName[NDCODEC_BSLZ4]) {
@@ -579,6 +793,23 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
     NDArrayInfo_t info;
     input->getInfo(&info);
 
+    BSLZ4Chunks chunks;
+    int nChunks = splitBSLZ4(&chunks, info.nElements, info.bytesPerElement, numThreads);
+
+    // Walk the block size headers to find where each chunk starts in the compressed stream
+    const unsigned char *pIn = (const unsigned char *)input->pData;
+    size_t pos = 0;
+    for (int i = 0; i < nChunks; ++i) {
+        chunks.offset[i] = pos;
+        if (!skipBSLZ4(pIn, input->compressedSize, &pos, chunks.start[i+1] - chunks.start[i],
+                       chunks.elemSize, chunks.blockSize)) {
+            sprintf(errorMessage, "Truncated BSLZ4 data");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
+    }
+    chunks.offset[nChunks] = pos;
+
     NDArray *output = allocArray(input);
 
     if (!output) {
@@ -587,16 +818,17 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
         return NULL;
     }
 
-    size_t blockSize = 0;
+    chunks.pIn = (const char *)input->pData;
+    chunks.pOut = (char *)output->pData;
+    NDCodecWorkerPool::run(decompressBSLZ4Chunk, &chunks, nChunks, numThreads);
 
-    int64_t ret = bshuf_decompress_lz4(input->pData, output->pData, info.nElements,
-                                       info.bytesPerElement, blockSize);
-
-    if (ret <= 0){
-        output->release();
-        sprintf(errorMessage, "Failed to Blosc decompress");
-        *status = NDCODEC_ERROR;
-        return NULL;
+    for (int i = 0; i < nChunks; ++i) {
+        if (chunks.result[i] != (int64_t)(chunks.offset[i+1] - chunks.offset[i])) {
+            output->release();
+            sprintf(errorMessage, "Failed to BSLZ4 decompress");
+            *status = NDCODEC_ERROR;
+            return NULL;
+        }
     }
 
     output->codec.clear();
@@ -619,14 +851,14 @@ NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessa
     return NULL;
 }
 
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+NDArray *compressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
 {
     sprintf(errorMessage, "No Bitshuffle support");
     *status = NDCODEC_ERROR;
     return NULL;
 }
 
-NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage)
+NDArray *decompressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
 {
     sprintf(errorMessage, "No Bitshuffle support");
     *status = NDCODEC_ERROR;
@@ -635,6 +867,486 @@ NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMes
 
 #endif // ifdef HAVE_BITSHUFFLE
 
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+
+struct NDCodecZstdDict {
+    ZSTD_CDict *cdict;
+    ZSTD_DDict *ddict;
+    unsigned int id;        /* 0 for a raw content dictionary */
+    int refCount;
+    epicsMutexId mutex;
+};
+
+NDCodecZstdDict *createZstdDict(const void *pBuffer, size_t size, int level,
+                                NDCodecStatus_t *status, char *errorMessage)
+{
+    NDCodecZstdDict *pDict = (NDCodecZstdDict *)calloc(1, sizeof(NDCodecZstdDict));
+
+    pDict->cdict = ZSTD_createCDict(pBuffer, size, level);
+    pDict->ddict = ZSTD_createDDict(pBuffer, size);
+    if (!pDict->cdict || !pDict->ddict) {
+        ZSTD_freeCDict(pDict->cdict);
+        ZSTD_freeDDict(pDict->ddict);
+        free(pDict);
+        sprintf(errorMessage, "Invalid zstd dictionary");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+    pDict->id = ZSTD_getDictID_fromDict(pBuffer, size);
+    pDict->refCount = 1;
+    pDict->mutex = epicsMutexMustCreate();
+
+    return pDict;
+}
+
+void acquireZstdDict(NDCodecZstdDict *pDict)
+{
+    if (!pDict)
+        return;
+    epicsMutexMustLock(pDict->mutex);
+    pDict->refCount++;
+    epicsMutexUnlock(pDict->mutex);
+}
+
+void releaseZstdDict(NDCodecZstdDict *pDict)
+{
+    if (!pDict)
+        return;
+    epicsMutexMustLock(pDict->mutex);
+    int refCount = --pDict->refCount;
+    epicsMutexUnlock(pDict->mutex);
+    if (refCount == 0) {
+        ZSTD_freeCDict(pDict->cdict);
+        ZSTD_freeDDict(pDict->ddict);
+        epicsMutexDestroy(pDict->mutex);
+        free(pDict);
+    }
+}
+
+unsigned int getZstdDictID(NDCodecZstdDict *pDict)
+{
+    return pDict ? pDict->id : 0;
+}
+
+/* zstd contexts are kept per thread and reused. Creating a compression context, and with it
+ * the zstd worker threads when numThreads > 1, costs more than compressing a small array. */
+static epicsThreadOnceId zstdOnceId = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId zstdCCtxId;
+static epicsThreadPrivateId zstdDCtxId;
+static epicsThreadPrivateId zstdDStreamId;
+
+static void zstdInit(void *)
+{
+    zstdCCtxId = epicsThreadPrivateCreate();
+    zstdDCtxId = epicsThreadPrivateCreate();
+    zstdDStreamId = epicsThreadPrivateCreate();
+}
+
+static ZSTD_CCtx *getZstdCCtx()
+{
+    epicsThreadOnce(&zstdOnceId, zstdInit, NULL);
+    ZSTD_CCtx *cctx = (ZSTD_CCtx *)epicsThreadPrivateGet(zstdCCtxId);
+    if (!cctx) {
+        cctx = ZSTD_createCCtx();
+        epicsThreadPrivateSet(zstdCCtxId, cctx);
+    }
+    return cctx;
+}
+
+static ZSTD_DCtx *getZstdDCtx()
+{
+    epicsThreadOnce(&zstdOnceId, zstdInit, NULL);
+    ZSTD_DCtx *dctx = (ZSTD_DCtx *)epicsThreadPrivateGet(zstdDCtxId);
+    if (!dctx) {
+        dctx = ZSTD_createDCtx();
+        epicsThreadPrivateSet(zstdDCtxId, dctx);
+    }
+    return dctx;
+}
+
+/* NDCodecBlockReader keeps its state in this context between blocks, so it has its own */
+static ZSTD_DStream *getZstdDStream()
+{
+    epicsThreadOnce(&zstdOnceId, zstdInit, NULL);
+    ZSTD_DStream *dstream = (ZSTD_DStream *)epicsThreadPrivateGet(zstdDStreamId);
+    if (!dstream) {
+        dstream = ZSTD_createDStream();
+        epicsThreadPrivateSet(zstdDStreamId, dstream);
+    }
+    return dstream;
+}
+
+NDArray *compressZstd(NDArray *input, int level, int numThreads, NDCodecZstdDict *pDict,
+                      NDCodecStatus_t *status, char *errorMessage)
+{
+    if (!input->codec.empty()) {
+        sprintf(errorMessage, "Array is already compressed");
+        *status = NDCODEC_WARNING;
+        return NULL;
+    }
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    size_t outputSize = ZSTD_compressBound(info.totalBytes);
+    NDArray *output = allocArray(input, -1, outputSize);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate Zstd output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    ZSTD_CCtx *cctx = getZstdCCtx();
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    // This fails harmlessly if the library was built without multithreading support
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, numThreads > 1 ? numThreads : 0);
+    if (pDict)
+        ZSTD_CCtx_refCDict(cctx, pDict->cdict);
+
+    size_t compSize = ZSTD_compress2(cctx, output->pData, outputSize, input->pData, info.totalBytes);
+
+    // Do not keep a reference to the dictionary, it may be freed before the next call
+    ZSTD_CCtx_refCDict(cctx, NULL);
+
+    if (ZSTD_isError(compSize)) {
+        output->release();
+        sprintf(errorMessage, "Zstd error: %s", ZSTD_getErrorName(compSize));
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.name = codecName[NDCODEC_ZSTD];
+    output->codec.level = level;
+    output->compressedSize = compSize;
+
+    return output;
+}
+
+NDArray *decompressZstd(NDArray *input, NDCodecZstdDict *pDict, NDCodecStatus_t *status, char *errorMessage)
+{
+    // Sanity check
+    if (input->codec.name != codecName[NDCODEC_ZSTD]) {
+        sprintf(errorMessage, "Invalid codec '%s', expected '%s'",
+                input->codec.name.c_str(), codecName[NDCODEC_ZSTD].c_str());
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    // The frame header records the ID of the dictionary it was compressed with
+    unsigned int dictID = ZSTD_getDictID_fromFrame(input->pData, input->compressedSize);
+    if (dictID && dictID != getZstdDictID(pDict)) {
+        sprintf(errorMessage, "Array needs zstd dictionary %u", dictID);
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    NDArrayInfo_t info;
+    input->getInfo(&info);
+
+    NDArray *output = allocArray(input);
+
+    if (!output) {
+        sprintf(errorMessage, "Failed to allocate Zstd output array");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    ZSTD_DCtx *dctx = getZstdDCtx();
+    size_t ret;
+    if (pDict && dictID == pDict->id)
+        ret = ZSTD_decompress_usingDDict(dctx, output->pData, info.totalBytes,
+                                         input->pData, input->compressedSize, pDict->ddict);
+    else
+        ret = ZSTD_decompressDCtx(dctx, output->pData, info.totalBytes,
+                                  input->pData, input->compressedSize);
+
+    if (ZSTD_isError(ret) || ret != info.totalBytes) {
+        output->release();
+        sprintf(errorMessage, "Failed to Zstd decompress");
+        *status = NDCODEC_ERROR;
+        return NULL;
+    }
+
+    output->codec.clear();
+
+    return output;
+}
+
+#else
+
+NDCodecZstdDict *createZstdDict(const void *pBuffer, size_t size, int level,
+                                NDCodecStatus_t *status, char *errorMessage)
+{
+    sprintf(errorMessage, "No Zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+void acquireZstdDict(NDCodecZstdDict *pDict)
+{
+}
+
+void releaseZstdDict(NDCodecZstdDict *pDict)
+{
+}
+
+unsigned int getZstdDictID(NDCodecZstdDict *pDict)
+{
+    return 0;
+}
+
+NDArray *compressZstd(NDArray *input, int level, int numThreads, NDCodecZstdDict *pDict,
+                      NDCodecStatus_t *status, char *errorMessage)
+{
+    sprintf(errorMessage, "No Zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+NDArray *decompressZstd(NDArray *input, NDCodecZstdDict *pDict, NDCodecStatus_t *status, char *errorMessage)
+{
+    sprintf(errorMessage, "No Zstd support");
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+#endif // ifdef HAVE_ZSTD
+
+NDArray *decompressArray(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage)
+{
+    if (input->codec.empty()) {
+        input->reserve();
+        return input;
+    } else if (input->codec.name == codecName[NDCODEC_JPEG]) {
+        return decompressJPEG(input, status, errorMessage);
+    } else if (input->codec.name == codecName[NDCODEC_BLOSC]) {
+        return decompressBlosc(input, numThreads, status, errorMessage);
+    } else if (input->codec.name == codecName[NDCODEC_LZ4]) {
+        return decompressLZ4(input, status, errorMessage);
+    } else if (input->codec.name == codecName[NDCODEC_BSLZ4]) {
+        return decompressBSLZ4(input, numThreads, status, errorMessage);
+    } else if (input->codec.name == codecName[NDCODEC_ZSTD]) {
+        return decompressZstd(input, NULL, status, errorMessage);
+    }
+
+    sprintf(errorMessage, "Unsupported codec '%s'", input->codec.name.c_str());
+    *status = NDCODEC_ERROR;
+    return NULL;
+}
+
+/* How NDCodecBlockReader produces the blocks of the current array */
+typedef enum {
+    NDCodecReadDone,    /* No array, or all blocks returned, or an error */
+    NDCodecReadPlain,   /* Uncompressed, one block in place */
+    NDCodecReadWhole,   /* Decompressed with decompressArray(), one block */
+    NDCodecReadBlosc,
+    NDCodecReadBSLZ4,
+    NDCodecReadZstd
+} NDCodecReadMode_t;
+
+NDCodecBlockReader::NDCodecBlockReader(size_t blockSize)
+    : mode_(NDCodecReadDone), pArray_(NULL), pDecompressed_(NULL), blockSize_(blockSize),
+      elemSize_(1), nElements_(0), nextElement_(0), chunkElements_(0), bshufBlockSize_(0),
+      inPos_(0), pZstdStream_(NULL)
+{
+}
+
+NDCodecBlockReader::~NDCodecBlockReader()
+{
+    end();
+}
+
+/** Starts reading an array.
+  * \param[in] pArray The array, which must stay valid until end() or the next begin().
+  * \param[out] status Set to NDCODEC_ERROR on error.
+  * \param[out] errorMessage The error message on error.
+  * \return ND_SUCCESS or ND_ERROR; after an error next() returns no blocks. */
+int NDCodecBlockReader::begin(NDArray *pArray, NDCodecStatus_t *status, char *errorMessage)
+{
+    NDArrayInfo_t info;
+
+    end();
+    pArray->getInfo(&info);
+    pArray_ = pArray;
+    elemSize_ = info.bytesPerElement;
+    nElements_ = info.nElements;
+    nextElement_ = 0;
+    inPos_ = 0;
+    chunkElements_ = nElements_;
+    mode_ = NDCodecReadWhole;
+
+    if (pArray->codec.empty()) {
+        mode_ = NDCodecReadPlain;
+    }
+#ifdef HAVE_BLOSC
+    else if (pArray->codec.name == codecName[NDCODEC_BLOSC] &&
+             pArray->compressedSize >= BLOSC_MIN_HEADER_LENGTH) {
+        size_t nBytes, cBytes, bloscBlock, typeSize;
+        int flags;
+        blosc_cbuffer_sizes(pArray->pData, &nBytes, &cBytes, &bloscBlock);
+        blosc_cbuffer_metainfo(pArray->pData, &typeSize, &flags);
+        if (nBytes != info.totalBytes || cBytes > pArray->compressedSize) {
+            sprintf(errorMessage, "Invalid Blosc header");
+            *status = NDCODEC_ERROR;
+            mode_ = NDCodecReadDone;
+            return ND_ERROR;
+        }
+        // blosc_getitem() counts in units of the Blosc type size, which must be the element size
+        if (typeSize == elemSize_ && bloscBlock > 0 && bloscBlock % elemSize_ == 0) {
+            mode_ = NDCodecReadBlosc;
+            chunkElements_ = std::max(blockSize_ / bloscBlock, (size_t)1) * bloscBlock / elemSize_;
+        }
+    }
+#endif
+#ifdef HAVE_BITSHUFFLE
+    else if (pArray->codec.name == codecName[NDCODEC_BSLZ4]) {
+        mode_ = NDCodecReadBSLZ4;
+        bshufBlockSize_ = bshuf_default_block_size(elemSize_);
+        chunkElements_ = std::max(blockSize_ / (bshufBlockSize_ * elemSize_), (size_t)1) * bshufBlockSize_;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+        unsigned int dictID = ZSTD_getDictID_fromFrame(pArray->pData, pArray->compressedSize);
+        if (dictID) {
+            sprintf(errorMessage, "Array needs zstd dictionary %u", dictID);
+            *status = NDCODEC_ERROR;
+            mode_ = NDCodecReadDone;
+            return ND_ERROR;
+        }
+        mode_ = NDCodecReadZstd;
+        pZstdStream_ = getZstdDStream();
+        ZSTD_DCtx_reset((ZSTD_DStream *)pZstdStream_, ZSTD_reset_session_only);
+        chunkElements_ = std::max(blockSize_ / elemSize_, (size_t)1);
+    }
+#endif
+
+    if (mode_ == NDCodecReadWhole) {
+        // Codecs that cannot be decompressed in parts
+        pDecompressed_ = decompressArray(pArray, 1, status, errorMessage);
+        if (!pDecompressed_) {
+            mode_ = NDCodecReadDone;
+            return ND_ERROR;
+        }
+    } else if (mode_ != NDCodecReadPlain) {
+        chunkElements_ = std::min(chunkElements_, nElements_);
+        buffer_.resize(chunkElements_ * elemSize_);
+    }
+
+    return ND_SUCCESS;
+}
+
+/** Returns the next block of uncompressed elements.
+  * \param[out] firstElement Index in the array of the first element of the block.
+  * \param[out] nElements Number of elements in the block.
+  * \param[out] status Set to NDCODEC_ERROR on error.
+  * \param[out] errorMessage The error message on error.
+  * \return Pointer to the elements, valid until the next call, or NULL after the last block or on error. */
+const void *NDCodecBlockReader::next(size_t *firstElement, size_t *nElements,
+                                     NDCodecStatus_t *status, char *errorMessage)
+{
+    const void *pBlock = NULL;
+    size_t n = std::min(chunkElements_, nElements_ - nextElement_);
+
+    if (mode_ == NDCodecReadDone || nextElement_ >= nElements_)
+        return NULL;
+
+    switch (mode_) {
+    case NDCodecReadPlain:
+        pBlock = pArray_->pData;
+        break;
+
+    case NDCodecReadWhole:
+        pBlock = pDecompressed_->pData;
+        break;
+
+#ifdef HAVE_BLOSC
+    case NDCodecReadBlosc: {
+        int ret = blosc_getitem(pArray_->pData, (int)nextElement_, (int)n, &buffer_[0]);
+        if (ret == (int)(n * elemSize_))
+            pBlock = &buffer_[0];
+        else
+            sprintf(errorMessage, "Failed to Blosc decompress");
+        break;
+    }
+#endif
+
+#ifdef HAVE_BITSHUFFLE
+    case NDCodecReadBSLZ4: {
+        // Check the block headers first, bshuf_decompress_lz4() does not know the input size
+        size_t endPos = inPos_;
+        if (!skipBSLZ4((const unsigned char *)pArray_->pData, pArray_->compressedSize, &endPos,
+                       n, elemSize_, bshufBlockSize_)) {
+            sprintf(errorMessage, "Truncated BSLZ4 data");
+            break;
+        }
+        int64_t ret = bshuf_decompress_lz4((const char *)pArray_->pData + inPos_, &buffer_[0],
+                                           n, elemSize_, bshufBlockSize_);
+        if (ret == (int64_t)(endPos - inPos_)) {
+            inPos_ = endPos;
+            pBlock = &buffer_[0];
+        } else {
+            sprintf(errorMessage, "Failed to BSLZ4 decompress");
+        }
+        break;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    case NDCodecReadZstd: {
+        ZSTD_inBuffer in = { pArray_->pData, pArray_->compressedSize, inPos_ };
+        ZSTD_outBuffer out = { &buffer_[0], n * elemSize_, 0 };
+        size_t ret = 1;
+        while (out.pos < out.size && ret != 0) {
+            size_t inBefore = in.pos, outBefore = out.pos;
+            ret = ZSTD_decompressStream((ZSTD_DStream *)pZstdStream_, &out, &in);
+            if (ZSTD_isError(ret) || (in.pos == inBefore && out.pos == outBefore))
+                break;
+        }
+        inPos_ = in.pos;
+        if (ZSTD_isError(ret))
+            sprintf(errorMessage, "Failed to Zstd decompress");
+        else if (out.pos < out.size)
+            sprintf(errorMessage, "Truncated Zstd data");
+        else
+            pBlock = &buffer_[0];
+        break;
+    }
+#endif
+
+    default:
+        break;
+    }
+
+    if (!pBlock) {
+        *status = NDCODEC_ERROR;
+        mode_ = NDCodecReadDone;
+        return NULL;
+    }
+
+    *firstElement = nextElement_;
+    *nElements = n;
+    nextElement_ += n;
+    return pBlock;
+}
+
+/** Finishes reading the current array and releases any decompressed copy of it */
+void NDCodecBlockReader::end()
+{
+    if (pDecompressed_)
+        pDecompressed_->release();
+    pDecompressed_ = NULL;
+    pArray_ = NULL;
+    pZstdStream_ = NULL;
+    mode_ = NDCodecReadDone;
+    nElements_ = 0;
+    nextElement_ = 0;
+}
+
 /** Callback function that is called by the NDArray driver with new NDArray data.
   * Does JPEG or Blosc compression on the array.
   * If compression is None or fails the input array is passed on without
@@ -672,6 +1384,8 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
     }
 
     if (mode == NDCODEC_COMPRESS) {
+        collectZstdSamples(pArray);
+
         switch(algo) {
         case NDCODEC_NONE:
         default:
@@ -711,9 +1425,26 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
         }
 
         case NDCODEC_BSLZ4: {
+            int numThreads;
+            getIntegerParam(NDCodecNumThreads, &numThreads);
+
+            unlock();
+            result = compressBSLZ4(pArray, numThreads, &codecStatus, errorMessage);
+            lock();
+            break;
+        }
+
+        case NDCODEC_ZSTD: {
+            int level, numThreads;
+            getIntegerParam(NDCodecZstdLevel, &level);
+            getIntegerParam(NDCodecNumThreads, &numThreads);
+            NDCodecZstdDict *pDict = zstdDict_;
+            acquireZstdDict(pDict);
+
             unlock();
-            result = compressBSLZ4(pArray, &codecStatus, errorMessage);
+            result = compressZstd(pArray, level, numThreads, pDict, &codecStatus, errorMessage);
             lock();
+            releaseZstdDict(pDict);
             break;
         }
 
@@ -721,6 +1452,11 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
 
         if (result && result != pArray) {
             NDArrayInfo_t info;
+            /* Move the data out of the worst case sized output buffer so queued arrays
+             * only hold as much pool memory as the compressed data need */
+            unlock();
+            result->pNDArrayPool->compact(result);
+            lock();
             pArray->getInfo(&info);
             factor = (double)info.totalBytes / (double)result->compressedSize;
         }
@@ -747,10 +1483,22 @@ void NDPluginCodec::processCallbacks(NDArray *pArray)
             lock();
             setIntegerParam(NDCodecCompressor, NDCODEC_LZ4);
         } else if (pArray->codec.name == codecName[NDCODEC_BSLZ4]) {
+            int numThreads;
+            getIntegerParam(NDCodecNumThreads, &numThreads);
+
             unlock();
-            result = decompressBSLZ4(pArray, &codecStatus, errorMessage);
+            result = decompressBSLZ4(pArray, numThreads, &codecStatus, errorMessage);
             lock();
             setIntegerParam(NDCodecCompressor, NDCODEC_BSLZ4);
+        } else if (pArray->codec.name == codecName[NDCODEC_ZSTD]) {
+            NDCodecZstdDict *pDict = zstdDict_;
+            acquireZstdDict(pDict);
+
+            unlock();
+            result = decompressZstd(pArray, pDict, &codecStatus, errorMessage);
+            lock();
+            releaseZstdDict(pDict);
+            setIntegerParam(NDCodecCompressor, NDCODEC_ZSTD);
         } else {
             sprintf(errorMessage, "Unexpected codec: '%s'", pArray->codec.name.c_str());
             codecStatus = NDCODEC_ERROR;
@@ -805,6 +1553,14 @@ asynStatus NDPluginCodec::writeInt32(asynUser *pasynUser, epicsInt32 value)
     } else if (function == NDCodecBloscNumThreads) {
         if (value < 1)
             value = 1;
+    } else if (function == NDCodecNumThreads) {
+        if (value < 1)
+            value = 1;
+    } else if (function == NDCodecZstdTrain) {
+        if (value < 0)
+            value = 0;
+        zstdSamples_.clear();
+        zstdSampleSizes_.clear();
     } else if (function < FIRST_NDCODEC_PARAM) {
         status = NDPluginDriver::writeInt32(pasynUser, value);
     }
@@ -812,6 +1568,10 @@ asynStatus NDPluginCodec::writeInt32(asynUser *pasynUser, epicsInt32 value)
     /* Set the parameter in the parameter library. */
     status = (asynStatus) setIntegerParam(function, value);
 
+    // The compression dictionary is digested for one level, so build it again
+    if (function == NDCodecZstdLevel && !zstdDictBuffer_.empty())
+        status = updateZstdDict();
+
     /* Do callbacks so higher layers see any changes */
     callParamCallbacks();
 
@@ -833,6 +1593,197 @@ asynStatus NDPluginCodec::writeInt32(asynUser *pasynUser, epicsInt32 value)
     return status;
 }
 
+/** Called when asyn clients call pasynOctet->write().
+  * Loads the zstd dictionary when NDCodecZstdDictFile is written, and passes all other
+  * parameters to the base class.
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Address of the string to write.
+  * \param[in] nChars Number of characters to write.
+  * \param[out] nActual Number of characters actually written. */
+asynStatus NDPluginCodec::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+    int function = pasynUser->reason;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeOctet";
+
+    if (function < FIRST_NDCODEC_PARAM)
+        return NDPluginDriver::writeOctet(pasynUser, value, nChars, nActual);
+
+    status = (asynStatus)setStringParam(function, value);
+    if (function == NDCodecZstdDictFile)
+        status = loadZstdDict();
+
+    callParamCallbacks();
+
+    if (status) {
+        epicsSnprintf(pasynUser->errorMessage, pasynUser->errorMessageSize,
+                      "%s:%s: status=%d, function=%d, value=%s",
+                      driverName, functionName, status, function, value);
+    } else {
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+                  "%s:%s: function=%d, value=%s\n",
+                  driverName, functionName, function, value);
+    }
+    *nActual = nChars;
+    return status;
+}
+
+void NDPluginCodec::setCodecError(NDCodecStatus_t status, const char *errorMessage)
+{
+    setIntegerParam(NDCodecCodecStatus, (int)status);
+    setStringParam(NDCodecCodecError, errorMessage);
+}
+
+/** Reads the dictionary in NDCodecZstdDictFile; an empty file name removes the dictionary.
+  * The file may be a dictionary trained with "zstd --train" or raw content.
+  * Called with the lock held. */
+asynStatus NDPluginCodec::loadZstdDict()
+{
+    std::string fileName;
+    static const char *functionName = "loadZstdDict";
+
+    getStringParam(NDCodecZstdDictFile, fileName);
+    zstdDictBuffer_.clear();
+
+    if (!fileName.empty()) {
+        FILE *fp = fopen(fileName.c_str(), "rb");
+        if (fp) {
+            char buffer[65536];
+            size_t n;
+            while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+                zstdDictBuffer_.insert(zstdDictBuffer_.end(), buffer, buffer + n);
+            fclose(fp);
+        }
+        if (!fp || zstdDictBuffer_.empty()) {
+            char errorMessage[256];
+            epicsSnprintf(errorMessage, sizeof(errorMessage), "Cannot read zstd dictionary %s", fileName.c_str());
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s %s\n", driverName, functionName, errorMessage);
+            setCodecError(NDCODEC_ERROR, errorMessage);
+        }
+    }
+
+    return updateZstdDict();
+}
+
+/** Builds the dictionary in zstdDictBuffer_ for the current compression level and
+  * replaces the one in use. Called with the lock held. */
+asynStatus NDPluginCodec::updateZstdDict()
+{
+    NDCodecZstdDict *pDict = NULL;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "updateZstdDict";
+
+    if (!zstdDictBuffer_.empty()) {
+        NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+        char errorMessage[256] = "";
+        int level;
+
+        getIntegerParam(NDCodecZstdLevel, &level);
+        pDict = createZstdDict(&zstdDictBuffer_[0], zstdDictBuffer_.size(), level, &codecStatus, errorMessage);
+        if (!pDict) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s %s\n", driverName, functionName, errorMessage);
+            setCodecError(codecStatus, errorMessage);
+            status = asynError;
+        }
+    }
+
+    // Threads that are compressing keep their own reference to the old dictionary
+    releaseZstdDict(zstdDict_);
+    zstdDict_ = pDict;
+    setIntegerParam(NDCodecZstdDictID, (int)getZstdDictID(pDict));
+
+    return status;
+}
+
+/** Keeps a copy of uncompressed arrays while NDCodecZstdTrain is non-zero, and trains a
+  * dictionary when the requested number of arrays has been collected, or earlier when
+  * ZSTD_TRAIN_MAX_BYTES or ZSTD_TRAIN_MAX_SAMPLES is reached.
+  * Called with the lock held. */
+void NDPluginCodec::collectZstdSamples(NDArray *pArray)
+{
+    int remaining;
+
+    getIntegerParam(NDCodecZstdTrain, &remaining);
+    if (remaining <= 0 || !pArray->codec.empty())
+        return;
+
+    // zstd trains better on many moderate samples than on a few large ones
+    NDArrayInfo_t info;
+    pArray->getInfo(&info);
+    const char *pData = (const char *)pArray->pData;
+    size_t offset = 0;
+    while ((offset < info.totalBytes) && (zstdSamples_.size() < ZSTD_TRAIN_MAX_BYTES) &&
+           (zstdSampleSizes_.size() < ZSTD_TRAIN_MAX_SAMPLES)) {
+        size_t sampleSize = std::min((size_t)ZSTD_TRAIN_SAMPLE_SIZE, info.totalBytes - offset);
+        sampleSize = std::min(sampleSize, ZSTD_TRAIN_MAX_BYTES - zstdSamples_.size());
+        zstdSamples_.insert(zstdSamples_.end(), pData + offset, pData + offset + sampleSize);
+        zstdSampleSizes_.push_back(sampleSize);
+        offset += sampleSize;
+    }
+
+    remaining--;
+    if ((remaining > 0) && ((zstdSamples_.size() >= ZSTD_TRAIN_MAX_BYTES) ||
+                            (zstdSampleSizes_.size() >= ZSTD_TRAIN_MAX_SAMPLES))) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                  "%s::collectZstdSamples sample limit reached, training with %d arrays fewer than requested\n",
+                  driverName, remaining);
+        remaining = 0;
+    }
+    setIntegerParam(NDCodecZstdTrain, remaining);
+    if (remaining == 0)
+        trainZstdDict();
+}
+
+/** Trains a dictionary on the collected arrays, writes it to NDCodecZstdDictFile and loads it.
+  * Called with the lock held, which is released while training. */
+void NDPluginCodec::trainZstdDict()
+{
+    std::vector<char> samples;
+    std::vector<size_t> sampleSizes;
+    std::string fileName;
+    char errorMessage[256] = "";
+    static const char *functionName = "trainZstdDict";
+
+    samples.swap(zstdSamples_);
+    sampleSizes.swap(zstdSampleSizes_);
+    getStringParam(NDCodecZstdDictFile, fileName);
+
+    if (fileName.empty()) {
+        epicsSnprintf(errorMessage, sizeof(errorMessage), "No zstd dictionary file to train");
+    } else {
+#ifdef HAVE_ZSTD
+        std::vector<char> dict(ZSTD_DICT_CAPACITY);
+
+        unlock();
+        size_t dictSize = ZDICT_trainFromBuffer(&dict[0], dict.size(), &samples[0],
+                                                &sampleSizes[0], (unsigned)sampleSizes.size());
+        if (ZDICT_isError(dictSize)) {
+            epicsSnprintf(errorMessage, sizeof(errorMessage), "Zstd training failed: %s",
+                          ZDICT_getErrorName(dictSize));
+        } else {
+            FILE *fp = fopen(fileName.c_str(), "wb");
+            if (!fp || fwrite(&dict[0], 1, dictSize, fp) != dictSize)
+                epicsSnprintf(errorMessage, sizeof(errorMessage), "Cannot write zstd dictionary %s",
+                              fileName.c_str());
+            if (fp)
+                fclose(fp);
+        }
+        lock();
+#else
+        epicsSnprintf(errorMessage, sizeof(errorMessage), "No Zstd support");
+#endif
+    }
+
+    if (errorMessage[0]) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s::%s %s\n", driverName, functionName, errorMessage);
+        setCodecError(NDCODEC_ERROR, errorMessage);
+        return;
+    }
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s::%s trained %s on %d samples\n",
+              driverName, functionName, fileName.c_str(), (int)sampleSizes.size());
+    loadZstdDict();
+}
+
 /** Constructor for NDPluginCodec; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   * After calling the base class constructor this method sets reasonable default values for all of the
   * ROI parameters.
@@ -863,7 +1814,8 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
                    asynGenericPointerMask,
                    asynGenericPointerMask,
                    0, 1, priority, stackSize, maxThreads,
-                   true)
+                   true),
+      zstdDict_(NULL)
 {
     //static const char *functionName = "NDPluginCodec";
 
@@ -877,6 +1829,11 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     createParam(NDCodecBloscCLevelString,     asynParamInt32,   &NDCodecBloscCLevel);
     createParam(NDCodecBloscShuffleString,    asynParamInt32,   &NDCodecBloscShuffle);
     createParam(NDCodecBloscNumThreadsString, asynParamInt32,   &NDCodecBloscNumThreads);
+    createParam(NDCodecNumThreadsString,      asynParamInt32,   &NDCodecNumThreads);
+    createParam(NDCodecZstdLevelString,       asynParamInt32,   &NDCodecZstdLevel);
+    createParam(NDCodecZstdDictFileString,    asynParamOctet,   &NDCodecZstdDictFile);
+    createParam(NDCodecZstdDictIDString,      asynParamInt32,   &NDCodecZstdDictID);
+    createParam(NDCodecZstdTrainString,       asynParamInt32,   &NDCodecZstdTrain);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginCodec");
@@ -889,6 +1846,11 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     setIntegerParam(NDCodecBloscCompressor, NDCODEC_BLOSC_BLOSCLZ);
     setIntegerParam(NDCodecBloscCLevel,     5);
     setIntegerParam(NDCodecBloscNumThreads, 1);
+    setIntegerParam(NDCodecNumThreads,      1);
+    setIntegerParam(NDCodecZstdLevel,       3);
+    setStringParam (NDCodecZstdDictFile,    "");
+    setIntegerParam(NDCodecZstdDictID,      0);
+    setIntegerParam(NDCodecZstdTrain,       0);
 
     // Enable ArrayCallbacks.
     // This plugin currently ignores this setting and always does callbacks, so make the setting reflect the behavior
@@ -898,6 +1860,11 @@ NDPluginCodec::NDPluginCodec(const char *portName, int queueSize, int blockingCa
     connectToArrayPort();
 }
 
+NDPluginCodec::~NDPluginCodec()
+{
+    releaseZstdDict(zstdDict_);
+}
+
 extern "C" int NDCodecConfigure(const char *portName, int queueSize, int blockingCallbacks,
                                           const char *NDArrayPort, int NDArrayAddr,
                                           int maxBuffers, size_t maxMemory,
@@ -1,6 +1,13 @@
 #ifndef NDPluginCodec_H
 #define NDPluginCodec_H
 
+#include <vector>
+#include <deque>
+
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
 #include "NDPluginDriver.h"
 
 #define NDCodecModeString             "MODE"             /* (NDCodecMode_t r/w) Mode: Compress/Decompress */
@@ -13,6 +20,11 @@
 #define NDCodecBloscCLevelString      "BLOSC_CLEVEL"     /* (int r/w) Blosc compression level */
 #define NDCodecBloscShuffleString     "BLOSC_SHUFFLE"    /* (bool r/w) Should Blosc apply shuffling? */
 #define NDCodecBloscNumThreadsString  "BLOSC_NUMTHREADS" /* (int r/w) Number of threads to be used by Blosc */
+#define NDCodecNumThreadsString       "CODEC_NUMTHREADS" /* (int r/w) Number of threads for BSLZ4 and zstd [de]compression */
+#define NDCodecZstdLevelString        "ZSTD_LEVEL"       /* (int r/w) Zstd compression level */
+#define NDCodecZstdDictFileString     "ZSTD_DICT_FILE"   /* (string r/w) Zstd dictionary file, empty for no dictionary */
+#define NDCodecZstdDictIDString       "ZSTD_DICT_ID"     /* (int r/o) ID of the loaded zstd dictionary, 0 if none or raw content */
+#define NDCodecZstdTrainString        "ZSTD_TRAIN"       /* (int r/w) Number of frames still to collect to train a dictionary */
 
 /** Compress/decompress NDArrays according to available codecs.
   * This plugin is a source of NDArray callbacks, passing the (possibly
@@ -22,6 +34,9 @@
   * <ul>
   *  <li> JPEG</li>
   *  <li> Blosc</li>
+  *  <li> LZ4</li>
+  *  <li> Bitshuffle/LZ4</li>
+  *  <li> Zstd</li>
   * </ul>
   */
 
@@ -60,8 +75,96 @@ NDArray *compressBlosc(NDArray *input, int clevel, int shuffle, NDCodecBloscComp
 NDArray *decompressBlosc(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
 NDArray *compressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
 NDArray *decompressLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
-NDArray *compressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
-NDArray *decompressBSLZ4(NDArray *input, NDCodecStatus_t *status, char *errorMessage);
+NDArray *compressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
+NDArray *decompressBSLZ4(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
+
+/* A zstd dictionary prepared for compression at one level and for decompression.
+ * Dictionaries are reference counted, so one can be replaced while other threads are using it;
+ * createZstdDict() returns it with one reference. acquire/release accept NULL. */
+typedef struct NDCodecZstdDict NDCodecZstdDict;
+NDCodecZstdDict *createZstdDict(const void *pBuffer, size_t size, int level,
+                                NDCodecStatus_t *status, char *errorMessage);
+void acquireZstdDict(NDCodecZstdDict *pDict);
+void releaseZstdDict(NDCodecZstdDict *pDict);
+unsigned int getZstdDictID(NDCodecZstdDict *pDict);
+
+NDArray *compressZstd(NDArray *input, int level, int numThreads, NDCodecZstdDict *pDict,
+                      NDCodecStatus_t *status, char *errorMessage);
+NDArray *decompressZstd(NDArray *input, NDCodecZstdDict *pDict, NDCodecStatus_t *status, char *errorMessage);
+
+/* Decompresses an array with the function above for its codec. An uncompressed input array is
+ * reserved and returned, so the result is always released by the caller. Arrays that need a
+ * zstd dictionary cannot be decompressed. */
+NDArray *decompressArray(NDArray *input, int numThreads, NDCodecStatus_t *status, char *errorMessage);
+
+
+/* A job for the codec worker pool: func is called once for each chunk in [0, nChunks).
+ * The chunks are shared out between the workers and the thread that submitted the job. */
+typedef struct NDCodecJob {
+    void (*func)(void *arg, int chunk);
+    void *arg;
+    int nChunks;
+    int next;           /* Next chunk to hand out */
+    int done;           /* Number of chunks that have completed */
+    epicsEventId doneEvent;
+} NDCodecJob;
+
+/* Worker threads shared by all NDPluginCodec instances and NDFileHDF5 for blockwise [de]compression.
+ * Workers are created on demand, up to the largest number of threads ever requested,
+ * and are never destroyed. */
+class NDPLUGIN_API NDCodecWorkerPool {
+public:
+    static void run(void (*func)(void *arg, int chunk), void *arg, int nChunks, int numThreads);
+
+private:
+    static void init(void *);
+    static void workerTask(void *);
+    static bool runNext(NDCodecJob *pJob);
+
+    static epicsThreadOnceId onceId_;
+    static epicsMutexId mutex_;       /* Protects everything below and the next/done fields of all jobs */
+    static epicsEventId workEvent_;
+    static std::deque<NDCodecJob *> jobs_;  /* Jobs that still have chunks to hand out */
+    static int numWorkers_;
+};
+
+
+/* Default size in bytes of the blocks returned by NDCodecBlockReader */
+#define ND_CODEC_BLOCK_SIZE (128*1024)
+
+/** Reads the elements of an NDArray in blocks, so that a reduction over a compressed array
+  * does not need a buffer for the whole uncompressed array.
+  * Blosc, BSLZ4 and zstd arrays are decompressed about blockSize bytes at a time into a buffer
+  * that is reused for every block, so the data stay in the cache between decompression and use.
+  * JPEG and LZ4 arrays cannot be decompressed in parts and are decompressed whole with
+  * decompressArray(); uncompressed arrays are returned in place as a single block.
+  * begin(), next() and end() must be called from the same thread.
+  */
+class NDPLUGIN_API NDCodecBlockReader {
+public:
+    NDCodecBlockReader(size_t blockSize = ND_CODEC_BLOCK_SIZE);
+    ~NDCodecBlockReader();
+    int begin(NDArray *pArray, NDCodecStatus_t *status, char *errorMessage);
+    const void *next(size_t *firstElement, size_t *nElements, NDCodecStatus_t *status, char *errorMessage);
+    void end();
+
+private:
+    NDCodecBlockReader(const NDCodecBlockReader &);
+    NDCodecBlockReader &operator=(const NDCodecBlockReader &);
+
+    int mode_;
+    NDArray *pArray_;
+    NDArray *pDecompressed_;      /* Whole decompressed array for codecs that cannot be read in blocks */
+    std::vector<char> buffer_;
+    size_t blockSize_;
+    size_t elemSize_;
+    size_t nElements_;
+    size_t nextElement_;
+    size_t chunkElements_;        /* Elements decompressed by each call to next() */
+    size_t bshufBlockSize_;
+    size_t inPos_;                /* Position in the compressed data */
+    void *pZstdStream_;
+};
 
 
 class NDPLUGIN_API NDPluginCodec : public NDPluginDriver {
@@ -70,10 +173,12 @@ public:
                   const char *NDArrayPort, int NDArrayAddr,
                   int maxBuffers, size_t maxMemory,
                   int priority, int stackSize, int maxThreads);
+    ~NDPluginCodec();
 
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
 
 protected:
     int NDCodecMode;
@@ -87,7 +192,23 @@ protected:
     int NDCodecBloscCLevel;
     int NDCodecBloscShuffle;
     int NDCodecBloscNumThreads;
-
+    int NDCodecNumThreads;
+    int NDCodecZstdLevel;
+    int NDCodecZstdDictFile;
+    int NDCodecZstdDictID;
+    int NDCodecZstdTrain;
+
+private:
+    asynStatus loadZstdDict();
+    asynStatus updateZstdDict();
+    void collectZstdSamples(NDArray *pArray);
+    void trainZstdDict();
+    void setCodecError(NDCodecStatus_t status, const char *errorMessage);
+
+    std::vector<char> zstdDictBuffer_;   /* Contents of ZstdDictFile */
+    NDCodecZstdDict *zstdDict_;          /* Dictionary built from zstdDictBuffer_ at the current level */
+    std::vector<char> zstdSamples_;      /* Frames collected for dictionary training */
+    std::vector<size_t> zstdSampleSizes_;
 };
 
 #endif
@@ -13,6 +13,8 @@
 #include <stdio.h>
 #include <errno.h>
 
+#include <vector>
+
 #include <epicsMessageQueue.h>
 #include <cantProceed.h>
 
@@ -21,16 +23,6 @@
 
 #include <epicsExport.h>
 
-typedef enum {
-    ToThreadMessageData,
-    ToThreadMessageExit
-} ToThreadMessageType_t;
-
-typedef struct {
-    ToThreadMessageType_t messageType;
-    NDArray *pArray;
-} ToThreadMessage_t;
-
 typedef enum {
     FromThreadMessageEnter,
     FromThreadMessageExit
@@ -94,12 +86,25 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     pPrevInputArray_(0),
     pluginStarted_(false),
     firstOutputArray_(true),
-    pToThreadMsgQ_(NULL),
     pFromThreadMsgQ_(NULL),
     prevUniqueId_(-1000),
     sortingThreadId_(0),
     compressionAware_(compressionAware),
-    throttler_(new Throttler())
+    throttler_(new Throttler()),
+    creditReportMutex_(new epicsMutex()),
+    pUpstream_(0),
+    interruptRegistered_(false),
+    lossless_(false),
+    ownCredits_(queueSize),
+    reportedCredits_(-1),
+    queueMutex_(new epicsMutex()),
+    inputQueueSize_(0),
+    exitRequests_(0),
+    priorityClass_(NDPriorityNormal),
+    pendingShedArrays_(0),
+    queuedEvent_(epicsEventMustCreate(epicsEventEmpty)),
+    dequeuedEvent_(epicsEventMustCreate(epicsEventEmpty)),
+    dequeueMutex_(new epicsMutex())
 {
     asynUser *pasynUser;
     //static const char *functionName = "NDPluginDriver";
@@ -142,6 +147,8 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     createParam(NDPluginDriverExecutionTimeString,     asynParamFloat64, &NDPluginDriverExecutionTime);
     createParam(NDPluginDriverMinCallbackTimeString,   asynParamFloat64, &NDPluginDriverMinCallbackTime);
     createParam(NDPluginDriverMaxByteRateString,       asynParamFloat64, &NDPluginDriverMaxByteRate);
+    createParam(NDPluginDriverLosslessString,          asynParamInt32, &NDPluginDriverLossless);
+    createParam(NDPluginDriverPriorityClassString,     asynParamInt32, &NDPluginDriverPriorityClass);
 
     /* Here we set the values of read-only parameters and of read/write parameters that cannot
      * or should not get their values from the database.  Note that values set here will override
@@ -158,6 +165,8 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
     setIntegerParam(NDPluginDriverMaxThreads, maxThreads);
     setIntegerParam(NDPluginDriverNumThreads, 1);
     setIntegerParam(NDPluginDriverBlockingCallbacks, blockingCallbacks);
+    setIntegerParam(NDPluginDriverLossless, 0);
+    setIntegerParam(NDPluginDriverPriorityClass, NDPriorityNormal);
 
     /* Create the callback threads, unless blocking callbacks are disabled with
      * the blockingCallbacks argument here. Even then, if they are enabled
@@ -166,6 +175,8 @@ NDPluginDriver::NDPluginDriver(const char *portName, int queueSize, int blocking
         createCallbackThreads();
     }
 
+    NDArrayPool::addShedder(this);
+
     unlock();
 }
 
@@ -176,10 +187,20 @@ NDPluginDriver::~NDPluginDriver()
   // We lock the mutex because deleteCallbackThreads expects it to be held, but then
   // unlocked it because the mutex is deleted in the asynPortDriver destructor and the
   // mutex must be unlocked before deleting it.
+  NDArrayPool::removeShedder(this);
   delete throttler_;
   this->lock();
   deleteCallbackThreads();
   this->unlock();
+  creditReportMutex_->lock();
+  if (pUpstream_ && (reportedCredits_ >= 0)) pUpstream_->removeCredits(this);
+  pUpstream_ = 0;
+  creditReportMutex_->unlock();
+  delete creditReportMutex_;
+  delete queueMutex_;
+  delete dequeueMutex_;
+  epicsEventDestroy(queuedEvent_);
+  epicsEventDestroy(dequeuedEvent_);
 }
 
 /** Method that is normally called at the beginning of the processCallbacks
@@ -374,7 +395,10 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
     double minCallbackTime, deltaTime;
     int status=0;
     int blockingCallbacks;
-    int droppedArrays, queueSize, queueFree;
+    int droppedArrays, queueFree;
+    int lossless;
+    bool queued;
+    double creditTimeout;
     bool ignoreQueueFull = false;
     static const char *functionName = "driverCallback";
 
@@ -395,7 +419,7 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
 
     status |= getDoubleParam(NDPluginDriverMinCallbackTime, &minCallbackTime);
     status |= getIntegerParam(NDPluginDriverBlockingCallbacks, &blockingCallbacks);
-    status |= getIntegerParam(NDPluginDriverQueueSize, &queueSize);
+    status |= getIntegerParam(NDPluginDriverLossless, &lossless);
 
     epicsTimeGetCurrent(&tNow);
     deltaTime = epicsTimeDiffInSeconds(&tNow, &this->lastProcessTime_);
@@ -417,20 +441,43 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
         epicsTimeGetCurrent(&tNow);
         memcpy(&this->lastProcessTime_, &tNow, sizeof(tNow));
         if (blockingCallbacks) {
+            /* Allocations made by this plugin in the driver's thread use this plugin's priority class */
+            int threadPriorityClass = NDArrayPool::getThreadPriorityClass();
+            NDArrayPool::setThreadPriorityClass(getPriorityClass());
             processCallbacks(pArray);
+            NDArrayPool::setThreadPriorityClass(threadPriorityClass);
             epicsTimeGetCurrent(&tEnd);
             setDoubleParam(NDPluginDriverExecutionTime, epicsTimeDiffInSeconds(&tEnd, &tNow)*1e3);
         } else {
             /* Increase the reference count again on this array
              * It will be released in the background task when processing is done */
             pArray->reserve();
-            /* Try to put this array on the message queue.  If there is no room then return
+            /* Try to put this array on the input queue.  If there is no room then return
              * immediately. */
-            ToThreadMessage_t msg = {ToThreadMessageData, pArray};
-            status = pToThreadMsgQ_->trySend(&msg, sizeof(msg));
-            queueFree = queueSize - pToThreadMsgQ_->pending();
+            queued = queueArray(pArray);
+            if (!queued && lossless && !ignoreQueueFull) {
+                /* A lossless plugin waits for room in the queue rather than dropping the array.
+                 * The driver did not wait for credits, so tell it that this array would have been dropped.
+                 * This runs in the driver's callback thread, so the wait is limited to CreditTimeout
+                 * and the array is dropped after that. */
+                asynPrint(pasynUser, ASYN_TRACE_FLOW,
+                    "%s::%s message queue full, waiting to queue array uniqueId=%d\n",
+                    driverName, functionName, pArray->uniqueId);
+                pArray->pDriver->incrementWouldDropCount();
+                getDoubleParam(NDCreditTimeout, &creditTimeout);
+                this->unlock();
+                queued = queueArray(pArray, creditTimeout);
+                this->lock();
+                if (!queued) {
+                    asynPrint(pasynUser, ASYN_TRACE_WARNING,
+                        "%s::%s message queue still full after %f seconds, dropping array uniqueId=%d\n",
+                        driverName, functionName, creditTimeout, pArray->uniqueId);
+                }
+            }
+            queueFree = getQueueFree();
             setIntegerParam(NDPluginDriverQueueFree, queueFree);
-            if (status) {
+            reportCredits(queueFree);
+            if (!queued) {
                 pasynUser->auxStatus = asynOverflow;
                 if (!ignoreQueueFull) {
                     status |= getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
@@ -459,12 +506,11 @@ void NDPluginDriver::driverCallback(asynUser *pasynUser, void *genericPointer)
 void NDPluginDriver::processTask()
 {
     /* This thread processes a new array when it arrives */
-    int queueSize, queueFree;
+    int queueFree;
+    int droppedArrays, shedArrays, threadPriorityClass;
     epicsTimeStamp tStart, tEnd;
-    int numBytes;
     int status;
     NDArray *pArray=0;
-    ToThreadMessage_t toMsg;
     FromThreadMessage_t fromMsg = {FromThreadMessageEnter, epicsThreadGetIdSelf()};
     static const char *functionName = "processTask";
 
@@ -479,38 +525,41 @@ void NDPluginDriver::processTask()
     /* Loop forever */
     while (1) {
 
-        /* Wait for an array to arrive from the queue. Release the lock while  waiting. */
+        /* Wait for an array to arrive in the queue. Release the lock while  waiting.
+         * dequeueMutex_ is held until the lock is taken again, so that when there are several threads
+         * processCallbacks starts with the arrays in the order they were taken from the queue. */
         this->unlock();
-        numBytes = pToThreadMsgQ_->receive(&toMsg, sizeof(toMsg));
-        if (numBytes != sizeof(toMsg)) {
-            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                "%s::%s error reading message queue, expected size=%d, actual=%d\n",
-                driverName, functionName, (int)sizeof(toMsg), numBytes);
-        }
-        switch (toMsg.messageType) {
-            case ToThreadMessageExit:
-                asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                    "%s::%s received exit message, thread=%s\n",
-                    driverName, functionName, epicsThreadGetNameSelf());
-                fromMsg.messageType = FromThreadMessageExit;
-                pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
-                return; // shutdown thread if special message
-                break;
-            case ToThreadMessageData:
-                pArray = toMsg.pArray;
-                break;
-            default:
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s unknown message type = %d\n",
-                    driverName, functionName, toMsg.messageType);
+        dequeueMutex_->lock();
+        pArray = dequeueArray();
+        if (!pArray) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s::%s received exit request, thread=%s\n",
+                driverName, functionName, epicsThreadGetNameSelf());
+            dequeueMutex_->unlock();
+            fromMsg.messageType = FromThreadMessageExit;
+            pFromThreadMsgQ_->send(&fromMsg, sizeof(fromMsg));
+            return; // shutdown thread
         }
 
         // Note: the lock must not be taken until after the thread exit logic above
         this->lock();
+        dequeueMutex_->unlock();
         epicsTimeGetCurrent(&tStart);
-        getIntegerParam(NDPluginDriverQueueSize, &queueSize);
-        queueFree = queueSize - pToThreadMsgQ_->pending();
+        queueFree = getQueueFree();
         setIntegerParam(NDPluginDriverQueueFree, queueFree);
+        reportCredits(queueFree);
+
+        /* Count any arrays that were shed from the queue as dropped */
+        queueMutex_->lock();
+        shedArrays = pendingShedArrays_;
+        pendingShedArrays_ = 0;
+        threadPriorityClass = priorityClass_;
+        queueMutex_->unlock();
+        if (shedArrays) {
+            getIntegerParam(NDPluginDriverDroppedArrays, &droppedArrays);
+            setIntegerParam(NDPluginDriverDroppedArrays, droppedArrays + shedArrays);
+        }
+        NDArrayPool::setThreadPriorityClass(threadPriorityClass);
 
         /* Call the function that does the business of this callback.
          * This function should release the lock during time-consuming operations,
@@ -557,9 +606,186 @@ asynStatus NDPluginDriver::setArrayInterrupt(int enableCallbacks)
             return(status);
         }
     }
+    creditReportMutex_->lock();
+    interruptRegistered_ = (this->asynGenericPointerInterruptPvt_ != NULL);
+    creditReportMutex_->unlock();
+    reportCredits();
     return(asynSuccess);
 }
 
+/** Reports the number of arrays this plugin can accept to the driver on NDArrayPort.
+  * Credits are reported if Lossless=1 or if any of this plugin's own consumers are lossless,
+  * in which case the smaller of the free queue space and the downstream credits is reported,
+  * so that pressure propagates through intermediate plugins to the driver.
+  * Credits are withdrawn when neither is true or callbacks are disabled.
+  * \param[in] ownCredits The free space in the input queue, or -1 to use the last value. */
+void NDPluginDriver::reportCredits(int ownCredits)
+{
+    int credits, downstreamCredits;
+
+    creditReportMutex_->lock();
+    if (ownCredits >= 0) ownCredits_ = ownCredits;
+    if (pUpstream_) {
+        downstreamCredits = getCredits();
+        if (interruptRegistered_ && (lossless_ || (downstreamCredits >= 0))) {
+            credits = ownCredits_;
+            if ((downstreamCredits >= 0) && (downstreamCredits < credits)) credits = downstreamCredits;
+            if (credits != reportedCredits_) {
+                pUpstream_->setCredits(this, credits);
+                reportedCredits_ = credits;
+            }
+        } else if (reportedCredits_ >= 0) {
+            pUpstream_->removeCredits(this);
+            reportedCredits_ = -1;
+        }
+    }
+    creditReportMutex_->unlock();
+}
+
+/** Called when the credits reported by this plugin's own lossless consumers change */
+void NDPluginDriver::creditsChanged()
+{
+    reportCredits();
+}
+
+/** Sets the priority class (NDPriorityClass_t) that NDArrayPool uses to decide whether this plugin sheds
+  * queued arrays when a pool runs out of memory.  Derived classes call this in their constructor
+  * to change the default of NDPriorityNormal.  Must be called with the lock held.
+  * \param[in] priorityClass NDPriorityLow, NDPriorityNormal or NDPriorityHigh. */
+void NDPluginDriver::setPriorityClass(int priorityClass)
+{
+    if (priorityClass < NDPriorityLow) priorityClass = NDPriorityLow;
+    if (priorityClass > NDPriorityHigh) priorityClass = NDPriorityHigh;
+    queueMutex_->lock();
+    priorityClass_ = priorityClass;
+    queueMutex_->unlock();
+    setIntegerParam(NDPluginDriverPriorityClass, priorityClass);
+}
+
+/** Returns the priority class of this plugin */
+int NDPluginDriver::getPriorityClass()
+{
+    int priorityClass;
+
+    queueMutex_->lock();
+    priorityClass = priorityClass_;
+    queueMutex_->unlock();
+    return priorityClass;
+}
+
+/** Called by an NDArrayPool that has run out of memory to release arrays from pPool that are waiting in
+  * the input queue, oldest first.  Lossless plugins never shed arrays.
+  * The arrays are removed from inputQueue_ in place, so the order of the arrays that remain is unchanged.
+  * This does not take the asynPortDriver lock, because the pool calls it from other plugins' threads;
+  * the arrays are counted in DroppedArrays by the callback thread.
+  * \param[in] pPool The pool that needs memory.
+  * \param[in] bytesNeeded Number of bytes the pool needs.
+  * \param[out] bytesShed Number of bytes in the arrays that were released.
+  * \return The number of arrays that were released. */
+int NDPluginDriver::shedArrays(NDArrayPool *pPool, size_t bytesNeeded, size_t *bytesShed)
+{
+    std::vector<NDArray *> shed;
+    std::deque<NDArray *>::iterator it;
+    bool lossless;
+    size_t i;
+
+    *bytesShed = 0;
+    creditReportMutex_->lock();
+    lossless = lossless_;
+    creditReportMutex_->unlock();
+    if (lossless) return 0;
+
+    queueMutex_->lock();
+    it = inputQueue_.begin();
+    while ((it != inputQueue_.end()) && (*bytesShed < bytesNeeded)) {
+        if ((*it)->pNDArrayPool == pPool) {
+            *bytesShed += (*it)->dataSize;
+            shed.push_back(*it);
+            it = inputQueue_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    pendingShedArrays_ += (int)shed.size();
+    queueMutex_->unlock();
+    if (shed.empty()) return 0;
+
+    /* The arrays are released without queueMutex_ held, because that takes the pool's lock */
+    for (i=0; i<shed.size(); i++) {
+        shed[i]->pDriver->decrementQueuedArrayCount();
+        shed[i]->release();
+    }
+    epicsEventSignal(dequeuedEvent_);
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::shedArrays shed %d arrays (%ld bytes) from the queue\n",
+        driverName, (int)shed.size(), (long)*bytesShed);
+    return (int)shed.size();
+}
+
+/** Adds an array to the end of the input queue, waiting up to timeout seconds for room.
+  * Must be called with the asynPortDriver lock released if timeout is not 0.
+  * \param[in] pArray The array, which has already been reserved for the processing threads.
+  * \param[in] timeout Maximum time to wait for room in seconds; 0 to return immediately.
+  * \return true if the array was queued, false if the queue was still full. */
+bool NDPluginDriver::queueArray(NDArray *pArray, double timeout)
+{
+    epicsTimeStamp tStart, tNow;
+    double remaining;
+
+    epicsTimeGetCurrent(&tStart);
+    while (1) {
+        queueMutex_->lock();
+        if (inputQueue_.size() < inputQueueSize_) {
+            inputQueue_.push_back(pArray);
+            queueMutex_->unlock();
+            epicsEventSignal(queuedEvent_);
+            return true;
+        }
+        queueMutex_->unlock();
+        epicsTimeGetCurrent(&tNow);
+        remaining = timeout - epicsTimeDiffInSeconds(&tNow, &tStart);
+        if (remaining <= 0.) return false;
+        epicsEventWaitWithTimeout(dequeuedEvent_, remaining);
+    }
+}
+
+/** Takes the oldest array off the input queue, waiting until there is one.
+  * Called by the processing threads with dequeueMutex_ held, so only one thread waits at a time.
+  * \return The array, or NULL if the thread has been asked to exit and the queue is empty. */
+NDArray *NDPluginDriver::dequeueArray()
+{
+    NDArray *pArray;
+
+    while (1) {
+        queueMutex_->lock();
+        if (!inputQueue_.empty()) {
+            pArray = inputQueue_.front();
+            inputQueue_.pop_front();
+            queueMutex_->unlock();
+            epicsEventSignal(dequeuedEvent_);
+            return pArray;
+        }
+        if (exitRequests_ > 0) {
+            exitRequests_--;
+            queueMutex_->unlock();
+            return NULL;
+        }
+        queueMutex_->unlock();
+        epicsEventMustWait(queuedEvent_);
+    }
+}
+
+/** Returns the number of arrays that can be added to the input queue */
+int NDPluginDriver::getQueueFree()
+{
+    int queueFree;
+
+    queueMutex_->lock();
+    queueFree = (int)(inputQueueSize_ - inputQueue_.size());
+    queueMutex_->unlock();
+    return queueFree;
+}
+
 /** Connect this plugin to an NDArray port driver; disconnect from any existing driver first, register
   * for callbacks if enabled. */
 asynStatus NDPluginDriver::connectToArrayPort(void)
@@ -580,6 +806,13 @@ asynStatus NDPluginDriver::connectToArrayPort(void)
         status = setArrayInterrupt(0);
     }
 
+    /* Withdraw any credits from the previous array port driver */
+    creditReportMutex_->lock();
+    if (pUpstream_ && (reportedCredits_ >= 0)) pUpstream_->removeCredits(this);
+    pUpstream_ = 0;
+    reportedCredits_ = -1;
+    creditReportMutex_->unlock();
+
     /* Disconnect the array port from our asynUser.  Ignore error if there is no device
      * currently connected. */
     pasynManager->disconnect(this->pasynUserGenericPointer_);
@@ -606,6 +839,11 @@ asynStatus NDPluginDriver::connectToArrayPort(void)
     asynGenericPointerPvt_ = pasynInterface->drvPvt;
     connectedToArrayPort_ = true;
 
+    /* Credits can only be reported if the array port is an asynNDArrayDriver in this IOC */
+    creditReportMutex_->lock();
+    pUpstream_ = dynamic_cast<asynNDArrayDriver *>((asynPortDriver *)findAsynPortDriver(arrayPort.c_str()));
+    creditReportMutex_->unlock();
+
     /* Enable or disable interrupt callbacks */
     status = setArrayInterrupt(enableCallbacks);
 
@@ -721,6 +959,15 @@ asynStatus NDPluginDriver::writeInt32(asynUser *pasynUser, epicsInt32 value)
             }
         }
 
+    } else if (function == NDPluginDriverPriorityClass) {
+        setPriorityClass(value);
+
+    } else if (function == NDPluginDriverLossless) {
+        creditReportMutex_->lock();
+        lossless_ = (value != 0);
+        creditReportMutex_->unlock();
+        reportCredits();
+
     } else if (function == NDPluginDriverArrayAddr) {
         this->unlock();
         status = connectToArrayPort();
@@ -940,7 +1187,7 @@ void NDPluginDriver::run()
 asynStatus NDPluginDriver::createCallbackThreads()
 {
     assert(this->pThreads_.size() == 0);
-    assert(this->pToThreadMsgQ_ == 0);
+    assert(this->inputQueue_.empty());
     assert(this->pFromThreadMsgQ_ == 0);
 
     int queueSize;
@@ -981,12 +1228,11 @@ asynStatus NDPluginDriver::createCallbackThreads()
 
     pThreads_.resize(numThreads);
 
-    /* Create the message queue for the input arrays */
-    pToThreadMsgQ_ = new epicsMessageQueue(queueSize, sizeof(ToThreadMessage_t));
-    if (!pToThreadMsgQ_) {
-        /* We don't handle memory errors above, so no point in handling this. */
-        cantProceed("NDPluginDriver::createCallbackThreads epicsMessageQueueCreate failure\n");
-    }
+    /* Size the queue for the input arrays */
+    queueMutex_->lock();
+    inputQueueSize_ = queueSize;
+    exitRequests_ = 0;
+    queueMutex_->unlock();
     pFromThreadMsgQ_ = new epicsMessageQueue(numThreads, sizeof(FromThreadMessage_t));
     if (!pFromThreadMsgQ_) {
         /* We don't handle memory errors above, so no point in handling this. */
@@ -1006,6 +1252,7 @@ asynStatus NDPluginDriver::createCallbackThreads()
     }
     getIntegerParam(NDPluginDriverEnableCallbacks, &enableCallbacks);
     setIntegerParam(NDPluginDriverQueueFree, queueSize);
+    reportCredits(queueSize);
     if (enableCallbacks) this->setArrayInterrupt(1);
     return (asynStatus) status;
 }
@@ -1014,7 +1261,6 @@ asynStatus NDPluginDriver::createCallbackThreads()
   * This method is called from the destructor and whenever QueueSize or NumThreads is changed. */
 asynStatus NDPluginDriver::deleteCallbackThreads()
 {
-    ToThreadMessage_t toMsg = {ToThreadMessageExit, 0};
     FromThreadMessage_t fromMsg;
     asynStatus status = asynSuccess;
     int i;
@@ -1022,27 +1268,25 @@ asynStatus NDPluginDriver::deleteCallbackThreads()
     int numBytes;
     static const char *functionName = "deleteCallbackThreads";
 
-    //  Disable callbacks from driver so the threads will empty the message queue
-    if (pToThreadMsgQ_ != 0) {
+    //  Disable callbacks from driver so the threads will empty the input queue
+    if (pThreads_.size() > 0) {
         this->unlock();
         this->setArrayInterrupt(0);
-        while ((pending=pToThreadMsgQ_->pending()) > 0) {
+        while ((pending=(int)(inputQueueSize_ - getQueueFree())) > 0) {
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
                 "%s::%s waiting for queue to empty, pending=%d\n",
                 driverName, functionName, pending);
             epicsThreadSleep(0.05);
         }
-        // Send a kill message to the threads and wait for reply.
-        // Must do this with lock released else the threads may not be able to receive the message
+        // Ask the threads to exit one at a time and wait for reply.
+        // Must do this with lock released else the threads may not be able to take the request
         for (i=0; i<numThreads_; i++) {
-            if (pToThreadMsgQ_->send(&toMsg, sizeof(toMsg)) != 0) {
-                asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
-                    "%s::%s error sending plugin thread %d exit message\n",
-                    driverName, functionName, i);
-                status = asynError;
-            }
+            queueMutex_->lock();
+            exitRequests_++;
+            queueMutex_->unlock();
+            epicsEventSignal(queuedEvent_);
             asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
-                "%s::%s sent exit message %d\n",
+                "%s::%s sent exit request %d\n",
                 driverName, functionName, i);
             numBytes = pFromThreadMsgQ_->receive(&fromMsg, sizeof(fromMsg), 2.0);
             if (numBytes != sizeof(fromMsg)) {
@@ -1063,8 +1307,10 @@ asynStatus NDPluginDriver::deleteCallbackThreads()
             delete pThreads_[i]; // The epicsThread destructor waits for the thread to return
         }
         pThreads_.resize(0);
-        delete pToThreadMsgQ_;
-        pToThreadMsgQ_ = 0;
+        queueMutex_->lock();
+        inputQueueSize_ = 0;
+        exitRequests_ = 0;
+        queueMutex_->unlock();
     }
     if (pFromThreadMsgQ_) {
         delete pFromThreadMsgQ_;
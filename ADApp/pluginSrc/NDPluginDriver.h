@@ -2,7 +2,9 @@
 #define NDPluginDriver_H
 
 #include <set>
+#include <deque>
 #include <epicsTypes.h>
+#include <epicsEvent.h>
 #include <epicsMessageQueue.h>
 #include <epicsThread.h>
 #include <epicsTime.h>
@@ -53,8 +55,12 @@ class sortedListElement {
 #define NDPluginDriverMinCallbackTimeString     "MIN_CALLBACK_TIME"     /**< (asynFloat64,  r/w) Minimum time between calling processCallbacks
                                                                          *to execute plugin code */
 #define NDPluginDriverMaxByteRateString         "MAX_BYTE_RATE"         /**< (asynFloat64,  r/w) Limit on byte rate output of plugin */
+#define NDPluginDriverPriorityClassString       "PRIORITY_CLASS"        /**< (asynInt32,    r/w) Priority class for shedding arrays when
+                                                                         * an NDArrayPool runs out of memory (NDPriorityClass_t) */
+#define NDPluginDriverLosslessString            "LOSSLESS"              /**< (asynInt32,    r/w) Report credits upstream and wait rather than drop
+                                                                         * when the queue is full (1=Yes, 0=No) */
 /** Class from which actual plugin drivers are derived; derived from asynNDArrayDriver */
-class NDPLUGIN_API NDPluginDriver : public asynNDArrayDriver, public epicsThreadRunable {
+class NDPLUGIN_API NDPluginDriver : public asynNDArrayDriver, public epicsThreadRunable, public NDArrayShedder {
 public:
     NDPluginDriver(const char *portName, int queueSize, int blockingCallbacks,
                    const char *NDArrayPort, int NDArrayAddr, int maxAddr,
@@ -73,16 +79,20 @@ public:
 
     /* These are the methods that are new to this class */
     virtual void driverCallback(asynUser *pasynUser, void *genericPointer);
+    virtual int getPriorityClass();
+    virtual int shedArrays(NDArrayPool *pPool, size_t bytesNeeded, size_t *bytesShed);
     virtual void run(void);
     virtual asynStatus start(void);
     void sortingTask();
 
 protected:
+    virtual void creditsChanged();
     virtual void processCallbacks(NDArray *pArray) = 0;
     virtual void beginProcessCallbacks(NDArray *pArray);
     virtual asynStatus endProcessCallbacks(NDArray *pArray, bool copyArray=false, bool readAttributes=true);
     virtual asynStatus connectToArrayPort(void);
     virtual asynStatus setArrayInterrupt(int connect);
+    void setPriorityClass(int priorityClass);
 
 protected:
     int NDPluginDriverArrayPort;
@@ -106,6 +116,8 @@ protected:
     int NDPluginDriverExecutionTime;
     int NDPluginDriverMinCallbackTime;
     int NDPluginDriverMaxByteRate;
+    int NDPluginDriverLossless;
+    int NDPluginDriverPriorityClass;
 
     NDArray *pPrevInputArray_;
     bool throttled(NDArray *pArray);
@@ -116,6 +128,10 @@ private:
     asynStatus startCallbackThreads();
     asynStatus deleteCallbackThreads();
     asynStatus createSortingThread();
+    void reportCredits(int ownCredits=-1);
+    bool queueArray(NDArray *pArray, double timeout=0.);
+    NDArray *dequeueArray();
+    int getQueueFree();
 
     /* The asyn interfaces we access as a client */
     void *asynGenericPointerInterruptPvt_;
@@ -129,7 +145,6 @@ private:
     asynGenericPointer *pasynGenericPointer_;    /**< asyn interface for connecting to NDArray driver */
     bool connectedToArrayPort_;
     std::vector<epicsThread*>pThreads_;
-    epicsMessageQueue *pToThreadMsgQ_;
     epicsMessageQueue *pFromThreadMsgQ_;
     std::multiset<sortedListElement> sortedNDArrayList_;
     int prevUniqueId_;
@@ -138,6 +153,22 @@ private:
     int dimsPrev_[ND_ARRAY_MAX_DIMS];
     bool compressionAware_;
     Throttler *throttler_;
+    epicsMutex *creditReportMutex_;              /**< Protects the members below, which are used to report credits */
+    asynNDArrayDriver *pUpstream_;               /**< The driver for NDArrayPort, if it is an asynNDArrayDriver */
+    bool interruptRegistered_;
+    bool lossless_;
+    int ownCredits_;
+    int reportedCredits_;
+    epicsMutex *queueMutex_;                     /**< Protects the members below; no other lock is taken while it is held */
+    std::deque<NDArray *> inputQueue_;           /**< Arrays waiting for the processing threads, oldest first */
+    size_t inputQueueSize_;                      /**< Maximum number of arrays in inputQueue_ */
+    int exitRequests_;                           /**< Processing threads that have been asked to exit */
+    int priorityClass_;
+    int pendingShedArrays_;                      /**< Arrays shed but not yet added to DroppedArrays */
+    epicsEventId queuedEvent_;                   /**< Signalled when an array is queued or a thread is asked to exit */
+    epicsEventId dequeuedEvent_;                 /**< Signalled when arrays leave inputQueue_ */
+    epicsMutex *dequeueMutex_;                   /**< Held by a processing thread from taking an array off the queue
+                                                  *  until it has the lock */
 };
 
 
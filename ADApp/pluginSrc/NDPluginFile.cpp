@@ -14,6 +14,7 @@
 #include <errno.h>
 
 #include <epicsString.h>
+#include <epicsTime.h>
 
 #include "NDPluginFile.h"
 
@@ -78,6 +79,25 @@ asynStatus NDPluginFile::openFileBase(NDFileOpenMode_t openMode, NDArray *pArray
     return(status);
 }
 
+/** Opens, writes and closes a file containing a single NDArray.
+  * This version calls openFile, writeFile and closeFile with the file mutex held; derived classes that set
+  * supportsConcurrentWrites override it with one that can be called by several threads at once.
+  * \param[in] fileName  Absolute path name of the file to write.
+  * \param[in] pArray Pointer to the NDArray to write to the file. */
+asynStatus NDPluginFile::writeSingleFile(const char *fileName, NDArray *pArray)
+{
+    asynStatus status;
+
+    epicsMutexLock(this->fileMutexId);
+    status = this->openFile(fileName, NDFileModeWrite, pArray);
+    if (status == asynSuccess) {
+        status = this->writeFile(pArray);
+        if (this->closeFile()) status = asynError;
+    }
+    epicsMutexUnlock(this->fileMutexId);
+    return status;
+}
+
 /** Base method for closing a file
   * Calls the pure virtual function closeFile in the derived class. */
 asynStatus NDPluginFile::closeFileBase()
@@ -86,7 +106,6 @@ asynStatus NDPluginFile::closeFileBase()
     asynStatus status = asynSuccess;
     char fullFileName[2*MAX_FILENAME_LEN];
     char tempSuffix[MAX_FILENAME_LEN];
-    char tempFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
     static const char* functionName = "closeFileBase";
 
@@ -100,34 +119,143 @@ asynStatus NDPluginFile::closeFileBase()
     /* Do this with the main lock released since it is slow */
     this->unlock();
     epicsMutexLock(this->fileMutexId);
+    this->closeDeferred = false;
     status = this->closeFile();
     if (status) {
         epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
             "Error closing file, status=%d", status);
     }
 
+    /* If the derived class finishes closing the file later it renames the file then */
+    if (!this->closeDeferred &&
+        this->renameTempFile(fullFileName, tempSuffix, errorMessage, sizeof(errorMessage))) {
+        status=asynError;
+    }
+
+    epicsMutexUnlock(this->fileMutexId);
+    this->lock();
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s %s\n",
+              driverName, functionName, errorMessage);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, errorMessage);
+    }
+
+    return(status);
+}
+
+/** Renames a file written with the NDFileTempSuffix appended to its name to its full name.
+  * Called by closeFileBase, or by a derived class that set closeDeferred once it has closed the file.
+  * \param[in] fullFileName The full name of the file, without the suffix.
+  * \param[in] tempSuffix The value of NDFileTempSuffix when the file was opened; nothing is done if it is empty.
+  * \param[out] errorMessage The error message if the file could not be renamed.
+  * \param[in] maxChars The size of errorMessage. */
+asynStatus NDPluginFile::renameTempFile(const char *fullFileName, const char *tempSuffix, char *errorMessage, size_t maxChars)
+{
+    char tempFileName[MAX_FILENAME_LEN];
+
     if ( *tempSuffix != 0 &&
-         (strlen(fullFileName) - strlen(tempSuffix)) < sizeof(fullFileName) ) {
+         (strlen(fullFileName) - strlen(tempSuffix)) < 2*MAX_FILENAME_LEN ) {
         strcpy( tempFileName, fullFileName );
         strcat( tempFileName, tempSuffix );
         if ( rename( tempFileName, fullFileName ) != 0 ) {
-            epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+            epicsSnprintf(errorMessage, maxChars-1,
                           "Error renaming temporary file %s to %s", tempFileName, fullFileName );
-            status=asynError;
+            return asynError;
         }
     }
+    return asynSuccess;
+}
 
-    epicsMutexUnlock(this->fileMutexId);
+/** Writes a file for one NDArray in NDFileModeSingle when the derived class sets supportsConcurrentWrites
+  * and NumThreads > 1. The file name is created while the lock is held, and the threads take the lock in
+  * the order that they took the arrays from the queue, so the file numbers follow the order of the arrays.
+  * The file is then written by writeSingleFile with the lock released, at the same time as the other threads
+  * write theirs.
+  * \param[in] pArray  The NDArray from the callback. */
+asynStatus NDPluginFile::writeFileConcurrent(NDArray *pArray)
+{
+    asynStatus status;
+    char fullFileName[2*MAX_FILENAME_LEN];
+    char writeFileName[2*MAX_FILENAME_LEN];
+    char tempSuffix[MAX_FILENAME_LEN];
+    char errorMessage[256];
+    static const char* functionName = "writeFileConcurrent";
+
+    // Some file writing plugins use the value of NDFileNumCaptured even in single mode
+    setIntegerParam(NDFileNumCaptured, 1);
+    status = (asynStatus)createFileName(2*MAX_FILENAME_LEN, fullFileName);
+    if (status) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+              "%s::%s error creating full file name, fullFileName=%s, status=%d\n",
+              driverName, functionName, fullFileName, status);
+        setIntegerParam(NDFileWriteStatus, NDFileWriteError);
+        setStringParam(NDFileWriteMessage, "Error creating full file name");
+        return(status);
+    }
+    setStringParam(NDFullFileName, fullFileName);
+
+    strcpy(writeFileName, fullFileName);
+    getStringParam(NDFileTempSuffix, sizeof(tempSuffix), tempSuffix);
+    if ( *tempSuffix != 0 &&
+         (strlen(writeFileName) + strlen(tempSuffix)) < sizeof(writeFileName) ) {
+        strcat( writeFileName, tempSuffix );
+    }
+
+    this->unlock();
+    status = this->writeSingleFile(writeFileName, pArray);
+    if (status) {
+        epicsSnprintf(errorMessage, sizeof(errorMessage)-1,
+            "Error writing file %s, status=%d", writeFileName, status);
+    } else if (this->renameTempFile(fullFileName, tempSuffix, errorMessage, sizeof(errorMessage))) {
+        status = asynError;
+    }
     this->lock();
+
+    /* The file was written from pArray itself, so it is passed on without a copy.
+     * endProcessCallbacks keeps the reference that is taken here in pArrays[0] */
+    pArray->reserve();
+    NDPluginDriver::endProcessCallbacks(pArray, false, true);
     if (status) {
         asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
               "%s::%s %s\n",
               driverName, functionName, errorMessage);
         setIntegerParam(NDFileWriteStatus, NDFileWriteError);
         setStringParam(NDFileWriteMessage, errorMessage);
+    } else {
+        setIntegerParam(NDFileWriteStatus, NDFileWriteOK);
+        setStringParam(NDFileWriteMessage, "");
     }
+    return status;
+}
 
-    return(status);
+/** Closes the current file and opens the next one when NDFileNumCapture arrays have been streamed to
+  * a file and NDFileRotate is set. If NDFileLazyOpen is set the next file is opened by writeFileBase with
+  * the next array. The time the plugin is held up is reported in NDFileBoundaryStall. Streaming is stopped
+  * if either file operation fails. */
+asynStatus NDPluginFile::rotateFile()
+{
+    asynStatus status;
+    epicsTimeStamp start, end;
+
+    epicsTimeGetCurrent(&start);
+    this->rotatingFile = true;
+    status = this->closeFileBase();
+    setIntegerParam(NDFileNumCaptured, 0);
+    if ((status == asynSuccess) && !this->lazyOpen) {
+        status = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, this->pArrays[0]);
+        this->rotatingFile = false;
+    }
+    epicsTimeGetCurrent(&end);
+    this->boundaryStall = epicsTimeDiffInSeconds(&end, &start);
+    setDoubleParam(NDFileBoundaryStall, this->boundaryStall);
+    if (status) {
+        this->rotatingFile = false;
+        setIntegerParam(NDFileCapture, 0);
+        setIntegerParam(NDWriteFile, 0);
+    }
+    return status;
 }
 
 /** Base method for reading a file
@@ -210,6 +338,7 @@ asynStatus NDPluginFile::writeFileBase()
     NDAttribute *pAttribute;
     char driverFileName[MAX_FILENAME_LEN];
     char errorMessage[256];
+    epicsTimeStamp openStart, openEnd;
     static const char* functionName = "writeFileBase";
 
     /* Make sure there is a valid array */
@@ -319,9 +448,17 @@ asynStatus NDPluginFile::writeFileBase()
             break;
         case NDFileModeStream:
             doLazyOpen = this->lazyOpen && (numCaptured == 0);
-            if (!this->supportsMultipleArrays || doLazyOpen)
+            if (!this->supportsMultipleArrays || doLazyOpen) {
+                epicsTimeGetCurrent(&openStart);
                 status = this->openFileBase(NDFileModeWrite | NDFileModeMultiple, pArrayOut);
-            else
+                if (doLazyOpen && this->rotatingFile) {
+                    /* The open of the next file after a rotation is part of the stall at the file boundary */
+                    this->rotatingFile = false;
+                    epicsTimeGetCurrent(&openEnd);
+                    this->boundaryStall += epicsTimeDiffInSeconds(&openEnd, &openStart);
+                    setDoubleParam(NDFileBoundaryStall, this->boundaryStall);
+                }
+            } else
                 this->attrFileNameCheck();
             if (!this->isFrameValid(pArrayOut)) {
                 setIntegerParam(NDFileWriteStatus, NDFileWriteError);
@@ -470,6 +607,7 @@ asynStatus NDPluginFile::doCapture(int capture)
             }
             break;
         case NDFileModeStream:
+            this->rotatingFile = false;
             if (capture) {
                 /* Streaming was just started */
                 if (this->supportsMultipleArrays && !this->useAttrFilePrefix && !this->lazyOpen)
@@ -711,7 +849,7 @@ bool NDPluginFile::isFrameValid(NDArray *pArray)
   */
 void NDPluginFile::processCallbacks(NDArray *pArray)
 {
-    int fileWriteMode, autoSave, capture;
+    int fileWriteMode, autoSave, capture, rotate, numThreads;
     int arrayCounter;
     int numCapture, numCaptured;
     asynStatus status = asynSuccess;
@@ -734,6 +872,8 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
     getIntegerParam(NDFileWriteMode, &fileWriteMode);
     getIntegerParam(NDFileNumCapture, &numCapture);
     getIntegerParam(NDFileNumCaptured, &numCaptured);
+    getIntegerParam(NDFileRotate, &rotate);
+    getIntegerParam(NDPluginDriverNumThreads, &numThreads);
 
     /* We always keep the last array so read() can use it.
      * Release previous one, reserve new one */
@@ -745,7 +885,14 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
         case NDFileModeSingle:
             if (autoSave) {
                 arrayCounter++;
-                writeFileBase();
+                if (this->supportsConcurrentWrites && (numThreads > 1) && !this->useAttrFilePrefix) {
+                    /* Other threads count their arrays while this one writes its file */
+                    setIntegerParam(NDArrayCounter, arrayCounter);
+                    writeFileConcurrent(pArray);
+                    getIntegerParam(NDArrayCounter, &arrayCounter);
+                } else {
+                    writeFileBase();
+                }
             }
             break;
         case NDFileModeCapture:
@@ -775,7 +922,11 @@ void NDPluginFile::processCallbacks(NDArray *pArray)
                     setIntegerParam(NDFileNumCaptured, numCaptured);
                 }
                 if (numCaptured == numCapture) {
-                    doCapture(0);
+                    /* Carry on streaming to the next file if rotation is enabled */
+                    if (rotate && this->supportsMultipleArrays && !this->useAttrFilePrefix)
+                        rotateFile();
+                    else
+                        doCapture(0);
                 }
             }
             break;
@@ -932,12 +1083,19 @@ NDPluginFile::NDPluginFile(const char *portName, int queueSize, int blockingCall
 
     this->ndArrayInfoInit = NULL;
     this->lazyOpen = false;
+    this->rotatingFile = false;
+    this->closeDeferred = false;
+    this->boundaryStall = 0.0;
 
     this->useAttrFilePrefix = false;
+    this->supportsConcurrentWrites = 0;
     this->fileMutexId = epicsMutexCreate();
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginFile");
 
+    // File writers must not have their arrays shed when an NDArrayPool runs out of memory
+    setPriorityClass(NDPriorityHigh);
+
     // Disable ArrayCallbacks.
     // This plugin currently does not do array callbacks, so make the setting reflect the behavior
     setIntegerParam(NDArrayCallbacks, 0);
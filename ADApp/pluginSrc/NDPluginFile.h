@@ -63,14 +63,35 @@ public:
       * pure virtual function that must be implemented by derived classes. */
     virtual asynStatus closeFile() = 0;
 
+    /** Open, write and close a file containing a single NDArray.
+      * Called with neither the lock nor the file mutex held when supportsConcurrentWrites is set, so derived
+      * classes that set it must override this with a version that keeps its state in local variables.
+      * \param[in] fileName  Absolute path name of the file to write.
+      * \param[in] pArray Pointer to the NDArray to write to the file. */
+    virtual asynStatus writeSingleFile(const char *fileName, NDArray *pArray);
+
     int supportsMultipleArrays; /**< Derived classes must set this flag to 0/1 if they cannot/can write
                                   * multiple NDArrays to a single file. Used in capture and stream modes. */
+    int supportsConcurrentWrites; /**< Derived classes set this flag to 1 if writeSingleFile can be called by several
+                                    * threads at once. Used in single mode with AutoSave when NumThreads > 1. */
+
+protected:
+    asynStatus renameTempFile(const char *fullFileName, const char *tempSuffix, char *errorMessage, size_t maxChars);
+
+    bool rotatingFile;  /**< True from closing a file until the next one is open when NDFileRotate changes to the
+                          *  next file in Stream mode. A derived class may then close the file and open the next
+                          *  one on another thread, as long as the arrays are written to the right file. */
+    bool closeDeferred; /**< Set by closeFile in a derived class that will finish closing the file on another thread,
+                          *  in which case the derived class must call renameTempFile once the file is closed,
+                          *  or that did not write a file with the name passed to openFile. */
 
 private:
     asynStatus openFileBase(NDFileOpenMode_t openMode, NDArray *pArray);
     asynStatus readFileBase();
     asynStatus writeFileBase();
+    asynStatus writeFileConcurrent(NDArray *pArray);
     asynStatus closeFileBase();
+    asynStatus rotateFile();
     asynStatus doCapture(int capture);
     void       freeCaptureBuffer(int numCapture);
     asynStatus attrFileCloseCheck();
@@ -84,6 +105,7 @@ private:
     epicsMutexId fileMutexId;
     bool useAttrFilePrefix;
     bool lazyOpen;
+    double boundaryStall;
     NDArrayInfo_t *ndArrayInfoInit; /**< The NDArray information at file open time.
                                       *  Used to check against changes in incoming frames dimensions or datatype */
 };
@@ -165,6 +165,9 @@ NDPluginPva::NDPluginPva(const char *portName, int queueSize,
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginPva");
 
+    // Arrays for display are the first to be shed when an NDArrayPool runs out of memory
+    setPriorityClass(NDPriorityLow);
+
     /* Set PvName */
     setStringParam(NDPluginPvaPvName, pvName);
 
@@ -15,6 +15,7 @@
 #include <iocsh.h>
 
 #include "NDPluginROIStat.h"
+#include "NDPluginCodec.h"
 
 #include <epicsExport.h>
 
@@ -24,114 +25,136 @@
 #define DEFAULT_NUM_TSPOINTS 2048
 
 /**
- * Templated function to calculate statistics on different NDArray data types.
- * \param[in] pArray The pointer to the NDArray object
+ * Adds the elements of one row segment that lie in [xMin, xMax) to a sum.
+ * \param[in] pRow Pointer to element 0 of the row; only elements in [xStart, xEnd) may be read.
+ * \return The number of elements added.
+ */
+template <typename epicsType>
+static size_t sumRow(const epicsType *pRow, size_t xStart, size_t xEnd, size_t xMin, size_t xMax, double *sum)
+{
+  size_t x;
+  size_t xFirst = MAX(xStart, xMin);
+  size_t xLast = MIN(xEnd, xMax);
+
+  for (x=xFirst; x<xLast; ++x) {
+    *sum += (double)pRow[x];
+  }
+  return (xLast > xFirst) ? xLast - xFirst : 0;
+}
+
+/**
+ * Adds one block of elements to the statistics of an ROI.
+ * The blocks are consecutive runs of the array elements, so each block holds part of one or more
+ * rows; the background is counted with the same multiplicity as the regions overlap.
+ * \param[in] pData The elements of the block.
+ * \param[in] firstElement The index in the array of the first element of the block.
+ * \param[in] nElements The number of elements in the block.
+ * \param[in] ndims The number of array dimensions, 1 or 2.
  * \param[in] pROI The pointer to the NDROI object
- * \return asynStatus
  */
 template <typename epicsType>
-asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
+static void accumulateROI(const epicsType *pData, size_t firstElement, size_t nElements, int ndims, NDROI *pROI)
 {
-  epicsType *pData = (epicsType *)pArray->pData;
-  double value = 0;
-  double bgd = 0;
+  size_t width = pROI->arraySize[0];
   size_t sizeX = pROI->size[0];
-  size_t sizeY = pROI->size[1];
+  size_t sizeY = (ndims == 1) ? 1 : pROI->size[1];
   size_t offsetX = pROI->offset[0];
-  size_t offsetY = pROI->offset[1];
-  size_t x = 0;
-  size_t y = 0;
-  size_t nElements = 0;
-  size_t nBgd = 0;
+  size_t offsetY = (ndims == 1) ? 0 : pROI->offset[1];
   size_t bgdWidthX = MIN(pROI->bgdWidth, sizeX);
-  size_t bgdWidthY = MIN(pROI->bgdWidth, sizeY);
-  bool initial = true;
-  size_t yOffset = 0;
-
-  pROI->min = 0;
-  pROI->max = 0;
-  pROI->total = 0;
-  pROI->mean = 0;
-  pROI->net = 0;
-
-  if (pArray->ndims == 1) {
-    nElements = sizeX;
-    for (x=offsetX; x<offsetX+sizeX; ++x) {
-      value = (double)pData[x];
-      if (initial) {
+  size_t bgdWidthY = (ndims == 1) ? 0 : MIN(pROI->bgdWidth, sizeY);
+  size_t yFirst = MAX(firstElement / width, offsetY);
+  size_t yLast = MIN((firstElement + nElements - 1) / width, offsetY + sizeY - 1);
+  size_t x, y, xStart, xEnd, xLast, rowStart;
+  size_t weight, count;
+  double value, sum;
+  const epicsType *pRow;
+
+  for (y=yFirst; y<=yLast; ++y) {
+    rowStart = y * width;
+    xStart = (rowStart < firstElement) ? firstElement - rowStart : 0;
+    xEnd = MIN(width, firstElement + nElements - rowStart);
+    pRow = pData + rowStart - firstElement;
+
+    xLast = MIN(xEnd, offsetX + sizeX);
+    for (x=MAX(xStart, offsetX); x<xLast; ++x) {
+      value = (double)pRow[x];
+      if (pROI->nElements == 0) {
         pROI->min = value;
         pROI->max = value;
-        initial = false;
       }
       if (value < pROI->min) pROI->min = value;
       if (value > pROI->max) pROI->max = value;
       pROI->total += value;
+      pROI->nElements++;
     }
-    if (pROI->bgdWidth > 0) {
-      for (x=offsetX; x<offsetX+bgdWidthX; ++x) {
-        nBgd++;
-        bgd += (double)pData[x];
-      }
-      for (x=offsetX+sizeX-bgdWidthX; x<offsetX+sizeX; ++x) {
-        nBgd++;
-        bgd += (double)pData[x];
-      }
-    }
-  } else if (pArray->ndims == 2) {
-    nElements = sizeX * sizeY;
-    for (y=offsetY; y<offsetY+sizeY; ++y) {
-      yOffset = y*pROI->arraySize[0];
-      for (x=offsetX; x<offsetX+sizeX; ++x) {
-        value = (double)pData[x+yOffset];
-        if (initial) {
-          pROI->min = value;
-          pROI->max = value;
-          initial = false;
-        }
-        if (value < pROI->min) pROI->min = value;
-        if (value > pROI->max) pROI->max = value;
-        pROI->total += value;
-      }
-    }
-    if (pROI->bgdWidth > 0) {
-      // Compute total counts in the bgdWidthY rows at the top
-      for (y=offsetY; y<offsetY+bgdWidthY; ++y) {
-        yOffset = y*pROI->arraySize[0];
-        for (x=offsetX; x<offsetX+sizeX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-      }
-      // Compute total counts in the bgdWidthY rows at the bottom
-      for (y=offsetY+sizeY-bgdWidthY; y<offsetY+sizeY; ++y) {
-        yOffset = y*pROI->arraySize[0];
-        for (x=offsetX; x<offsetX+sizeX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-      }
-      // Compute total counts in the bgdWidthX columns left and right
-      for (y=offsetY+bgdWidthY; y<offsetY+sizeY-bgdWidthY; ++y) {
-        yOffset = y*pROI->arraySize[0];
-        for (x=offsetX; x<offsetX+bgdWidthX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-        for (x=offsetX+sizeX-bgdWidthX; x<offsetX+sizeX; ++x) {
-          nBgd++;
-          bgd += (double)pData[x+yOffset];
-        }
-      }
+
+    if (pROI->bgdWidth == 0) continue;
+    // The bgdWidthY rows at the top and bottom are background, as are the bgdWidthX columns
+    // at the left and right of the other rows
+    weight = (y < offsetY + bgdWidthY) + (y >= offsetY + sizeY - bgdWidthY);
+    sum = 0;
+    if (weight > 0) {
+      count = sumRow(pRow, xStart, xEnd, offsetX, offsetX + sizeX, &sum);
+      pROI->bgdTotal += weight * sum;
+      pROI->bgdElements += weight * count;
+    } else {
+      count = sumRow(pRow, xStart, xEnd, offsetX, offsetX + bgdWidthX, &sum);
+      count += sumRow(pRow, xStart, xEnd, offsetX + sizeX - bgdWidthX, offsetX + sizeX, &sum);
+      pROI->bgdTotal += sum;
+      pROI->bgdElements += count;
     }
   }
+}
+
+/**
+ * Templated function to calculate statistics on different NDArray data types.
+ * The statistics of all of the ROIs are computed in one pass over the array, so a compressed
+ * array is only decompressed once, block by block, without allocating the whole uncompressed array.
+ * \param[in] pArray The pointer to the NDArray object
+ * \param[in] pROIs The NDROI objects, only those with use set are computed
+ * \param[in] numROIs The number of NDROI objects
+ * \return asynStatus
+ */
+template <typename epicsType>
+asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROIs, int numROIs)
+{
+  NDCodecBlockReader reader;
+  NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+  char errorMessage[256] = "";
+  const epicsType *pData;
+  size_t firstElement, nElements;
+  double bgd;
+  NDROI *pROI;
+  int roi;
+  const char* functionName = "NDPluginROIStat::doComputeStatisticsT";
 
-  if (nBgd > 0) {
-    bgd = bgd/nBgd * nElements;
+  reader.begin(pArray, &codecStatus, errorMessage);
+  while ((pData = (const epicsType *)reader.next(&firstElement, &nElements, &codecStatus, errorMessage))) {
+    for (roi=0; roi<numROIs; ++roi) {
+      if (pROIs[roi].use) accumulateROI(pData, firstElement, nElements, pArray->ndims, &pROIs[roi]);
+    }
+  }
+  reader.end();
+  if (codecStatus != NDCODEC_SUCCESS) {
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s: error reading array: %s\n",
+      functionName, errorMessage);
+    return asynError;
   }
-  pROI->net = pROI->total - bgd;
 
-  if (nElements > 0) {
-    pROI->mean = pROI->total / nElements;
+  for (roi=0; roi<numROIs; ++roi) {
+    pROI = &pROIs[roi];
+    if (!pROI->use) continue;
+    nElements = pROI->size[0];
+    if (pArray->ndims == 2) nElements *= pROI->size[1];
+    bgd = 0;
+    if (pROI->bgdElements > 0) {
+      bgd = pROI->bgdTotal/pROI->bgdElements * nElements;
+    }
+    pROI->net = pROI->total - bgd;
+    if (nElements > 0) {
+      pROI->mean = pROI->total / nElements;
+    }
   }
 
   return asynSuccess;
@@ -142,43 +165,63 @@ asynStatus NDPluginROIStat::doComputeStatisticsT(NDArray *pArray, NDROI *pROI)
 /**
  * Call the templated doComputeStatistics so we can cast correctly.
  * \param[in] pArray The pointer to the NDArray object
- * \param[in] pROI The pointer to the NDROI object
+ * \param[in] pROIs The NDROI objects
+ * \param[in] numROIs The number of NDROI objects
  * \return asynStatus
  */
-asynStatus NDPluginROIStat::doComputeStatistics(NDArray *pArray, NDROI_t *pROI)
+asynStatus NDPluginROIStat::doComputeStatistics(NDArray *pArray, NDROI_t *pROIs, int numROIs)
 {
   asynStatus status = asynSuccess;
+  NDROI *pROI;
+  int roi;
+
+  for (roi=0; roi<numROIs; ++roi) {
+    pROI = &pROIs[roi];
+    pROI->min = 0;
+    pROI->max = 0;
+    pROI->total = 0;
+    pROI->mean = 0;
+    pROI->net = 0;
+    pROI->nElements = 0;
+    pROI->bgdTotal = 0;
+    pROI->bgdElements = 0;
+  }
+
+  // This plugin only works with 1-D or 2-D arrays, processCallbacks() reports other arrays
+  if ((pArray->ndims < 1) || (pArray->ndims > 2)) {
+    return asynSuccess;
+  }
 
   switch(pArray->dataType) {
   case NDInt8:
-    status = doComputeStatisticsT<epicsInt8>(pArray, pROI);
+    status = doComputeStatisticsT<epicsInt8>(pArray, pROIs, numROIs);
     break;
   case NDUInt8:
-    status = doComputeStatisticsT<epicsUInt8>(pArray, pROI);
+    status = doComputeStatisticsT<epicsUInt8>(pArray, pROIs, numROIs);
     break;
   case NDInt16:
-    status = doComputeStatisticsT<epicsInt16>(pArray, pROI);
+    status = doComputeStatisticsT<epicsInt16>(pArray, pROIs, numROIs);
     break;
   case NDUInt16:
-    status = doComputeStatisticsT<epicsUInt16>(pArray, pROI);
+    status = doComputeStatisticsT<epicsUInt16>(pArray, pROIs, numROIs);
     break;
   case NDInt32:
-    status = doComputeStatisticsT<epicsInt32>(pArray, pROI);
+    status = doComputeStatisticsT<epicsInt32>(pArray, pROIs, numROIs);
     break;
   case NDUInt32:
-    status = doComputeStatisticsT<epicsUInt32>(pArray, pROI);
+    status = doComputeStatisticsT<epicsUInt32>(pArray, pROIs, numROIs);
     break;
   case NDInt64:
-    status = doComputeStatisticsT<epicsInt64>(pArray, pROI);
+    status = doComputeStatisticsT<epicsInt64>(pArray, pROIs, numROIs);
     break;
   case NDUInt64:
-    status = doComputeStatisticsT<epicsUInt64>(pArray, pROI);
+    status = doComputeStatisticsT<epicsUInt64>(pArray, pROIs, numROIs);
     break;
   case NDFloat32:
-    status = doComputeStatisticsT<epicsFloat32>(pArray, pROI);
+    status = doComputeStatisticsT<epicsFloat32>(pArray, pROIs, numROIs);
     break;
   case NDFloat64:
-    status = doComputeStatisticsT<epicsFloat64>(pArray, pROI);
+    status = doComputeStatisticsT<epicsFloat64>(pArray, pROIs, numROIs);
     break;
   default:
     return asynError;
@@ -266,22 +309,22 @@ void NDPluginROIStat::processCallbacks(NDArray *pArray)
    * pPvt that other threads can access. */
   this->unlock();
 
-  for (int roi=0; roi<maxROIs_; ++roi) {
-    pROI = &pROIs[roi];
-    if (!pROI->use) {
-      continue;
-    }
-    status = doComputeStatistics(pArray, pROI);
-    if (status != asynSuccess) {
-      asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
-        "%s: doComputeStatistics failed. status=%d\n",
-        functionName, status);
-    }
-  }
+  status = doComputeStatistics(pArray, pROIs, maxROIs_);
 
   /* We must enter the loop and exit with the mutex locked */
   this->lock();
 
+  if (status != asynSuccess) {
+    /* The array could not be read, so none of the results are published */
+    asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+      "%s: doComputeStatistics failed. status=%d\n",
+      functionName, status);
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+    callParamCallbacks();
+    delete[] pROIs;
+    return;
+  }
+
   getIntegerParam(NDPluginROIStatTSAcquiring, &TSAcquiring);
 
   for (int roi=0; roi<maxROIs_; ++roi) {
@@ -480,7 +523,7 @@ NDPluginROIStat::NDPluginROIStat(const char *portName, int queueSize, int blocki
              NDArrayPort, NDArrayAddr, maxROIs, maxBuffers, maxMemory,
              asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
              asynInt32ArrayMask | asynFloat64Mask | asynFloat64ArrayMask | asynGenericPointerMask,
-             ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads)
+             ASYN_MULTIDEVICE, 1, priority, stackSize, maxThreads, true)
 {
 //  const char *functionName = "NDPluginROIStat::NDPluginROIStat";
 
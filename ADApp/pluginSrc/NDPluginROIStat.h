@@ -77,6 +77,9 @@ typedef struct NDROI {
     double max;
     double net;
     size_t arraySize[2];
+    size_t nElements;       /* Elements of the ROI read so far */
+    double bgdTotal;        /* Background counts read so far */
+    size_t bgdElements;     /* Background elements read so far */
 } NDROI_t;
 
 
@@ -137,8 +140,8 @@ protected:
 
 private:
 
-    template <typename epicsType> asynStatus doComputeStatisticsT(NDArray *pArray, NDROI_t *pROI);
-    asynStatus doComputeStatistics(NDArray *pArray, NDROI_t *pStats);
+    template <typename epicsType> asynStatus doComputeStatisticsT(NDArray *pArray, NDROI_t *pROIs, int numROIs);
+    asynStatus doComputeStatistics(NDArray *pArray, NDROI_t *pROIs, int numROIs);
     asynStatus clear(epicsUInt32 roi);
     void doTimeSeriesCallbacks();
 
@@ -76,6 +76,8 @@ asynStatus NDPluginScatter::doNDArrayCallbacks(NDArray *pArray, int reason, int
         /* If this is not a multi-device then address is -1, change to 0 */
         if (addr == -1) addr = 0;
         if ((pInterrupt->pasynUser->reason != reason) || (address != addr)) continue;
+        /* Skip lossless clients that have reported that they have no room, unless this is the last node */
+        if ((i < numNodes-1) && (getCredits(pInterrupt->userPvt) == 0)) continue;
         /* Set pasynUser->auxStatus to asynOverflow.
          * This is a flag that means return without generating an error if the queue is full.
          * We don't set this for the last node because if the last node cannot queue the array
@@ -89,6 +91,23 @@ asynStatus NDPluginScatter::doNDArrayCallbacks(NDArray *pArray, int reason, int
     return asynSuccess;
 }
 
+/** Returns the number of arrays that the lossless clients can accept between them.
+  * Each array goes to only one client, so this is the sum rather than the minimum of their credits,
+  * or -1 if there are no lossless clients. */
+int NDPluginScatter::getCredits()
+{
+    std::map<void *, int>::iterator it;
+    int credits = -1;
+
+    creditMutex_->lock();
+    for (it=credits_.begin(); it!=credits_.end(); ++it) {
+        if (credits < 0) credits = 0;
+        credits += it->second;
+    }
+    creditMutex_->unlock();
+    return credits;
+}
+
 /** Constructor for NDPluginScatter; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
   *
   * \param[in] portName The name of the asyn port driver to be created.
@@ -15,6 +15,8 @@ public:
                       int priority, int stackSize);
     /* These methods override the virtual methods in the base class */
     void processCallbacks(NDArray *pArray);
+    using NDPluginDriver::getCredits;
+    int getCredits();
 
 protected:
     int NDPluginScatterMethod;
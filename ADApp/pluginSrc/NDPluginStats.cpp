@@ -13,6 +13,7 @@
 #include <iocsh.h>
 
 #include "NDPluginStats.h"
+#include "NDPluginCodec.h"
 
 #include <epicsExport.h>
 
@@ -26,23 +27,45 @@
 
 static const char *driverName="NDPluginStats";
 
+/* The statistics and the histogram are accumulated block by block, so that they can be computed
+ * in one pass over the blocks of a compressed array as NDCodecBlockReader decompresses them. */
 template <typename epicsType>
-asynStatus NDPluginStats::doComputeHistogramT(NDArray *pArray, NDStats_t *pStats)
+static void accumulateStatistics(const epicsType *pData, size_t firstElement, size_t nElements,
+                                 NDStats_t *pStats, size_t *imin, size_t *imax)
 {
-    epicsType *pData = (epicsType *)pArray->pData;
     size_t i;
-    double scale, entropy;
-    int bin;
-    size_t nElements;
-    double value, counts;
-    NDArrayInfo arrayInfo;
+    double value;
 
-    pArray->getInfo(&arrayInfo);
-    nElements = arrayInfo.nElements;
-    scale = (pStats->histSize - 1) / (pStats->histMax - pStats->histMin);
+    if (firstElement == 0) {
+        pStats->min = (double) pData[0];
+        *imin = 0;
+        pStats->max = (double) pData[0];
+        *imax = 0;
+        pStats->total = 0.;
+        pStats->sigma = 0.;
+    }
+    for (i=0; i<nElements; i++) {
+        value = (double)pData[i];
+        if (value < pStats->min) {
+            pStats->min = value;
+            *imin = firstElement + i;
+        }
+        if (value > pStats->max) {
+            pStats->max = value;
+            *imax = firstElement + i;
+        }
+        pStats->total += value;
+        pStats->sigma += value * value;
+    }
+}
+
+template <typename epicsType>
+static void accumulateHistogram(const epicsType *pData, size_t nElements, NDStats_t *pStats, double scale)
+{
+    size_t i;
+    int bin;
+    double value;
 
-    pStats->histBelow = 0;
-    pStats->histAbove = 0;
     for (i=0; i<nElements; i++) {
         value = (double)pData[i];
         bin = (int)(((value - pStats->histMin) * scale) + 0.5);
@@ -53,138 +76,106 @@ asynStatus NDPluginStats::doComputeHistogramT(NDArray *pArray, NDStats_t *pStats
         else
             pStats->histogram[bin]++;
     }
-
-    entropy = 0;
-    for (i=0; (int)i<pStats->histSize; i++) {
-        counts = pStats->histogram[i];
-        if (counts <= 0) counts = 1;
-        entropy += counts * log(counts);
-    }
-    entropy = -entropy / nElements;
-    pStats->histEntropy = entropy;
-
-    return(asynSuccess);
-}
-
-asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray, NDStats_t *pStats)
-{
-    asynStatus status;
-
-    switch(pArray->dataType) {
-        case NDInt8:
-            status = doComputeHistogramT<epicsInt8>(pArray, pStats);
-            break;
-        case NDUInt8:
-            status = doComputeHistogramT<epicsUInt8>(pArray, pStats);
-            break;
-        case NDInt16:
-            status = doComputeHistogramT<epicsInt16>(pArray, pStats);
-            break;
-        case NDUInt16:
-            status = doComputeHistogramT<epicsUInt16>(pArray, pStats);
-            break;
-        case NDInt32:
-            status = doComputeHistogramT<epicsInt32>(pArray, pStats);
-            break;
-        case NDUInt32:
-            status = doComputeHistogramT<epicsUInt32>(pArray, pStats);
-            break;
-        case NDInt64:
-            status = doComputeHistogramT<epicsInt64>(pArray, pStats);
-            break;
-        case NDUInt64:
-            status = doComputeHistogramT<epicsUInt64>(pArray, pStats);
-            break;
-        case NDFloat32:
-            status = doComputeHistogramT<epicsFloat32>(pArray, pStats);
-            break;
-        case NDFloat64:
-            status = doComputeHistogramT<epicsFloat64>(pArray, pStats);
-            break;
-        default:
-            status = asynError;
-        break;
-    }
-    return(status);
 }
 
 template <typename epicsType>
-void NDPluginStats::doComputeStatisticsT(NDArray *pArray, NDStats_t *pStats)
+int NDPluginStats::doComputeReductionsT(NDArray *pArray, NDStats_t *pStats, bool statistics, bool histogram)
 {
-    size_t i, imin, imax;
-    epicsType *pData = (epicsType *)pArray->pData;
+    NDCodecBlockReader reader;
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    char errorMessage[256] = "";
+    const epicsType *pData;
+    size_t i, firstElement, nElements, imin=0, imax=0;
+    double scale=0., entropy, counts;
     NDArrayInfo arrayInfo;
-    double value;
+    static const char *functionName = "doComputeReductionsT";
 
     pArray->getInfo(&arrayInfo);
-    pStats->nElements = arrayInfo.nElements;
-    pStats->min = (double) pData[0];
-    imin = 0;
-    pStats->max = (double) pData[0];
-    imax = 0;
-    pStats->total = 0.;
-    pStats->sigma = 0.;
-    for (i=0; i<pStats->nElements; i++) {
-        value = (double)pData[i];
-        if (value < pStats->min) {
-            pStats->min = value;
-            imin = i;
-        }
-        if (value > pStats->max) {
-            pStats->max = value;
-            imax = i;
+    if (histogram) {
+        scale = (pStats->histSize - 1) / (pStats->histMax - pStats->histMin);
+        pStats->histBelow = 0;
+        pStats->histAbove = 0;
+    }
+
+    reader.begin(pArray, &codecStatus, errorMessage);
+    while ((pData = (const epicsType *)reader.next(&firstElement, &nElements, &codecStatus, errorMessage))) {
+        if (statistics) accumulateStatistics(pData, firstElement, nElements, pStats, &imin, &imax);
+        if (histogram) accumulateHistogram(pData, nElements, pStats, scale);
+    }
+    reader.end();
+    if (codecStatus != NDCODEC_SUCCESS) {
+        asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error reading array: %s\n",
+            driverName, functionName, errorMessage);
+        return(ND_ERROR);
+    }
+
+    if (statistics) {
+        pStats->nElements = arrayInfo.nElements;
+        pStats->minX = imin % arrayInfo.xSize;
+        pStats->minY = imin / arrayInfo.xSize;
+        pStats->maxX = imax % arrayInfo.xSize;
+        pStats->maxY = imax / arrayInfo.xSize;
+        pStats->net = pStats->total;
+        pStats->mean = pStats->total / pStats->nElements;
+        pStats->sigma = sqrt((pStats->sigma / pStats->nElements) - (pStats->mean * pStats->mean));
+    }
+
+    if (histogram) {
+        entropy = 0;
+        for (i=0; (int)i<pStats->histSize; i++) {
+            counts = pStats->histogram[i];
+            if (counts <= 0) counts = 1;
+            entropy += counts * log(counts);
         }
-        pStats->total += value;
-        pStats->sigma += value * value;
+        entropy = -entropy / arrayInfo.nElements;
+        pStats->histEntropy = entropy;
     }
-    pStats->minX = imin % arrayInfo.xSize;
-    pStats->minY = imin / arrayInfo.xSize;
-    pStats->maxX = imax % arrayInfo.xSize;
-    pStats->maxY = imax / arrayInfo.xSize;
-    pStats->net = pStats->total;
-    pStats->mean = pStats->total / pStats->nElements;
-    pStats->sigma = sqrt((pStats->sigma / pStats->nElements) - (pStats->mean * pStats->mean));
+
+    return(ND_SUCCESS);
 }
 
-int NDPluginStats::doComputeStatistics(NDArray *pArray, NDStats_t *pStats)
+/** Computes the statistics and/or the histogram of an array in one pass over the data.
+  * Compressed arrays are decompressed block by block while the reductions are computed,
+  * without allocating the whole uncompressed array. */
+int NDPluginStats::doComputeReductions(NDArray *pArray, NDStats_t *pStats, bool statistics, bool histogram)
 {
 
     switch(pArray->dataType) {
         case NDInt8:
-            doComputeStatisticsT<epicsInt8>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsInt8>(pArray, pStats, statistics, histogram);
         case NDUInt8:
-            doComputeStatisticsT<epicsUInt8>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsUInt8>(pArray, pStats, statistics, histogram);
         case NDInt16:
-            doComputeStatisticsT<epicsInt16>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsInt16>(pArray, pStats, statistics, histogram);
         case NDUInt16:
-            doComputeStatisticsT<epicsUInt16>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsUInt16>(pArray, pStats, statistics, histogram);
         case NDInt32:
-            doComputeStatisticsT<epicsInt32>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsInt32>(pArray, pStats, statistics, histogram);
         case NDUInt32:
-            doComputeStatisticsT<epicsUInt32>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsUInt32>(pArray, pStats, statistics, histogram);
         case NDInt64:
-            doComputeStatisticsT<epicsInt64>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsInt64>(pArray, pStats, statistics, histogram);
         case NDUInt64:
-            doComputeStatisticsT<epicsUInt64>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsUInt64>(pArray, pStats, statistics, histogram);
         case NDFloat32:
-            doComputeStatisticsT<epicsFloat32>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsFloat32>(pArray, pStats, statistics, histogram);
         case NDFloat64:
-            doComputeStatisticsT<epicsFloat64>(pArray, pStats);
-            break;
+            return doComputeReductionsT<epicsFloat64>(pArray, pStats, statistics, histogram);
         default:
             return(ND_ERROR);
         break;
     }
-    return(ND_SUCCESS);
+}
+
+asynStatus NDPluginStats::doComputeHistogram(NDArray *pArray, NDStats_t *pStats)
+{
+    return (doComputeReductions(pArray, pStats, false, true) == ND_SUCCESS) ? asynSuccess : asynError;
+}
+
+int NDPluginStats::doComputeStatistics(NDArray *pArray, NDStats_t *pStats)
+{
+    return doComputeReductions(pArray, pStats, true, false);
 }
 
 template <typename epicsType>
@@ -430,6 +421,9 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     NDStats_t stats, *pStats=&stats, statsTemp, *pStatsTemp=&statsTemp;
     double bgdCounts, avgBgd;
     NDArray *pBgdArray=NULL;
+    NDArray *pInput=pArray;
+    NDCodecStatus_t codecStatus = NDCODEC_SUCCESS;
+    char errorMessage[256] = "";
     int computeStatistics, computeCentroid, computeProfiles, computeHistogram;
     size_t sizeX=0, sizeY=0;
     int i;
@@ -457,6 +451,22 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     if (pArray->ndims == 1) sizeY = 1;
     if (pArray->ndims > 1)  sizeY = pArray->dims[1].size;
 
+    /* The statistics and histogram of a compressed array are computed while it is decompressed
+     * block by block, but the centroid, profiles and background need the whole array */
+    if (!pArray->codec.empty() && (computeCentroid || computeProfiles || (computeStatistics && (bgdWidth > 0)))) {
+        this->unlock();
+        pInput = decompressArray(pArray, 1, &codecStatus, errorMessage);
+        this->lock();
+        if (!pInput) {
+            asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error decompressing array: %s\n",
+                driverName, functionName, errorMessage);
+            NDPluginDriver::endProcessCallbacks(pArray, true, true);
+            callParamCallbacks();
+            return;
+        }
+    }
+
 
     if (computeCentroid || computeProfiles) {
         pStats->profileSizeX = sizeX;
@@ -478,8 +488,27 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     // Release the lock.  While it is released we cannot access the parameter library or class member data.
     this->unlock();
 
+    if (computeStatistics || computeHistogram) {
+        if (doComputeReductions(pInput, pStats, computeStatistics != 0, computeHistogram != 0) != ND_SUCCESS) {
+            /* The array could not be read, so none of the results are published */
+            if (computeCentroid || computeProfiles) {
+                for (i=0; i<MAX_PROFILE_TYPES; i++) {
+                    free(pStats->profileX[i]);
+                    free(pStats->profileY[i]);
+                }
+            }
+            if (computeHistogram) {
+                free(pStats->histogram);
+            }
+            if (pInput != pArray) pInput->release();
+            this->lock();
+            NDPluginDriver::endProcessCallbacks(pArray, true, true);
+            callParamCallbacks();
+            return;
+        }
+    }
+
     if (computeStatistics) {
-        doComputeStatistics(pArray, pStats);
         /* If there is a non-zero background width then compute the background counts */
         // Note that the following algorithm is general in N-dimensions but does have a slight inaccuracy.
         // It computes the background region such that the pixels at the corners are counted twice.
@@ -496,7 +525,7 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
                 pDim = &bgdDims[dim];
                 pDim->offset = 0;
                 pDim->size = MIN((size_t)bgdWidth, pDim->size);
-                this->pNDArrayPool->convert(pArray, &pBgdArray, pArray->dataType, bgdDims);
+                this->pNDArrayPool->convert(pInput, &pBgdArray, pArray->dataType, bgdDims);
                 pDim->size = pArray->dims[dim].size;
                 if (!pBgdArray) {
                     asynPrint(this->pasynUserSelf, ASYN_TRACE_ERROR,
@@ -510,7 +539,7 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
                 bgdCounts += pStatsTemp->total;
                 pDim->offset = MAX(0, (int)(pDim->size - bgdWidth));
                 pDim->size = MIN((size_t)bgdWidth, pArray->dims[dim].size - pDim->offset);
-                this->pNDArrayPool->convert(pArray, &pBgdArray, pArray->dataType, bgdDims);
+                this->pNDArrayPool->convert(pInput, &pBgdArray, pArray->dataType, bgdDims);
                 pDim->offset = 0;
                 pDim->size = pArray->dims[dim].size;
                 if (!pBgdArray) {
@@ -531,16 +560,14 @@ void NDPluginStats::processCallbacks(NDArray *pArray)
     }
 
     if (computeCentroid) {
-         doComputeCentroid(pArray, pStats);
+         doComputeCentroid(pInput, pStats);
     }
 
     if (computeProfiles) {
-        doComputeProfiles(pArray, pStats);
+        doComputeProfiles(pInput, pStats);
     }
 
-    if (computeHistogram) {
-        doComputeHistogram(pArray, pStats);
-    }
+    if (pInput != pArray) pInput->release();
 
     // Take the lock again.  The time-series data need to be protected.
     this->lock();
@@ -769,7 +796,7 @@ NDPluginStats::NDPluginStats(const char *portName, int queueSize, int blockingCa
                    NDArrayPort, NDArrayAddr, 2, maxBuffers, maxMemory,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
                    asynInt32ArrayMask | asynFloat64ArrayMask | asynGenericPointerMask,
-                   0, 1, priority, stackSize, maxThreads)
+                   0, 1, priority, stackSize, maxThreads, true)
 {
     //static const char *functionName = "NDPluginStats";
 
@@ -165,13 +165,14 @@ public:
     asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
     asynStatus writeFloat64(asynUser *pasynUser, epicsFloat64 value);
 
-    template <typename epicsType> void doComputeStatisticsT(NDArray *pArray, NDStats_t *pStats);
+    template <typename epicsType> int doComputeReductionsT(NDArray *pArray, NDStats_t *pStats,
+                                                           bool statistics, bool histogram);
+    int doComputeReductions(NDArray *pArray, NDStats_t *pStats, bool statistics, bool histogram);
     int doComputeStatistics(NDArray *pArray, NDStats_t *pStats);
     template <typename epicsType> asynStatus doComputeCentroidT(NDArray *pArray, NDStats_t *pStats);
     asynStatus doComputeCentroid(NDArray *pArray, NDStats_t *pStats);
     template <typename epicsType> asynStatus doComputeProfilesT(NDArray *pArray, NDStats_t *pStats);
     asynStatus doComputeProfiles(NDArray *pArray, NDStats_t *pStats);
-    template <typename epicsType> asynStatus doComputeHistogramT(NDArray *pArray, NDStats_t *pStats);
     asynStatus doComputeHistogram(NDArray *pArray, NDStats_t *pStats);
 
 protected:
@@ -10,6 +10,9 @@
  */
 
 #include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
 
 #include <iocsh.h>
 
@@ -19,6 +22,162 @@
 
 static const char *driverName="NDPluginStdArrays";
 
+/* Reduces an array of up to 3 dimensions by an integer factor in each dimension, either by taking
+ * the first element of each block (decimation) or the mean of the block (binning).
+ * The innermost loops run over contiguous memory so that the compiler can vectorize them. */
+template <typename epicsType>
+static void previewKernel(const epicsType *pIn, epicsType *pOut, const size_t *inDims,
+                          const size_t *outDims, const size_t *factors, bool bin)
+{
+    size_t in0=inDims[0], in1=inDims[1];
+    size_t f0=factors[0], f1=factors[1], f2=factors[2];
+    size_t out0=outDims[0], out1=outDims[1], out2=outDims[2];
+
+    if (!bin) {
+        for (size_t o2=0; o2<out2; o2++) {
+            for (size_t o1=0; o1<out1; o1++) {
+                const epicsType *pRow = pIn + (o2*f2*in1 + o1*f1)*in0;
+                for (size_t o0=0; o0<out0; o0++) {
+                    *pOut++ = pRow[o0*f0];
+                }
+            }
+        }
+        return;
+    }
+
+    std::vector<double> acc(out0);
+    double scale = 1.0/(double)(f0*f1*f2);
+    for (size_t o2=0; o2<out2; o2++) {
+        for (size_t o1=0; o1<out1; o1++) {
+            std::fill(acc.begin(), acc.end(), 0.);
+            for (size_t i2=o2*f2; i2<(o2+1)*f2; i2++) {
+                for (size_t i1=o1*f1; i1<(o1+1)*f1; i1++) {
+                    const epicsType *pRow = pIn + (i2*in1 + i1)*in0;
+                    if (f0 == 1) {
+                        for (size_t o0=0; o0<out0; o0++) acc[o0] += pRow[o0];
+                    } else {
+                        for (size_t o0=0; o0<out0; o0++) {
+                            const epicsType *pBlock = pRow + o0*f0;
+                            double sum = 0.;
+                            for (size_t k=0; k<f0; k++) sum += pBlock[k];
+                            acc[o0] += sum;
+                        }
+                    }
+                }
+            }
+            for (size_t o0=0; o0<out0; o0++) {
+                *pOut++ = (epicsType)(acc[o0]*scale);
+            }
+        }
+    }
+}
+
+/** Creates a reduced copy of an array for display clients.
+  * The X and Y dimensions are reduced by the smallest integer factor that makes the array no larger than
+  * maxElements; the color dimension of RGB arrays is not reduced.
+  * \param[in] pArray The input array, which must not be compressed.
+  * \param[in] previewMode NDStdArraysPreviewDecimate or NDStdArraysPreviewBin.
+  * \param[in] maxElements The maximum number of elements in the output array.
+  * \param[out] factorX The reduction factor that was used in X.
+  * \param[out] factorY The reduction factor that was used in Y. The factors of the two dimensions differ
+  * when the factor is limited by the size of one of them.
+  * \return Returns pArray with an extra reference if it is already small enough, a new array from
+  * the pool otherwise, or NULL on error. */
+NDArray *NDPluginStdArrays::createPreview(NDArray *pArray, int previewMode, size_t maxElements, int *factorX, int *factorY)
+{
+    NDArrayInfo_t arrayInfo;
+    size_t inDims[3] = {1, 1, 1};
+    size_t outDims[3];
+    size_t factors[3];
+    bool reduce[3] = {false, false, false};
+    size_t f, nOut;
+    int i;
+    NDArray *pOutput;
+    static const char *functionName = "createPreview";
+
+    *factorX = 1;
+    *factorY = 1;
+    pArray->getInfo(&arrayInfo);
+    if ((maxElements == 0) || (arrayInfo.nElements <= maxElements) || (pArray->ndims > 3)) {
+        pArray->reserve();
+        return pArray;
+    }
+    for (i=0; i<pArray->ndims; i++) inDims[i] = pArray->dims[i].size;
+    reduce[arrayInfo.xDim] = true;
+    if (pArray->ndims > 1) reduce[arrayInfo.yDim] = true;
+
+    /* Start from the factor that would be exact for a square image and increase it until the output fits */
+    if (pArray->ndims == 1) f = (arrayInfo.nElements + maxElements - 1) / maxElements;
+    else f = (size_t)ceil(sqrt((double)arrayInfo.nElements / (double)maxElements));
+    if (f < 2) f = 2;
+    while (1) {
+        bool fullyReduced = true;
+        nOut = 1;
+        for (i=0; i<3; i++) {
+            factors[i] = reduce[i] ? std::min(f, inDims[i]) : 1;
+            outDims[i] = inDims[i] / factors[i];
+            if (reduce[i] && (outDims[i] > 1)) fullyReduced = false;
+            nOut *= outDims[i];
+        }
+        if ((nOut <= maxElements) || fullyReduced) break;
+        f++;
+    }
+
+    pOutput = this->pNDArrayPool->alloc(pArray->ndims, outDims, pArray->dataType, 0, NULL);
+    if (!pOutput) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error allocating preview array\n",
+            driverName, functionName);
+        return NULL;
+    }
+    for (i=0; i<pArray->ndims; i++) {
+        pOutput->dims[i].offset  = pArray->dims[i].offset;
+        pOutput->dims[i].binning = pArray->dims[i].binning * (int)factors[i];
+        pOutput->dims[i].reverse = pArray->dims[i].reverse;
+    }
+    pOutput->uniqueId  = pArray->uniqueId;
+    pOutput->timeStamp = pArray->timeStamp;
+    pOutput->epicsTS   = pArray->epicsTS;
+    pArray->pAttributeList->copy(pOutput->pAttributeList);
+
+    bool bin = (previewMode == NDStdArraysPreviewBin);
+    switch (pArray->dataType) {
+        case NDInt8:
+            previewKernel<epicsInt8>((epicsInt8 *)pArray->pData, (epicsInt8 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDUInt8:
+            previewKernel<epicsUInt8>((epicsUInt8 *)pArray->pData, (epicsUInt8 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDInt16:
+            previewKernel<epicsInt16>((epicsInt16 *)pArray->pData, (epicsInt16 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDUInt16:
+            previewKernel<epicsUInt16>((epicsUInt16 *)pArray->pData, (epicsUInt16 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDInt32:
+            previewKernel<epicsInt32>((epicsInt32 *)pArray->pData, (epicsInt32 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDUInt32:
+            previewKernel<epicsUInt32>((epicsUInt32 *)pArray->pData, (epicsUInt32 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDInt64:
+            previewKernel<epicsInt64>((epicsInt64 *)pArray->pData, (epicsInt64 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDUInt64:
+            previewKernel<epicsUInt64>((epicsUInt64 *)pArray->pData, (epicsUInt64 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDFloat32:
+            previewKernel<epicsFloat32>((epicsFloat32 *)pArray->pData, (epicsFloat32 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+        case NDFloat64:
+            previewKernel<epicsFloat64>((epicsFloat64 *)pArray->pData, (epicsFloat64 *)pOutput->pData, inDims, outDims, factors, bin);
+            break;
+    }
+    *factorX = (int)factors[arrayInfo.xDim];
+    if (pArray->ndims > 1) *factorY = (int)factors[arrayInfo.yDim];
+    return pOutput;
+}
+
 template <typename epicsType, typename interruptType>
 void NDPluginStdArrays::arrayInterruptCallback(NDArray *pArray, NDArrayPool *pNDArrayPool,
                             void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled)
@@ -153,10 +312,30 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
     int float32Initialized=0;
     int float64Initialized=0;
     bool wasThrottled=false;
+    int previewMode;
     NDArrayInfo_t arrayInfo;
     asynStandardInterfaces *pInterfaces = this->getAsynStdInterfaces();
     /* static const char* functionName = "processCallbacks"; */
 
+    /* In preview mode the clients get a reduced copy of the array; the rate is limited with MinCallbackTime.
+     * Compressed arrays cannot be reduced and are passed unchanged. */
+    getIntegerParam(NDPluginStdArraysPreviewMode, &previewMode);
+    if ((previewMode != NDStdArraysPreviewOff) && pArray->codec.empty()) {
+        int maxElements, factorX, factorY;
+        getIntegerParam(NDPluginStdArraysPreviewMaxElements, &maxElements);
+        /* The array is only read here so this can be done without the mutex */
+        this->unlock();
+        pArray = createPreview(pArray, previewMode, maxElements > 0 ? (size_t)maxElements : 0, &factorX, &factorY);
+        this->lock();
+        if (!pArray) return;
+        setIntegerParam(NDPluginStdArraysPreviewFactorX, factorX);
+        setIntegerParam(NDPluginStdArraysPreviewFactorY, factorY);
+    } else {
+        setIntegerParam(NDPluginStdArraysPreviewFactorX, 1);
+        setIntegerParam(NDPluginStdArraysPreviewFactorY, 1);
+        pArray->reserve();
+    }
+
     /* Call the base class method */
     NDPluginDriver::beginProcessCallbacks(pArray);
 
@@ -213,6 +392,9 @@ void NDPluginStdArrays::processCallbacks(NDArray *pArray)
     // Do NDArray callbacks (rarely needed for this plugin).  We need to copy the array and get the attributes
     NDPluginDriver::endProcessCallbacks(pArray, true, true);
 
+    // Release the reference taken above, on the input array or the preview we created
+    pArray->release();
+
     callParamCallbacks();
 }
 
@@ -333,11 +515,23 @@ NDPluginStdArrays::NDPluginStdArrays(const char *portName, int queueSize, int bl
 {
     //static const char *functionName = "NDPluginStdArrays";
 
-    createParam(NDPluginStdArraysDataString, asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysDataString,               asynParamGenericPointer, &NDPluginStdArraysData);
+    createParam(NDPluginStdArraysPreviewModeString,        asynParamInt32,          &NDPluginStdArraysPreviewMode);
+    createParam(NDPluginStdArraysPreviewMaxElementsString, asynParamInt32,          &NDPluginStdArraysPreviewMaxElements);
+    createParam(NDPluginStdArraysPreviewFactorXString,     asynParamInt32,          &NDPluginStdArraysPreviewFactorX);
+    createParam(NDPluginStdArraysPreviewFactorYString,     asynParamInt32,          &NDPluginStdArraysPreviewFactorY);
+
+    setIntegerParam(NDPluginStdArraysPreviewMode,        NDStdArraysPreviewOff);
+    setIntegerParam(NDPluginStdArraysPreviewMaxElements, 1024*1024);
+    setIntegerParam(NDPluginStdArraysPreviewFactorX,     1);
+    setIntegerParam(NDPluginStdArraysPreviewFactorY,     1);
 
     /* Set the plugin type string */
     setStringParam(NDPluginDriverPluginType, "NDPluginStdArrays");
 
+    // Arrays for display are the first to be shed when an NDArrayPool runs out of memory
+    setPriorityClass(NDPriorityLow);
+
     // Disable ArrayCallbacks.
     // This plugin currently does not do array callbacks, so make the setting reflect the behavior
     setIntegerParam(NDArrayCallbacks, 0);
@@ -3,7 +3,18 @@
 
 #include "NDPluginDriver.h"
 
-#define NDPluginStdArraysDataString "STD_ARRAY_DATA"           /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysDataString               "STD_ARRAY_DATA"                 /* (asynXXXArray, r/w) Array data waveform */
+#define NDPluginStdArraysPreviewModeString        "STD_ARRAY_PREVIEW_MODE"         /* (asynInt32,    r/w) Preview mode (Off, Decimate, Bin) */
+#define NDPluginStdArraysPreviewMaxElementsString "STD_ARRAY_PREVIEW_MAX_ELEMENTS" /* (asynInt32,    r/w) Maximum elements in preview arrays */
+#define NDPluginStdArraysPreviewFactorXString     "STD_ARRAY_PREVIEW_FACTOR_X"     /* (asynInt32,    r/o) Reduction factor used in X */
+#define NDPluginStdArraysPreviewFactorYString     "STD_ARRAY_PREVIEW_FACTOR_Y"     /* (asynInt32,    r/o) Reduction factor used in Y */
+
+/** Preview modes */
+typedef enum {
+    NDStdArraysPreviewOff,      /**< Output the full array */
+    NDStdArraysPreviewDecimate, /**< Output every Nth element in X and Y */
+    NDStdArraysPreviewBin       /**< Output the mean of NxN blocks in X and Y */
+} NDStdArraysPreviewMode_t;
 
 /** Converts NDArray callback data into standard asyn arrays (asynInt8Array, asynInt16Array, asynInt32Array, asynInt64Array,
   * asynFloat32Array or asynFloat64Array); normally used for putting NDArray data in EPICS waveform records.
@@ -32,14 +43,18 @@ public:
 protected:
     int NDPluginStdArraysData;
     #define FIRST_NDPLUGIN_STDARRAYS_PARAM NDPluginStdArraysData
+    int NDPluginStdArraysPreviewMode;
+    int NDPluginStdArraysPreviewMaxElements;
+    int NDPluginStdArraysPreviewFactorX;
+    int NDPluginStdArraysPreviewFactorY;
 private:
     /* These methods are just for this class */
+    NDArray *createPreview(NDArray *pArray, int previewMode, size_t maxElements, int *factorX, int *factorY);
     template <typename epicsType> asynStatus readArray(asynUser *pasynUser, epicsType *value,
                                         size_t nElements, size_t *nIn, NDDataType_t outputType);
     template <typename epicsType, typename interruptType> void arrayInterruptCallback(NDArray *pArray,
                             NDArrayPool *pNDArrayPool,
                             void *interruptPvt, int *initialized, NDDataType_t signedType, bool *wasThrottled);
-
 };
 
 #endif
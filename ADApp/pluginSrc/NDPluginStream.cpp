@@ -0,0 +1,730 @@
+/*
+ * NDPluginStream.cpp
+ *
+ * Streams NDArrays to TCP clients as a fixed binary header followed by the raw array data.
+ * On Linux the data can be sent with MSG_ZEROCOPY, in which case each NDArray is kept
+ * reserved until the kernel reports that it has finished with the buffer.
+ *
+ * Created October 2026
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <epicsString.h>
+#include <osiSock.h>
+#include <iocsh.h>
+
+#ifndef _WIN32
+  #include <sys/uio.h>
+  #include <poll.h>
+#endif
+#ifdef __linux__
+  #include <linux/errqueue.h>
+#endif
+
+#include "NDPluginStream.h"
+
+#include <epicsExport.h>
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+  #define ND_STREAM_HAVE_ZEROCOPY 1
+#endif
+
+#ifdef MSG_NOSIGNAL
+  #define ND_STREAM_SEND_FLAGS MSG_NOSIGNAL
+#else
+  #define ND_STREAM_SEND_FLAGS 0
+#endif
+
+/* Milliseconds to wait for zero-copy completions before checking whether the client is closing */
+#define ND_STREAM_COMPLETION_TIMEOUT_MS 100
+
+static const char *driverName="NDPluginStream";
+
+static void listenTaskC(void *drvPvt)
+{
+    NDPluginStream *pPvt = (NDPluginStream *)drvPvt;
+
+    pPvt->listenTask();
+}
+
+static void senderTaskC(void *drvPvt)
+{
+    NDStreamClient *pPvt = (NDStreamClient *)drvPvt;
+
+    pPvt->senderTask();
+}
+
+NDStreamClient::NDStreamClient(NDPluginStream *pPlugin, int index)
+    : pPlugin_(pPlugin), index_(index), fd_(INVALID_SOCKET), state_(NDStreamClientFree),
+      zeroCopy_(false), nextSeq_(0), sent_(0), dropped_(0), bytesSent_(0.)
+{
+    peer_[0] = 0;
+    mutex_ = epicsMutexMustCreate();
+    wakeEvent_ = epicsEventMustCreate(epicsEventEmpty);
+}
+
+NDStreamClient::~NDStreamClient()
+{
+    epicsEventDestroy(wakeEvent_);
+    epicsMutexDestroy(mutex_);
+}
+
+/** Releases all arrays that are queued or in flight for this client.
+  * Called by the sender thread after the socket has been closed, so the kernel no longer
+  * references any of the buffers. */
+void NDStreamClient::releaseAll()
+{
+    epicsMutexLock(mutex_);
+    while (!queue_.empty()) {
+        queue_.front()->release();
+        queue_.pop_front();
+    }
+    while (!inFlight_.empty()) {
+        inFlight_.front().pArray->release();
+        inFlight_.pop_front();
+    }
+    epicsMutexUnlock(mutex_);
+}
+
+/** Reads zero-copy completion notifications from the socket error queue and releases the
+  * arrays whose buffers the kernel no longer needs.
+  * \param[in] wait If true block until at least one notification has been read or the client is closing.
+  * Returns 0 on success, -1 if the connection has failed. */
+int NDStreamClient::reapCompletions(bool wait)
+{
+#ifdef ND_STREAM_HAVE_ZEROCOPY
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    bool gotOne = false;
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) return -1;
+            if (!wait || gotOne || (state_ != NDStreamClientConnected)) return 0;
+            struct pollfd pfd = {fd_, 0, 0};
+            poll(&pfd, 1, ND_STREAM_COMPLETION_TIMEOUT_MS);
+            if (pfd.revents & POLLHUP) return -1;
+            continue;
+        }
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if ((serr->ee_errno != 0) || (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)) continue;
+            /* Notifications cover the range [ee_info, ee_data] and arrive in order on TCP sockets */
+            epicsUInt32 hi = serr->ee_data;
+            gotOne = true;
+            epicsMutexLock(mutex_);
+            while (!inFlight_.empty() && inFlight_.front().submitted &&
+                   ((epicsInt32)(inFlight_.front().lastSeq - hi) <= 0)) {
+                inFlight_.front().pArray->release();
+                inFlight_.pop_front();
+            }
+            epicsMutexUnlock(mutex_);
+        }
+    }
+#else
+    return 0;
+#endif
+}
+
+/** Writes the header and data for one array, looping over partial writes.
+  * Returns 0 on success, -1 if the connection has failed. */
+int NDStreamClient::sendBuffers(NDStreamInFlight *pEntry, const char *pData, size_t dataSize)
+{
+    const char *base[2] = {(const char *)&pEntry->header, pData};
+    size_t remaining[2] = {sizeof(pEntry->header), dataSize};
+    int first = 0;
+
+    while (first < 2) {
+        if (remaining[first] == 0) {
+            first++;
+            continue;
+        }
+#ifdef _WIN32
+        int n = send(fd_, base[first], (int)remaining[first], 0);
+#else
+        struct iovec iov[2];
+        struct msghdr msg;
+        int niov = 0;
+        int flags = ND_STREAM_SEND_FLAGS;
+        for (int i=first; i<2; i++) {
+            if (remaining[i] == 0) continue;
+            iov[niov].iov_base = (void *)base[i];
+            iov[niov].iov_len = remaining[i];
+            niov++;
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = niov;
+  #ifdef ND_STREAM_HAVE_ZEROCOPY
+        if (zeroCopy_) flags |= MSG_ZEROCOPY;
+  #endif
+        ssize_t n = sendmsg(fd_, &msg, flags);
+#endif
+        if (n < 0) {
+            if (errno == EINTR) continue;
+#ifdef ND_STREAM_HAVE_ZEROCOPY
+            /* The socket option memory is exhausted by outstanding notifications; drain them and retry */
+            if (zeroCopy_ && (errno == ENOBUFS)) {
+                if (reapCompletions(true)) return -1;
+                continue;
+            }
+#endif
+            return -1;
+        }
+#ifdef ND_STREAM_HAVE_ZEROCOPY
+        if (zeroCopy_) pEntry->lastSeq = nextSeq_++;
+#endif
+        size_t written = (size_t)n;
+        while ((written > 0) && (first < 2)) {
+            size_t chunk = (written < remaining[first]) ? written : remaining[first];
+            base[first] += chunk;
+            remaining[first] -= chunk;
+            written -= chunk;
+            if (remaining[first] == 0) first++;
+        }
+    }
+    return 0;
+}
+
+/** Sends one array to this client.  The array is released when the kernel is done with it.
+  * Returns 0 on success, -1 if the connection has failed. */
+int NDStreamClient::sendArray(NDArray *pArray)
+{
+    NDArrayInfo_t info;
+    NDAttribute *pAttribute;
+    NDStreamInFlight entry;
+    NDStreamInFlight *pEntry;
+    int colorMode = NDColorModeMono;
+    size_t dataSize;
+    int status;
+
+    pArray->getInfo(&info);
+    dataSize = pArray->codec.empty() ? info.totalBytes : pArray->compressedSize;
+    pAttribute = pArray->pAttributeList->find("ColorMode");
+    if (pAttribute) pAttribute->getValue(NDAttrInt32, &colorMode);
+
+    memset(&entry, 0, sizeof(entry));
+    entry.pArray = pArray;
+    entry.header.magic            = ND_STREAM_MAGIC;
+    entry.header.version          = ND_STREAM_VERSION;
+    entry.header.headerSize       = sizeof(NDStreamHeader);
+    entry.header.uniqueId         = pArray->uniqueId;
+    entry.header.dataType         = pArray->dataType;
+    entry.header.ndims            = pArray->ndims;
+    entry.header.colorMode        = colorMode;
+    for (int i=0; i<pArray->ndims; i++) entry.header.dims[i] = pArray->dims[i].size;
+    entry.header.timeStamp        = pArray->timeStamp;
+    entry.header.epicsTSSec       = pArray->epicsTS.secPastEpoch;
+    entry.header.epicsTSNsec      = pArray->epicsTS.nsec;
+    entry.header.uncompressedSize = info.totalBytes;
+    entry.header.dataSize         = dataSize;
+    strncpy(entry.header.codec, pArray->codec.name.c_str(), ND_STREAM_CODEC_LEN-1);
+
+    /* The header must live at a stable address until the send completes */
+    epicsMutexLock(mutex_);
+    inFlight_.push_back(entry);
+    pEntry = &inFlight_.back();
+    epicsMutexUnlock(mutex_);
+
+    status = sendBuffers(pEntry, (const char *)pArray->pData, dataSize);
+
+    epicsMutexLock(mutex_);
+    if (status == 0) {
+        inFlight_.back().submitted = true;
+        sent_++;
+        bytesSent_ += (double)(sizeof(NDStreamHeader) + dataSize);
+    }
+    if (!zeroCopy_) {
+        /* The kernel has copied the data, the array can be released now */
+        inFlight_.back().pArray->release();
+        inFlight_.pop_back();
+    }
+    epicsMutexUnlock(mutex_);
+    if (status) return status;
+    return reapCompletions(false);
+}
+
+/** Thread that sends the queued arrays to one client.  It runs from the time the client
+  * connects until the connection fails or the client is disconnected. */
+void NDStreamClient::senderTask()
+{
+    NDArray *pArray;
+    static const char *functionName = "senderTask";
+
+    while (1) {
+        epicsMutexLock(mutex_);
+        while (queue_.empty() && (state_ == NDStreamClientConnected)) {
+            bool pending = zeroCopy_ && !inFlight_.empty();
+            epicsMutexUnlock(mutex_);
+            if (pending) {
+                if (reapCompletions(false)) {
+                    epicsMutexLock(mutex_);
+                    state_ = NDStreamClientClosing;
+                    break;
+                }
+                epicsEventWaitWithTimeout(wakeEvent_, ND_STREAM_COMPLETION_TIMEOUT_MS/1000.);
+            } else {
+                epicsEventWait(wakeEvent_);
+            }
+            epicsMutexLock(mutex_);
+        }
+        if (state_ != NDStreamClientConnected) {
+            epicsMutexUnlock(mutex_);
+            break;
+        }
+        pArray = queue_.front();
+        queue_.pop_front();
+        epicsMutexUnlock(mutex_);
+
+        if (sendArray(pArray)) {
+            asynPrint(pPlugin_->pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s::%s client %d (%s) send failed, errno=%d, disconnecting\n",
+                driverName, functionName, index_, peer_, errno);
+            break;
+        }
+    }
+
+    if (zeroCopy_) {
+        /* Abort rather than linger so that the kernel drops any data still referencing our buffers */
+        struct linger lingerOpt = {1, 0};
+        setsockopt(fd_, SOL_SOCKET, SO_LINGER, (char *)&lingerOpt, sizeof(lingerOpt));
+    }
+    epicsSocketDestroy(fd_);
+    releaseAll();
+    epicsMutexLock(mutex_);
+    fd_ = INVALID_SOCKET;
+    state_ = NDStreamClientFree;
+    epicsMutexUnlock(mutex_);
+    pPlugin_->clientDisconnected(index_);
+}
+
+/** Thread that accepts connections from clients on the TCP port. */
+void NDPluginStream::listenTask()
+{
+    struct sockaddr_in clientAddr;
+    osiSocklen_t addrLen;
+    int fd;
+    int zeroCopy;
+    static const char *functionName = "listenTask";
+
+    while (1) {
+        addrLen = sizeof(clientAddr);
+        fd = epicsSocketAccept(listenFd_, (struct sockaddr *)&clientAddr, &addrLen);
+        if (fd == INVALID_SOCKET) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s accept failed, errno=%d\n",
+                driverName, functionName, SOCKERRNO);
+            epicsThreadSleep(1.0);
+            continue;
+        }
+
+        lock();
+        NDStreamClient *pClient = 0;
+        for (int i=0; i<maxClients_; i++) {
+            epicsMutexLock(clients_[i]->mutex_);
+            bool isFree = (clients_[i]->state_ == NDStreamClientFree);
+            epicsMutexUnlock(clients_[i]->mutex_);
+            if (isFree) {
+                pClient = clients_[i];
+                break;
+            }
+        }
+        if (!pClient) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_WARNING,
+                "%s::%s maximum number of clients (%d) connected, rejecting connection\n",
+                driverName, functionName, maxClients_);
+            epicsSocketDestroy(fd);
+            unlock();
+            continue;
+        }
+
+        int one = 1;
+        bool clientZeroCopy = false;
+        char peer[sizeof(pClient->peer_)];
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof(one));
+        getIntegerParam(NDPluginStreamZeroCopy, &zeroCopy);
+#ifdef ND_STREAM_HAVE_ZEROCOPY
+        if (zeroCopy && (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0)) {
+            clientZeroCopy = true;
+        }
+#endif
+        ipAddrToDottedIP(&clientAddr, peer, sizeof(peer));
+
+        // processCallbacks and updateClientParams read the slot under its mutex on other threads
+        epicsMutexLock(pClient->mutex_);
+        pClient->zeroCopy_ = clientZeroCopy;
+        pClient->fd_ = fd;
+        pClient->nextSeq_ = 0;
+        pClient->sent_ = 0;
+        pClient->dropped_ = 0;
+        pClient->bytesSent_ = 0.;
+        strcpy(pClient->peer_, peer);
+        pClient->state_ = NDStreamClientConnected;
+        epicsMutexUnlock(pClient->mutex_);
+
+        char taskName[256];
+        epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Stream_%d", portName, pClient->index_);
+        if (!epicsThreadCreate(taskName, this->threadPriority_, this->threadStackSize_,
+                               (EPICSTHREADFUNC)senderTaskC, pClient)) {
+            asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+                "%s::%s error creating sender thread\n",
+                driverName, functionName);
+            epicsMutexLock(pClient->mutex_);
+            pClient->fd_ = INVALID_SOCKET;
+            pClient->state_ = NDStreamClientFree;
+            epicsMutexUnlock(pClient->mutex_);
+            epicsSocketDestroy(fd);
+        } else {
+            asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                "%s::%s client %d connected from %s, zeroCopy=%d\n",
+                driverName, functionName, pClient->index_, peer, clientZeroCopy);
+        }
+        updateClientParams();
+        unlock();
+    }
+}
+
+/** Called by a client's sender thread when its connection has been closed. */
+void NDPluginStream::clientDisconnected(int index)
+{
+    lock();
+    asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+        "%s::clientDisconnected client %d disconnected\n",
+        driverName, index);
+    updateClientParams();
+    unlock();
+}
+
+/** Copies the per-client counters into the parameter library and does callbacks.
+  * Called with the lock held. */
+void NDPluginStream::updateClientParams()
+{
+    int numClients = 0;
+    int totalSent = 0;
+    int totalDropped = 0;
+    double totalBytes = 0.;
+    double elapsed;
+    epicsTimeStamp now;
+
+    for (int i=0; i<maxClients_; i++) {
+        NDStreamClient *pClient = clients_[i];
+        epicsMutexLock(pClient->mutex_);
+        bool connected = (pClient->state_ == NDStreamClientConnected);
+        if (connected) numClients++;
+        setIntegerParam(i, NDPluginStreamClientConnected, connected);
+        setStringParam (i, NDPluginStreamClientAddress,   pClient->peer_);
+        setIntegerParam(i, NDPluginStreamClientQueued,    (int)(pClient->queue_.size() + pClient->inFlight_.size()));
+        setIntegerParam(i, NDPluginStreamClientSent,      pClient->sent_);
+        setIntegerParam(i, NDPluginStreamClientDropped,   pClient->dropped_);
+        setDoubleParam (i, NDPluginStreamClientMBytes,    pClient->bytesSent_/1.e6);
+        totalSent    += pClient->sent_;
+        totalDropped += pClient->dropped_;
+        totalBytes   += pClient->bytesSent_;
+        epicsMutexUnlock(pClient->mutex_);
+    }
+    setIntegerParam(NDPluginStreamNumClients, numClients);
+
+    /* The counters restart when a client reconnects, so only accumulate increases */
+    int prevSent, prevDropped;
+    getIntegerParam(NDPluginStreamTotalSent, &prevSent);
+    getIntegerParam(NDPluginStreamTotalDropped, &prevDropped);
+    if (totalSent > prevSent) setIntegerParam(NDPluginStreamTotalSent, totalSent);
+    if (totalDropped > prevDropped) setIntegerParam(NDPluginStreamTotalDropped, totalDropped);
+
+    epicsTimeGetCurrent(&now);
+    elapsed = epicsTimeDiffInSeconds(&now, &prevRateTime_);
+    if (elapsed >= 1.0) {
+        double rate = (totalBytes >= prevBytesSent_) ? (totalBytes - prevBytesSent_)/elapsed/1.e6 : 0.;
+        setDoubleParam(NDPluginStreamSendRate, rate);
+        prevBytesSent_ = totalBytes;
+        prevRateTime_ = now;
+    }
+    for (int i=0; i<maxClients_; i++) callParamCallbacks(i);
+}
+
+/** Callback function that is called by the NDArray driver with new NDArray data.
+  * Queues the array to every connected client, or counts a drop for clients whose queue is full.
+  * \param[in] pArray  The NDArray from the callback.
+  */
+void NDPluginStream::processCallbacks(NDArray *pArray)
+{
+    int clientQueue;
+    static const char *functionName = "processCallbacks";
+
+    /* Call the base class method */
+    NDPluginDriver::beginProcessCallbacks(pArray);
+
+    getIntegerParam(NDPluginStreamClientQueue, &clientQueue);
+    if (clientQueue < 1) clientQueue = 1;
+
+    for (int i=0; i<maxClients_; i++) {
+        NDStreamClient *pClient = clients_[i];
+        epicsMutexLock(pClient->mutex_);
+        if (pClient->state_ == NDStreamClientConnected) {
+            if ((int)(pClient->queue_.size() + pClient->inFlight_.size()) >= clientQueue) {
+                pClient->dropped_++;
+                asynPrint(pasynUserSelf, ASYN_TRACE_FLOW,
+                    "%s::%s client %d queue full, dropped array uniqueId=%d\n",
+                    driverName, functionName, i, pArray->uniqueId);
+            } else {
+                pArray->reserve();
+                pClient->queue_.push_back(pArray);
+                epicsEventSignal(pClient->wakeEvent_);
+            }
+        }
+        epicsMutexUnlock(pClient->mutex_);
+    }
+    updateClientParams();
+
+    // Cache the array in pArrays[0]; NDArray callbacks are normally disabled for this plugin
+    NDPluginDriver::endProcessCallbacks(pArray, true, true);
+}
+
+/** Called when asyn clients call pasynInt32->write().
+  * \param[in] pasynUser pasynUser structure that encodes the reason and address.
+  * \param[in] value Value to write. */
+asynStatus NDPluginStream::writeInt32(asynUser *pasynUser, epicsInt32 value)
+{
+    int function = pasynUser->reason;
+    int addr;
+    asynStatus status = asynSuccess;
+    static const char *functionName = "writeInt32";
+
+    getAddress(pasynUser, &addr);
+
+    if (function == NDPluginStreamClientDisconnect) {
+        if (value && (addr >= 0) && (addr < maxClients_)) {
+            NDStreamClient *pClient = clients_[addr];
+            epicsMutexLock(pClient->mutex_);
+            if (pClient->state_ == NDStreamClientConnected) {
+                pClient->state_ = NDStreamClientClosing;
+                /* Wake the sender thread whether it is waiting for data or blocked in a send */
+                shutdown(pClient->fd_, 2);
+                epicsEventSignal(pClient->wakeEvent_);
+            }
+            epicsMutexUnlock(pClient->mutex_);
+        }
+        setIntegerParam(addr, function, 0);
+    } else if (function < FIRST_NDPLUGIN_STREAM_PARAM) {
+        /* If this parameter belongs to a base class call its method */
+        return NDPluginDriver::writeInt32(pasynUser, value);
+    } else {
+        status = setIntegerParam(addr, function, value);
+    }
+
+    callParamCallbacks(addr);
+    if (status)
+        asynPrint(pasynUser, ASYN_TRACE_ERROR,
+              "%s::%s error, status=%d function=%d, value=%d\n",
+              driverName, functionName, status, function, value);
+    else
+        asynPrint(pasynUser, ASYN_TRACEIO_DRIVER,
+              "%s::%s function=%d, value=%d\n",
+              driverName, functionName, function, value);
+    return status;
+}
+
+/** Report status of the plugin, including the state of each client.
+  * \param[in] fp File pointed passed by caller where the output is written to.
+  * \param[in] details If >0 then the per-client state is printed. */
+void NDPluginStream::report(FILE *fp, int details)
+{
+    fprintf(fp, "%s: TCP port %d, %d client slots\n", portName, tcpPort_, maxClients_);
+    if (details > 0) {
+        for (int i=0; i<maxClients_; i++) {
+            NDStreamClient *pClient = clients_[i];
+            epicsMutexLock(pClient->mutex_);
+            if (pClient->state_ != NDStreamClientFree) {
+                fprintf(fp, "  client %d: peer=%s, zeroCopy=%d, queued=%d, inFlight=%d, sent=%d, dropped=%d, MB=%.1f\n",
+                        i, pClient->peer_, pClient->zeroCopy_, (int)pClient->queue_.size(),
+                        (int)pClient->inFlight_.size(), pClient->sent_, pClient->dropped_,
+                        pClient->bytesSent_/1.e6);
+            }
+            epicsMutexUnlock(pClient->mutex_);
+        }
+    }
+    NDPluginDriver::report(fp, details);
+}
+
+/** Constructor for NDPluginStream; most parameters are simply passed to NDPluginDriver::NDPluginDriver.
+  * After calling the base class constructor this method opens the listening socket and starts the
+  * thread that accepts client connections.
+  *
+  * \param[in] portName The name of the asyn port driver to be created.
+  * \param[in] tcpPort The TCP port number on which to listen for clients.
+  * \param[in] maxClients The maximum number of clients that can be connected at once.
+  *            This is also the number of asyn addresses for the per-client parameters.
+  * \param[in] queueSize The number of NDArrays that the input queue for this plugin can hold when
+  *            NDPluginDriverBlockingCallbacks=0.  Larger queues can decrease the number of dropped arrays,
+  *            at the expense of more NDArray buffers being allocated from the underlying driver's NDArrayPool.
+  * \param[in] blockingCallbacks Initial setting for the NDPluginDriverBlockingCallbacks flag.
+  *            0=callbacks are queued and executed by the callback thread; 1 callbacks execute in the thread
+  *            of the driver doing the callbacks.
+  * \param[in] NDArrayPort Name of asyn port driver for initial source of NDArray callbacks.
+  * \param[in] NDArrayAddr asyn port driver address for initial source of NDArray callbacks.
+  * \param[in] maxBuffers The maximum number of NDArray buffers that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited number of buffers.
+  * \param[in] maxMemory The maximum amount of memory that the NDArrayPool for this driver is
+  *            allowed to allocate. Set this to 0 to allow an unlimited amount of memory.
+  * \param[in] priority The thread priority for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  * \param[in] stackSize The stack size for the asyn port driver thread if ASYN_CANBLOCK is set in asynFlags.
+  */
+NDPluginStream::NDPluginStream(const char *portName, int tcpPort, int maxClients,
+                               int queueSize, int blockingCallbacks,
+                               const char *NDArrayPort, int NDArrayAddr,
+                               int maxBuffers, size_t maxMemory,
+                               int priority, int stackSize)
+    /* Invoke the base class constructor */
+    : NDPluginDriver(portName, queueSize, blockingCallbacks,
+                   NDArrayPort, NDArrayAddr, (maxClients < 1) ? 1 : maxClients, maxBuffers, maxMemory,
+                   asynGenericPointerMask,
+                   asynGenericPointerMask,
+                   ASYN_MULTIDEVICE, 1, priority, stackSize, 1, true),
+    tcpPort_(tcpPort), listenFd_(INVALID_SOCKET), prevBytesSent_(0.)
+{
+    struct sockaddr_in serverAddr;
+    static const char *functionName = "NDPluginStream";
+
+    maxClients_ = (maxClients < 1) ? 1 : maxClients;
+    epicsTimeGetCurrent(&prevRateTime_);
+
+    createParam(NDPluginStreamPortString,             asynParamInt32,   &NDPluginStreamPort);
+    createParam(NDPluginStreamMaxClientsString,       asynParamInt32,   &NDPluginStreamMaxClients);
+    createParam(NDPluginStreamNumClientsString,       asynParamInt32,   &NDPluginStreamNumClients);
+    createParam(NDPluginStreamClientQueueString,      asynParamInt32,   &NDPluginStreamClientQueue);
+    createParam(NDPluginStreamZeroCopyString,         asynParamInt32,   &NDPluginStreamZeroCopy);
+    createParam(NDPluginStreamTotalSentString,        asynParamInt32,   &NDPluginStreamTotalSent);
+    createParam(NDPluginStreamTotalDroppedString,     asynParamInt32,   &NDPluginStreamTotalDropped);
+    createParam(NDPluginStreamSendRateString,         asynParamFloat64, &NDPluginStreamSendRate);
+    createParam(NDPluginStreamClientConnectedString,  asynParamInt32,   &NDPluginStreamClientConnected);
+    createParam(NDPluginStreamClientAddressString,    asynParamOctet,   &NDPluginStreamClientAddress);
+    createParam(NDPluginStreamClientQueuedString,     asynParamInt32,   &NDPluginStreamClientQueued);
+    createParam(NDPluginStreamClientSentString,       asynParamInt32,   &NDPluginStreamClientSent);
+    createParam(NDPluginStreamClientDroppedString,    asynParamInt32,   &NDPluginStreamClientDropped);
+    createParam(NDPluginStreamClientMBytesString,     asynParamFloat64, &NDPluginStreamClientMBytes);
+    createParam(NDPluginStreamClientDisconnectString, asynParamInt32,   &NDPluginStreamClientDisconnect);
+
+    setIntegerParam(NDPluginStreamPort,         tcpPort);
+    setIntegerParam(NDPluginStreamMaxClients,   maxClients_);
+    setIntegerParam(NDPluginStreamNumClients,   0);
+    setIntegerParam(NDPluginStreamClientQueue,  16);
+    setIntegerParam(NDPluginStreamTotalSent,    0);
+    setIntegerParam(NDPluginStreamTotalDropped, 0);
+    setDoubleParam (NDPluginStreamSendRate,     0.);
+
+    clients_.resize(maxClients_);
+    for (int i=0; i<maxClients_; i++) {
+        clients_[i] = new NDStreamClient(this, i);
+        setIntegerParam(i, NDPluginStreamClientConnected,  0);
+        setStringParam (i, NDPluginStreamClientAddress,    "");
+        setIntegerParam(i, NDPluginStreamClientQueued,     0);
+        setIntegerParam(i, NDPluginStreamClientSent,       0);
+        setIntegerParam(i, NDPluginStreamClientDropped,    0);
+        setDoubleParam (i, NDPluginStreamClientMBytes,     0.);
+        setIntegerParam(i, NDPluginStreamClientDisconnect, 0);
+    }
+
+    /* Set the plugin type string */
+    setStringParam(NDPluginDriverPluginType, "NDPluginStream");
+
+    // Disable ArrayCallbacks.
+    // This plugin is normally the end of a chain and copying the array for callbacks would cost bandwidth
+    setIntegerParam(NDArrayCallbacks, 0);
+
+    /* Try to connect to the array port */
+    connectToArrayPort();
+
+    /* Open the listening socket */
+    listenFd_ = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ == INVALID_SOCKET) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating socket\n",
+            driverName, functionName);
+        return;
+    }
+    epicsSocketEnableAddressReuseDuringTimeWaitState(listenFd_);
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serverAddr.sin_port = htons((unsigned short)tcpPort);
+    if (bind(listenFd_, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) ||
+        listen(listenFd_, maxClients_)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error binding or listening on TCP port %d, errno=%d\n",
+            driverName, functionName, tcpPort, SOCKERRNO);
+        epicsSocketDestroy(listenFd_);
+        listenFd_ = INVALID_SOCKET;
+        return;
+    }
+
+    char taskName[256];
+    epicsSnprintf(taskName, sizeof(taskName)-1, "%s_Stream_Listen", portName);
+    if (!epicsThreadCreate(taskName, this->threadPriority_, this->threadStackSize_,
+                           (EPICSTHREADFUNC)listenTaskC, this)) {
+        asynPrint(pasynUserSelf, ASYN_TRACE_ERROR,
+            "%s::%s error creating listen thread\n",
+            driverName, functionName);
+    }
+}
+
+/** Configuration command */
+extern "C" int NDStreamConfigure(const char *portName, int tcpPort, int maxClients,
+                                 int queueSize, int blockingCallbacks,
+                                 const char *NDArrayPort, int NDArrayAddr,
+                                 int maxBuffers, size_t maxMemory,
+                                 int priority, int stackSize)
+{
+    NDPluginStream *pPlugin = new NDPluginStream(portName, tcpPort, maxClients, queueSize, blockingCallbacks,
+                                                 NDArrayPort, NDArrayAddr, maxBuffers, maxMemory,
+                                                 priority, stackSize);
+    return pPlugin->start();
+}
+
+/* EPICS iocsh shell commands */
+static const iocshArg initArg0 = { "portName",iocshArgString};
+static const iocshArg initArg1 = { "TCP port",iocshArgInt};
+static const iocshArg initArg2 = { "maxClients",iocshArgInt};
+static const iocshArg initArg3 = { "frame queue size",iocshArgInt};
+static const iocshArg initArg4 = { "blocking callbacks",iocshArgInt};
+static const iocshArg initArg5 = { "NDArrayPort",iocshArgString};
+static const iocshArg initArg6 = { "NDArrayAddr",iocshArgInt};
+static const iocshArg initArg7 = { "maxBuffers",iocshArgInt};
+static const iocshArg initArg8 = { "maxMemory",iocshArgInt};
+static const iocshArg initArg9 = { "priority",iocshArgInt};
+static const iocshArg initArg10 = { "stackSize",iocshArgInt};
+static const iocshArg * const initArgs[] = {&initArg0,
+                                            &initArg1,
+                                            &initArg2,
+                                            &initArg3,
+                                            &initArg4,
+                                            &initArg5,
+                                            &initArg6,
+                                            &initArg7,
+                                            &initArg8,
+                                            &initArg9,
+                                            &initArg10};
+static const iocshFuncDef initFuncDef = {"NDStreamConfigure",11,initArgs};
+static void initCallFunc(const iocshArgBuf *args)
+{
+  NDStreamConfigure(args[0].sval, args[1].ival, args[2].ival,
+                    args[3].ival, args[4].ival, args[5].sval,
+                    args[6].ival, args[7].ival, args[8].ival,
+                    args[9].ival, args[10].ival);
+}
+
+extern "C" void NDStreamRegister(void)
+{
+  iocshRegister(&initFuncDef,initCallFunc);
+}
+
+extern "C" {
+epicsExportRegistrar(NDStreamRegister);
+}
@@ -0,0 +1,157 @@
+#ifndef NDPluginStream_H
+#define NDPluginStream_H
+
+#include <deque>
+#include <vector>
+
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+
+#include "NDPluginDriver.h"
+
+/* Parameters for the plugin as a whole (address 0) */
+#define NDPluginStreamPortString            "STREAM_PORT"             /* (asynInt32,   r/o) TCP port the plugin listens on */
+#define NDPluginStreamMaxClientsString      "STREAM_MAX_CLIENTS"      /* (asynInt32,   r/o) Maximum number of clients */
+#define NDPluginStreamNumClientsString      "STREAM_NUM_CLIENTS"      /* (asynInt32,   r/o) Number of connected clients */
+#define NDPluginStreamClientQueueString     "STREAM_CLIENT_QUEUE"     /* (asynInt32,   r/w) Maximum arrays queued or in flight per client */
+#define NDPluginStreamZeroCopyString        "STREAM_ZERO_COPY"        /* (asynInt32,   r/w) Use MSG_ZEROCOPY sends if available */
+#define NDPluginStreamTotalSentString       "STREAM_TOTAL_SENT"       /* (asynInt32,   r/o) Arrays sent to all clients */
+#define NDPluginStreamTotalDroppedString    "STREAM_TOTAL_DROPPED"    /* (asynInt32,   r/o) Arrays dropped for all clients */
+#define NDPluginStreamSendRateString        "STREAM_SEND_RATE"        /* (asynFloat64, r/o) Aggregate send rate in MB/s */
+
+/* Per-client parameters (address N is client N) */
+#define NDPluginStreamClientConnectedString "STREAM_CLIENT_CONNECTED" /* (asynInt32,   r/o) Client slot is connected */
+#define NDPluginStreamClientAddressString   "STREAM_CLIENT_ADDRESS"   /* (asynOctet,   r/o) Peer address of client */
+#define NDPluginStreamClientQueuedString    "STREAM_CLIENT_QUEUED"    /* (asynInt32,   r/o) Arrays queued or in flight */
+#define NDPluginStreamClientSentString      "STREAM_CLIENT_SENT"      /* (asynInt32,   r/o) Arrays sent to this client */
+#define NDPluginStreamClientDroppedString   "STREAM_CLIENT_DROPPED"   /* (asynInt32,   r/o) Arrays dropped for this client */
+#define NDPluginStreamClientMBytesString    "STREAM_CLIENT_MBYTES"    /* (asynFloat64, r/o) MB sent to this client */
+#define NDPluginStreamClientDisconnectString "STREAM_CLIENT_DISCONNECT" /* (asynInt32, r/w) Disconnect this client */
+
+/** Magic number at the start of every frame header, "NDAS" in memory order on a little-endian host.
+  * A client that reads it byte-swapped knows that the sender has the opposite byte order. */
+#define ND_STREAM_MAGIC   0x5341444E
+#define ND_STREAM_VERSION 1
+#define ND_STREAM_CODEC_LEN 24
+
+/** Fixed size binary header that precedes the data of every NDArray on the wire.
+  * All fields are in the byte order of the IOC host and naturally aligned, so the structure
+  * has no padding and is 160 bytes long. The header is followed by dataSize bytes of array data;
+  * if codec is not empty the data are compressed and uncompressedSize gives the decompressed size. */
+typedef struct NDStreamHeader {
+    epicsUInt32 magic;              /**< ND_STREAM_MAGIC */
+    epicsUInt16 version;            /**< ND_STREAM_VERSION */
+    epicsUInt16 headerSize;         /**< sizeof(NDStreamHeader) */
+    epicsInt32  uniqueId;           /**< NDArray::uniqueId */
+    epicsInt32  dataType;           /**< NDArray::dataType (NDDataType_t) */
+    epicsInt32  ndims;              /**< NDArray::ndims */
+    epicsInt32  colorMode;          /**< ColorMode attribute, NDColorModeMono if absent */
+    epicsUInt64 dims[ND_ARRAY_MAX_DIMS]; /**< Dimension sizes, only the first ndims are meaningful */
+    epicsFloat64 timeStamp;         /**< NDArray::timeStamp */
+    epicsUInt32 epicsTSSec;         /**< NDArray::epicsTS.secPastEpoch */
+    epicsUInt32 epicsTSNsec;        /**< NDArray::epicsTS.nsec */
+    epicsUInt64 uncompressedSize;   /**< Size of the uncompressed array in bytes */
+    epicsUInt64 dataSize;           /**< Number of data bytes following this header */
+    char        codec[ND_STREAM_CODEC_LEN]; /**< Codec name, empty if uncompressed */
+} NDStreamHeader;
+
+class NDPluginStream;
+
+/** An NDArray that has been (or is being) handed to the kernel for one client.
+  * The header must stay valid, and the array must stay reserved, until the kernel
+  * no longer needs the buffers, which for zero-copy sends is only after the completion
+  * notification has been received. */
+typedef struct NDStreamInFlight {
+    NDArray *pArray;
+    NDStreamHeader header;
+    epicsUInt32 lastSeq;            /**< Last MSG_ZEROCOPY sequence number used for this array */
+    bool submitted;                 /**< All of the data have been handed to the kernel */
+} NDStreamInFlight;
+
+typedef enum {
+    NDStreamClientFree,
+    NDStreamClientConnected,
+    NDStreamClientClosing
+} NDStreamClientState_t;
+
+/** State of one client connection; the plugin owns a fixed array of these, one per asyn address */
+class NDStreamClient {
+public:
+    NDStreamClient(NDPluginStream *pPlugin, int index);
+    ~NDStreamClient();
+    void senderTask();
+
+    NDPluginStream *pPlugin_;
+    int index_;
+    int fd_;
+    NDStreamClientState_t state_;
+    char peer_[64];
+    epicsMutexId mutex_;           /**< Protects everything below */
+    epicsEventId wakeEvent_;
+    std::deque<NDArray *> queue_;
+    std::deque<NDStreamInFlight> inFlight_;
+    bool zeroCopy_;
+    epicsUInt32 nextSeq_;
+    int sent_;
+    int dropped_;
+    double bytesSent_;
+
+private:
+    int sendArray(NDArray *pArray);
+    int sendBuffers(NDStreamInFlight *pEntry, const char *pData, size_t dataSize);
+    int reapCompletions(bool wait);
+    void releaseAll();
+};
+
+/** Streams NDArrays to one or more TCP clients as a fixed binary header followed by the raw
+  * (possibly compressed) array data, without any per-frame serialization.
+  * Each client has its own sender thread and bounded queue, so a slow client drops frames
+  * without slowing down the others or the plugin itself. */
+class NDPLUGIN_API NDPluginStream : public NDPluginDriver {
+public:
+    NDPluginStream(const char *portName, int tcpPort, int maxClients,
+                   int queueSize, int blockingCallbacks,
+                   const char *NDArrayPort, int NDArrayAddr,
+                   int maxBuffers, size_t maxMemory,
+                   int priority, int stackSize);
+    /* These methods override the virtual methods in the base class */
+    void processCallbacks(NDArray *pArray);
+    asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+    void report(FILE *fp, int details);
+
+    /* These methods are new to this class */
+    void listenTask();
+    void clientDisconnected(int index);
+
+protected:
+    int NDPluginStreamPort;
+    #define FIRST_NDPLUGIN_STREAM_PARAM NDPluginStreamPort
+    int NDPluginStreamMaxClients;
+    int NDPluginStreamNumClients;
+    int NDPluginStreamClientQueue;
+    int NDPluginStreamZeroCopy;
+    int NDPluginStreamTotalSent;
+    int NDPluginStreamTotalDropped;
+    int NDPluginStreamSendRate;
+    int NDPluginStreamClientConnected;
+    int NDPluginStreamClientAddress;
+    int NDPluginStreamClientQueued;
+    int NDPluginStreamClientSent;
+    int NDPluginStreamClientDropped;
+    int NDPluginStreamClientMBytes;
+    int NDPluginStreamClientDisconnect;
+
+private:
+    void updateClientParams();
+
+    int tcpPort_;
+    int maxClients_;
+    int listenFd_;
+    std::vector<NDStreamClient *> clients_;
+    double prevBytesSent_;
+    epicsTimeStamp prevRateTime_;
+};
+
+#endif
@@ -5,6 +5,10 @@
  *      Author: gnx91527
  */
 
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
 #include "HDF5FileReader.h"
 
 herr_t file_info(hid_t loc_id, const char *name, const H5L_info_t *info, void *opdata)
@@ -201,3 +205,35 @@ HDF5FileReader::~HDF5FileReader ()
   H5Fclose(file);
 }
 
+void verifyHDF5Frames(const std::string& filename, const std::vector<NDArray*>& arrays, size_t first,
+                      size_t numFrames, const std::string& datasetName)
+{
+  if (numFrames == 0) numFrames = arrays.size() - first;
+  BOOST_REQUIRE(first + numFrames <= arrays.size());
+  hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen2(file, datasetName.c_str(), H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  hid_t dataspace = H5Dget_space(dataset);
+  hsize_t fileDims[H5S_MAX_RANK];
+  BOOST_REQUIRE(H5Sget_simple_extent_dims(dataspace, fileDims, NULL) > 0);
+  BOOST_REQUIRE_EQUAL(fileDims[0], (hsize_t)numFrames);
+  hssize_t numPoints = H5Sget_simple_extent_npoints(dataspace);
+  H5Sclose(dataspace);
+
+  // The frames are read in the native type of the dataset, which is the type of the NDArrays
+  size_t frameSize = arrays[first]->dataSize;
+  std::vector<char> data(numFrames * frameSize);
+  hid_t datatype = H5Dget_type(dataset);
+  hid_t nativeType = H5Tget_native_type(datatype, H5T_DIR_ASCEND);
+  BOOST_REQUIRE_EQUAL(H5Tget_size(nativeType) * (size_t)numPoints, data.size());
+  BOOST_CHECK(H5Dread(dataset, nativeType, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]) >= 0);
+  for (size_t i = 0; i < numFrames; i++) {
+    BOOST_CHECK_MESSAGE(memcmp(&data[i * frameSize], arrays[first + i]->pData, frameSize) == 0,
+                        filename << " frame " << i << " differs from array " << first + i);
+  }
+  H5Tclose(nativeType);
+  H5Tclose(datatype);
+  H5Dclose(dataset);
+  H5Fclose(file);
+}
@@ -14,6 +14,8 @@
 #include <vector>
 #include <hdf5.h>
 
+#include <NDArray.h>
+
 typedef enum
 {
   NoType,
@@ -86,4 +88,9 @@ private:
 
 };
 
+// Checks that a dataset holds numFrames frames that are equal to arrays[first] onwards; all frames
+// from first on if numFrames is 0
+void verifyHDF5Frames(const std::string& filename, const std::vector<NDArray*>& arrays, size_t first=0,
+                      size_t numFrames=0, const std::string& datasetName="/entry/data/data");
+
 #endif /* PLUGINTESTS_HDF5FileReader_H_ */
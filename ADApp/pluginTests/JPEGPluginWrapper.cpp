@@ -0,0 +1,19 @@
+/*
+ * JPEGPluginWrapper.cpp
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#include "JPEGPluginWrapper.h"
+
+JPEGPluginWrapper::JPEGPluginWrapper(const std::string& port,
+                                     const std::string& detectorPort)
+  :  NDFileJPEG(port.c_str(), 50, 0, detectorPort.c_str(), 0, 0, 0),
+     AsynPortClientContainer(port)
+{
+}
+
+JPEGPluginWrapper::~JPEGPluginWrapper()
+{
+  cleanup();
+}
@@ -0,0 +1,21 @@
+/*
+ * JPEGPluginWrapper.h
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#ifndef ADAPP_PLUGINTESTS_JPEGPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_JPEGPLUGINWRAPPER_H_
+
+#include <NDFileJPEG.h>
+#include "AsynPortClientContainer.h"
+
+class JPEGPluginWrapper : public NDFileJPEG, public AsynPortClientContainer
+{
+public:
+  JPEGPluginWrapper(const std::string& port,
+                    const std::string& detectorPort);
+  virtual ~JPEGPluginWrapper();
+};
+
+#endif /* ADAPP_PLUGINTESTS_JPEGPLUGINWRAPPER_H_ */
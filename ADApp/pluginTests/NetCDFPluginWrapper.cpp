@@ -0,0 +1,19 @@
+/*
+ * NetCDFPluginWrapper.cpp
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#include "NetCDFPluginWrapper.h"
+
+NetCDFPluginWrapper::NetCDFPluginWrapper(const std::string& port,
+                                         const std::string& detectorPort)
+  :  NDFileNetCDF(port.c_str(), 50, 0, detectorPort.c_str(), 0, 0, 0),
+     AsynPortClientContainer(port)
+{
+}
+
+NetCDFPluginWrapper::~NetCDFPluginWrapper()
+{
+  cleanup();
+}
@@ -0,0 +1,18 @@
+/*
+ * ROIStatPluginWrapper.cpp
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#include "ROIStatPluginWrapper.h"
+
+ROIStatPluginWrapper::ROIStatPluginWrapper(const std::string& port, const std::string& detectorPort, int maxROIs)
+  :  NDPluginROIStat(port.c_str(), 50, 1, detectorPort.c_str(), 0, maxROIs, 0, 0, 0, 0, 1),
+     AsynPortClientContainer(port)
+{
+}
+
+ROIStatPluginWrapper::~ROIStatPluginWrapper ()
+{
+  cleanup();
+}
@@ -0,0 +1,20 @@
+/*
+ * ROIStatPluginWrapper.h
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#ifndef ADAPP_PLUGINTESTS_ROISTATPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_ROISTATPLUGINWRAPPER_H_
+
+#include <NDPluginROIStat.h>
+#include "AsynPortClientContainer.h"
+
+class ROIStatPluginWrapper : public NDPluginROIStat, public AsynPortClientContainer
+{
+public:
+  ROIStatPluginWrapper(const std::string& port, const std::string& detectorPort, int maxROIs);
+  virtual ~ROIStatPluginWrapper ();
+};
+
+#endif /* ADAPP_PLUGINTESTS_ROISTATPLUGINWRAPPER_H_ */
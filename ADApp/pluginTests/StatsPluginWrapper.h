@@ -0,0 +1,20 @@
+/*
+ * StatsPluginWrapper.h
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#ifndef ADAPP_PLUGINTESTS_STATSPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_STATSPLUGINWRAPPER_H_
+
+#include <NDPluginStats.h>
+#include "AsynPortClientContainer.h"
+
+class StatsPluginWrapper : public NDPluginStats, public AsynPortClientContainer
+{
+public:
+  StatsPluginWrapper(const std::string& port, const std::string& detectorPort);
+  virtual ~StatsPluginWrapper ();
+};
+
+#endif /* ADAPP_PLUGINTESTS_STATSPLUGINWRAPPER_H_ */
@@ -0,0 +1,22 @@
+/*
+ * StdArraysPluginWrapper.h
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#ifndef ADAPP_PLUGINTESTS_STDARRAYSPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_STDARRAYSPLUGINWRAPPER_H_
+
+#include <NDPluginStdArrays.h>
+#include "AsynPortClientContainer.h"
+
+class StdArraysPluginWrapper : public NDPluginStdArrays, public AsynPortClientContainer
+{
+public:
+  StdArraysPluginWrapper(const std::string& port, const std::string& detectorPort);
+  virtual ~StdArraysPluginWrapper ();
+  /** Returns the array that the plugin output last, which it caches for waveform reads */
+  NDArray *getLastArray() { return pArrays[0]; }
+};
+
+#endif /* ADAPP_PLUGINTESTS_STDARRAYSPLUGINWRAPPER_H_ */
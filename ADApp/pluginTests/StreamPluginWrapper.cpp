@@ -0,0 +1,22 @@
+/*
+ * StreamPluginWrapper.cpp
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#include "StreamPluginWrapper.h"
+
+StreamPluginWrapper::StreamPluginWrapper(const std::string& port,
+                                         int tcpPort,
+                                         int maxClients,
+                                         const std::string& detectorPort)
+  :  NDPluginStream(port.c_str(), tcpPort, maxClients, 50, 1,
+                    detectorPort.c_str(), 0, 0, 0, 0, 0),
+     AsynPortClientContainer(port)
+{
+}
+
+StreamPluginWrapper::~StreamPluginWrapper ()
+{
+  cleanup();
+}
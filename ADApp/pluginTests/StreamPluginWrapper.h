@@ -0,0 +1,23 @@
+/*
+ * StreamPluginWrapper.h
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#ifndef ADAPP_PLUGINTESTS_STREAMPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_STREAMPLUGINWRAPPER_H_
+
+#include <NDPluginStream.h>
+#include "AsynPortClientContainer.h"
+
+class StreamPluginWrapper : public NDPluginStream, public AsynPortClientContainer
+{
+public:
+  StreamPluginWrapper(const std::string& port,
+                      int tcpPort,
+                      int maxClients,
+                      const std::string& detectorPort);
+  virtual ~StreamPluginWrapper ();
+};
+
+#endif /* ADAPP_PLUGINTESTS_STREAMPLUGINWRAPPER_H_ */
@@ -0,0 +1,20 @@
+/*
+ * TIFFPluginWrapper.cpp
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#include "TIFFPluginWrapper.h"
+
+TIFFPluginWrapper::TIFFPluginWrapper(const std::string& port,
+                                     const std::string& detectorPort,
+                                     int maxThreads)
+  :  NDFileTIFF(port.c_str(), 50, 0, detectorPort.c_str(), 0, 0, 0, maxThreads),
+     AsynPortClientContainer(port)
+{
+}
+
+TIFFPluginWrapper::~TIFFPluginWrapper()
+{
+  cleanup();
+}
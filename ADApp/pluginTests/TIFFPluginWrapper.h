@@ -0,0 +1,22 @@
+/*
+ * TIFFPluginWrapper.h
+ *
+ *  Created on: 16 Oct 2026
+ */
+
+#ifndef ADAPP_PLUGINTESTS_TIFFPLUGINWRAPPER_H_
+#define ADAPP_PLUGINTESTS_TIFFPLUGINWRAPPER_H_
+
+#include <NDFileTIFF.h>
+#include "AsynPortClientContainer.h"
+
+class TIFFPluginWrapper : public NDFileTIFF, public AsynPortClientContainer
+{
+public:
+  TIFFPluginWrapper(const std::string& port,
+                    const std::string& detectorPort,
+                    int maxThreads);
+  virtual ~TIFFPluginWrapper();
+};
+
+#endif /* ADAPP_PLUGINTESTS_TIFFPLUGINWRAPPER_H_ */
@@ -0,0 +1,107 @@
+/** benchmark_NDFileHDF5.cpp
+ *
+ *  Throughput of the NDFileHDF5 compression paths. Run with
+ *  --log_level=message to see the results.
+ */
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <epicsTime.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "testingutilities.h"
+#include "HDF5PluginWrapper.h"
+
+static NDArrayPool *arrayPool;
+
+struct NDFileHDF5BenchmarkFixture
+{
+  asynNDArrayDriver* dummy_driver;
+  boost::shared_ptr<HDF5PluginWrapper> hdf5;
+
+  NDFileHDF5BenchmarkFixture()
+  {
+    std::string dummy_port("simHDF5bench"), testport("HDF5bench");
+    uniqueAsynPortName(dummy_port);
+    uniqueAsynPortName(testport);
+
+    dummy_driver = new asynNDArrayDriver(dummy_port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+    arrayPool = dummy_driver->pNDArrayPool;
+    hdf5 = boost::shared_ptr<HDF5PluginWrapper>(new HDF5PluginWrapper(testport.c_str(), 50, 1, dummy_port.c_str(), 0, 0, 2000000));
+    hdf5->start();
+    hdf5->write(NDPluginDriverEnableCallbacksString, 1);
+    hdf5->write(NDPluginDriverBlockingCallbacksString, 1);
+  }
+  ~NDFileHDF5BenchmarkFixture()
+  {
+    hdf5.reset();
+    delete dummy_driver;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileHDF5Benchmarks, NDFileHDF5BenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(benchmark_ParallelCompression)
+{
+  // zlib compression by the HDF5 filter pipeline (0 threads) and by the plugin,
+  // for whole frame, row and tile chunks
+  const size_t sizeX = 1024, sizeY = 512;
+  const int numFrames = 10;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  size_t chunks[][2] = {{sizeX, sizeY}, {sizeX, 16}, {100, 100}};
+  int threads[] = {0, 1, 4};
+
+  // 16-bit frames with some structure and noise, so that they compress but not trivially
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  unsigned int seed = 1;
+  for (int i = 0; i < numFrames; i++) {
+    epicsUInt16 *pData = (epicsUInt16 *)arrays[i]->pData;
+    for (size_t j = 0; j < sizeX * sizeY; j++) {
+      seed = seed * 1103515245 + 12345;
+      pData[j] = (epicsUInt16)((j % sizeX) + i + ((seed >> 16) & 0xF));
+    }
+  }
+
+  hdf5->write(NDFileWriteModeString, NDFileModeStream);
+  hdf5->write(NDFilePathString, "");
+  hdf5->write(NDFileNameString, "benchmark");
+  hdf5->write(NDFileTemplateString, "%s%s_%d.h5");
+  hdf5->write(NDFileNumberString, 0);
+  hdf5->write(NDAutoIncrementString, 0);
+  hdf5->write(str_NDFileHDF5_compressionType, 3); // zlib
+  hdf5->write(str_NDFileHDF5_zCompressLevel, 1);
+  hdf5->write(str_NDFileHDF5_chunkSizeAuto, 0);
+  hdf5->write(str_NDFileHDF5_nFramesChunks, 1);
+  for (size_t c = 0; c < sizeof(chunks)/sizeof(chunks[0]); c++) {
+    for (size_t t = 0; t < sizeof(threads)/sizeof(threads[0]); t++) {
+      hdf5->write(NDFileHDF5::str_NDFileHDF5_chunkSize[0], (int)chunks[c][0]);
+      hdf5->write(NDFileHDF5::str_NDFileHDF5_chunkSize[1], (int)chunks[c][1]);
+      hdf5->write(str_NDFileHDF5_compressionNumThreads, threads[t]);
+      startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+
+      epicsTimeStamp start, end;
+      epicsTimeGetCurrent(&start);
+      streamFrames(hdf5.get(), arrays);
+      epicsTimeGetCurrent(&end);
+      double elapsed = epicsTimeDiffInSeconds(&end, &start);
+      BOOST_TEST_MESSAGE("zlib chunks " << chunks[c][0] << "x" << chunks[c][1] << ", "
+                         << threads[t] << " threads: "
+                         << numFrames * sizeX * sizeY * 2 / elapsed / 1e6 << " MB/s");
+    }
+  }
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
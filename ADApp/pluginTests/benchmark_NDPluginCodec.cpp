@@ -0,0 +1,80 @@
+/** benchmark_NDPluginCodec.cpp
+ *
+ *  Throughput of the blockwise BSLZ4 compressor with increasing numbers of
+ *  threads. Run with --log_level=message to see the results.
+ */
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginCodec.h>
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+#include <epicsTime.h>
+
+#include "testingutilities.h"
+
+struct CodecBenchmarkFixture
+{
+  asynNDArrayDriver *driver;
+  NDArrayPool *pPool;
+
+  CodecBenchmarkFixture()
+  {
+    std::string port("simCodecBench");
+    uniqueAsynPortName(port);
+    driver = new asynNDArrayDriver(port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+    pPool = driver->pNDArrayPool;
+  }
+  ~CodecBenchmarkFixture()
+  {
+    delete driver;
+  }
+
+  // A 16-bit image with some structure and noise, so that it compresses but not trivially
+  NDArray *makeArray(size_t sizeX, size_t sizeY)
+  {
+    size_t dims[2] = {sizeX, sizeY};
+    NDArray *pArray = pPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    unsigned int seed = 1;
+    for (size_t i = 0; i < sizeX * sizeY; ++i) {
+      seed = seed * 1103515245 + 12345;
+      pData[i] = (epicsUInt16)((i % sizeX) + ((seed >> 16) & 0xF));
+    }
+    return pArray;
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginCodecBenchmarks, CodecBenchmarkFixture)
+
+#ifdef HAVE_BITSHUFFLE
+BOOST_AUTO_TEST_CASE(benchmark_BSLZ4Threads)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  NDArray *pArray = makeArray(2048, 2048);
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+  const int repeats = 10;
+
+  for (int numThreads = 1; numThreads <= 8; numThreads *= 2) {
+    epicsTimeStamp start, end;
+    epicsTimeGetCurrent(&start);
+    for (int i = 0; i < repeats; ++i) {
+      NDArray *pOut = compressBSLZ4(pArray, numThreads, &status, errorMessage);
+      BOOST_REQUIRE(pOut);
+      pOut->release();
+    }
+    epicsTimeGetCurrent(&end);
+    double elapsed = epicsTimeDiffInSeconds(&end, &start);
+    BOOST_TEST_MESSAGE("BSLZ4 compress, " << numThreads << " threads: "
+                       << repeats * info.totalBytes / elapsed / 1e6 << " MB/s");
+  }
+
+  pArray->release();
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
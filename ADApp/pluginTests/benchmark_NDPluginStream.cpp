@@ -0,0 +1,111 @@
+/** benchmark_NDPluginStream.cpp
+ *
+ *  Throughput of NDPluginStream over the loopback interface, with and
+ *  without zero-copy sends. Run with --log_level=message to see the results.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include <osiSock.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "testingutilities.h"
+#include "StreamPluginWrapper.h"
+
+static int nextTcpPort = 19800;
+
+struct StreamBenchmarkFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  // The plugin is purposefully leaked because its listen thread cannot be stopped
+  // and asyn ports cannot be deleted
+  StreamPluginWrapper *stream;
+  NDArrayPool *arrayPool;
+  int tcpPort;
+
+  StreamBenchmarkFixture()
+  {
+    std::string simport("simStreamBench"), testport("StreamBench");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+    tcpPort = nextTcpPort++;
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(), 1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+    stream = new StreamPluginWrapper(testport, tcpPort, 2, simport);
+    stream->start();
+    stream->write(NDPluginDriverEnableCallbacksString, 1);
+    stream->write(NDPluginDriverBlockingCallbacksString, 1);
+  }
+  ~StreamBenchmarkFixture()
+  {
+    driver.reset();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginStreamBenchmarks, StreamBenchmarkFixture)
+
+BOOST_AUTO_TEST_CASE(benchmark_StreamLoopback)
+{
+  const int numFrames = 200;
+  const size_t frameSize = 2048;
+  std::vector<size_t> dims;
+  dims.push_back(frameSize);
+  dims.push_back(frameSize);
+  std::vector<NDArray *> arrays(1);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  NDArray *pArray = arrays[0];
+  size_t frameBytes = frameSize*frameSize*sizeof(epicsUInt16);
+  std::vector<char> buffer(frameBytes);
+
+  // Queue every frame up front so that no frames are dropped
+  stream->write(NDPluginStreamClientQueueString, numFrames);
+
+  for (int zeroCopy=0; zeroCopy<2; zeroCopy++) {
+    stream->write(NDPluginStreamZeroCopyString, zeroCopy);
+    int numClients = stream->readInt(NDPluginStreamNumClientsString);
+    SOCKET fd = connectLoopbackClient(tcpPort);
+    BOOST_REQUIRE(fd != INVALID_SOCKET);
+    for (int i=0; i<500 && stream->readInt(NDPluginStreamNumClientsString) == numClients; i++) {
+      epicsThreadSleep(0.01);
+    }
+
+    epicsTimeStamp start, end;
+    epicsTimeGetCurrent(&start);
+    // The same array is queued repeatedly; each queue entry holds its own reference
+    for (int i=0; i<numFrames; i++) {
+      stream->lock();
+      stream->processCallbacks(pArray);
+      stream->unlock();
+    }
+    for (int i=0; i<numFrames; i++) {
+      NDStreamHeader header;
+      BOOST_REQUIRE(readFully(fd, (char *)&header, sizeof(header)));
+      BOOST_REQUIRE_EQUAL(header.dataSize, frameBytes);
+      BOOST_REQUIRE(readFully(fd, &buffer[0], frameBytes));
+    }
+    epicsTimeGetCurrent(&end);
+    double elapsed = epicsTimeDiffInSeconds(&end, &start);
+    BOOST_TEST_MESSAGE("NDPluginStream loopback zeroCopy=" << zeroCopy << ": " << numFrames
+                       << " frames of " << frameBytes/1e6 << " MB in " << elapsed << " s = "
+                       << numFrames*frameBytes/1e6/elapsed << " MB/s");
+
+    epicsSocketDestroy(fd);
+  }
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,12 @@
+/** plugin-benchmark.cpp
+ *
+ *  Defines the boost unittest module for the plugin benchmarks.
+ *  These measure throughput rather than check results, so they
+ *  are kept out of plugin-test and are run by hand.
+ */
+#ifndef BOOST_USE_STATIC_LINK
+#define BOOST_TEST_DYN_LINK
+#endif
+#define BOOST_TEST_MODULE "NDPlugin Benchmarks"
+#include <boost/test/unit_test.hpp>
+
@@ -0,0 +1,171 @@
+/*
+ * test_NDArrayCredits.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests the credit based backpressure between lossless plugins and their driver,
+ *  and the shedding of queued arrays when a pool runs out of memory.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <asynPortClient.h>
+#include <epicsThread.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "StdArraysPluginWrapper.h"
+
+struct CreditsTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<StdArraysPluginWrapper> plugin;
+  boost::shared_ptr<asynInt32Client> throttledCount;
+  boost::shared_ptr<asynInt32Client> creditsAvailable;
+
+  CreditsTestFixture()
+  {
+    std::string simport("simCredits"), testport("Credits");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    throttledCount = boost::shared_ptr<asynInt32Client>(new asynInt32Client(simport.c_str(), 0, NDThrottledCountString));
+    creditsAvailable = boost::shared_ptr<asynInt32Client>(new asynInt32Client(simport.c_str(), 0, NDCreditsAvailableString));
+
+    // The wrapper creates the plugin with a queue size of 50
+    plugin = boost::shared_ptr<StdArraysPluginWrapper>(new StdArraysPluginWrapper(testport, simport));
+    plugin->start();
+    plugin->write(NDPluginDriverEnableCallbacksString, 1);
+  }
+  ~CreditsTestFixture()
+  {
+    plugin.reset();
+    creditsAvailable.reset();
+    throttledCount.reset();
+    driver.reset();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDArrayCreditsTests, CreditsTestFixture)
+
+BOOST_AUTO_TEST_CASE(credit_registry)
+{
+  int a, b;
+
+  // No lossless consumers, so the driver never waits
+  BOOST_CHECK_EQUAL(driver->getCredits(), -1);
+  BOOST_CHECK_EQUAL(driver->waitForCredits(0.01), asynSuccess);
+
+  driver->setCredits(&a, 3);
+  driver->setCredits(&b, 1);
+  BOOST_CHECK_EQUAL(driver->getCredits(), 1);
+  BOOST_CHECK_EQUAL(driver->getCredits(&a), 3);
+  driver->removeCredits(&b);
+  BOOST_CHECK_EQUAL(driver->getCredits(), 3);
+  BOOST_CHECK_EQUAL(driver->getCredits(&b), -1);
+  driver->removeCredits(&a);
+  BOOST_CHECK_EQUAL(driver->getCredits(), -1);
+}
+
+BOOST_AUTO_TEST_CASE(wait_for_credits)
+{
+  int a;
+  epicsInt32 value;
+
+  driver->setCredits(&a, 0);
+  BOOST_CHECK_EQUAL(driver->waitForCredits(0.05), asynTimeout);
+  driver->setCredits(&a, 2);
+  BOOST_CHECK_EQUAL(driver->waitForCredits(0.05), asynSuccess);
+  driver->removeCredits(&a);
+
+  // The counters are published by a background thread
+  epicsThreadSleep(0.1);
+  throttledCount->read(&value);
+  BOOST_CHECK_EQUAL(value, 1);
+}
+
+BOOST_AUTO_TEST_CASE(lossless_plugin)
+{
+  epicsInt32 value;
+
+  BOOST_CHECK_EQUAL(driver->getCredits(), -1);
+
+  plugin->write(NDPluginDriverLosslessString, 1);
+  BOOST_CHECK_EQUAL(driver->getCredits(), 50);
+  epicsThreadSleep(0.1);
+  creditsAvailable->read(&value);
+  BOOST_CHECK_EQUAL(value, 50);
+
+  // A plugin that is not receiving callbacks does not hold the driver back
+  plugin->write(NDPluginDriverEnableCallbacksString, 0);
+  BOOST_CHECK_EQUAL(driver->getCredits(), -1);
+  plugin->write(NDPluginDriverEnableCallbacksString, 1);
+  BOOST_CHECK_EQUAL(driver->getCredits(), 50);
+
+  plugin->write(NDPluginDriverLosslessString, 0);
+  BOOST_CHECK_EQUAL(driver->getCredits(), -1);
+}
+
+BOOST_AUTO_TEST_CASE(shed_queued_arrays)
+{
+  const int numArrays = 5;
+  std::vector<size_t> dims;
+  dims.push_back(64);
+  dims.push_back(32);
+  std::vector<NDArray *> arrays(numArrays);
+  NDArrayPool *pPool = driver->pNDArrayPool;
+  size_t bytesShed;
+  int i;
+
+  fillNDArraysFromPool(dims, NDUInt8, arrays, pPool);
+  plugin->write(NDPluginDriverBlockingCallbacksString, 0);
+
+  // Holding the plugin's lock stops its thread after it takes the first array, so the others stay queued
+  plugin->lock();
+  for (i=0; i<numArrays; i++) {
+    plugin->driverCallback(plugin->pasynUserSelf, arrays[i]);
+  }
+  epicsThreadSleep(0.1);
+
+  // The oldest queued arrays are released first, and only as many as are needed
+  BOOST_CHECK_EQUAL(plugin->shedArrays(pPool, arrays[1]->dataSize + 1, &bytesShed), 2);
+  BOOST_CHECK_EQUAL(bytesShed, arrays[1]->dataSize + arrays[2]->dataSize);
+  BOOST_CHECK_EQUAL(arrays[1]->getReferenceCount(), 1);
+  BOOST_CHECK_EQUAL(arrays[2]->getReferenceCount(), 1);
+  BOOST_CHECK_EQUAL(arrays[3]->getReferenceCount(), 2);
+  plugin->unlock();
+
+  // The arrays that were kept are processed in order and the shed ones are counted as dropped
+  epicsThreadSleep(0.2);
+  BOOST_CHECK_EQUAL(plugin->readInt(NDArrayCounterString), 3);
+  BOOST_CHECK_EQUAL(plugin->readInt(NDUniqueIdString), arrays[numArrays-1]->uniqueId);
+  BOOST_CHECK_EQUAL(plugin->readInt(NDPluginDriverDroppedArraysString), 2);
+
+  // A lossless plugin never sheds arrays
+  plugin->write(NDPluginDriverLosslessString, 1);
+  plugin->lock();
+  plugin->driverCallback(plugin->pasynUserSelf, arrays[0]);
+  plugin->driverCallback(plugin->pasynUserSelf, arrays[1]);
+  epicsThreadSleep(0.1);
+  BOOST_CHECK_EQUAL(plugin->shedArrays(pPool, arrays[1]->dataSize, &bytesShed), 0);
+  plugin->unlock();
+  epicsThreadSleep(0.2);
+
+  for (i=0; i<numArrays; i++) arrays[i]->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <deque>
 
 #include "testingutilities.h"
 
@@ -41,6 +42,41 @@ struct NDArrayPoolFixture
     }
 };
 
+// Buffer owner that records when the pool gives the buffer back
+struct TestBufferOwner : public NDArrayBufferOwner
+{
+    void *released;
+    int releaseCount;
+    TestBufferOwner() : released(0), releaseCount(0) {}
+    void releaseBuffer(void *pData) { released = pData; releaseCount++; }
+};
+
+// Shedder that holds a queue of arrays and releases the oldest ones on request
+struct TestShedder : public NDArrayShedder
+{
+  int priorityClass;
+  std::deque<NDArray *> queue;
+  TestShedder(int priorityClass) : priorityClass(priorityClass) { NDArrayPool::addShedder(this); }
+  ~TestShedder()
+  {
+    NDArrayPool::removeShedder(this);
+    while (!queue.empty()) { queue.front()->release(); queue.pop_front(); }
+  }
+  int getPriorityClass() { return priorityClass; }
+  int shedArrays(NDArrayPool *pPool, size_t bytesNeeded, size_t *bytesShed)
+  {
+    int numShed = 0;
+    *bytesShed = 0;
+    while (!queue.empty() && (*bytesShed < bytesNeeded)) {
+      *bytesShed += queue.front()->dataSize;
+      queue.front()->release();
+      queue.pop_front();
+      numShed++;
+    }
+    return numShed;
+  }
+};
+
 BOOST_FIXTURE_TEST_SUITE(NDArrayPoolTests, NDArrayPoolFixture)
 
 BOOST_AUTO_TEST_CASE(test_Pool)
@@ -129,4 +165,206 @@ BOOST_AUTO_TEST_CASE(test_Pool)
 
 }
 
+BOOST_AUTO_TEST_CASE(test_BorrowedBuffer)
+{
+  char buffer[1000];
+  TestBufferOwner owner;
+  size_t dims = sizeof(buffer);
+  NDArray *pArray;
+
+  // A borrowed buffer is used in place and does not count as pool memory
+  pArray = pPool->alloc(1, &dims, NDUInt8, sizeof(buffer), buffer, &owner);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(pArray->pData, (void *)buffer);
+  BOOST_CHECK_EQUAL(pArray->dataSize, sizeof(buffer));
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), 0);
+
+  // The owner gets the buffer back only when the last reference is released
+  pArray->reserve();
+  pArray->release();
+  BOOST_CHECK_EQUAL(owner.releaseCount, 0);
+  pArray->release();
+  BOOST_CHECK_EQUAL(owner.releaseCount, 1);
+  BOOST_CHECK_EQUAL(owner.released, (void *)buffer);
+  BOOST_CHECK_EQUAL(pPool->getNumFree(), 1);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), 0);
+
+  // A normal allocation never gets the borrowed buffer
+  NDArray *pArrayTest = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArrayTest != 0);
+  BOOST_CHECK(pArrayTest->pData != (void *)buffer);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), sizeof(buffer));
+  pArrayTest->release();
+  BOOST_CHECK_EQUAL(owner.releaseCount, 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_Shedding)
+{
+  size_t dims = 10000;
+  NDArray *pArray;
+  TestShedder low(NDPriorityLow), high(NDPriorityHigh);
+
+  // Fill the pool: 3 arrays queued by the Low consumer, 2 by the High consumer
+  for (int i=0; i<5; i++) {
+    pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != 0);
+    if (i < 3) low.queue.push_back(pArray);
+    else high.queue.push_back(pArray);
+  }
+  BOOST_CHECK_EQUAL(pPool->getMemoryHighWater(), (size_t)50000);
+  BOOST_CHECK_EQUAL(pPool->getBuffersHighWater(), 5);
+
+  // The driver thread needs 20000 bytes but only 10000 are left, so the Low consumer gives up its oldest array
+  size_t bigDims = 20000;
+  NDArray *pFirst = low.queue.front();
+  pArray = pPool->alloc(1, &bigDims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(low.queue.size(), (size_t)2);
+  BOOST_CHECK(low.queue.front() != pFirst);
+  BOOST_CHECK_EQUAL(high.queue.size(), (size_t)2);
+  BOOST_CHECK_EQUAL(pPool->getShedCount(NDPriorityLow), 1);
+
+  // The next one takes the rest of the Low consumer's arrays
+  NDArray *pArray2 = pPool->alloc(1, &bigDims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray2 != 0);
+  BOOST_CHECK_EQUAL(low.queue.size(), (size_t)0);
+  BOOST_CHECK_EQUAL(pPool->getShedCount(NDPriorityLow), 3);
+  BOOST_CHECK_EQUAL(pPool->getAllocFailures(), 0);
+
+  // Once the Low consumer is empty the High consumer is never asked and the allocation fails
+  NDArray *pArray3 = pPool->alloc(1, &bigDims, NDUInt8, 0, NULL);
+  BOOST_CHECK(pArray3 == 0);
+  BOOST_CHECK_EQUAL(high.queue.size(), (size_t)2);
+  BOOST_CHECK_EQUAL(pPool->getAllocFailures(), 1);
+
+  // A thread of Normal priority cannot take arrays from other Normal consumers
+  TestShedder normal(NDPriorityNormal);
+  normal.queue.push_back(pArray);
+  normal.queue.push_back(pArray2);
+  NDArrayPool::setThreadPriorityClass(NDPriorityNormal);
+  pArray3 = pPool->alloc(1, &bigDims, NDUInt8, 0, NULL);
+  NDArrayPool::setThreadPriorityClass(NDPriorityCritical);
+  BOOST_CHECK(pArray3 == 0);
+  BOOST_CHECK_EQUAL(normal.queue.size(), (size_t)2);
+  BOOST_CHECK_EQUAL(pPool->getAllocFailures(), 2);
+
+  pPool->resetStatistics();
+  BOOST_CHECK_EQUAL(pPool->getShedCount(NDPriorityLow), 0);
+  BOOST_CHECK_EQUAL(pPool->getAllocFailures(), 0);
+  BOOST_CHECK_EQUAL(pPool->getMemoryHighWater(), pPool->getMemorySize());
+}
+
+BOOST_AUTO_TEST_CASE(test_Compact)
+{
+  size_t dims = 10000;
+  NDArray *pArray, *pArray2;
+  epicsUInt8 *pData;
+
+  // A compressed array is moved to a buffer of its compressedSize, the large buffer goes on the free list
+  pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray != 0);
+  pData = (epicsUInt8 *)pArray->pData;
+  for (int i=0; i<1000; i++) pData[i] = (epicsUInt8)i;
+  pArray->codec.name = "lz4";
+  pArray->compressedSize = 1000;
+  BOOST_CHECK_EQUAL(pPool->compact(pArray), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pArray->dataSize, (size_t)1000);
+  BOOST_CHECK_EQUAL(pArray->compressedSize, (size_t)1000);
+  pData = (epicsUInt8 *)pArray->pData;
+  for (int i=0; i<1000; i++) BOOST_REQUIRE_EQUAL(pData[i], (epicsUInt8)i);
+  BOOST_CHECK_EQUAL(pPool->getNumFree(), 1);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)11000);
+  BOOST_CHECK_EQUAL(pPool->getCompactCount(), 1);
+  BOOST_CHECK_EQUAL(pPool->getCompactBytesSaved(), 9000.);
+
+  // The next compressor output reuses the large buffer
+  pArray2 = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray2 != 0);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)11000);
+
+  // A small free buffer is swapped in rather than allocating a new one
+  pArray->release();
+  pArray2->codec.name = "lz4";
+  pArray2->compressedSize = 900;
+  BOOST_CHECK_EQUAL(pPool->compact(pArray2), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pArray2->dataSize, (size_t)1000);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)11000);
+  BOOST_CHECK_EQUAL(pPool->getNumBuffers(), 2);
+
+  // Poorly compressed and uncompressed arrays are left alone
+  pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(pPool->compact(pArray), ND_ERROR);
+  pArray->codec.name = "lz4";
+  pArray->compressedSize = 8000;
+  BOOST_CHECK_EQUAL(pPool->compact(pArray), ND_ERROR);
+  BOOST_CHECK_EQUAL(pArray->dataSize, dims);
+  BOOST_CHECK_EQUAL(pPool->getCompactCount(), 2);
+  pArray->release();
+  pArray2->release();
+
+  pPool->resetStatistics();
+  BOOST_CHECK_EQUAL(pPool->getCompactCount(), 0);
+  BOOST_CHECK_EQUAL(pPool->getCompactBytesSaved(), 0.);
+}
+
+BOOST_AUTO_TEST_CASE(test_CompactFullPool)
+{
+  size_t bigDims = 50000, dims = 10000;
+  NDArray *pBig, *pArray;
+
+  // With the pool full the large buffer cannot be kept, so it is freed
+  pBig = pPool->alloc(1, &bigDims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pBig != 0);
+  pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray != 0);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)MAX_MEMORY);
+  pArray->codec.name = "lz4";
+  pArray->compressedSize = 1000;
+  BOOST_CHECK_EQUAL(pPool->compact(pArray), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pArray->dataSize, (size_t)1000);
+  BOOST_CHECK_EQUAL(pPool->getNumFree(), 0);
+  BOOST_CHECK_EQUAL(pPool->getMemorySize(), (size_t)51000);
+  pArray->release();
+  pBig->release();
+}
+
+BOOST_AUTO_TEST_CASE(test_Alignment)
+{
+  size_t dims = 1000;
+  NDArray *pArray;
+
+  // Non power of 2 alignments are rejected
+  BOOST_CHECK_EQUAL(pPool->setAlignment(3000), ND_ERROR);
+  BOOST_CHECK_EQUAL(pPool->getAlignment(), (size_t)0);
+
+  // A buffer on the free list that is not aligned is deleted rather than reused
+  pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+  BOOST_REQUIRE(pArray != 0);
+  bool aligned = ((uintptr_t)pArray->pData % 4096) == 0;
+  pArray->release();
+#if defined(_WIN32) || defined(vxWorks)
+  // Buffers cannot be aligned, so the alignment is rejected rather than reported and not applied
+  BOOST_CHECK_EQUAL(pPool->setAlignment(4096), ND_ERROR);
+  BOOST_CHECK_EQUAL(pPool->getAlignment(), (size_t)0);
+  (void)aligned;
+#else
+  BOOST_CHECK_EQUAL(pPool->setAlignment(4096), ND_SUCCESS);
+  BOOST_CHECK_EQUAL(pPool->getAlignment(), (size_t)4096);
+  BOOST_CHECK_EQUAL(pPool->getNumFree(), aligned ? 1 : 0);
+
+  for (int i=0; i<3; i++) {
+    pArray = pPool->alloc(1, &dims, NDUInt8, 0, NULL);
+    BOOST_REQUIRE(pArray != 0);
+    BOOST_CHECK_EQUAL((uintptr_t)pArray->pData % 4096, (uintptr_t)0);
+    pArray->codec.name = "lz4";
+    pArray->compressedSize = 100;
+    BOOST_CHECK_EQUAL(pPool->compact(pArray), ND_SUCCESS);
+    BOOST_CHECK_EQUAL((uintptr_t)pArray->pData % 4096, (uintptr_t)0);
+    pArray->release();
+  }
+#endif
+  BOOST_CHECK_EQUAL(pPool->setAlignment(0), ND_SUCCESS);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,8 @@
 #include <NDArray.h>
 #include <NDAttribute.h>
 #include <asynDriver.h>
+#include <epicsTime.h>
+#include <epicsThread.h>
 
 #include <string.h>
 #include <stdint.h>
@@ -19,11 +21,33 @@ using namespace std;
 
 #include "testingutilities.h"
 #include "asynPortDriver.h"
+#include "AsynPortClientContainer.h"
 #include "HDF5PluginWrapper.h"
 #include "HDF5FileReader.h"
+#include <NDPluginCodec.h>
+#include <NDFileHDF5Replay.h>
 
 static  NDArrayPool *arrayPool;
 
+// Keeps a reference to every NDArray that a driver passes to its plugins
+class ArrayRecorder : public asynGenericPointerClient {
+public:
+  ArrayRecorder(const char *portName)
+  : asynGenericPointerClient(portName, 0, NDArrayDataString)
+  {
+    this->registerInterruptUser(arrayCallback);
+  }
+  std::vector<NDArray *> arrays;
+
+private:
+  static void arrayCallback(void *drvPvt, asynUser *pasynUser, void *ptr)
+  {
+    NDArray *pArray = (NDArray *)ptr;
+    pArray->reserve();
+    ((ArrayRecorder *)drvPvt)->arrays.push_back(pArray);
+  }
+};
+
 struct NDFileHDF5TestFixture
 {
   asynNDArrayDriver* dummy_driver;
@@ -76,6 +100,53 @@ struct NDFileHDF5TestFixture
     hdf5->write(NDFileTemplateString, "%s%s_%d.5");
   }
 
+  // Stream mode writing to name_<fileNumber>.h5
+  void setup_hdf_file(const char *name, int fileNumber = 0, int autoIncrement = 0)
+  {
+    setup_hdf_stream();
+    hdf5->write(NDFileNameString, name);
+    hdf5->write(NDFileTemplateString, "%s%s_%d.h5");
+    hdf5->write(NDFileNumberString, fileNumber);
+    hdf5->write(NDAutoIncrementString, autoIncrement);
+  }
+
+#if H5_VERSION_GE(1, 10, 3) && (defined(HAVE_BITSHUFFLE) || defined(HAVE_ZSTD))
+  // Write arrays compressed by NDPluginCodec and check that NDFileHDF5Reader reads the chunks back
+  // with a direct chunk read as the same compressed arrays, which decompress to the original arrays
+  void check_compressed_read(const char *name, const std::vector<NDArray*>& arrays,
+                             const std::vector<NDArray*>& compressed)
+  {
+    char errorMessage[256];
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+
+    setup_hdf_file(name);
+    startCapture(hdf5.get(), hdf5.get(), compressed[0], (int)compressed.size());
+    streamFrames(hdf5.get(), compressed);
+    BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+    std::string fileName = std::string(name) + "_0.h5";
+    asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+    NDFileHDF5Reader reader(pasynUser);
+    BOOST_REQUIRE_EQUAL(reader.open(fileName.c_str(), ""), asynSuccess);
+    BOOST_REQUIRE_EQUAL(reader.getNumFrames(), (int)arrays.size());
+    for (size_t i = 0; i < arrays.size(); i++) {
+      NDArray *pArray = NULL;
+      NDArrayInfo_t info;
+      arrays[i]->getInfo(&info);
+      BOOST_REQUIRE_EQUAL(reader.readFrame((int)i, arrayPool, &pArray), asynSuccess);
+      BOOST_CHECK_EQUAL(pArray->codec.name, compressed[i]->codec.name);
+      BOOST_CHECK_EQUAL(pArray->compressedSize, compressed[i]->compressedSize);
+      NDArray *pOut = decompressArray(pArray, 1, &status, errorMessage);
+      BOOST_REQUIRE_MESSAGE(pOut, errorMessage);
+      BOOST_CHECK(memcmp(pOut->pData, arrays[i]->pData, info.totalBytes) == 0);
+      pOut->release();
+      pArray->release();
+    }
+    reader.close();
+    pasynManager->freeAsynUser(pasynUser);
+  }
+#endif
+
   void populateAttributeList(NDAttributeList *pAttributeList)
   {
     epicsFloat64 val1 = 1.0;
@@ -292,4 +363,688 @@ BOOST_AUTO_TEST_CASE(test_DatasetLayout1)
 
 }
 
+// Reads a whole uint16 dataset and the size it takes in the file
+static std::vector<epicsUInt16> readUInt16Data(const char *fileName, hsize_t *storageSize)
+{
+  std::vector<epicsUInt16> data;
+  hid_t file = H5Fopen(fileName, H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  hid_t dataspace = H5Dget_space(dataset);
+  data.resize(H5Sget_simple_extent_npoints(dataspace));
+  H5Sclose(dataspace);
+  BOOST_CHECK(H5Dread(dataset, H5T_NATIVE_UINT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, &data[0]) >= 0);
+  *storageSize = H5Dget_storage_size(dataset);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  return data;
+}
+
+BOOST_AUTO_TEST_CASE(test_ParallelCompression)
+{
+  // zlib compression of the chunks by the plugin with several threads must write the
+  // same file as with one thread, and the HDF5 filter pipeline (0 threads) the same
+  // data, for whole frame, row and tile chunks. The throughput is measured by
+  // benchmark_ParallelCompression in plugin-benchmark.
+  const size_t sizeX = 256, sizeY = 128;
+  const int numFrames = 6;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  size_t chunks[][2] = {{sizeX, sizeY}, {sizeX, 16}, {100, 100}};
+  int threads[] = {1, 0, 4};
+  int fileNumber = 100;
+
+  // 16-bit frames with some structure and noise, so that they compress but not trivially
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  unsigned int seed = 1;
+  for (int i = 0; i < numFrames; i++) {
+    epicsUInt16 *pData = (epicsUInt16 *)arrays[i]->pData;
+    for (size_t j = 0; j < sizeX * sizeY; j++) {
+      seed = seed * 1103515245 + 12345;
+      pData[j] = (epicsUInt16)((j % sizeX) + i + ((seed >> 16) & 0xF));
+    }
+  }
+
+  for (size_t c = 0; c < sizeof(chunks)/sizeof(chunks[0]); c++) {
+    std::vector<epicsUInt16> oneThreadData;
+    hsize_t oneThreadSize = 0;
+    for (size_t t = 0; t < sizeof(threads)/sizeof(threads[0]); t++) {
+      setup_hdf_file("parallel", fileNumber);
+      hdf5->write(str_NDFileHDF5_compressionType, 3); // zlib
+      hdf5->write(str_NDFileHDF5_zCompressLevel, 1);
+      hdf5->write(str_NDFileHDF5_chunkSizeAuto, 0);
+      hdf5->write(NDFileHDF5::str_NDFileHDF5_chunkSize[0], (int)chunks[c][0]);
+      hdf5->write(NDFileHDF5::str_NDFileHDF5_chunkSize[1], (int)chunks[c][1]);
+      hdf5->write(str_NDFileHDF5_nFramesChunks, 1);
+      hdf5->write(str_NDFileHDF5_compressionNumThreads, threads[t]);
+      startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+      streamFrames(hdf5.get(), arrays);
+      BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+      char fileName[64];
+      sprintf(fileName, "parallel_%d.h5", fileNumber++);
+      hsize_t storageSize;
+      std::vector<epicsUInt16> data = readUInt16Data(fileName, &storageSize);
+      if (threads[t] == 1) {
+        verifyHDF5Frames(fileName, arrays);
+        oneThreadData = data;
+        oneThreadSize = storageSize;
+        continue;
+      }
+      BOOST_CHECK_MESSAGE(data == oneThreadData, "chunks " << chunks[c][0] << "x" << chunks[c][1]
+                          << ": data written with " << threads[t] << " threads differs from 1 thread");
+      // The chunks are compressed independently, so more threads must not change the result
+      if (threads[t] > 1) BOOST_CHECK_EQUAL(storageSize, oneThreadSize);
+    }
+  }
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_WriteBehind)
+{
+  // Stream frames through the write-behind queue, limited to 2 arrays so that the plugin
+  // has to wait for the write thread, and check that the frames and their attributes
+  // are written in order
+  const size_t sizeX = 256, sizeY = 128;
+  const int numFrames = 20;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+  }
+
+  setup_hdf_file("writebehind");
+  hdf5->write(str_NDFileHDF5_writeBehind, 1);
+  hdf5->write(str_NDFileHDF5_writeBehindMaxArrays, 2);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+
+  for (int i = 0; i < numFrames; i++) {
+    hdf5->lock();
+    BOOST_CHECK_NO_THROW(hdf5->processCallbacks(arrays[i]));
+    hdf5->unlock();
+    BOOST_CHECK(hdf5->readInt(str_NDFileHDF5_writeBehindQueueSize) <= 2);
+  }
+
+  // The file was closed after the last frame, which waits for the queue to empty
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_writeBehindQueueSize), 0);
+  BOOST_CHECK_EQUAL(hdf5->readDouble(str_NDFileHDF5_writeBehindMemory), 0.0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+  verifyHDF5Frames("writebehind_0.h5", arrays);
+  hid_t file = H5Fopen("writebehind_0.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen2(file, "/entry/instrument/NDAttributes/NDArrayUniqueId", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  std::vector<epicsInt32> uniqueIds(numFrames);
+  BOOST_CHECK(H5Dread(dataset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &uniqueIds[0]) >= 0);
+  for (int i = 0; i < numFrames; i++) {
+    BOOST_CHECK_EQUAL(uniqueIds[i], i + 1);
+  }
+  H5Dclose(dataset);
+  H5Fclose(file);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_BufferedAttributes)
+{
+  // Write a number of frames that is not a multiple of the NDAttribute chunk size, so that
+  // the buffered NDAttribute values are written a chunk at a time and the rest on close,
+  // and check that every value is in the file
+  const size_t sizeX = 16, sizeY = 8;
+  const int numFrames = 10;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+    epicsInt32 counter = i * 3;
+    arrays[i]->pAttributeList->add("Counter", "Test counter", NDAttrInt32, &counter);
+    char label[MAX_STRING_SIZE];
+    sprintf(label, "frame%d", i);
+    arrays[i]->pAttributeList->add("Label", "Test label", NDAttrString, label);
+  }
+
+  setup_hdf_file("bufferedattr");
+  hdf5->write(str_NDFileHDF5_NDAttributeChunk, 4);
+  hdf5->write(str_NDFileHDF5_NDAttributeWritePeriod, 10.0);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+  hid_t file = H5Fopen("bufferedattr_0.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen2(file, "/entry/instrument/NDAttributes/NDArrayUniqueId", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  std::vector<epicsInt32> values(numFrames);
+  BOOST_CHECK(H5Dread(dataset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &values[0]) >= 0);
+  for (int i = 0; i < numFrames; i++) {
+    BOOST_CHECK_EQUAL(values[i], i + 1);
+  }
+  H5Dclose(dataset);
+  dataset = H5Dopen2(file, "/entry/instrument/NDAttributes/Counter", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  BOOST_CHECK(H5Dread(dataset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &values[0]) >= 0);
+  for (int i = 0; i < numFrames; i++) {
+    BOOST_CHECK_EQUAL(values[i], i * 3);
+  }
+  H5Dclose(dataset);
+  dataset = H5Dopen2(file, "/entry/instrument/NDAttributes/Label", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  hid_t datatype = H5Dget_type(dataset);
+  size_t size = H5Tget_size(datatype);
+  std::vector<char> labels(numFrames * size);
+  BOOST_CHECK(H5Dread(dataset, datatype, H5S_ALL, H5S_ALL, H5P_DEFAULT, &labels[0]) >= 0);
+  for (int i = 0; i < numFrames; i++) {
+    char label[MAX_STRING_SIZE];
+    sprintf(label, "frame%d", i);
+    BOOST_CHECK_EQUAL(std::string(&labels[i * size]), std::string(label));
+  }
+  H5Tclose(datatype);
+  H5Dclose(dataset);
+  H5Fclose(file);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_AssembledChunks)
+{
+  // Write frames into chunks of 4 frames, with a number of frames that leaves the last chunk
+  // partly filled, and check that the frames assembled into chunks read back correctly
+  const size_t sizeX = 64, sizeY = 32;
+  const int numFrames = 10, chunkFrames = 4;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+
+  setup_hdf_file("assembled");
+  hdf5->write(str_NDFileHDF5_chunkSizeAuto, 1);
+  hdf5->write(str_NDFileHDF5_nFramesChunks, chunkFrames);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+  hid_t file = H5Fopen("assembled_0.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen2(file, "/entry/data/data", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  hid_t cparms = H5Dget_create_plist(dataset);
+  hsize_t chunk[3];
+  BOOST_REQUIRE_EQUAL(H5Pget_chunk(cparms, 3, chunk), 3);
+  BOOST_CHECK_EQUAL(chunk[0], (hsize_t)chunkFrames);
+  H5Pclose(cparms);
+  H5Dclose(dataset);
+  H5Fclose(file);
+  verifyHDF5Frames("assembled_0.h5", arrays);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_FileRotation)
+{
+  // Stream with FileRotate and write-behind so that the file changes are queued for the write
+  // thread, stop part way through the third file, and check that each file has its own frames
+  const size_t sizeX = 64, sizeY = 32;
+  const int numFrames = 12, framesPerFile = 5, numFiles = 3;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+  }
+
+  setup_hdf_file("rotation", 0, 1);
+  hdf5->write(NDFileRotateString, 1);
+  hdf5->write(str_NDFileHDF5_writeBehind, 1);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], framesPerFile);
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileCaptureString), 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileNumCapturedString), numFrames - 2 * framesPerFile);
+  hdf5->write(NDFileCaptureString, 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_writeBehindQueueSize), 0);
+
+  for (int n = 0; n < numFiles; n++) {
+    char fileName[MAX_FILENAME_LEN];
+    sprintf(fileName, "rotation_%d.h5", n);
+    int first = n * framesPerFile;
+    int frames = (numFrames - first < framesPerFile) ? numFrames - first : framesPerFile;
+    verifyHDF5Frames(fileName, arrays, first, frames);
+  }
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_LayoutCache)
+{
+  // Rotate through files with the same XML layout, and check that the layout parsed for the
+  // first file is used for the others and gives them the same datasets and hard links
+  const int numFrames = 6, framesPerFile = 3, numFiles = 2;
+  size_t tmpdims[] = {10,10};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt32, arrays, arrayPool);
+  for (int i = 0; i < numFrames; i++) {
+    populateAttributeList(arrays[i]->pAttributeList);
+  }
+
+  setup_hdf_file("layoutcache", 0, 1);
+  hdf5->write(str_NDFileHDF5_storeAttributes, 1);
+  hdf5->write(NDFileRotateString, 1);
+  hdf5->write(str_NDFileHDF5_layoutFilename, "<?xml version=\"1.0\" standalone=\"no\" ?>\
+<hdf5_layout>\
+  <group name=\"entry\">\
+    <group name=\"detector\">\
+      <dataset name=\"data\" source=\"detector\" det_default=\"true\" />\
+    </group>\
+    <dataset name=\"temperature\" ndattribute=\"temperature\" source=\"ndattribute\" />\
+    <hardlink name=\"data\" target=\"/entry/detector/data\" />\
+    <group name=\"metadata\" ndattr_default=\"true\" />\
+  </group>\
+</hdf5_layout>");
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_layoutValid), 1);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], framesPerFile);
+  streamFrames(hdf5.get(), arrays);
+  hdf5->write(NDFileCaptureString, 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_layoutCached), 1);
+  BOOST_CHECK(hdf5->readDouble(str_NDFileHDF5_openTime) >= 0.0);
+  BOOST_CHECK(hdf5->readDouble(str_NDFileHDF5_closeTime) >= 0.0);
+
+  for (int n = 0; n < numFiles; n++) {
+    char fileName[MAX_FILENAME_LEN];
+    sprintf(fileName, "layoutcache_%d.h5", n);
+    HDF5FileReader fr(fileName);
+    std::vector<hsize_t> odims;
+    BOOST_CHECK_EQUAL(fr.checkDatasetExists("/entry/data"), true);
+    odims = fr.getDatasetDimensions("/entry/data");
+    BOOST_REQUIRE_EQUAL(odims.size(), 3);
+    BOOST_CHECK_EQUAL(odims[0], (hsize_t)framesPerFile);
+    BOOST_CHECK_EQUAL(fr.checkDatasetExists("/entry/temperature"), true);
+    odims = fr.getDatasetDimensions("/entry/temperature");
+    BOOST_REQUIRE_EQUAL(odims.size(), 1);
+    BOOST_CHECK_EQUAL(odims[0], (hsize_t)framesPerFile);
+    BOOST_CHECK_EQUAL(fr.checkDatasetExists("/entry/metadata/ArrayCounter"), true);
+  }
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_VirtualShards)
+{
+  // Write the odd frames as shard 1 and then the even frames as shard 0, which also writes the
+  // master file, and check that the virtual datasets in the master file have every frame in order
+  const size_t sizeX = 32, sizeY = 16;
+  const int numFrames = 6, numShards = 2;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+  }
+
+  setup_hdf_file("shards");
+  hdf5->write(str_NDFileHDF5_shardCount, numShards);
+
+  for (int shard = numShards - 1; shard >= 0; shard--) {
+    hdf5->write(NDFileNumberString, 0);
+    hdf5->write(str_NDFileHDF5_shardIndex, shard);
+    startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames / numShards);
+    streamFrames(hdf5.get(), arrays, shard, numShards);
+    BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  }
+
+  hid_t file = H5Fopen("shards_0_shard1.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  H5Fclose(file);
+  verifyHDF5Frames("shards_0.h5", arrays);
+  file = H5Fopen("shards_0.h5", H5F_ACC_RDONLY, H5P_DEFAULT);
+  BOOST_REQUIRE(file >= 0);
+  hid_t dataset = H5Dopen2(file, "/entry/instrument/NDAttributes/NDArrayUniqueId", H5P_DEFAULT);
+  BOOST_REQUIRE(dataset >= 0);
+  std::vector<epicsInt32> uniqueIds(numFrames);
+  BOOST_CHECK(H5Dread(dataset, H5T_NATIVE_INT32, H5S_ALL, H5S_ALL, H5P_DEFAULT, &uniqueIds[0]) >= 0);
+  for (int i = 0; i < numFrames; i++) {
+    BOOST_CHECK_EQUAL(uniqueIds[i], i + 1);
+  }
+  H5Dclose(dataset);
+  H5Fclose(file);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_PreSizedDatasets)
+{
+  // Capture fewer frames than NumCapture into a pre-sized dataset and check that the dataset
+  // is trimmed to the frames written when capture is stopped
+  const size_t sizeX = 32, sizeY = 16;
+  const int numCapture = 10, numFrames = 6;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+
+  setup_hdf_file("presized");
+  hdf5->write(str_NDFileHDF5_preSize, 1);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numCapture);
+  streamFrames(hdf5.get(), arrays);
+  hdf5->write(NDFileCaptureString, 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+  // The dataset was created with room for numCapture frames and trimmed to numFrames
+  verifyHDF5Frames("presized_0.h5", arrays);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_DirectIO)
+{
+  // Write a file with direct I/O, which falls back to the page cache if the HDF5 library
+  // does not have the direct I/O driver, and check that the frames read back
+  const size_t sizeX = 64, sizeY = 32;
+  const int numFrames = 4;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+
+  setup_hdf_file("directio");
+  hdf5->write(str_NDFileHDF5_directIO, 1);
+  size_t poolAlignment = arrayPool->getAlignment();
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+#ifdef H5_HAVE_DIRECT
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_directIORunning), 1);
+#else
+  // Without the direct I/O driver the file is written through the page cache
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_directIORunning), 0);
+#endif
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_directIORunning), 0);
+  // The pool of the driver is shared with other plugins and is not changed by direct I/O
+  BOOST_CHECK_EQUAL(arrayPool->getAlignment(), poolAlignment);
+
+  verifyHDF5Frames("directio_0.h5", arrays);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_PerformanceDetail)
+{
+  // Write a file with the phase times stored after the standard performance columns, and check
+  // the size of the performance dataset and the rolling statistics
+  const size_t sizeX = 64, sizeY = 32;
+  const int numFrames = 6;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+
+  setup_hdf_file("perfdetail");
+  hdf5->write(str_NDFileHDF5_storePerformance, 1);
+  hdf5->write(str_NDFileHDF5_performanceDetail, 1);
+  hdf5->write(str_NDFileHDF5_performanceWindow, 4);
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  double writeMean = hdf5->readDouble(NDFileHDF5::str_NDFileHDF5_phaseMean[NDFileHDF5PhaseWrite]);
+  double writeMax = hdf5->readDouble(NDFileHDF5::str_NDFileHDF5_phaseMax[NDFileHDF5PhaseWrite]);
+  BOOST_CHECK(writeMean > 0.0);
+  BOOST_CHECK(writeMax >= writeMean);
+  // The dataset is not pre-sized, so it is extended in the file for every frame
+  double extendMean = hdf5->readDouble(NDFileHDF5::str_NDFileHDF5_phaseMean[NDFileHDF5PhaseExtend]);
+  double extendMax = hdf5->readDouble(NDFileHDF5::str_NDFileHDF5_phaseMax[NDFileHDF5PhaseExtend]);
+  BOOST_CHECK(extendMean > 0.0);
+  BOOST_CHECK(extendMax >= extendMean);
+
+  HDF5FileReader fr("perfdetail_0.h5");
+  std::vector<hsize_t> odims = fr.getDatasetDimensions("/entry/instrument/performance/timestamp");
+  BOOST_REQUIRE_EQUAL(odims.size(), 2);
+  BOOST_CHECK_EQUAL(odims[0], (hsize_t)numFrames);
+  BOOST_CHECK_EQUAL(odims[1], (hsize_t)(5 + NDFileHDF5NumPhases));
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_ReadFile)
+{
+  // Write a file with NDAttributes, read the frames back with NDFileHDF5Reader and then
+  // with ReadFile of the plugin
+  const size_t sizeX = 32, sizeY = 16;
+  const int numFrames = 5;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 100);
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+    epicsInt32 counter = i * 3;
+    arrays[i]->pAttributeList->add("Counter", "Test counter", NDAttrInt32, &counter);
+    char label[MAX_STRING_SIZE];
+    sprintf(label, "frame%d", i);
+    arrays[i]->pAttributeList->add("Label", "Test label", NDAttrString, label);
+  }
+
+  setup_hdf_file("readfile");
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+  asynUser *pasynUser = pasynManager->createAsynUser(0, 0);
+  NDFileHDF5Reader reader(pasynUser);
+  BOOST_REQUIRE_EQUAL(reader.open("readfile_0.h5", ""), asynSuccess);
+  BOOST_CHECK_EQUAL(reader.getNumFrames(), numFrames);
+  // The first link to the detector dataset in name order
+  BOOST_CHECK_EQUAL(reader.getDatasetName(), std::string("/entry/data/data"));
+  for (int i = 0; i < numFrames; i++) {
+    NDArray *pArray = NULL;
+    BOOST_REQUIRE_EQUAL(reader.readFrame(i, arrayPool, &pArray), asynSuccess);
+    BOOST_CHECK_EQUAL(pArray->ndims, 2);
+    BOOST_CHECK_EQUAL(pArray->dims[0].size, sizeX);
+    BOOST_CHECK_EQUAL(pArray->dims[1].size, sizeY);
+    BOOST_CHECK_EQUAL(pArray->dataType, NDUInt16);
+    BOOST_CHECK(memcmp(pArray->pData, arrays[i]->pData, sizeX * sizeY * 2) == 0);
+    BOOST_CHECK_EQUAL(pArray->uniqueId, i + 1);
+    epicsInt32 counter = -1;
+    NDAttribute *pAttribute = pArray->pAttributeList->find("Counter");
+    BOOST_REQUIRE(pAttribute != NULL);
+    pAttribute->getValue(NDAttrInt32, &counter);
+    BOOST_CHECK_EQUAL(counter, i * 3);
+    std::string label;
+    pAttribute = pArray->pAttributeList->find("Label");
+    BOOST_REQUIRE(pAttribute != NULL);
+    pAttribute->getValue(label);
+    char expected[MAX_STRING_SIZE];
+    sprintf(expected, "frame%d", i);
+    BOOST_CHECK_EQUAL(label, std::string(expected));
+    pArray->release();
+  }
+  NDArray *pArray = NULL;
+  BOOST_CHECK_EQUAL(reader.readFrame(numFrames, arrayPool, &pArray), asynError);
+  reader.close();
+  pasynManager->freeAsynUser(pasynUser);
+
+  // ReadFile reads the frame ReadFrame and advances it
+  hdf5->write(str_NDFileHDF5_readFrame, 2);
+  hdf5->write(NDReadFileString, 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readNumFrames), numFrames);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readFrame), 3);
+
+  // The file stays open for the next ReadFile, and is opened again after it has been rewritten
+  hdf5->write(NDReadFileString, 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readFrame), 4);
+  const int numRewritten = 3;
+  std::vector<NDArray*> rewritten(arrays.begin(), arrays.begin() + numRewritten);
+  startCapture(hdf5.get(), hdf5.get(), rewritten[0], numRewritten);
+  streamFrames(hdf5.get(), rewritten);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  hdf5->write(NDReadFileString, 1);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readNumFrames), numRewritten);
+  BOOST_CHECK_EQUAL(hdf5->readInt(str_NDFileHDF5_readFrame), 1);
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
+#if H5_VERSION_GE(1, 10, 3) && (defined(HAVE_BITSHUFFLE) || defined(HAVE_ZSTD))
+BOOST_AUTO_TEST_CASE(test_ReadCompressed)
+{
+  // Chunks compressed with bitshuffle/lz4, lz4 and zstd are read back compressed
+  const size_t sizeX = 64, sizeY = 32;
+  const int numFrames = 4;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+  std::vector<NDArray*>arrays(numFrames);
+  std::vector<NDArray*>compressed(numFrames);
+
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+
+#ifdef HAVE_BITSHUFFLE
+  {
+    char errorMessage[256];
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+    for (int i = 0; i < numFrames; i++) {
+      compressed[i] = compressBSLZ4(arrays[i], 1, &status, errorMessage);
+      BOOST_REQUIRE_MESSAGE(compressed[i], errorMessage);
+    }
+    check_compressed_read("readbslz4", arrays, compressed);
+    for (int i = 0; i < numFrames; i++) {
+      compressed[i]->release();
+      compressed[i] = compressLZ4(arrays[i], &status, errorMessage);
+      BOOST_REQUIRE_MESSAGE(compressed[i], errorMessage);
+    }
+    check_compressed_read("readlz4", arrays, compressed);
+    for (int i = 0; i < numFrames; i++) {
+      compressed[i]->release();
+    }
+  }
+#endif
+#ifdef HAVE_ZSTD
+  {
+    char errorMessage[256];
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+    for (int i = 0; i < numFrames; i++) {
+      compressed[i] = compressZstd(arrays[i], 3, 1, NULL, &status, errorMessage);
+      BOOST_REQUIRE_MESSAGE(compressed[i], errorMessage);
+    }
+    check_compressed_read("readzstd", arrays, compressed);
+    for (int i = 0; i < numFrames; i++) {
+      compressed[i]->release();
+    }
+  }
+#endif
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(test_Replay)
+{
+  // Replay a file twice; the plugins must get every frame in order, with the uniqueIds
+  // of the second loop following on from the first
+  const size_t sizeX = 32, sizeY = 16;
+  const int numFrames = 5, numLoops = 2;
+  size_t tmpdims[] = {sizeX, sizeY};
+  std::vector<size_t>dims(tmpdims, tmpdims + sizeof(tmpdims)/sizeof(tmpdims[0]));
+
+  std::vector<NDArray*>arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 100);
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+  }
+  setup_hdf_file("replay");
+  startCapture(hdf5.get(), hdf5.get(), arrays[0], numFrames);
+  streamFrames(hdf5.get(), arrays);
+  BOOST_CHECK_EQUAL(hdf5->readInt(NDFileWriteStatusString), 0);
+
+  // Asyn ports cannot be deleted, so the driver and the recorder are left allocated
+  std::string replayPort("HDF5Replay");
+  uniqueAsynPortName(replayPort);
+  new NDFileHDF5Replay(replayPort.c_str(), 0, 0, 0, 0);
+  ArrayRecorder *recorder = new ArrayRecorder(replayPort.c_str());
+  AsynPortClientContainer replay(replayPort);
+  replay.write(NDFilePathString, "");
+  replay.write(NDFileNameString, "replay");
+  replay.write(NDFileTemplateString, "%s%s_%d.h5");
+  replay.write(NDFileNumberString, 0);
+  replay.write(str_NDFileHDF5Replay_numLoops, numLoops);
+  replay.write(NDArrayCallbacksString, 1);
+  replay.write(ADAcquireString, 1);
+  for (int i = 0; i < 1000 && replay.readInt(ADAcquireString) != 0; i++) {
+    epicsThreadSleep(0.01);
+  }
+  BOOST_REQUIRE_EQUAL(replay.readInt(ADAcquireString), 0);
+  BOOST_CHECK_EQUAL(replay.readInt(NDFileWriteStatusString), NDFileWriteOK);
+  BOOST_CHECK_EQUAL(replay.readInt(str_NDFileHDF5Replay_framesInFile), numFrames);
+  BOOST_CHECK_EQUAL(replay.readInt(str_NDFileHDF5Replay_loop), numLoops - 1);
+
+  BOOST_REQUIRE_EQUAL(recorder->arrays.size(), (size_t)(numFrames * numLoops));
+  for (size_t i = 0; i < recorder->arrays.size(); i++) {
+    NDArray *pArray = recorder->arrays[i];
+    BOOST_CHECK_EQUAL(pArray->uniqueId, (int)i + 1);
+    BOOST_CHECK_EQUAL(pArray->ndims, 2);
+    BOOST_CHECK(memcmp(pArray->pData, arrays[i % numFrames]->pData, sizeX * sizeY * 2) == 0);
+    pArray->release();
+  }
+  recorder->arrays.clear();
+
+  for (int i = 0; i < numFrames; i++) {
+    arrays[i]->release();
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -717,3 +717,40 @@ BOOST_AUTO_TEST_CASE(test_AttributeDimensionalDataset)
 
 }
 
+
+BOOST_AUTO_TEST_CASE(test_AttributeDirtyFlag)
+{
+  // Open an HDF5 file for testing
+  std::string filename = "test_att_dirty.h5";
+  hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, 0, 0);
+  BOOST_REQUIRE_GT(file, -1);
+
+  // Add a test group.
+  std::string gname = "group";
+  hid_t group = H5Gcreate(file, gname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  BOOST_REQUIRE_GT(group, -1);
+
+  boost::shared_ptr<NDFileHDF5AttributeDataset> adPtr;
+  adPtr = boost::shared_ptr<NDFileHDF5AttributeDataset>(new NDFileHDF5AttributeDataset(file, "att1", NDAttrInt32));
+  adPtr->setDsetName("dset1");
+  adPtr->setParentGroupName(gname);
+  adPtr->createDataset(1);
+  // Nothing has been written yet, so there is nothing to flush
+  BOOST_CHECK_EQUAL(adPtr->isDirty(), false);
+
+  epicsInt32 val = 1;
+  NDAttribute ndAttr("att1", "Test attribute 1", NDAttrSourceFunct, "test", NDAttrInt32, &val);
+  adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, 0);
+  // A written value is waiting to be flushed
+  BOOST_CHECK_EQUAL(adPtr->isDirty(), true);
+
+  BOOST_CHECK_EQUAL(adPtr->flushDataset(), asynSuccess);
+  BOOST_CHECK_EQUAL(adPtr->isDirty(), false);
+
+  adPtr->writeAttributeDataset(hdf5::OnFrame, &ndAttr, 0);
+  BOOST_CHECK_EQUAL(adPtr->isDirty(), true);
+  adPtr->closeAttributeDataset();
+
+  H5Gclose(group);
+  H5Fclose(file);
+}
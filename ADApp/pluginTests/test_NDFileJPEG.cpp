@@ -0,0 +1,159 @@
+/*
+ * test_NDFileJPEG.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests writing MJPEG files with NDFileJPEG.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "JPEGPluginWrapper.h"
+
+// Reads a little-endian 32-bit value from an AVI file
+static epicsUInt32 get32(const std::vector<unsigned char>& file, size_t offset)
+{
+  return file[offset] | (file[offset+1] << 8) | (file[offset+2] << 16) | ((epicsUInt32)file[offset+3] << 24);
+}
+
+// Decodes a grayscale JPEG image and returns the mean of its pixels
+static double meanPixel(const unsigned char *jpeg, size_t size)
+{
+  struct jpeg_decompress_struct info;
+  struct jpeg_error_mgr err;
+  double sum = 0;
+
+  info.err = jpeg_std_error(&err);
+  jpeg_create_decompress(&info);
+  jpeg_mem_src(&info, (unsigned char *)jpeg, (unsigned long)size);
+  jpeg_read_header(&info, TRUE);
+  jpeg_start_decompress(&info);
+  std::vector<unsigned char> row(info.output_width * info.output_components);
+  while (info.output_scanline < info.output_height) {
+    JSAMPROW rowPointer = &row[0];
+    jpeg_read_scanlines(&info, &rowPointer, 1);
+    for (size_t i=0; i<row.size(); i++) sum += row[i];
+  }
+  sum /= (double)info.output_width * info.output_height * info.output_components;
+  jpeg_finish_decompress(&info);
+  jpeg_destroy_decompress(&info);
+  return sum;
+}
+
+struct JPEGPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<JPEGPluginWrapper> jpeg;
+  NDArrayPool *arrayPool;
+  std::string fileName;
+
+  JPEGPluginTestFixture()
+  {
+    std::string simport("simJPEG"), testport("JPEG");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+    fileName = testport;
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+
+    jpeg = boost::shared_ptr<JPEGPluginWrapper>(new JPEGPluginWrapper(testport, simport));
+    jpeg->start();
+    jpeg->write(NDPluginDriverEnableCallbacksString, 1);
+    jpeg->write(NDFilePathString, "");
+    jpeg->write(NDFileNameString, fileName);
+    jpeg->write(NDFileTemplateString, "%s%s_%d.avi");
+    jpeg->write(NDFileNumberString, 0);
+    jpeg->write(NDAutoIncrementString, 1);
+  }
+  ~JPEGPluginTestFixture()
+  {
+    jpeg.reset();
+    driver.reset();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileJPEGTests, JPEGPluginTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_MJPEGStream)
+{
+  // 7 frames with 2 threads are a batch of 4 frames and a batch of 3 frames written by closeFile
+  const int numFrames = 7;
+  std::vector<size_t> dims;
+  dims.push_back(64);
+  dims.push_back(48);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt8, arrays, arrayPool);
+  for (int i=0; i<numFrames; i++) {
+    memset(arrays[i]->pData, 30*i, arrays[i]->dataSize);
+    arrays[i]->timeStamp = 0.1*i;
+  }
+
+  jpeg->write(NDFileJPEGQualityString, 90);
+  jpeg->write(NDFileJPEGEncodeThreadsString, 2);
+  startCapture(jpeg.get(), jpeg.get(), arrays[0], numFrames);
+  streamFrames(jpeg.get(), arrays);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(jpeg->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  char name[256];
+  epicsSnprintf(name, sizeof(name), "%s_%d.avi", fileName.c_str(), 0);
+  FILE *pFile = fopen(name, "rb");
+  BOOST_REQUIRE(pFile != NULL);
+  std::vector<unsigned char> file;
+  int c;
+  while ((c = fgetc(pFile)) != EOF) file.push_back((unsigned char)c);
+  fclose(pFile);
+  remove(name);
+
+  BOOST_REQUIRE(file.size() > 224);
+  BOOST_CHECK(memcmp(&file[0], "RIFF", 4) == 0);
+  BOOST_CHECK_EQUAL(get32(file, 4), file.size() - 8);
+  BOOST_CHECK(memcmp(&file[8], "AVI ", 4) == 0);
+  BOOST_CHECK_EQUAL(get32(file, 32), 100000u);          // microseconds per frame from the timeStamps
+  BOOST_CHECK_EQUAL(get32(file, 48), (epicsUInt32)numFrames);
+  BOOST_CHECK_EQUAL(get32(file, 64), 64u);
+  BOOST_CHECK_EQUAL(get32(file, 68), 48u);
+  BOOST_REQUIRE(memcmp(&file[220], "movi", 4) == 0);
+
+  // The index follows the movi list, and the frames are in the order of the arrays
+  size_t index = 220 + get32(file, 216);
+  BOOST_REQUIRE(index + 8 + 16*numFrames <= file.size());
+  BOOST_REQUIRE(memcmp(&file[index], "idx1", 4) == 0);
+  BOOST_REQUIRE_EQUAL(get32(file, index + 4), 16u*numFrames);
+  for (int i=0; i<numFrames; i++) {
+    size_t entry = index + 8 + 16*i;
+    size_t chunk = 220 + get32(file, entry + 8);
+    epicsUInt32 size = get32(file, entry + 12);
+    BOOST_REQUIRE(memcmp(&file[entry], "00dc", 4) == 0);
+    BOOST_REQUIRE(chunk + 8 + size <= index);
+    BOOST_REQUIRE(memcmp(&file[chunk], "00dc", 4) == 0);
+    BOOST_REQUIRE_EQUAL(get32(file, chunk + 4), size);
+    BOOST_CHECK_EQUAL(file[chunk + 8], 0xff);
+    BOOST_CHECK_EQUAL(file[chunk + 9], 0xd8);
+    BOOST_CHECK_SMALL(meanPixel(&file[chunk + 8], size) - 30.*i, 2.);
+  }
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,190 @@
+/*
+ * test_NDFileNetCDF.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests writing netCDF files with NDFileNetCDF.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <netcdf.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "NetCDFPluginWrapper.h"
+
+struct NetCDFPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<NetCDFPluginWrapper> netcdf;
+  NDArrayPool *arrayPool;
+  std::string fileName;
+
+  NetCDFPluginTestFixture()
+  {
+    std::string simport("simNetCDF"), testport("NetCDF");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+    fileName = testport;
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+
+    netcdf = boost::shared_ptr<NetCDFPluginWrapper>(new NetCDFPluginWrapper(testport, simport));
+    netcdf->start();
+    netcdf->write(NDPluginDriverEnableCallbacksString, 1);
+    netcdf->write(NDFilePathString, "");
+    netcdf->write(NDFileNameString, fileName);
+    netcdf->write(NDFileTemplateString, "%s%s_%d.nc");
+    netcdf->write(NDFileNumberString, 0);
+    netcdf->write(NDAutoIncrementString, 1);
+  }
+  ~NetCDFPluginTestFixture()
+  {
+    netcdf.reset();
+    driver.reset();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileNetCDFTests, NetCDFPluginTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_BufferedRecords)
+{
+  // 10 arrays with 4 buffered frames are written in 2 blocks of 4 and a block of 2 when the file is closed
+  const int numFrames = 10;
+  std::vector<size_t> dims;
+  dims.push_back(16);
+  dims.push_back(8);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 100);
+  for (int i=0; i<numFrames; i++) {
+    char label[32];
+    epicsSnprintf(label, sizeof(label), "frame %d", i);
+    arrays[i]->uniqueId = i + 1;
+    arrays[i]->timeStamp = 0.5*i;
+    arrays[i]->pAttributeList->add("Label", "Frame label", NDAttrString, label);
+  }
+
+  netcdf->write(NDFileNetCDFBufferFramesString, 4);
+  startCapture(netcdf.get(), netcdf.get(), arrays[0], numFrames);
+  streamFrames(netcdf.get(), arrays);
+  BOOST_CHECK_EQUAL(netcdf->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK_EQUAL(netcdf->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(netcdf->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  char name[256];
+  int ncId, dimId, varId;
+  size_t numArrays = 0;
+  epicsSnprintf(name, sizeof(name), "%s_%d.nc", fileName.c_str(), 0);
+  BOOST_REQUIRE_EQUAL(nc_open(name, NC_NOWRITE, &ncId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_inq_dimid(ncId, "numArrays", &dimId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_inq_dimlen(ncId, dimId, &numArrays), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(numArrays, (size_t)numFrames);
+
+  std::vector<int> uniqueIds(numFrames);
+  std::vector<double> timeStamps(numFrames);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "uniqueId", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_int(ncId, varId, &uniqueIds[0]), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "timeStamp", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_var_double(ncId, varId, &timeStamps[0]), NC_NOERR);
+  for (int i=0; i<numFrames; i++) {
+    char label[32], expected[32];
+    size_t start[2] = {(size_t)i, 0};
+    size_t count[2] = {1, sizeof(label)};
+    BOOST_CHECK_EQUAL(uniqueIds[i], i + 1);
+    BOOST_CHECK_EQUAL(timeStamps[i], 0.5*i);
+    BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "Attr_Label", &varId), NC_NOERR);
+    BOOST_REQUIRE_EQUAL(nc_get_vara_text(ncId, varId, start, count, label), NC_NOERR);
+    label[sizeof(label)-1] = 0;
+    epicsSnprintf(expected, sizeof(expected), "frame %d", i);
+    BOOST_CHECK_EQUAL(std::string(label), std::string(expected));
+  }
+
+  // The array data is written as each array arrives
+  std::vector<short> data(16*8);
+  size_t start[3] = {7, 0, 0};
+  size_t count[3] = {1, 8, 16};
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "array_data", &varId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_get_vara_short(ncId, varId, start, count, &data[0]), NC_NOERR);
+  BOOST_CHECK_EQUAL(data[0], 700);
+  BOOST_CHECK_EQUAL(data[16*8-1], 700 + 16*8 - 1);
+  nc_close(ncId);
+  remove(name);
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+
+#ifdef NC_HAS_NC4
+BOOST_AUTO_TEST_CASE(test_NetCDF4Deflate)
+{
+  // In a netCDF-4 file each array is one chunk of array_data, compressed with shuffle and deflate
+  const int numFrames = 4;
+  const int deflateLevel = 4;
+  std::vector<size_t> dims;
+  dims.push_back(16);
+  dims.push_back(8);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 100);
+
+  netcdf->write(NDFileFormatString, NDFileNetCDFFormatNetCDF4);
+  netcdf->write(NDFileNetCDFDeflateLevelString, deflateLevel);
+  netcdf->write(NDFileNetCDFShuffleString, 1);
+  startCapture(netcdf.get(), netcdf.get(), arrays[0], numFrames);
+  streamFrames(netcdf.get(), arrays);
+  BOOST_CHECK_EQUAL(netcdf->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK_EQUAL(netcdf->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  char name[256];
+  int ncId, varId, format;
+  epicsSnprintf(name, sizeof(name), "%s_%d.nc", fileName.c_str(), 0);
+  BOOST_REQUIRE_EQUAL(nc_open(name, NC_NOWRITE, &ncId), NC_NOERR);
+  BOOST_REQUIRE_EQUAL(nc_inq_format(ncId, &format), NC_NOERR);
+  BOOST_CHECK_EQUAL(format, NC_FORMAT_NETCDF4);
+  BOOST_REQUIRE_EQUAL(nc_inq_varid(ncId, "array_data", &varId), NC_NOERR);
+
+  int storage = -1;
+  size_t chunks[3] = {0, 0, 0};
+  BOOST_REQUIRE_EQUAL(nc_inq_var_chunking(ncId, varId, &storage, chunks), NC_NOERR);
+  BOOST_CHECK_EQUAL(storage, NC_CHUNKED);
+  BOOST_CHECK_EQUAL(chunks[0], 1u);
+  BOOST_CHECK_EQUAL(chunks[1], 8u);
+  BOOST_CHECK_EQUAL(chunks[2], 16u);
+
+  int shuffle = 0, deflate = 0, level = 0;
+  BOOST_REQUIRE_EQUAL(nc_inq_var_deflate(ncId, varId, &shuffle, &deflate, &level), NC_NOERR);
+  BOOST_CHECK_EQUAL(shuffle, 1);
+  BOOST_CHECK_EQUAL(deflate, 1);
+  BOOST_CHECK_EQUAL(level, deflateLevel);
+
+  std::vector<short> data(16*8);
+  for (int i=0; i<numFrames; i++) {
+    size_t start[3] = {(size_t)i, 0, 0};
+    size_t count[3] = {1, 8, 16};
+    BOOST_REQUIRE_EQUAL(nc_get_vara_short(ncId, varId, start, count, &data[0]), NC_NOERR);
+    BOOST_CHECK(memcmp(&data[0], arrays[i]->pData, 16*8*sizeof(short)) == 0);
+  }
+  nc_close(ncId);
+  remove(name);
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
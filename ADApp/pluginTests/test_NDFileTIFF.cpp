@@ -0,0 +1,222 @@
+/*
+ * test_NDFileTIFF.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests writing TIFF files with NDFileTIFF.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <epicsThread.h>
+#include <tiffio.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+using namespace std;
+
+#include "testingutilities.h"
+#include "TIFFPluginWrapper.h"
+
+// The private tag that NDFileTIFF writes the NDArray uniqueId to
+static const int TIFFTAG_UNIQUEID = 65001;
+
+struct TIFFPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<TIFFPluginWrapper> tiff;
+  NDArrayPool *arrayPool;
+  std::string fileName;
+
+  TIFFPluginTestFixture()
+  {
+    std::string simport("simTIFF"), testport("TIFF");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+    fileName = testport;
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+
+    tiff = boost::shared_ptr<TIFFPluginWrapper>(new TIFFPluginWrapper(testport, simport, 4));
+    tiff->start();
+    tiff->write(NDPluginDriverEnableCallbacksString, 1);
+    tiff->write(NDFilePathString, "");
+    tiff->write(NDFileNameString, fileName);
+    tiff->write(NDFileTemplateString, "%s%s_%d.tif");
+    tiff->write(NDFileNumberString, 0);
+    tiff->write(NDAutoIncrementString, 1);
+  }
+  ~TIFFPluginTestFixture()
+  {
+    tiff.reset();
+    driver.reset();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDFileTIFFTests, TIFFPluginTestFixture)
+
+BOOST_AUTO_TEST_CASE(test_ConcurrentSingleFiles)
+{
+  const int numFrames = 40;
+  std::vector<size_t> dims;
+  dims.push_back(64);
+  dims.push_back(32);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+
+  tiff->write(NDPluginDriverNumThreadsString, 4);
+  BOOST_REQUIRE_EQUAL(tiff->readInt(NDPluginDriverNumThreadsString), 4);
+  tiff->write(NDFileWriteModeString, NDFileModeSingle);
+  tiff->write(NDAutoSaveString, 1);
+
+  for (int i=0; i<numFrames; i++) {
+    arrays[i]->uniqueId = i + 1;
+    tiff->driverCallback(tiff->pasynUserSelf, arrays[i]);
+  }
+  // The driver counts the arrays that are queued, until a thread has finished writing them
+  for (int i=0; i<1000 && driver->getQueuedArrayCount() > 0; i++) {
+    epicsThreadSleep(0.01);
+  }
+  BOOST_REQUIRE_EQUAL(driver->getQueuedArrayCount(), 0);
+  BOOST_REQUIRE_EQUAL(tiff->readInt(NDArrayCounterString), numFrames);
+  BOOST_CHECK_EQUAL(tiff->readInt(NDPluginDriverDroppedArraysString), 0);
+  BOOST_CHECK_EQUAL(tiff->readInt(NDFileNumberString), numFrames);
+  BOOST_CHECK_EQUAL(tiff->readInt(NDFileWriteStatusString), NDFileWriteOK);
+
+  // The file numbers follow the order of the arrays even though the files were written by 4 threads
+  for (int i=0; i<numFrames; i++) {
+    char name[256];
+    epicsUInt32 uniqueId = 0;
+    epicsUInt32 width = 0;
+    epicsSnprintf(name, sizeof(name), "%s_%d.tif", fileName.c_str(), i);
+    TIFF *pTIFF = TIFFOpen(name, "r");
+    BOOST_REQUIRE(pTIFF != NULL);
+    BOOST_CHECK_EQUAL(TIFFGetField(pTIFF, TIFFTAG_UNIQUEID, &uniqueId), 1);
+    BOOST_CHECK_EQUAL(uniqueId, (epicsUInt32)(i + 1));
+    TIFFGetField(pTIFF, TIFFTAG_IMAGEWIDTH, &width);
+    BOOST_CHECK_EQUAL(width, 64u);
+    TIFFClose(pTIFF);
+    remove(name);
+  }
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+
+// Streams arrays into one file and returns its name
+static std::string streamArrays(boost::shared_ptr<TIFFPluginWrapper> tiff, const std::string& fileName,
+                                std::vector<NDArray *>& arrays)
+{
+  int numFrames = (int)arrays.size();
+  char name[256];
+
+  for (int i=0; i<numFrames; i++) arrays[i]->uniqueId = i + 1;
+  startCapture(tiff.get(), tiff.get(), arrays[0], numFrames);
+  streamFrames(tiff.get(), arrays);
+  BOOST_CHECK_EQUAL(tiff->readInt(NDFileNumCapturedString), numFrames);
+  BOOST_CHECK_EQUAL(tiff->readInt(NDFileCaptureString), 0);
+  BOOST_CHECK_EQUAL(tiff->readInt(NDFileWriteStatusString), NDFileWriteOK);
+  epicsSnprintf(name, sizeof(name), "%s_%d.tif", fileName.c_str(), 0);
+  return name;
+}
+
+BOOST_AUTO_TEST_CASE(test_MultiPage)
+{
+  const int numFrames = 5;
+  std::vector<size_t> dims;
+  dims.push_back(64);
+  dims.push_back(32);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+
+  // 1024 byte strips are 8 rows of 64 pixels, so each page has 4 strips
+  tiff->write(NDFileTIFFStripSizeString, 1024);
+  std::string name = streamArrays(tiff, fileName, arrays);
+
+  TIFF *pTIFF = TIFFOpen(name.c_str(), "r");
+  BOOST_REQUIRE(pTIFF != NULL);
+  BOOST_CHECK_EQUAL(TIFFNumberOfDirectories(pTIFF), numFrames);
+  std::vector<char> buffer(arrays[0]->dataSize);
+  for (int i=0; i<numFrames; i++) {
+    epicsUInt32 uniqueId = 0;
+    epicsUInt32 rowsPerStrip = 0;
+    BOOST_REQUIRE_EQUAL(TIFFSetDirectory(pTIFF, (epicsUInt16)i), 1);
+    BOOST_CHECK_EQUAL(TIFFGetField(pTIFF, TIFFTAG_UNIQUEID, &uniqueId), 1);
+    BOOST_CHECK_EQUAL(uniqueId, (epicsUInt32)(i + 1));
+    TIFFGetField(pTIFF, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+    BOOST_CHECK_EQUAL(rowsPerStrip, 8u);
+    BOOST_REQUIRE_EQUAL(TIFFNumberOfStrips(pTIFF), 4u);
+    size_t offset = 0;
+    for (epicsUInt32 strip=0; strip<4; strip++) {
+      tmsize_t size = TIFFReadEncodedStrip(pTIFF, strip, &buffer[offset], buffer.size() - offset);
+      BOOST_REQUIRE_EQUAL(size, 1024);
+      offset += size;
+    }
+    BOOST_CHECK(memcmp(&buffer[0], arrays[i]->pData, buffer.size()) == 0);
+  }
+  TIFFClose(pTIFF);
+  remove(name.c_str());
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+
+#ifdef HAVE_ZSTD
+BOOST_AUTO_TEST_CASE(test_ParallelZstdStrips)
+{
+  const int numFrames = 3;
+  std::vector<size_t> dims;
+  dims.push_back(64);
+  dims.push_back(30);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+
+  // 1024 byte strips are 8 rows, so the last of the 4 strips of each page has 6 rows
+  tiff->write(NDFileTIFFStripSizeString, 1024);
+  tiff->write(NDFileTIFFCompressionString, NDFileTIFFCompressionZstd);
+  tiff->write(NDFileTIFFCompressThreadsString, 2);
+  std::string name = streamArrays(tiff, fileName, arrays);
+
+  // Decompress the raw strips here, so the test does not need a libtiff that was built with zstd
+  TIFF *pTIFF = TIFFOpen(name.c_str(), "r");
+  BOOST_REQUIRE(pTIFF != NULL);
+  BOOST_CHECK_EQUAL(TIFFNumberOfDirectories(pTIFF), numFrames);
+  std::vector<char> buffer(arrays[0]->dataSize);
+  for (int i=0; i<numFrames; i++) {
+    epicsUInt16 compression = 0;
+    BOOST_REQUIRE_EQUAL(TIFFSetDirectory(pTIFF, (epicsUInt16)i), 1);
+    TIFFGetField(pTIFF, TIFFTAG_COMPRESSION, &compression);
+    BOOST_CHECK_EQUAL(compression, COMPRESSION_ZSTD);
+    BOOST_REQUIRE_EQUAL(TIFFNumberOfStrips(pTIFF), 4u);
+    size_t offset = 0;
+    for (epicsUInt32 strip=0; strip<4; strip++) {
+      std::vector<char> raw(TIFFRawStripSize(pTIFF, strip));
+      BOOST_REQUIRE_EQUAL(TIFFReadRawStrip(pTIFF, strip, &raw[0], raw.size()), (tmsize_t)raw.size());
+      size_t size = ZSTD_decompress(&buffer[offset], buffer.size() - offset, &raw[0], raw.size());
+      BOOST_REQUIRE(!ZSTD_isError(size));
+      BOOST_CHECK_EQUAL(size, (strip < 3) ? 1024u : 768u);
+      offset += size;
+    }
+    BOOST_CHECK_EQUAL(offset, buffer.size());
+    BOOST_CHECK(memcmp(&buffer[0], arrays[i]->pData, buffer.size()) == 0);
+  }
+  TIFFClose(pTIFF);
+  remove(name.c_str());
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,231 @@
+/*
+ * test_NDPluginCodec.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests the blockwise multi-threaded BSLZ4 codec, the zstd codec and the block reader.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginCodec.h>
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+
+#include "testingutilities.h"
+
+using namespace std;
+
+struct CodecFixture
+{
+  asynNDArrayDriver *driver;
+  NDArrayPool *pPool;
+
+  CodecFixture()
+  {
+    std::string port("simCodec");
+    uniqueAsynPortName(port);
+    driver = new asynNDArrayDriver(port.c_str(), 1, 0, 0, asynGenericPointerMask, asynGenericPointerMask, 0, 0, 0, 0);
+    pPool = driver->pNDArrayPool;
+  }
+  ~CodecFixture()
+  {
+    delete driver;
+  }
+
+  // A 16-bit image with some structure and noise, so that it compresses but not trivially
+  NDArray *makeArray(size_t sizeX, size_t sizeY)
+  {
+    size_t dims[2] = {sizeX, sizeY};
+    NDArray *pArray = pPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    unsigned int seed = 1;
+    for (size_t i = 0; i < sizeX * sizeY; ++i) {
+      seed = seed * 1103515245 + 12345;
+      pData[i] = (epicsUInt16)((i % sizeX) + ((seed >> 16) & 0xF));
+    }
+    return pArray;
+  }
+
+  // Reads pArray with NDCodecBlockReader and checks that the blocks reassemble to pOrig
+  void checkBlockReader(NDArray *pArray, NDArray *pOrig, size_t blockSize)
+  {
+    char errorMessage[256];
+    NDCodecStatus_t status = NDCODEC_SUCCESS;
+    NDArrayInfo_t info;
+    pOrig->getInfo(&info);
+    std::vector<char> out(info.totalBytes);
+    NDCodecBlockReader reader(blockSize);
+    size_t expected = 0, firstElement, nElements;
+    const void *pBlock;
+
+    BOOST_REQUIRE_EQUAL(reader.begin(pArray, &status, errorMessage), ND_SUCCESS);
+    while ((pBlock = reader.next(&firstElement, &nElements, &status, errorMessage))) {
+      BOOST_REQUIRE_EQUAL(firstElement, expected);
+      BOOST_REQUIRE(firstElement + nElements <= info.nElements);
+      memcpy(&out[firstElement * info.bytesPerElement], pBlock, nElements * info.bytesPerElement);
+      expected += nElements;
+    }
+    reader.end();
+    BOOST_CHECK_MESSAGE(status != NDCODEC_ERROR, errorMessage);
+    BOOST_CHECK_EQUAL(expected, info.nElements);
+    BOOST_CHECK(memcmp(&out[0], pOrig->pData, info.totalBytes) == 0);
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginCodecTests, CodecFixture)
+
+BOOST_AUTO_TEST_CASE(block_reader_uncompressed)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  NDArray *pArray = makeArray(1031, 517);
+
+  checkBlockReader(pArray, pArray, ND_CODEC_BLOCK_SIZE);
+
+  // decompressArray returns an uncompressed array itself, with a reference for the caller
+  NDArray *pOut = decompressArray(pArray, 1, &status, errorMessage);
+  BOOST_CHECK(pOut == pArray);
+  BOOST_CHECK_EQUAL(pArray->getReferenceCount(), 2);
+  pOut->release();
+  pArray->release();
+}
+
+#ifdef HAVE_BITSHUFFLE
+BOOST_AUTO_TEST_CASE(block_reader_bslz4)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  NDArray *pArray = makeArray(1031, 517);
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+
+  NDArray *pComp = compressBSLZ4(pArray, 4, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pComp, errorMessage);
+  // Blocks smaller than, equal to and larger than the bitshuffle blocks
+  checkBlockReader(pComp, pArray, 1000);
+  checkBlockReader(pComp, pArray, 8192);
+  checkBlockReader(pComp, pArray, ND_CODEC_BLOCK_SIZE);
+
+  NDArray *pOut = decompressArray(pComp, 2, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pOut, errorMessage);
+  BOOST_CHECK(memcmp(pOut->pData, pArray->pData, info.totalBytes) == 0);
+  pOut->release();
+
+  // Truncated data is reported as an error by next()
+  pComp->compressedSize /= 2;
+  NDCodecBlockReader reader;
+  size_t firstElement, nElements;
+  BOOST_REQUIRE_EQUAL(reader.begin(pComp, &status, errorMessage), ND_SUCCESS);
+  while (reader.next(&firstElement, &nElements, &status, errorMessage));
+  reader.end();
+  BOOST_CHECK_EQUAL(status, NDCODEC_ERROR);
+
+  pComp->release();
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(bslz4_threads_identical)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  // An odd size so that there is a partial block and some leftover elements
+  NDArray *pArray = makeArray(1031, 517);
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+
+  NDArray *pSingle = compressBSLZ4(pArray, 1, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pSingle, errorMessage);
+
+  for (int numThreads = 2; numThreads <= 8; numThreads *= 2) {
+    NDArray *pMulti = compressBSLZ4(pArray, numThreads, &status, errorMessage);
+    BOOST_REQUIRE(pMulti);
+    BOOST_CHECK_EQUAL(pMulti->compressedSize, pSingle->compressedSize);
+    BOOST_CHECK(memcmp(pMulti->pData, pSingle->pData, pSingle->compressedSize) == 0);
+
+    NDArray *pOut = decompressBSLZ4(pMulti, numThreads, &status, errorMessage);
+    BOOST_REQUIRE_MESSAGE(pOut, errorMessage);
+    BOOST_CHECK(memcmp(pOut->pData, pArray->pData, info.totalBytes) == 0);
+    pOut->release();
+    pMulti->release();
+  }
+
+  // Truncated data must be rejected rather than read past the end
+  pSingle->compressedSize /= 2;
+  BOOST_CHECK(decompressBSLZ4(pSingle, 4, &status, errorMessage) == NULL);
+  BOOST_CHECK_EQUAL(status, NDCODEC_ERROR);
+
+  pSingle->release();
+  pArray->release();
+}
+#endif
+
+#ifdef HAVE_ZSTD
+BOOST_AUTO_TEST_CASE(zstd_dictionary)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  NDArray *pArray = makeArray(256, 64);
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+
+  // Without a dictionary
+  NDArray *pComp = compressZstd(pArray, 3, 1, NULL, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pComp, errorMessage);
+  BOOST_CHECK_EQUAL(pComp->codec.name, "zstd");
+  NDArray *pOut = decompressZstd(pComp, NULL, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pOut, errorMessage);
+  BOOST_CHECK(memcmp(pOut->pData, pArray->pData, info.totalBytes) == 0);
+  pOut->release();
+  pComp->release();
+
+  // A raw content dictionary made from the array itself has ID 0
+  NDCodecZstdDict *pDict = createZstdDict(pArray->pData, info.totalBytes, 3, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pDict, errorMessage);
+  BOOST_CHECK_EQUAL(getZstdDictID(pDict), 0u);
+  pComp = compressZstd(pArray, 3, 1, pDict, &status, errorMessage);
+  BOOST_REQUIRE(pComp);
+  pOut = decompressZstd(pComp, pDict, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pOut, errorMessage);
+  BOOST_CHECK(memcmp(pOut->pData, pArray->pData, info.totalBytes) == 0);
+  pOut->release();
+
+  // The frame cannot be decoded without the dictionary
+  status = NDCODEC_SUCCESS;
+  BOOST_CHECK(decompressZstd(pComp, NULL, &status, errorMessage) == NULL);
+  BOOST_CHECK_EQUAL(status, NDCODEC_ERROR);
+  pComp->release();
+
+  releaseZstdDict(pDict);
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(block_reader_zstd)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  NDArray *pArray = makeArray(1031, 517);
+  NDArrayInfo_t info;
+  pArray->getInfo(&info);
+
+  NDArray *pComp = compressZstd(pArray, 3, 2, NULL, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pComp, errorMessage);
+  checkBlockReader(pComp, pArray, 1000);
+  checkBlockReader(pComp, pArray, ND_CODEC_BLOCK_SIZE);
+
+  NDArray *pOut = decompressArray(pComp, 1, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pOut, errorMessage);
+  BOOST_CHECK(memcmp(pOut->pData, pArray->pData, info.totalBytes) == 0);
+  pOut->release();
+
+  pComp->release();
+  pArray->release();
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,150 @@
+/*
+ * test_NDPluginROIStat.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests that NDPluginROIStat computes the same results from compressed arrays as from
+ *  uncompressed ones, and publishes nothing for arrays that cannot be read.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginCodec.h>
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "ROIStatPluginWrapper.h"
+
+static const char *roiStatDoubles[] = {
+  NDPluginROIStatMinValueString, NDPluginROIStatMaxValueString, NDPluginROIStatMeanValueString,
+  NDPluginROIStatTotalString, NDPluginROIStatNetString
+};
+
+struct ROIStatPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<ROIStatPluginWrapper> roiStat;
+  NDArrayPool *arrayPool;
+
+  ROIStatPluginTestFixture()
+  {
+    std::string simport("simROIStat"), roistatport("ROIStat");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(roistatport);
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+
+    roiStat = boost::shared_ptr<ROIStatPluginWrapper>(new ROIStatPluginWrapper(roistatport, simport, 2));
+    roiStat->start();
+    roiStat->write(NDPluginDriverEnableCallbacksString, 1);
+    // Two ROIs, one of them with a background region
+    for (int roi = 0; roi < 2; roi++) {
+      roiStat->write(NDPluginROIStatUseString, 1, roi);
+      roiStat->write(NDPluginROIStatDim0MinString, 4 + 30*roi, roi);
+      roiStat->write(NDPluginROIStatDim0SizeString, 20, roi);
+      roiStat->write(NDPluginROIStatDim1MinString, 2 + 10*roi, roi);
+      roiStat->write(NDPluginROIStatDim1SizeString, 10, roi);
+      roiStat->write(NDPluginROIStatBgdWidthString, roi, roi);
+    }
+  }
+  ~ROIStatPluginTestFixture()
+  {
+    roiStat.reset();
+    driver.reset();
+  }
+
+  // A 16-bit image with some structure and noise, so that it compresses but not trivially
+  NDArray *makeArray(size_t sizeX, size_t sizeY, int seed)
+  {
+    size_t dims[2] = {sizeX, sizeY};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    unsigned int state = seed;
+    for (size_t i = 0; i < sizeX * sizeY; ++i) {
+      state = state * 1103515245 + 12345;
+      pData[i] = (epicsUInt16)((i % sizeX) + ((state >> 16) & 0xF));
+    }
+    pArray->uniqueId = seed;
+    return pArray;
+  }
+
+  // Passes pArray to the plugin and returns the results it published
+  std::vector<double> process(NDArray *pArray)
+  {
+    std::vector<double> results;
+    roiStat->lock();
+    roiStat->processCallbacks(pArray);
+    roiStat->unlock();
+    for (int roi = 0; roi < 2; roi++) {
+      for (size_t i = 0; i < sizeof(roiStatDoubles)/sizeof(roiStatDoubles[0]); i++) {
+        results.push_back(roiStat->readDouble(roiStatDoubles[i], roi));
+      }
+    }
+    return results;
+  }
+
+  void checkSame(const std::vector<double>& expected, const std::vector<double>& actual)
+  {
+    BOOST_REQUIRE_EQUAL(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      BOOST_CHECK_CLOSE(expected[i], actual[i], 1e-9);
+    }
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginROIStatTests, ROIStatPluginTestFixture)
+
+#ifdef HAVE_BITSHUFFLE
+BOOST_AUTO_TEST_CASE(compressed_matches_uncompressed)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  // Large enough for the BSLZ4 data to be read in several blocks
+  NDArray *pArray = makeArray(512, 300, 1);
+  std::vector<double> expected = process(pArray);
+  BOOST_CHECK(expected[3] > 0.);
+
+  NDArray *pLZ4 = compressLZ4(pArray, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pLZ4, errorMessage);
+  checkSame(expected, process(pLZ4));
+  pLZ4->release();
+
+  NDArray *pBSLZ4 = compressBSLZ4(pArray, 2, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pBSLZ4, errorMessage);
+  checkSame(expected, process(pBSLZ4));
+  pBSLZ4->release();
+
+  pArray->release();
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(unreadable_array_not_published)
+{
+  NDArray *pArray = makeArray(128, 64, 1);
+  std::vector<double> expected = process(pArray);
+
+  // An array that cannot be decompressed leaves the previous results in place
+  NDArray *pBad = makeArray(128, 64, 2);
+  pBad->codec.name = "unknown";
+  pBad->compressedSize = pBad->dataSize / 2;
+  checkSame(expected, process(pBad));
+
+  pBad->release();
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,153 @@
+/*
+ * test_NDPluginStats.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests that NDPluginStats computes the same results from compressed arrays as from
+ *  uncompressed ones, and publishes nothing for arrays that cannot be read.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginCodec.h>
+#include <NDArray.h>
+#include <asynNDArrayDriver.h>
+
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "StatsPluginWrapper.h"
+
+static const char *statsDoubles[] = {
+  NDPluginStatsMinValueString, NDPluginStatsMaxValueString, NDPluginStatsMeanValueString,
+  NDPluginStatsSigmaValueString, NDPluginStatsTotalString, NDPluginStatsNetString,
+  NDPluginStatsMinXString, NDPluginStatsMinYString, NDPluginStatsMaxXString, NDPluginStatsMaxYString,
+  NDPluginStatsHistEntropyString
+};
+static const char *statsInts[] = {
+  NDPluginStatsHistBelowString, NDPluginStatsHistAboveString
+};
+
+struct StatsPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<StatsPluginWrapper> stats;
+  NDArrayPool *arrayPool;
+
+  StatsPluginTestFixture()
+  {
+    std::string simport("simStats"), statsport("Stats");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(statsport);
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+
+    stats = boost::shared_ptr<StatsPluginWrapper>(new StatsPluginWrapper(statsport, simport));
+    stats->start();
+    stats->write(NDPluginDriverEnableCallbacksString, 1);
+    stats->write(NDPluginStatsComputeStatisticsString, 1);
+    stats->write(NDPluginStatsComputeHistogramString, 1);
+    stats->write(NDPluginStatsHistSizeString, 64);
+    stats->write(NDPluginStatsHistMinString, 10.0);
+    stats->write(NDPluginStatsHistMaxString, 100.0);
+
+  }
+  ~StatsPluginTestFixture()
+  {
+    stats.reset();
+    driver.reset();
+  }
+
+  // A 16-bit image with some structure and noise, so that it compresses but not trivially
+  NDArray *makeArray(size_t sizeX, size_t sizeY, int seed)
+  {
+    size_t dims[2] = {sizeX, sizeY};
+    NDArray *pArray = arrayPool->alloc(2, dims, NDUInt16, 0, NULL);
+    epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+    unsigned int state = seed;
+    for (size_t i = 0; i < sizeX * sizeY; ++i) {
+      state = state * 1103515245 + 12345;
+      pData[i] = (epicsUInt16)((i % sizeX) + ((state >> 16) & 0xF));
+    }
+    pArray->uniqueId = seed;
+    return pArray;
+  }
+
+  // Passes pArray to the plugin and returns the results it published
+  std::vector<double> process(NDArray *pArray)
+  {
+    std::vector<double> results;
+    stats->lock();
+    stats->processCallbacks(pArray);
+    stats->unlock();
+    for (size_t i = 0; i < sizeof(statsDoubles)/sizeof(statsDoubles[0]); i++) {
+      results.push_back(stats->readDouble(statsDoubles[i]));
+    }
+    for (size_t i = 0; i < sizeof(statsInts)/sizeof(statsInts[0]); i++) {
+      results.push_back(stats->readInt(statsInts[i]));
+    }
+    return results;
+  }
+
+  void checkSame(const std::vector<double>& expected, const std::vector<double>& actual)
+  {
+    BOOST_REQUIRE_EQUAL(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); i++) {
+      BOOST_CHECK_CLOSE(expected[i], actual[i], 1e-9);
+    }
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginStatsTests, StatsPluginTestFixture)
+
+#ifdef HAVE_BITSHUFFLE
+BOOST_AUTO_TEST_CASE(compressed_matches_uncompressed)
+{
+  char errorMessage[256];
+  NDCodecStatus_t status = NDCODEC_SUCCESS;
+  // Large enough for the BSLZ4 data to be read in several blocks
+  NDArray *pArray = makeArray(512, 300, 1);
+  std::vector<double> expected = process(pArray);
+  BOOST_CHECK(expected[4] > 0.);
+
+  NDArray *pLZ4 = compressLZ4(pArray, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pLZ4, errorMessage);
+  checkSame(expected, process(pLZ4));
+  pLZ4->release();
+
+  NDArray *pBSLZ4 = compressBSLZ4(pArray, 2, &status, errorMessage);
+  BOOST_REQUIRE_MESSAGE(pBSLZ4, errorMessage);
+  checkSame(expected, process(pBSLZ4));
+  pBSLZ4->release();
+
+  pArray->release();
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(unreadable_array_not_published)
+{
+  NDArray *pArray = makeArray(128, 64, 1);
+  std::vector<double> expected = process(pArray);
+
+  // An array that cannot be decompressed leaves the previous results in place
+  NDArray *pBad = makeArray(128, 64, 2);
+  pBad->codec.name = "unknown";
+  pBad->compressedSize = pBad->dataSize / 2;
+  checkSame(expected, process(pBad));
+
+  pBad->release();
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
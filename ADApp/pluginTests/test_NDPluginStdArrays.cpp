@@ -0,0 +1,158 @@
+/*
+ * test_NDPluginStdArrays.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Tests the preview (decimate and bin) modes of NDPluginStdArrays.
+ */
+
+#include <stdio.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "StdArraysPluginWrapper.h"
+#include "AsynException.h"
+
+#define SIZE_X 100
+#define SIZE_Y 80
+
+struct StdArraysPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  boost::shared_ptr<StdArraysPluginWrapper> stdArrays;
+  NDArray *pArray;
+
+  StdArraysPluginTestFixture()
+  {
+    std::string simport("simStdArrays"), testport("StdArrays");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+
+    stdArrays = boost::shared_ptr<StdArraysPluginWrapper>(new StdArraysPluginWrapper(testport, simport));
+    stdArrays->start();
+    stdArrays->write(NDPluginDriverEnableCallbacksString, 1);
+    stdArrays->write(NDPluginDriverBlockingCallbacksString, 1);
+
+    // Each pixel holds x + 1000*y so that decimated and binned values are easy to predict
+    std::vector<size_t> dims;
+    dims.push_back(SIZE_X);
+    dims.push_back(SIZE_Y);
+    std::vector<NDArray *> arrays(1);
+    fillNDArraysFromPool(dims, NDFloat64, arrays, driver->pNDArrayPool);
+    pArray = arrays[0];
+    epicsFloat64 *pData = (epicsFloat64 *)pArray->pData;
+    for (int y=0; y<SIZE_Y; y++) {
+      for (int x=0; x<SIZE_X; x++) {
+        pData[y*SIZE_X + x] = x + 1000.*y;
+      }
+    }
+  }
+
+  ~StdArraysPluginTestFixture()
+  {
+    pArray->release();
+    stdArrays.reset();
+    driver.reset();
+  }
+
+  void process()
+  {
+    stdArrays->lock();
+    stdArrays->processCallbacks(pArray);
+    stdArrays->unlock();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(StdArraysPluginTests, StdArraysPluginTestFixture)
+
+BOOST_AUTO_TEST_CASE(preview_off)
+{
+  stdArrays->write(NDPluginStdArraysPreviewModeString, NDStdArraysPreviewOff);
+  process();
+  NDArray *pOut = stdArrays->getLastArray();
+  BOOST_REQUIRE(pOut != 0);
+  BOOST_CHECK_EQUAL(pOut->dims[0].size, SIZE_X);
+  BOOST_CHECK_EQUAL(pOut->dims[1].size, SIZE_Y);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorXString), 1);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorYString), 1);
+}
+
+BOOST_AUTO_TEST_CASE(preview_decimate)
+{
+  stdArrays->write(NDPluginStdArraysPreviewModeString, NDStdArraysPreviewDecimate);
+  stdArrays->write(NDPluginStdArraysPreviewMaxElementsString, SIZE_X*SIZE_Y/4);
+  process();
+  NDArray *pOut = stdArrays->getLastArray();
+  BOOST_REQUIRE(pOut != 0);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorXString), 2);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorYString), 2);
+  BOOST_REQUIRE_EQUAL(pOut->dims[0].size, SIZE_X/2);
+  BOOST_REQUIRE_EQUAL(pOut->dims[1].size, SIZE_Y/2);
+  BOOST_CHECK_EQUAL(pOut->dims[0].binning, 2);
+  BOOST_CHECK_EQUAL(pOut->uniqueId, pArray->uniqueId);
+  epicsFloat64 *pData = (epicsFloat64 *)pOut->pData;
+  BOOST_CHECK_CLOSE(pData[0], 0., 1e-9);
+  BOOST_CHECK_CLOSE(pData[1], 2., 1e-9);
+  BOOST_CHECK_CLOSE(pData[SIZE_X/2 + 3], 6. + 2000., 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(preview_bin)
+{
+  stdArrays->write(NDPluginStdArraysPreviewModeString, NDStdArraysPreviewBin);
+  stdArrays->write(NDPluginStdArraysPreviewMaxElementsString, SIZE_X*SIZE_Y/16);
+  process();
+  NDArray *pOut = stdArrays->getLastArray();
+  BOOST_REQUIRE(pOut != 0);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorXString), 4);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorYString), 4);
+  BOOST_REQUIRE_EQUAL(pOut->dims[0].size, SIZE_X/4);
+  BOOST_REQUIRE_EQUAL(pOut->dims[1].size, SIZE_Y/4);
+  epicsFloat64 *pData = (epicsFloat64 *)pOut->pData;
+  // Mean of x=0..3 is 1.5, mean of y=0..3 is 1.5
+  BOOST_CHECK_CLOSE(pData[0], 1.5 + 1500., 1e-9);
+  BOOST_CHECK_CLOSE(pData[SIZE_X/4 + 1], 5.5 + 5500., 1e-9);
+}
+
+BOOST_AUTO_TEST_CASE(preview_clamped_factor)
+{
+  // The factor needed for one element is larger than SIZE_Y, so Y is reduced by less than X
+  stdArrays->write(NDPluginStdArraysPreviewModeString, NDStdArraysPreviewDecimate);
+  stdArrays->write(NDPluginStdArraysPreviewMaxElementsString, 1);
+  process();
+  NDArray *pOut = stdArrays->getLastArray();
+  BOOST_REQUIRE(pOut != 0);
+  BOOST_REQUIRE_EQUAL(pOut->dims[0].size, 1);
+  BOOST_REQUIRE_EQUAL(pOut->dims[1].size, 1);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorXString), pOut->dims[0].binning);
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDPluginStdArraysPreviewFactorYString), SIZE_Y);
+  BOOST_CHECK_EQUAL(pOut->dims[1].binning, SIZE_Y);
+}
+
+BOOST_AUTO_TEST_CASE(preview_min_callback_time)
+{
+  stdArrays->write(NDPluginStdArraysPreviewModeString, NDStdArraysPreviewDecimate);
+  stdArrays->write(NDPluginDriverMinCallbackTimeString, 10.0);
+  int counter = stdArrays->readInt(NDArrayCounterString);
+  stdArrays->driverCallback(stdArrays->pasynUserSelf, pArray);
+  stdArrays->driverCallback(stdArrays->pasynUserSelf, pArray);
+  // Only the first array is within the rate limit
+  BOOST_CHECK_EQUAL(stdArrays->readInt(NDArrayCounterString), counter + 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
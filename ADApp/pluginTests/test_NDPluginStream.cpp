@@ -0,0 +1,185 @@
+/*
+ * test_NDPluginStream.cpp
+ *
+ *  Created on: 16 Oct 2026
+ *
+ *  Loopback tests for NDPluginStream. The throughput is measured by
+ *  benchmark_NDPluginStream.cpp in plugin-benchmark.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "boost/test/unit_test.hpp"
+
+// AD dependencies
+#include <NDPluginDriver.h>
+#include <NDArray.h>
+#include <asynDriver.h>
+#include <epicsThread.h>
+#include <osiSock.h>
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+using namespace std;
+
+#include "testingutilities.h"
+#include "StreamPluginWrapper.h"
+#include "AsynException.h"
+
+static int nextTcpPort = 19700;
+
+struct StreamPluginTestFixture
+{
+  boost::shared_ptr<asynNDArrayDriver> driver;
+  // The plugin is purposefully leaked because its listen thread cannot be stopped
+  // and asyn ports cannot be deleted
+  StreamPluginWrapper *stream;
+  NDArrayPool *arrayPool;
+  int tcpPort;
+
+  StreamPluginTestFixture()
+  {
+    std::string simport("simStream"), testport("Stream");
+    uniqueAsynPortName(simport);
+    uniqueAsynPortName(testport);
+    tcpPort = nextTcpPort++;
+
+    driver = boost::shared_ptr<asynNDArrayDriver>(new asynNDArrayDriver(simport.c_str(),
+                                                                     1, 0, 0,
+                                                                     asynGenericPointerMask,
+                                                                     asynGenericPointerMask,
+                                                                     0, 0, 0, 0));
+    arrayPool = driver->pNDArrayPool;
+
+    stream = new StreamPluginWrapper(testport, tcpPort, 2, simport);
+    stream->start();
+    stream->write(NDPluginDriverEnableCallbacksString, 1);
+    stream->write(NDPluginDriverBlockingCallbacksString, 1);
+  }
+
+  ~StreamPluginTestFixture()
+  {
+    driver.reset();
+  }
+
+  // Connects a client and waits until the plugin has accepted it
+  SOCKET connectAndWait()
+  {
+    int numClients = stream->readInt(NDPluginStreamNumClientsString);
+    SOCKET fd = connectLoopbackClient(tcpPort);
+    BOOST_REQUIRE(fd != INVALID_SOCKET);
+    for (int i=0; i<500; i++) {
+      if (stream->readInt(NDPluginStreamNumClientsString) > numClients) return fd;
+      epicsThreadSleep(0.01);
+    }
+    BOOST_FAIL("Plugin did not accept the client connection");
+    return fd;
+  }
+
+  void process(NDArray *pArray)
+  {
+    stream->lock();
+    stream->processCallbacks(pArray);
+    stream->unlock();
+  }
+};
+
+BOOST_FIXTURE_TEST_SUITE(NDPluginStreamTests, StreamPluginTestFixture)
+
+BOOST_AUTO_TEST_CASE(header_and_data)
+{
+  std::vector<size_t> dims;
+  dims.push_back(64);
+  dims.push_back(32);
+  std::vector<NDArray *> arrays(1);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  NDArray *pArray = arrays[0];
+  pArray->uniqueId = 42;
+  epicsUInt16 *pData = (epicsUInt16 *)pArray->pData;
+  for (size_t i=0; i<64*32; i++) pData[i] = (epicsUInt16)i;
+
+  SOCKET fd = connectAndWait();
+  process(pArray);
+
+  NDStreamHeader header;
+  BOOST_REQUIRE(readFully(fd, (char *)&header, sizeof(header)));
+  BOOST_CHECK_EQUAL(sizeof(header), 160u);
+  BOOST_CHECK_EQUAL(header.magic, (epicsUInt32)ND_STREAM_MAGIC);
+  BOOST_CHECK_EQUAL(header.version, ND_STREAM_VERSION);
+  BOOST_CHECK_EQUAL(header.headerSize, sizeof(NDStreamHeader));
+  BOOST_CHECK_EQUAL(header.uniqueId, 42);
+  BOOST_CHECK_EQUAL(header.dataType, NDUInt16);
+  BOOST_CHECK_EQUAL(header.ndims, 2);
+  BOOST_CHECK_EQUAL(header.dims[0], 64u);
+  BOOST_CHECK_EQUAL(header.dims[1], 32u);
+  BOOST_CHECK_EQUAL(header.uncompressedSize, 64*32*sizeof(epicsUInt16));
+  BOOST_CHECK_EQUAL(header.dataSize, 64*32*sizeof(epicsUInt16));
+  BOOST_CHECK_EQUAL(header.codec[0], 0);
+
+  std::vector<epicsUInt16> received(64*32);
+  BOOST_REQUIRE(readFully(fd, (char *)&received[0], header.dataSize));
+  BOOST_CHECK(memcmp(&received[0], pData, header.dataSize) == 0);
+
+  epicsSocketDestroy(fd);
+  pArray->release();
+}
+
+BOOST_AUTO_TEST_CASE(too_many_clients)
+{
+  SOCKET fd1 = connectAndWait();
+  SOCKET fd2 = connectAndWait();
+  // The third connection is accepted by the kernel and then closed by the plugin
+  SOCKET fd3 = connectLoopbackClient(tcpPort);
+  BOOST_REQUIRE(fd3 != INVALID_SOCKET);
+  char c;
+  BOOST_CHECK(!readFully(fd3, &c, 1));
+  BOOST_CHECK_EQUAL(stream->readInt(NDPluginStreamNumClientsString), 2);
+  epicsSocketDestroy(fd3);
+  epicsSocketDestroy(fd2);
+  epicsSocketDestroy(fd1);
+}
+
+BOOST_AUTO_TEST_CASE(zero_copy_and_copy)
+{
+  // A few frames must arrive in order and intact whether they are sent with zero-copy or copied
+  const int numFrames = 4;
+  const size_t sizeX = 256, sizeY = 128;
+  std::vector<size_t> dims;
+  dims.push_back(sizeX);
+  dims.push_back(sizeY);
+  std::vector<NDArray *> arrays(numFrames);
+  fillNDArraysFromPool(dims, NDUInt16, arrays, arrayPool);
+  fillUInt16Ramp(arrays, 1000);
+  size_t frameBytes = sizeX*sizeY*sizeof(epicsUInt16);
+  std::vector<char> buffer(frameBytes);
+
+  // Queue every frame so that none are dropped
+  stream->write(NDPluginStreamClientQueueString, numFrames);
+
+  for (int zeroCopy=0; zeroCopy<2; zeroCopy++) {
+    stream->write(NDPluginStreamZeroCopyString, zeroCopy);
+    SOCKET fd = connectAndWait();
+    for (int i=0; i<numFrames; i++) {
+      arrays[i]->uniqueId = zeroCopy*numFrames + i + 1;
+      process(arrays[i]);
+    }
+    for (int i=0; i<numFrames; i++) {
+      NDStreamHeader header;
+      BOOST_REQUIRE(readFully(fd, (char *)&header, sizeof(header)));
+      BOOST_CHECK_EQUAL(header.magic, (epicsUInt32)ND_STREAM_MAGIC);
+      BOOST_CHECK_EQUAL(header.uniqueId, zeroCopy*numFrames + i + 1);
+      BOOST_CHECK_EQUAL(header.dims[0], sizeX);
+      BOOST_CHECK_EQUAL(header.dims[1], sizeY);
+      BOOST_REQUIRE_EQUAL(header.dataSize, frameBytes);
+      BOOST_REQUIRE(readFully(fd, &buffer[0], frameBytes));
+      BOOST_CHECK_MESSAGE(memcmp(&buffer[0], arrays[i]->pData, frameBytes) == 0,
+                          "payload of frame " << i << " differs, zeroCopy=" << zeroCopy);
+    }
+    epicsSocketDestroy(fd);
+  }
+
+  for (int i=0; i<numFrames; i++) arrays[i]->release();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
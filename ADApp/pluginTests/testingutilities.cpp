@@ -7,8 +7,12 @@
 #include <sstream>
 #include <iostream>
 #include <stdlib.h>
+#include <string.h>
+#include "boost/test/unit_test.hpp"
 #include <NDPluginDriver.h>
+#include <NDPluginFile.h>
 #include "testingutilities.h"
+#include "AsynPortClientContainer.h"
 
 
 void fillNDArrays(const std::vector<size_t>& dimensions,
@@ -63,6 +67,44 @@ void fillNDArraysFromPool(const std::vector<size_t>& dimensions,
 }
 
 
+/** Fill NDUInt16 arrays with frame*frameStep + element, so that every frame is different
+ * and a frame that is written in the wrong place is easy to spot.
+ */
+void fillUInt16Ramp(std::vector<NDArray*>& arrays, int frameStep)
+{
+  for (size_t i = 0; i < arrays.size(); i++) {
+    epicsUInt16 *pData = (epicsUInt16 *)arrays[i]->pData;
+    size_t numElements = arrays[i]->dataSize / sizeof(epicsUInt16);
+    for (size_t j = 0; j < numElements; j++) {
+      pData[j] = (epicsUInt16)(i * frameStep + j);
+    }
+  }
+}
+
+/** Start capturing numCapture arrays with a file plugin in stream mode.
+ * The plugin is first given pArray, which it opens the file with.
+ */
+void startCapture(NDPluginFile *plugin, AsynPortClientContainer *client, NDArray *pArray, int numCapture)
+{
+  client->write(NDFileWriteModeString, NDFileModeStream);
+  plugin->lock();
+  plugin->processCallbacks(pArray);
+  plugin->unlock();
+  client->write(NDFileNumCaptureString, numCapture);
+  client->write(NDFileCaptureString, 1);
+}
+
+/** Pass every step'th array from first on to a file plugin, with the plugin locked as it is
+ * when processCallbacks is called from the plugin thread.
+ */
+void streamFrames(NDPluginFile *plugin, const std::vector<NDArray*>& arrays, size_t first, size_t step)
+{
+  for (size_t i = first; i < arrays.size(); i += step) {
+    plugin->lock();
+    BOOST_CHECK_NO_THROW(plugin->processCallbacks(arrays[i]));
+    plugin->unlock();
+  }
+}
 
 /** Append a unique code at the end of the string name
  * To be used to generate unique asyn port names. Currently only
@@ -78,6 +120,39 @@ void uniqueAsynPortName(std::string& name)
   counter++;
 }
 
+/** Connect a client socket to a TCP port on the loopback interface.
+ * Returns INVALID_SOCKET if the connection fails.
+ */
+SOCKET connectLoopbackClient(int tcpPort)
+{
+  struct sockaddr_in addr;
+  SOCKET fd = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+  if (fd == INVALID_SOCKET) return fd;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons((unsigned short)tcpPort);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+    epicsSocketDestroy(fd);
+    return INVALID_SOCKET;
+  }
+  return fd;
+}
+
+/** Read exactly nbytes from a socket.
+ * Returns false if the connection was closed first.
+ */
+bool readFully(SOCKET fd, char *buf, size_t nbytes)
+{
+  while (nbytes > 0) {
+    int n = recv(fd, buf, (int)nbytes, 0);
+    if (n <= 0) return false;
+    buf += n;
+    nbytes -= n;
+  }
+  return true;
+}
+
 void TestingPluginCallback(void *drvPvt, asynUser *pasynUser, void *ptr)
 {
   TestingPlugin* self = (TestingPlugin*)drvPvt;
@@ -19,11 +19,24 @@
 
 #include <NDArray.h>
 #include <asynPortClient.h>
+#include <osiSock.h>
+
+class NDPluginFile;
+class AsynPortClientContainer;
 
 void fillNDArrays(const std::vector<size_t>& dimensions, NDDataType_t dataType, std::vector<NDArray*>& arrays);
 void fillNDArraysFromPool(const std::vector<size_t>& dimensions, NDDataType_t dataType, std::vector<NDArray*>& arrays, NDArrayPool *pNDArrayPool);
+void fillUInt16Ramp(std::vector<NDArray*>& arrays, int frameStep);
 void uniqueAsynPortName(std::string& name);
 
+// Helpers for the file plugin tests, which call processCallbacks directly rather than through a driver
+void startCapture(NDPluginFile *plugin, AsynPortClientContainer *client, NDArray *pArray, int numCapture);
+void streamFrames(NDPluginFile *plugin, const std::vector<NDArray*>& arrays, size_t first=0, size_t step=1);
+
+// Helpers for the clients of NDPluginStream
+SOCKET connectLoopbackClient(int tcpPort);
+bool readFully(SOCKET fd, char *buf, size_t nbytes);
+
 // Mock simply stores all received NDArrays and provides them to a client on request.
 class TestingPlugin : public asynGenericPointerClient {
 public:
@@ -70,6 +70,12 @@ dbLoadRecords("NDFileTIFF.template",  "P=$(PREFIX),R=Proc1:TIFF:,PORT=PROC1TIFF,
 NDScatterConfigure("SCATTER1", $(QSIZE), 0, "$(PORT)", 0, 0, 0)
 dbLoadRecords("NDScatter.template",   "P=$(PREFIX),R=Scatter1:,  PORT=SCATTER1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
 
+# Create a raw TCP streaming plugin listening on port 9700 with up to 2 clients
+#NDStreamConfigure("STREAM1", 9700, 2, $(QSIZE), 0, "$(PORT)", 0, 0, 0, 0, 0)
+#dbLoadRecords("NDStream.template",       "P=$(PREFIX),R=Stream1:,  PORT=STREAM1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")
+#dbLoadRecords("NDStreamClientN.template", "P=$(PREFIX),R=Stream1:1:,PORT=STREAM1,ADDR=0,TIMEOUT=1")
+#dbLoadRecords("NDStreamClientN.template", "P=$(PREFIX),R=Stream1:2:,PORT=STREAM1,ADDR=1,TIMEOUT=1")
+
 # Create a gather plugin with 8 ports
 NDGatherConfigure("GATHER1", $(QSIZE), 0, 8, 0, 0)
 dbLoadRecords("NDGather.template",   "P=$(PREFIX),R=Gather1:, PORT=GATHER1,ADDR=0,TIMEOUT=1,NDARRAY_PORT=$(PORT)")